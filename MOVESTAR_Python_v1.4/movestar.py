@@ -10,11 +10,68 @@ Updated on Jul 6 2021
 
 import pandas as pd
 import numpy as np
+import ctypes
 import os
+import sys
 import math
 
 BASE_DIR = os.path.dirname(os.path.abspath(__file__))
 
+# Native kernels: the movestar_native library built from MOVESTAR_VISSIM_v1.0
+# runs Spd2Acc and OMCal with the same results at native speed. It is looked
+# up at MOVESTAR_NATIVE_LIB, then next to this file; without it (or with
+# MOVESTAR_NATIVE=0) the pure Python versions below are used.
+NATIVE_VERSION = 1
+NATIVE_BIN_COUNT = 23
+
+
+def load_native():
+    if os.environ.get('MOVESTAR_NATIVE', '1') == '0':
+        return None
+    if sys.platform == 'win32':
+        name = 'movestar_native.dll'
+    elif sys.platform == 'darwin':
+        name = 'libmovestar_native.dylib'
+    else:
+        name = 'libmovestar_native.so'
+    for path in [os.environ.get('MOVESTAR_NATIVE_LIB'), os.path.join(BASE_DIR, name)]:
+        if not path or not os.path.exists(path):
+            continue
+        try:
+            lib = ctypes.CDLL(path)
+        except OSError:
+            continue
+        lib.movestar_native_version.restype = ctypes.c_int32
+        if lib.movestar_native_version() != NATIVE_VERSION:
+            continue
+        # float64 arrays are passed as the buffers NumPy holds, without copies
+        array = np.ctypeslib.ndpointer(dtype=np.float64, ndim=1, flags='C_CONTIGUOUS')
+        lib.movestar_speed_to_acceleration.argtypes = [ctypes.c_int64, array, array]
+        lib.movestar_speed_to_acceleration.restype = None
+        lib.movestar_opmode_bins.argtypes = [ctypes.c_int64, array, array, array, ctypes.c_void_p, array]
+        lib.movestar_opmode_bins.restype = None
+        return lib
+    return None
+
+
+native = load_native()
+
+
+def native_arrays(*arrays):
+    # 1-D float64 views of the arrays (copies only of other types), None if they do not match
+    try:
+        arrays = [np.ascontiguousarray(a, dtype=np.float64) for a in arrays]
+    except (TypeError, ValueError):
+        return None
+    if any(a.ndim != 1 or len(a) != len(arrays[0]) for a in arrays):
+        return None
+    return arrays
+
+
+# Rate and coefficient tables read once per process
+ems_rate_tables = {}
+vehicle_src_coeff = None
+
 
 def sbs_spd(data):
     Time_fl = math.floor(Data[:, 2])
@@ -30,12 +87,15 @@ def sbs_spd(data):
 
 def ems_rate_cal(Bin_data, veh_type):
     # print(Bin_data)
-    ems_file = os.path.join(BASE_DIR, 'EmsRate_' + str(veh_type) + '.csv')
-    if os.path.exists(ems_file) == False:
-        return 'Invalid File Type', False
-
-    df = pd.read_csv(ems_file, header=None)
-    df = df / 3600
+    df = ems_rate_tables.get(veh_type)
+    if df is None:
+        ems_file = os.path.join(BASE_DIR, 'EmsRate_' + str(veh_type) + '.csv')
+        if os.path.exists(ems_file) == False:
+            return 'Invalid File Type', False
+
+        df = pd.read_csv(ems_file, header=None)
+        df = df / 3600
+        ems_rate_tables[veh_type] = df
     # print("EMS Table Columns: ", len(df.columns))
     # print(df)
     # Ems_rate = Bin_data*df[:, 0:7]
@@ -53,6 +113,13 @@ def ems_rate_cal(Bin_data, veh_type):
 
 def OMCal(Spd, Acc, VSP):  # Unit here: Spd -- m/s, Acc -- m/s^2 and VSP -- kWatt/tonne
 
+    if native is not None:
+        arrays = native_arrays(Spd, Acc, VSP)
+        if arrays is not None:
+            size_bin = np.zeros(NATIVE_BIN_COUNT)
+            native.movestar_opmode_bins(len(arrays[0]), arrays[0], arrays[1], arrays[2], None, size_bin)
+            return size_bin
+
     c1 = 2.23693629  # conversion factor for speed from m/s to mph and acceleration from m/s^2 to mph/s
     size_bin = np.zeros(23)  # vector of sample size for each of 23 operating mode
 
@@ -102,6 +169,13 @@ def get_derivative(input_array):
 def Spd2Acc(Speed):  # speed unit is m/s and acceleration is m/s^2
 
     # Use central difference method (N=3) to estimate the acceleration from speed data
+    if native is not None:
+        arrays = native_arrays(Speed)
+        if arrays is not None:
+            acc = np.zeros(len(arrays[0]))
+            native.movestar_speed_to_acceleration(len(acc), arrays[0], acc)
+            return acc
+
     acc = np.zeros(len(Speed))
 
     for i in range(1, (len(Speed) - 1)):
@@ -150,7 +224,10 @@ def movestar(veh_type, speed):
 
     # Calculate the acceleration/deceleration
     Acc = Spd2Acc(speed)  # Unit: Acc -- m/s^2
-    df_vehicle_src_coeff = pd.read_csv(os.path.join(BASE_DIR, 'VehicleSrcCoeff.csv'))
+    global vehicle_src_coeff
+    if vehicle_src_coeff is None:
+        vehicle_src_coeff = pd.read_csv(os.path.join(BASE_DIR, 'VehicleSrcCoeff.csv'))
+    df_vehicle_src_coeff = vehicle_src_coeff
 
     row = df_vehicle_src_coeff[df_vehicle_src_coeff['VehicleType'] == veh_type]
     # Calculate the VSP/STP (assuming roadway grade is zero)
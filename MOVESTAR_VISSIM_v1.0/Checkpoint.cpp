@@ -0,0 +1,192 @@
+/*========================================================================= */
+/* Checkpoint.cpp                                    Core module of MOVESTAR */
+/*																			*/
+/* Writer thread and file format of the snapshots.							*/
+/*========================================================================= */
+
+#include "Checkpoint.h"
+#include "MappedFile.h"
+#include <cstdio>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+using namespace std;
+
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//replaces <path> by <temporary>, atomically where the platform allows
+static bool replaceFile(const string &temporary, const string &path)
+{
+#ifdef _WIN32
+	return MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+}
+
+
+CheckpointFile::CheckpointFile()
+	: stopping(false), hasPending(false), busy(false), writtenSnapshots(0)
+{
+}
+
+CheckpointFile::~CheckpointFile()
+{
+	if (writer.joinable())
+	{
+		{
+			lock_guard<mutex> lock(guard);
+			stopping = true;
+		}
+		changed.notify_all();
+		writer.join();
+	}
+}
+
+bool CheckpointFile::write(const string &path, vector<char> &snapshot, string &error)
+{
+	bool reported = false;
+	{
+		lock_guard<mutex> lock(guard);
+		if (!failure.empty())
+		{
+			error = failure;
+			failure.clear();
+			reported = true;
+		}
+		pending.swap(snapshot);
+		pendingPath = path;
+		hasPending = true;
+	}
+	snapshot.clear();
+	if (!writer.joinable())
+	{
+		writer = thread(&CheckpointFile::writerLoop, this);
+	}
+	changed.notify_all();
+	return !reported;
+}
+
+bool CheckpointFile::flush(string &error)
+{
+	unique_lock<mutex> lock(guard);
+	changed.wait(lock, [this]() { return !hasPending && !busy; });
+	if (!failure.empty())
+	{
+		error = failure;
+		failure.clear();
+		return false;
+	}
+	return true;
+}
+
+uint64_t CheckpointFile::written()
+{
+	lock_guard<mutex> lock(guard);
+	return writtenSnapshots;
+}
+
+void CheckpointFile::writerLoop()
+{
+	unique_lock<mutex> lock(guard);
+	for (;;)
+	{
+		changed.wait(lock, [this]() { return hasPending || stopping; });
+		if (!hasPending)
+		{
+			return;
+		}
+		writing.swap(pending);
+		string path = pendingPath;
+		hasPending = false;
+		busy = true;
+
+		lock.unlock();
+		bool written = writeFile(path, writing);
+		lock.lock();
+
+		busy = false;
+		if (written)
+		{
+			writtenSnapshots++;
+		}
+		else if (failure.empty())
+		{
+			failure = "cannot write checkpoint " + path;
+		}
+		changed.notify_all();
+	}
+}
+
+bool CheckpointFile::writeFile(const string &path, const vector<char> &snapshot)
+{
+	CheckpointHeader header;
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.reserved = 0;
+	header.payloadSize = snapshot.size();
+	header.checksum = fnv1a(snapshot.data(), snapshot.size());
+
+	string temporary = path + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		(snapshot.empty() || fwrite(snapshot.data(), 1, snapshot.size(), file) == snapshot.size());
+	written = (fclose(file) == 0) && written;
+	if (!written || !replaceFile(temporary, path))
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool CheckpointFile::read(const string &path, vector<char> &snapshot, string &error)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		error = "cannot open checkpoint " + path;
+		return false;
+	}
+	CheckpointHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0;
+	if (!valid || header.version != CHECKPOINT_VERSION)
+	{
+		fclose(file);
+		error = path + " is not a checkpoint of this version";
+		return false;
+	}
+
+	//the size in the header is checked against the file before anything is allocated
+	unsigned long long fileSize;
+	long long modified;
+	if (!statFile(path, fileSize, modified) || fileSize < sizeof(header) || header.payloadSize > fileSize - sizeof(header))
+	{
+		fclose(file);
+		error = "checkpoint " + path + " is damaged";
+		return false;
+	}
+	snapshot.resize((size_t)header.payloadSize);
+	valid = snapshot.empty() || fread(snapshot.data(), 1, snapshot.size(), file) == snapshot.size();
+	fclose(file);
+	if (!valid || fnv1a(snapshot.data(), snapshot.size()) != header.checksum)
+	{
+		error = "checkpoint " + path + " is damaged";
+		return false;
+	}
+	return true;
+}
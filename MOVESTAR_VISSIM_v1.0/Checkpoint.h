@@ -0,0 +1,152 @@
+/*========================================================================= */
+/* Checkpoint.h                                      Core module of MOVESTAR */
+/*																			*/
+/* Binary snapshots of the state of a run (configuration, vehicle histories	*/
+/* and totals), so a long run can restart where it stopped. The simulation	*/
+/* thread only encodes the state into memory; a thread of its own writes	*/
+/* the snapshot to a temporary file and renames it over the previous one,	*/
+/* so the file always holds a complete snapshot. Snapshots are in native	*/
+/* byte order, for restarts on the machine (or platform) that wrote them.	*/
+/*========================================================================= */
+
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#define CHECKPOINT_MAGIC   "MVSTRCKP"
+#define CHECKPOINT_VERSION 1
+
+//file layout: this header, then <payloadSize> bytes of values as the
+//CheckpointWriter appended them
+struct CheckpointHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t payloadSize;
+	uint64_t checksum;		//FNV-1a hash of the payload
+};
+
+//appends values to a snapshot in memory
+class CheckpointWriter
+{
+public:
+	template <typename T> void put(T value)
+	{
+		static_assert(std::is_arithmetic<T>::value, "snapshots hold numbers");
+		std::size_t size = bytes.size();
+		bytes.resize(size + sizeof(value));
+		memcpy(&bytes[size], &value, sizeof(value));
+	}
+
+	void putString(const std::string &value)
+	{
+		put((uint64_t)value.size());
+		bytes.insert(bytes.end(), value.begin(), value.end());
+	}
+
+	void clear() { bytes.clear(); }
+	std::vector<char> &data() { return bytes; }
+
+private:
+	std::vector<char> bytes;
+};
+
+//reads the values of a snapshot in the order they were appended; every get
+//fails once the snapshot is exhausted
+class CheckpointReader
+{
+public:
+	CheckpointReader(const char *data, std::size_t size) : data(data), size(size), position(0) {}
+
+	template <typename T> bool get(T &value)
+	{
+		static_assert(std::is_arithmetic<T>::value, "snapshots hold numbers");
+		if (size - position < sizeof(value))
+		{
+			return false;
+		}
+		memcpy(&value, data + position, sizeof(value));
+		position += sizeof(value);
+		return true;
+	}
+
+	bool getString(std::string &value)
+	{
+		uint64_t length;
+		if (!get(length) || size - position < length)
+		{
+			return false;
+		}
+		value.assign(data + position, (std::size_t)length);
+		position += (std::size_t)length;
+		return true;
+	}
+
+	bool atEnd() const { return position == size; }
+
+private:
+	const char  *data;
+	std::size_t  size;
+	std::size_t  position;
+};
+
+//writes snapshots on a thread of its own, started with the first snapshot
+class CheckpointFile
+{
+public:
+	CheckpointFile();
+
+	//waits for the snapshot being written
+	~CheckpointFile();
+
+	//hands the payload <snapshot> to the writer thread for <path> and gives back
+	//an empty buffer of an earlier snapshot in its place; a snapshot still waiting
+	//for the writer is replaced. False with a message in <error> if an earlier
+	//write failed
+	bool write(const std::string &path, std::vector<char> &snapshot, std::string &error);
+
+	//waits until every snapshot handed over is written; false with a message in
+	//<error> if a write failed
+	bool flush(std::string &error);
+
+	//snapshots written so far
+	uint64_t written();
+
+	//reads the payload of the snapshot file <path> into <snapshot>; false with a
+	//message in <error> if it is missing, of another version or damaged
+	static bool read(const std::string &path, std::vector<char> &snapshot, std::string &error);
+
+private:
+	CheckpointFile(const CheckpointFile &);
+	CheckpointFile &operator=(const CheckpointFile &);
+
+	void writerLoop();
+	bool writeFile(const std::string &path, const std::vector<char> &snapshot);
+
+	std::thread             writer;
+	std::mutex              guard;
+	std::condition_variable changed;
+	bool                    stopping;
+
+	//guarded by <guard>: the snapshot waiting for the writer, the one it writes,
+	//and the first write that failed since the last report
+	std::vector<char>       pending;
+	std::string             pendingPath;
+	bool                    hasPending;
+	std::vector<char>       writing;
+	bool                    busy;
+	std::string             failure;
+	uint64_t                writtenSnapshots;
+};
+
+#endif /* __CHECKPOINT_H */
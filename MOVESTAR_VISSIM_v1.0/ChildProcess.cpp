@@ -0,0 +1,175 @@
+/*========================================================================= */
+/* ChildProcess.cpp                                  Core module of MOVESTAR */
+/*																			*/
+/* Worker processes started from an executable (Windows and POSIX).		*/
+/*========================================================================= */
+
+#include "ChildProcess.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+extern char **environ;
+#endif
+using namespace std;
+
+
+#ifdef _WIN32
+
+ChildProcess::ChildProcess()
+	: process(nullptr)
+{
+}
+
+//an argument quoted as CommandLineToArgvW splits it: backslashes are literal
+//unless they precede a quote, where they are doubled
+static string quotedArgument(const string &argument)
+{
+	if (!argument.empty() && argument.find_first_of(" \t\"") == string::npos)
+	{
+		return argument;
+	}
+	string quoted = "\"";
+	size_t backslashes = 0;
+	for (size_t i = 0; i < argument.size(); i++)
+	{
+		if (argument[i] == '\\')
+		{
+			backslashes++;
+			continue;
+		}
+		quoted.append(argument[i] == '"' ? 2 * backslashes + 1 : backslashes, '\\');
+		quoted += argument[i];
+		backslashes = 0;
+	}
+	quoted.append(2 * backslashes, '\\');
+	return quoted + "\"";
+}
+
+bool ChildProcess::start(const string &executable, const vector<string> &arguments, string &error)
+{
+	wait();
+	string commandLine = quotedArgument(executable);
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		commandLine += " " + quotedArgument(arguments[i]);
+	}
+	STARTUPINFOA startup;
+	ZeroMemory(&startup, sizeof(startup));
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION information;
+	if (!CreateProcessA(executable.c_str(), &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &information))
+	{
+		error = "cannot start " + executable + " (error " + to_string(GetLastError()) + ")";
+		return false;
+	}
+	CloseHandle(information.hThread);
+	process = information.hProcess;
+	return true;
+}
+
+int ChildProcess::wait()
+{
+	if (process == nullptr)
+	{
+		return -1;
+	}
+	DWORD code = (DWORD)-1;
+	WaitForSingleObject(process, INFINITE);
+	if (!GetExitCodeProcess(process, &code))
+	{
+		code = (DWORD)-1;
+	}
+	CloseHandle(process);
+	process = nullptr;
+	return (int)code;
+}
+
+bool ChildProcess::started() const
+{
+	return process != nullptr;
+}
+
+string currentExecutablePath()
+{
+	char path[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+	return (length > 0 && length < MAX_PATH) ? string(path, length) : string();
+}
+
+#else
+
+ChildProcess::ChildProcess()
+	: process(0)
+{
+}
+
+bool ChildProcess::start(const string &executable, const vector<string> &arguments, string &error)
+{
+	wait();
+	vector<char *> argv;
+	argv.push_back((char *)executable.c_str());
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		argv.push_back((char *)arguments[i].c_str());
+	}
+	argv.push_back(nullptr);
+	pid_t pid;
+	int failure = posix_spawn(&pid, executable.c_str(), nullptr, nullptr, argv.data(), environ);
+	if (failure != 0)
+	{
+		error = "cannot start " + executable + ": " + strerror(failure);
+		return false;
+	}
+	process = (long)pid;
+	return true;
+}
+
+int ChildProcess::wait()
+{
+	if (process == 0)
+	{
+		return -1;
+	}
+	int status = 0;
+	pid_t ended;
+	do
+	{
+		ended = waitpid((pid_t)process, &status, 0);
+	} while (ended < 0 && errno == EINTR);
+	process = 0;
+	return (ended > 0 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+bool ChildProcess::started() const
+{
+	return process != 0;
+}
+
+string currentExecutablePath()
+{
+#ifdef __APPLE__
+	char path[4096];
+	uint32_t size = sizeof(path);
+	return _NSGetExecutablePath(path, &size) == 0 ? string(path) : string();
+#else
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+	return (length > 0 && (size_t)length < sizeof(path)) ? string(path, (size_t)length) : string();
+#endif
+}
+
+#endif
+
+ChildProcess::~ChildProcess()
+{
+	wait();
+}
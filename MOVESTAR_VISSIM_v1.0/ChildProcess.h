@@ -0,0 +1,45 @@
+/*========================================================================= */
+/* ChildProcess.h                                    Core module of MOVESTAR */
+/*																			*/
+/* Worker processes started from an executable and its arguments, with	*/
+/* the standard streams of the parent (Windows and POSIX).					*/
+/*========================================================================= */
+
+#ifndef __CHILDPROCESS_H
+#define __CHILDPROCESS_H
+
+#include <string>
+#include <vector>
+
+class ChildProcess
+{
+public:
+	ChildProcess();
+
+	//waits for a process still running
+	~ChildProcess();
+
+	//starts <executable> with <arguments> (without the program name); false with
+	//a message in <error>
+	bool start(const std::string &executable, const std::vector<std::string> &arguments, std::string &error);
+
+	//waits for the process to end; its exit code, -1 if it was killed or never started
+	int wait();
+
+	bool started() const;
+
+private:
+	ChildProcess(const ChildProcess &);
+	ChildProcess &operator=(const ChildProcess &);
+
+#ifdef _WIN32
+	void *process;
+#else
+	long  process;		//pid, 0 if none
+#endif
+};
+
+//path of the running executable, empty if it cannot be found
+std::string currentExecutablePath();
+
+#endif /* __CHILDPROCESS_H */
@@ -0,0 +1,387 @@
+/*========================================================================= */
+/* ColumnarTrajectory.cpp                            Core module of MOVESTAR */
+/*																			*/
+/* CSV conversion, validation and block access of columnar trajectories.	*/
+/*========================================================================= */
+
+#include "ColumnarTrajectory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+using namespace std;
+
+
+//alignment of the columns in the file
+#define COLUMN_ALIGNMENT 64
+
+//rows decoded at a time while converting
+#define CONVERSION_BLOCK_ROWS 65536
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+}
+
+//writes <size> bytes at <offset>, zero-padding the file up to it
+static bool writeAt(FILE *file, uint64_t &position, uint64_t offset, const void *data, size_t size)
+{
+	static const char zeros[COLUMN_ALIGNMENT] = {};
+	if (offset < position || offset - position > COLUMN_ALIGNMENT)
+	{
+		return false;
+	}
+	if (offset > position && fwrite(zeros, 1, (size_t)(offset - position), file) != offset - position)
+	{
+		return false;
+	}
+	position = offset + size;
+	return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+//writes a double column, narrowed to float if <float32>
+static bool writeColumn(FILE *file, uint64_t &position, uint64_t offset, const vector<double> &column, bool float32)
+{
+	if (!float32)
+	{
+		return writeAt(file, position, offset, column.data(), column.size() * sizeof(double));
+	}
+	vector<float> narrowed(column.begin(), column.end());
+	return writeAt(file, position, offset, narrowed.data(), narrowed.size() * sizeof(float));
+}
+
+//rows of the vehicle at <first> .. <first> + <count> in time order, keeping the
+//file order of rows with equal times
+static void sortByTime(size_t first, size_t count, vector<double> &times, vector<double> &speeds, vector<double> &accelerations)
+{
+	bool sorted = true;
+	for (size_t i = first + 1; i < first + count && sorted; i++)
+	{
+		sorted = times[i - 1] <= times[i];
+	}
+	if (sorted)
+	{
+		return;
+	}
+
+	vector<size_t> order(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		order[i] = first + i;
+	}
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return times[a] < times[b]; });
+	vector<double> *columns[3] = { &times, &speeds, &accelerations };
+	vector<double> sortedColumn(count);
+	for (int c = 0; c < 3; c++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			sortedColumn[i] = (*columns[c])[order[i]];
+		}
+		copy(sortedColumn.begin(), sortedColumn.end(), columns[c]->begin() + first);
+	}
+}
+
+//central difference as in Spd2Acc, first and last row 0 (same arithmetic as TrajectoryProcessor)
+static void deriveAccelerations(size_t first, size_t count, const vector<double> &times, const vector<double> &speeds,
+	vector<double> &accelerations)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t row = first + i;
+		double acceleration = 0.0;
+		if (i >= 1 && i + 1 < count && times[row + 1] != times[row - 1])
+		{
+			acceleration = (speeds[row + 1] - speeds[row - 1]) / (times[row + 1] - times[row - 1]);
+		}
+		accelerations[row] = acceleration;
+	}
+}
+
+TrajectoryQuery::TrajectoryQuery()
+	: from(-HUGE_VAL), to(HUGE_VAL), shardIndex(0), shardCount(1)
+{
+}
+
+bool TrajectoryQuery::selects(long vehicleNumber) const
+{
+	if (shardCount > 1 && trajectoryShardOf(vehicleNumber, shardCount) != shardIndex)
+	{
+		return false;
+	}
+	return vehicles.empty() || binary_search(vehicles.begin(), vehicles.end(), vehicleNumber);
+}
+
+bool convertTrajectoryCsv(TrajectoryCsvReader &reader, const string &path, bool float32, string &error)
+{
+	//first pass: the vehicles, in order of appearance, and their row counts
+	vector<ColumnarVehicle> vehicles;
+	unordered_map<long, size_t> vehicleIndex;
+	TrajectoryBlock block;
+	size_t inputRow = 0;
+	reader.rewind();
+	while (reader.read(block, CONVERSION_BLOCK_ROWS, error))
+	{
+		for (size_t i = 0; i < block.size(); i++, inputRow++)
+		{
+			unordered_map<long, size_t>::iterator it = vehicleIndex.find(block.vehicleIds[i]);
+			if (it == vehicleIndex.end())
+			{
+				ColumnarVehicle vehicle = {};
+				vehicle.vehicleNumber = block.vehicleIds[i];
+				vehicle.vehicleType = block.vehicleTypes[i];
+				vehicle.firstInputRow = inputRow;
+				it = vehicleIndex.insert(make_pair(block.vehicleIds[i], vehicles.size())).first;
+				vehicles.push_back(vehicle);
+			}
+			vehicles[it->second].rowCount++;
+		}
+	}
+	if (!error.empty())
+	{
+		return false;
+	}
+
+	size_t rowCount = 0;
+	for (size_t v = 0; v < vehicles.size(); v++)
+	{
+		vehicles[v].firstRow = rowCount;
+		rowCount += (size_t)vehicles[v].rowCount;
+	}
+
+	//second pass: every row to the next slot of its vehicle
+	vector<double> times(rowCount), speeds(rowCount), accelerations(rowCount);
+	vector<size_t> nextRow(vehicles.size());
+	for (size_t v = 0; v < vehicles.size(); v++)
+	{
+		nextRow[v] = (size_t)vehicles[v].firstRow;
+	}
+	reader.rewind();
+	while (reader.read(block, CONVERSION_BLOCK_ROWS, error))
+	{
+		for (size_t i = 0; i < block.size(); i++)
+		{
+			size_t row = nextRow[vehicleIndex[block.vehicleIds[i]]]++;
+			times[row] = block.times[i];
+			speeds[row] = block.speeds[i];
+			accelerations[row] = reader.hasAccelerations() ? block.accelerations[i] : 0.0;
+		}
+	}
+	if (!error.empty())
+	{
+		return false;
+	}
+
+	//time order, accelerations and blocks of every vehicle
+	vector<ColumnarBlock> blocks;
+	for (size_t v = 0; v < vehicles.size(); v++)
+	{
+		ColumnarVehicle &vehicle = vehicles[v];
+		size_t first = (size_t)vehicle.firstRow;
+		size_t count = (size_t)vehicle.rowCount;
+		sortByTime(first, count, times, speeds, accelerations);
+		if (!reader.hasAccelerations())
+		{
+			deriveAccelerations(first, count, times, speeds, accelerations);
+		}
+
+		vehicle.firstBlock = blocks.size();
+		for (size_t start = 0; start < count; start += COLUMNAR_BLOCK_ROWS)
+		{
+			ColumnarBlock stats = {};
+			stats.firstRow = first + start;
+			stats.rowCount = min(count - start, (size_t)COLUMNAR_BLOCK_ROWS);
+			stats.minTime = times[first + start];
+			stats.maxTime = times[first + start + (size_t)stats.rowCount - 1];
+			stats.minSpeed = stats.maxSpeed = speeds[first + start];
+			for (size_t i = 1; i < stats.rowCount; i++)
+			{
+				stats.minSpeed = min(stats.minSpeed, speeds[first + start + i]);
+				stats.maxSpeed = max(stats.maxSpeed, speeds[first + start + i]);
+			}
+			blocks.push_back(stats);
+		}
+		vehicle.blockCount = blocks.size() - vehicle.firstBlock;
+	}
+
+	ColumnarTrajectoryHeader header = {};
+	memcpy(header.magic, COLUMNAR_TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = COLUMNAR_TRAJECTORY_VERSION;
+	header.flags = float32 ? COLUMNAR_FLOAT32 : 0;
+	header.rowCount = rowCount;
+	header.vehicleCount = vehicles.size();
+	header.blockCount = blocks.size();
+	size_t valueSize = float32 ? sizeof(float) : sizeof(double);
+	header.vehicleOffset = alignOffset(sizeof(header));
+	header.blockOffset = alignOffset(header.vehicleOffset + vehicles.size() * sizeof(ColumnarVehicle));
+	header.timeOffset = alignOffset(header.blockOffset + blocks.size() * sizeof(ColumnarBlock));
+	header.speedOffset = alignOffset(header.timeOffset + rowCount * sizeof(double));
+	header.accelerationOffset = alignOffset(header.speedOffset + rowCount * valueSize);
+	header.indexChecksum = fnv1a(blocks.data(), blocks.size() * sizeof(ColumnarBlock),
+		fnv1a(vehicles.data(), vehicles.size() * sizeof(ColumnarVehicle)));
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		error = "cannot create " + path;
+		return false;
+	}
+	uint64_t position = 0;
+	bool written = writeAt(file, position, 0, &header, sizeof(header)) &&
+		writeAt(file, position, header.vehicleOffset, vehicles.data(), vehicles.size() * sizeof(ColumnarVehicle)) &&
+		writeAt(file, position, header.blockOffset, blocks.data(), blocks.size() * sizeof(ColumnarBlock)) &&
+		writeAt(file, position, header.timeOffset, times.data(), times.size() * sizeof(double)) &&
+		writeColumn(file, position, header.speedOffset, speeds, float32) &&
+		writeColumn(file, position, header.accelerationOffset, accelerations, float32);
+	if (fclose(file) != 0 || !written)
+	{
+		remove(path.c_str());
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+
+ColumnarTrajectoryReader::ColumnarTrajectoryReader()
+	: header(nullptr), vehicles(nullptr), blocks(nullptr), times(nullptr), speeds(nullptr), accelerations(nullptr)
+{
+}
+
+bool ColumnarTrajectoryReader::isColumnar(const string &path)
+{
+	char magic[8];
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	bool columnar = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+		memcmp(magic, COLUMNAR_TRAJECTORY_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return columnar;
+}
+
+void ColumnarTrajectoryReader::close()
+{
+	file.close();
+	header = nullptr;
+	vehicles = nullptr;
+	blocks = nullptr;
+	times = nullptr;
+	speeds = accelerations = nullptr;
+}
+
+bool ColumnarTrajectoryReader::open(const string &path, string &error)
+{
+	close();
+	if (!file.open(path))
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	const ColumnarTrajectoryHeader *candidate = (const ColumnarTrajectoryHeader *)file.data();
+	uint64_t size = file.size();
+	bool valid = size >= sizeof(ColumnarTrajectoryHeader) &&
+		memcmp(candidate->magic, COLUMNAR_TRAJECTORY_MAGIC, sizeof(candidate->magic)) == 0;
+	if (valid && candidate->version != COLUMNAR_TRAJECTORY_VERSION)
+	{
+		error = path + ": columnar trajectory version " + to_string(candidate->version) + ", expected " +
+			to_string(COLUMNAR_TRAJECTORY_VERSION);
+		close();
+		return false;
+	}
+
+	//every section within the file, the columns aligned for the kernels
+	uint64_t valueSize = (valid && (candidate->flags & COLUMNAR_FLOAT32)) ? sizeof(float) : sizeof(double);
+	valid = valid &&
+		candidate->vehicleCount <= size / sizeof(ColumnarVehicle) &&
+		candidate->blockCount <= size / sizeof(ColumnarBlock) &&
+		candidate->rowCount <= size / sizeof(double) &&
+		candidate->vehicleOffset <= size - candidate->vehicleCount * sizeof(ColumnarVehicle) &&
+		candidate->blockOffset <= size - candidate->blockCount * sizeof(ColumnarBlock) &&
+		candidate->timeOffset <= size - candidate->rowCount * sizeof(double) &&
+		candidate->speedOffset <= size - candidate->rowCount * valueSize &&
+		candidate->accelerationOffset <= size - candidate->rowCount * valueSize &&
+		(candidate->vehicleOffset | candidate->blockOffset | candidate->timeOffset | candidate->speedOffset |
+			candidate->accelerationOffset) % sizeof(double) == 0;
+	if (valid)
+	{
+		const ColumnarVehicle *vehicleIndex = (const ColumnarVehicle *)(file.data() + candidate->vehicleOffset);
+		const ColumnarBlock *blockIndex = (const ColumnarBlock *)(file.data() + candidate->blockOffset);
+		valid = candidate->indexChecksum == fnv1a(blockIndex, (size_t)candidate->blockCount * sizeof(ColumnarBlock),
+			fnv1a(vehicleIndex, (size_t)candidate->vehicleCount * sizeof(ColumnarVehicle)));
+		for (uint64_t v = 0; v < candidate->vehicleCount && valid; v++)
+		{
+			const ColumnarVehicle &vehicle = vehicleIndex[v];
+			valid = vehicle.firstBlock <= candidate->blockCount && vehicle.blockCount <= candidate->blockCount - vehicle.firstBlock;
+		}
+		for (uint64_t b = 0; b < candidate->blockCount && valid; b++)
+		{
+			valid = blockIndex[b].firstRow <= candidate->rowCount && blockIndex[b].rowCount <= candidate->rowCount - blockIndex[b].firstRow;
+		}
+		vehicles = vehicleIndex;
+		blocks = blockIndex;
+	}
+	if (!valid)
+	{
+		error = path + ": not a valid columnar trajectory file";
+		close();
+		return false;
+	}
+
+	header = candidate;
+	times = (const double *)(file.data() + header->timeOffset);
+	speeds = file.data() + header->speedOffset;
+	accelerations = file.data() + header->accelerationOffset;
+	return true;
+}
+
+void ColumnarTrajectoryReader::span(const ColumnarBlock &block, double from, double to, TrajectorySpan &span,
+	vector<double> &scratch) const
+{
+	//rows of a block are in time order
+	size_t first = (size_t)block.firstRow;
+	size_t last = first + (size_t)block.rowCount;
+	if (block.minTime < from)
+	{
+		first = lower_bound(times + first, times + last, from) - times;
+	}
+	if (block.maxTime > to)
+	{
+		last = upper_bound(times + first, times + last, to) - times;
+	}
+
+	span.firstRow = first;
+	span.count = last - first;
+	span.times = times + first;
+	if (!float32())
+	{
+		span.speeds = (const double *)speeds + first;
+		span.accelerations = (const double *)accelerations + first;
+		return;
+	}
+	scratch.resize(2 * span.count);
+	const float *narrowSpeeds = (const float *)speeds + first;
+	const float *narrowAccelerations = (const float *)accelerations + first;
+	for (size_t i = 0; i < span.count; i++)
+	{
+		scratch[i] = narrowSpeeds[i];
+		scratch[span.count + i] = narrowAccelerations[i];
+	}
+	span.speeds = scratch.data();
+	span.accelerations = scratch.data() + span.count;
+}
@@ -0,0 +1,142 @@
+/*========================================================================= */
+/* ColumnarTrajectory.h                              Core module of MOVESTAR */
+/*																			*/
+/* Binary columnar trajectory format. The rows of each vehicle are stored	*/
+/* together in time order, as whole-file columns of time [s], speed [m/s]	*/
+/* and acceleration [m/s2] (derived from the speed on conversion if the	*/
+/* CSV file has none). A vehicle index gives each vehicle's rows, split	*/
+/* into blocks carrying their time and speed range, so a query for some	*/
+/* vehicles or a time window skips the other blocks unread. The file is	*/
+/* memory-mapped and double columns are handed out in place.				*/
+/*========================================================================= */
+
+#ifndef __COLUMNARTRAJECTORY_H
+#define __COLUMNARTRAJECTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "TrajectoryCsv.h"
+
+#define COLUMNAR_TRAJECTORY_MAGIC   "MVSTRCOL"
+#define COLUMNAR_TRAJECTORY_VERSION 1
+
+//rows per block of a vehicle
+#define COLUMNAR_BLOCK_ROWS 4096
+
+//flags of ColumnarTrajectoryHeader: speed and acceleration stored as float32
+#define COLUMNAR_FLOAT32 0x1
+
+//layout of the file (little endian): header, vehicle index, block index,
+//then the time, speed and acceleration columns, each aligned to 64 bytes
+struct ColumnarTrajectoryHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t rowCount;
+	uint64_t vehicleCount;
+	uint64_t blockCount;
+	uint64_t vehicleOffset;
+	uint64_t blockOffset;
+	uint64_t timeOffset;			//double[rowCount]
+	uint64_t speedOffset;			//double or float[rowCount]
+	uint64_t accelerationOffset;	//double or float[rowCount]
+	uint64_t indexChecksum;			//FNV-1a of the vehicle and block index
+};
+
+//vehicles in the order they first appear in the CSV file
+struct ColumnarVehicle
+{
+	int64_t  vehicleNumber;
+	int64_t  vehicleType;
+	uint64_t firstInputRow;		//row of the CSV file the vehicle first appeared in
+	uint64_t firstRow;			//rows firstRow .. firstRow + rowCount - 1 of the columns
+	uint64_t rowCount;
+	uint64_t firstBlock;
+	uint64_t blockCount;
+};
+
+struct ColumnarBlock
+{
+	uint64_t firstRow;
+	uint64_t rowCount;
+	double   minTime;
+	double   maxTime;
+	double   minSpeed;
+	double   maxSpeed;
+};
+
+//contiguous rows of one vehicle, pointing into the mapped file (or into the
+//scratch columns of a float32 file)
+struct TrajectorySpan
+{
+	std::size_t   firstRow;
+	std::size_t   count;
+	const double *times;
+	const double *speeds;
+	const double *accelerations;
+};
+
+//rows of a columnar file to calculate: a time window and a set of vehicles
+struct TrajectoryQuery
+{
+	double            from;			//[s]
+	double            to;			//[s]
+	std::vector<long> vehicles;		//sorted, empty for every vehicle
+	std::size_t       shardIndex;	//vehicles of this shard of <shardCount> only (see trajectoryShardOf)
+	std::size_t       shardCount;
+
+	TrajectoryQuery();
+
+	bool selects(long vehicleNumber) const;
+
+	//false if no row of <block> lies in the time window
+	bool overlaps(const ColumnarBlock &block) const { return block.maxTime >= from && block.minTime <= to; }
+};
+
+//converts a CSV trajectory file to <path>, with float32 speed and acceleration
+//columns if <float32>. Returns false with a message in <error>
+bool convertTrajectoryCsv(TrajectoryCsvReader &reader, const std::string &path, bool float32, std::string &error);
+
+class ColumnarTrajectoryReader
+{
+public:
+	ColumnarTrajectoryReader();
+
+	//true if <path> starts with the columnar magic
+	static bool isColumnar(const std::string &path);
+
+	//maps <path> and checks its header and index; false with a message in <error>
+	bool open(const std::string &path, std::string &error);
+	void close();
+
+	std::size_t rowCount() const { return (std::size_t)header->rowCount; }
+	std::size_t vehicleCount() const { return (std::size_t)header->vehicleCount; }
+	std::size_t blockCount() const { return (std::size_t)header->blockCount; }
+	bool float32() const { return (header->flags & COLUMNAR_FLOAT32) != 0; }
+
+	const ColumnarVehicle &vehicle(std::size_t index) const { return vehicles[index]; }
+	const ColumnarBlock &block(std::size_t index) const { return blocks[index]; }
+
+	//rows of <block> with a time within [from, to] (all rows if the block lies
+	//within it). A float32 block is widened into <scratch>, which must stay alive
+	//while <span> is used; double blocks are not copied
+	void span(const ColumnarBlock &block, double from, double to, TrajectorySpan &span, std::vector<double> &scratch) const;
+
+private:
+	ColumnarTrajectoryReader(const ColumnarTrajectoryReader &);
+	ColumnarTrajectoryReader &operator=(const ColumnarTrajectoryReader &);
+
+	MappedFile                      file;
+	const ColumnarTrajectoryHeader *header;
+	const ColumnarVehicle          *vehicles;
+	const ColumnarBlock            *blocks;
+	const double                   *times;
+	const void                     *speeds;
+	const void                     *accelerations;
+};
+
+#endif /* __COLUMNARTRAJECTORY_H */
@@ -0,0 +1,33 @@
+/*========================================================================= */
+/* CompactModel.cpp                                  Core module of MOVESTAR */
+/*																			*/
+/* Conversion of the source types to single precision.						*/
+/*========================================================================= */
+
+#include "CompactModel.h"
+using namespace std;
+
+
+CompactSourceTypes::CompactSourceTypes(const SourceTypeRegistry &sourceTypes)
+{
+	vector<const SourceTypeModel *> models = sourceTypes.list();
+	types.resize(models.size());
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		const VSPCoefficients &coefficients = models[i]->coefficients;
+		CompactSourceType &type = types[i];
+		type.coefficients.A = (float)coefficients.A;
+		type.coefficients.B = (float)coefficients.B;
+		type.coefficients.C = (float)coefficients.C;
+		type.coefficients.M = (float)coefficients.M;
+		type.coefficients.F = (float)coefficients.F;
+		for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+		{
+			for (int rate = 0; rate < EMISSION_RATE_COUNT; rate++)
+			{
+				type.rates.rates[row][rate] = (float)models[i]->rates->rates[row][rate];
+			}
+		}
+		index[models[i]] = i;
+	}
+}
@@ -0,0 +1,58 @@
+/*========================================================================= */
+/* CompactModel.h                                    Core module of MOVESTAR */
+/*																			*/
+/* Single-precision copies of the source types for the compact mode of the	*/
+/* engine, which calculates VSP and opmodes with the float32 kernels, looks	*/
+/* rates up in float32 tables and keeps the acceleration histories in		*/
+/* int16 (CompactAccelerationHistory). Meant for replays of millions of	*/
+/* vehicles; results differ from the double path by rounding ("movestar	*/
+/* --accuracy" reports by how much).										*/
+/*========================================================================= */
+
+#ifndef __COMPACTMODEL_H
+#define __COMPACTMODEL_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#include "MovestarKernels.h"
+#include "MovestarRates.h"
+#include "SourceTypeRegistry.h"
+
+//emission rates of one source type in float32, one row per opmode
+struct CompactRateTable
+{
+	float rates[OPMODE_ROW_COUNT][EMISSION_RATE_COUNT];
+};
+
+struct CompactSourceType
+{
+	CompactVSPCoefficients coefficients;
+	CompactRateTable       rates;
+};
+
+//compact copies of every source type of a registry, immutable once built and
+//shared by any number of engines
+class CompactSourceTypes
+{
+public:
+	explicit CompactSourceTypes(const SourceTypeRegistry &sourceTypes);
+
+	//compact copy of a source type of the registry, or nullptr
+	const CompactSourceType *find(const SourceTypeModel *sourceType) const
+	{
+		std::unordered_map<const SourceTypeModel *, std::size_t>::const_iterator it = index.find(sourceType);
+		return it == index.end() ? nullptr : &types[it->second];
+	}
+
+	std::size_t size() const { return types.size(); }
+
+private:
+	CompactSourceTypes(const CompactSourceTypes &);
+	CompactSourceTypes &operator=(const CompactSourceTypes &);
+
+	std::vector<CompactSourceType>                           types;
+	std::unordered_map<const SourceTypeModel *, std::size_t> index;
+};
+
+#endif /* __COMPACTMODEL_H */
@@ -0,0 +1,402 @@
+/*========================================================================= */
+/* EmissionAccumulator.cpp                           Core module of MOVESTAR */
+/*																			*/
+/* Accumulation of the emission totals and the summary files.				*/
+/*========================================================================= */
+
+#include "EmissionAccumulator.h"
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+
+static void addTotals(EmissionTotals &totals, const double emissions[EMISSION_RATE_COUNT])
+{
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		totals.values[k] += emissions[k];
+	}
+}
+
+static void printTotals(FILE *file, const EmissionTotals &totals)
+{
+	const double *values = totals.values;
+	fprintf(file, ",%.9g,%.9g,%.9g,%.9g,%.9g,%.9g", values[0], values[1], values[2], values[3], values[4], values[5]);
+}
+
+//keys of <totals> in ascending order, for a stable summary
+static vector<long> sortedKeys(const unordered_map<long, EmissionTotals> &totals)
+{
+	vector<long> keys;
+	keys.reserve(totals.size());
+	for (unordered_map<long, EmissionTotals>::const_iterator it = totals.begin(); it != totals.end(); ++it)
+	{
+		keys.push_back(it->first);
+	}
+	sort(keys.begin(), keys.end());
+	return keys;
+}
+
+#define EMISSION_TOTALS_HEADER "HC(g),CO(g),NOx(g),CO2(g),Energy(KJ),PM2.5(g)"
+
+
+EmissionAccumulator::EmissionAccumulator()
+	: networkTotals(), windowLength(DEFAULT_AGGREGATION_INTERVAL), firstWindow(0), vehicleFile(nullptr)
+{
+}
+
+EmissionAccumulator::~EmissionAccumulator()
+{
+	closeSummary();
+}
+
+void EmissionAccumulator::reset(double interval)
+{
+	closeSummary();
+	vehicles.clear();
+	links.clear();
+	vehicleTypes.clear();
+	networkTotals = EmissionTotals();
+	windowLength = (interval > 0.0) ? interval : 0.0;
+	windows.clear();
+	firstWindow = 0;
+}
+
+void EmissionAccumulator::add(long vehicleNumber, long vehicleType, long link, double time, double timeStep, double speed,
+	const double rates[EMISSION_RATE_COUNT])
+{
+	double emissions[EMISSION_RATE_COUNT];
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		emissions[k] = rates[k] * timeStep;
+	}
+
+	unordered_map<long, VehicleEmissionTotals>::iterator it = vehicles.find(vehicleNumber);
+	if (it == vehicles.end())
+	{
+		VehicleEmissionTotals created = {};
+		created.link = 0;
+		it = vehicles.insert(make_pair(vehicleNumber, created)).first;
+	}
+	VehicleEmissionTotals &vehicle = it->second;
+	vehicle.vehicleType = vehicleType;
+	if (link >= 0)
+	{
+		vehicle.link = link;
+	}
+	addTotals(vehicle.totals, emissions);
+	vehicle.travelTime += timeStep;
+	vehicle.travelDistance += speed * timeStep;
+
+	addTotals(links[vehicle.link], emissions);
+	addTotals(vehicleTypes[vehicleType], emissions);
+	addTotals(networkTotals, emissions);
+
+	if (windowLength > 0.0)
+	{
+		long long window = (long long)floor(time / windowLength);
+		if (windows.empty())
+		{
+			firstWindow = window;
+		}
+		if (window < firstWindow)
+		{
+			windows.insert(windows.begin(), (size_t)(firstWindow - window), EmissionTotals());
+			firstWindow = window;
+		}
+		if ((size_t)(window - firstWindow) >= windows.size())
+		{
+			windows.resize((size_t)(window - firstWindow) + 1, EmissionTotals());
+		}
+		addTotals(windows[(size_t)(window - firstWindow)], emissions);
+	}
+}
+
+void EmissionAccumulator::removeVehicle(long vehicleNumber)
+{
+	unordered_map<long, VehicleEmissionTotals>::iterator it = vehicles.find(vehicleNumber);
+	if (it == vehicles.end())
+	{
+		return;
+	}
+	writeVehicle(vehicleNumber, it->second);
+	vehicles.erase(it);
+}
+
+static void putTotals(CheckpointWriter &snapshot, const EmissionTotals &totals)
+{
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		snapshot.put(totals.values[k]);
+	}
+}
+
+static bool getTotals(CheckpointReader &snapshot, EmissionTotals &totals)
+{
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		if (!snapshot.get(totals.values[k]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void putTotalsMap(CheckpointWriter &snapshot, const unordered_map<long, EmissionTotals> &totals)
+{
+	snapshot.put((uint64_t)totals.size());
+	for (unordered_map<long, EmissionTotals>::const_iterator it = totals.begin(); it != totals.end(); ++it)
+	{
+		snapshot.put((int64_t)it->first);
+		putTotals(snapshot, it->second);
+	}
+}
+
+static bool getTotalsMap(CheckpointReader &snapshot, unordered_map<long, EmissionTotals> &totals)
+{
+	uint64_t count;
+	if (!snapshot.get(count))
+	{
+		return false;
+	}
+	for (uint64_t i = 0; i < count; i++)
+	{
+		int64_t key;
+		if (!snapshot.get(key) || !getTotals(snapshot, totals[(long)key]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void EmissionAccumulator::saveState(CheckpointWriter &snapshot) const
+{
+	putTotals(snapshot, networkTotals);
+	putTotalsMap(snapshot, links);
+	putTotalsMap(snapshot, vehicleTypes);
+
+	snapshot.put(windowLength);
+	snapshot.put((int64_t)firstWindow);
+	snapshot.put((uint64_t)windows.size());
+	for (size_t i = 0; i < windows.size(); i++)
+	{
+		putTotals(snapshot, windows[i]);
+	}
+
+	snapshot.put((uint64_t)vehicles.size());
+	for (unordered_map<long, VehicleEmissionTotals>::const_iterator it = vehicles.begin(); it != vehicles.end(); ++it)
+	{
+		const VehicleEmissionTotals &vehicle = it->second;
+		snapshot.put((int64_t)it->first);
+		snapshot.put((int64_t)vehicle.vehicleType);
+		snapshot.put((int64_t)vehicle.link);
+		putTotals(snapshot, vehicle.totals);
+		snapshot.put(vehicle.travelTime);
+		snapshot.put(vehicle.travelDistance);
+	}
+}
+
+bool EmissionAccumulator::restoreState(CheckpointReader &snapshot, string &error)
+{
+	vehicles.clear();
+	links.clear();
+	vehicleTypes.clear();
+	windows.clear();
+
+	int64_t first;
+	uint64_t count;
+	bool complete = getTotals(snapshot, networkTotals) && getTotalsMap(snapshot, links) &&
+		getTotalsMap(snapshot, vehicleTypes) && snapshot.get(windowLength) && snapshot.get(first) && snapshot.get(count);
+	if (complete)
+	{
+		firstWindow = first;
+		for (uint64_t i = 0; i < count && complete; i++)
+		{
+			windows.push_back(EmissionTotals());
+			complete = getTotals(snapshot, windows.back());
+		}
+	}
+	complete = complete && snapshot.get(count);
+	for (uint64_t i = 0; i < count && complete; i++)
+	{
+		int64_t vehicleNumber = 0, vehicleType = 0, link = 0;
+		VehicleEmissionTotals vehicle;
+		complete = snapshot.get(vehicleNumber) && snapshot.get(vehicleType) && snapshot.get(link) &&
+			getTotals(snapshot, vehicle.totals) && snapshot.get(vehicle.travelTime) && snapshot.get(vehicle.travelDistance);
+		vehicle.vehicleType = (long)vehicleType;
+		vehicle.link = (long)link;
+		if (complete)
+		{
+			vehicles[(long)vehicleNumber] = vehicle;
+		}
+	}
+	if (!complete)
+	{
+		vehicles.clear();
+		links.clear();
+		vehicleTypes.clear();
+		networkTotals = EmissionTotals();
+		windows.clear();
+		error = "the totals of the checkpoint are damaged";
+		return false;
+	}
+	return true;
+}
+
+const VehicleEmissionTotals *EmissionAccumulator::vehicle(long vehicleNumber) const
+{
+	unordered_map<long, VehicleEmissionTotals>::const_iterator it = vehicles.find(vehicleNumber);
+	return it == vehicles.end() ? nullptr : &it->second;
+}
+
+const EmissionTotals *EmissionAccumulator::link(long link) const
+{
+	unordered_map<long, EmissionTotals>::const_iterator it = links.find(link);
+	return it == links.end() ? nullptr : &it->second;
+}
+
+const EmissionTotals *EmissionAccumulator::window(long long window) const
+{
+	if (windows.empty() || window < firstWindow || (size_t)(window - firstWindow) >= windows.size())
+	{
+		return nullptr;
+	}
+	return &windows[(size_t)(window - firstWindow)];
+}
+
+const EmissionTotals *EmissionAccumulator::vehicleType(long vehicleType) const
+{
+	unordered_map<long, EmissionTotals>::const_iterator it = vehicleTypes.find(vehicleType);
+	return it == vehicleTypes.end() ? nullptr : &it->second;
+}
+
+bool EmissionAccumulator::openSummary(const string &prefix, string &error)
+{
+	closeSummary();
+	string path = prefix + "_veh.csv";
+	vehicleFile = fopen(path.c_str(), "w");
+	if (vehicleFile == nullptr)
+	{
+		error = "cannot create " + path;
+		return false;
+	}
+	summaryPrefix = prefix;
+	fprintf(vehicleFile, "Vehicle,Type,Link," EMISSION_TOTALS_HEADER ",TT(s),TD(m)\n");
+	return true;
+}
+
+void EmissionAccumulator::writeVehicle(long vehicleNumber, const VehicleEmissionTotals &vehicle)
+{
+	if (vehicleFile == nullptr)
+	{
+		return;
+	}
+	fprintf(vehicleFile, "%ld,%ld,%ld", vehicleNumber, vehicle.vehicleType, vehicle.link);
+	printTotals(vehicleFile, vehicle.totals);
+	fprintf(vehicleFile, ",%.9g,%.9g\n", vehicle.travelTime, vehicle.travelDistance);
+}
+
+void EmissionAccumulator::closeSummary()
+{
+	if (vehicleFile != nullptr)
+	{
+		fclose(vehicleFile);
+		vehicleFile = nullptr;
+	}
+}
+
+bool EmissionAccumulator::writeSummary(const SourceTypeRegistry &sourceTypes, string &error)
+{
+	if (vehicleFile == nullptr)
+	{
+		error = "no summary was started";
+		return false;
+	}
+
+	//vehicles still on the network, in number order
+	vector<long> numbers;
+	numbers.reserve(vehicles.size());
+	for (unordered_map<long, VehicleEmissionTotals>::const_iterator it = vehicles.begin(); it != vehicles.end(); ++it)
+	{
+		numbers.push_back(it->first);
+	}
+	sort(numbers.begin(), numbers.end());
+	for (size_t i = 0; i < numbers.size(); i++)
+	{
+		writeVehicle(numbers[i], vehicles[numbers[i]]);
+	}
+	bool written = (fclose(vehicleFile) == 0);
+	vehicleFile = nullptr;
+	if (!written)
+	{
+		error = "cannot write " + summaryPrefix + "_veh.csv";
+		return false;
+	}
+
+	string path = summaryPrefix + "_link.csv";
+	FILE *file = fopen(path.c_str(), "w");
+	if (file != nullptr)
+	{
+		fprintf(file, "Link," EMISSION_TOTALS_HEADER "\n");
+		vector<long> keys = sortedKeys(links);
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			fprintf(file, "%ld", keys[i]);
+			printTotals(file, links[keys[i]]);
+			fprintf(file, "\n");
+		}
+		written = (fclose(file) == 0);
+	}
+	if (file == nullptr || !written)
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+
+	path = summaryPrefix + "_interval.csv";
+	file = fopen(path.c_str(), "w");
+	if (file != nullptr)
+	{
+		fprintf(file, "Start(s),End(s)," EMISSION_TOTALS_HEADER "\n");
+		for (size_t i = 0; i < windows.size(); i++)
+		{
+			long long window = firstWindow + (long long)i;
+			fprintf(file, "%.9g,%.9g", window * windowLength, (window + 1) * windowLength);
+			printTotals(file, windows[i]);
+			fprintf(file, "\n");
+		}
+		written = (fclose(file) == 0);
+	}
+	if (file == nullptr || !written)
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+
+	path = summaryPrefix + "_type.csv";
+	file = fopen(path.c_str(), "w");
+	if (file != nullptr)
+	{
+		fprintf(file, "Type,SourceType," EMISSION_TOTALS_HEADER "\n");
+		vector<long> keys = sortedKeys(vehicleTypes);
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			const SourceTypeModel *model = sourceTypes.find(keys[i]);
+			fprintf(file, "%ld,%d", keys[i], model != nullptr ? model->sourceTypeId : 0);
+			printTotals(file, vehicleTypes[keys[i]]);
+			fprintf(file, "\n");
+		}
+		fprintf(file, "all,");
+		printTotals(file, networkTotals);
+		fprintf(file, "\n");
+		written = (fclose(file) == 0);
+	}
+	if (file == nullptr || !written)
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,110 @@
+/*========================================================================= */
+/* EmissionAccumulator.h                             Core module of MOVESTAR */
+/*																			*/
+/* Streaming emission totals of a simulation run, per vehicle on the		*/
+/* network, per link, per time window, per vehicle type and for the whole	*/
+/* network. Memory grows with the vehicles on the network, the links, the	*/
+/* windows and the types, not with the steps calculated: the totals of a	*/
+/* vehicle are written to the summary and dropped when it leaves.			*/
+/*========================================================================= */
+
+#ifndef __EMISSIONACCUMULATOR_H
+#define __EMISSIONACCUMULATOR_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Checkpoint.h"
+#include "MovestarRates.h"
+#include "SourceTypeRegistry.h"
+
+//default length of the time windows [s]
+#define DEFAULT_AGGREGATION_INTERVAL 60.0
+
+//emission totals in the output order: HC, CO, NOx, CO2 [g], Energy [KJ], PM2.5 [g]
+struct EmissionTotals
+{
+	double values[EMISSION_RATE_COUNT];
+};
+
+//totals of one vehicle on the network
+struct VehicleEmissionTotals
+{
+	long           vehicleType;
+	long           link;				//link of the last step
+	EmissionTotals totals;
+	double         travelTime;			//[s]
+	double         travelDistance;		//[m]
+};
+
+class EmissionAccumulator
+{
+public:
+	EmissionAccumulator();
+	~EmissionAccumulator();
+
+	//drops every total (start of a simulation run); <interval> is the length of
+	//the time windows [s], 0 for no windows. An open summary is closed unwritten
+	void reset(double interval);
+
+	//adds one step of a vehicle: emission rates [g/s] in the order of
+	//EmissionTotals over <timeStep> [s] at simulation time <time> [s] and speed
+	//[m/s]. A negative <link> keeps the link of the vehicle's last step
+	void add(long vehicleNumber, long vehicleType, long link, double time, double timeStep, double speed,
+		const double rates[EMISSION_RATE_COUNT]);
+
+	//a vehicle leaving the network: its totals go to the summary and are dropped
+	void removeVehicle(long vehicleNumber);
+
+	//totals of a vehicle on the network, a link, the window starting at
+	//<window> * interval(), or a vehicle type; nullptr if nothing was added
+	const VehicleEmissionTotals *vehicle(long vehicleNumber) const;
+	const EmissionTotals *link(long link) const;
+	const EmissionTotals *window(long long window) const;
+	const EmissionTotals *vehicleType(long vehicleType) const;
+	const EmissionTotals &network() const { return networkTotals; }
+
+	double interval() const { return windowLength; }
+
+	//appends every total to <snapshot>
+	void saveState(CheckpointWriter &snapshot) const;
+
+	//replaces every total (and the window length) by those saved to <snapshot>;
+	//false with a message in <error> (and no totals) if it is damaged. The
+	//summary is untouched
+	bool restoreState(CheckpointReader &snapshot, std::string &error);
+
+	//starts the summary of the run: <prefix>_veh.csv receives every vehicle as
+	//it leaves; false with a message in <error> if the file cannot be created
+	bool openSummary(const std::string &prefix, std::string &error);
+	bool summaryOpen() const { return vehicleFile != nullptr; }
+
+	//ends the summary: the vehicles still on the network go to <prefix>_veh.csv,
+	//the link, window and type totals to <prefix>_link.csv, <prefix>_interval.csv
+	//and <prefix>_type.csv (with the source type of each vehicle type)
+	bool writeSummary(const SourceTypeRegistry &sourceTypes, std::string &error);
+
+private:
+	EmissionAccumulator(const EmissionAccumulator &);
+	EmissionAccumulator &operator=(const EmissionAccumulator &);
+
+	void writeVehicle(long vehicleNumber, const VehicleEmissionTotals &vehicle);
+	void closeSummary();
+
+	std::unordered_map<long, VehicleEmissionTotals> vehicles;
+	std::unordered_map<long, EmissionTotals>        links;
+	std::unordered_map<long, EmissionTotals>        vehicleTypes;
+	EmissionTotals                                  networkTotals;
+
+	//element i holds the window firstWindow + i
+	double                                          windowLength;
+	std::vector<EmissionTotals>                     windows;
+	long long                                       firstWindow;
+
+	std::string                                     summaryPrefix;
+	FILE                                           *vehicleFile;
+};
+
+#endif /* __EMISSIONACCUMULATOR_H */
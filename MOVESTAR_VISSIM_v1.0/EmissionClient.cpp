@@ -0,0 +1,152 @@
+/*========================================================================= */
+/* EmissionClient.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* Channel claim, step submission and the wait for the results.			*/
+/*========================================================================= */
+
+#include "EmissionClient.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+using namespace std;
+
+
+//polls of a wait spent spinning before the client yields between polls; on a
+//single core the server cannot run while the client spins, so it yields at once
+#define CLIENT_SPIN_POLLS 4000
+
+static const unsigned spinPolls = thread::hardware_concurrency() > 1 ? CLIENT_SPIN_POLLS : 0;
+
+//polls between two checks that the server still runs
+#define CLIENT_LIVENESS_POLLS 65536
+
+EmissionClient::EmissionClient()
+	: header(nullptr), channel(nullptr), channelIndex(0), submitted(0), waited(0)
+{
+}
+
+EmissionClient::~EmissionClient()
+{
+	close();
+}
+
+bool EmissionClient::connect(const string &name, string &error)
+{
+	close();
+	if (!segment.open(name, error))
+	{
+		return false;
+	}
+	ServerHeader *server = (ServerHeader *)segment.data();
+	if (segment.size() < sizeof(ServerHeader) || server->running.load(memory_order_acquire) == 0 ||
+		memcmp(server->magic, EMISSION_SERVER_MAGIC, sizeof(server->magic)) != 0)
+	{
+		segment.close();
+		error = "no server running on " + name;
+		return false;
+	}
+	if (server->version != EMISSION_SERVER_VERSION || segment.size() < serverSegmentBytes(server->channelCount, server->slotVehicles))
+	{
+		segment.close();
+		error = "the server on " + name + " speaks another protocol version";
+		return false;
+	}
+
+	uint64_t process = currentProcessId();
+	for (size_t c = 0; c < server->channelCount; c++)
+	{
+		ServerChannel *candidate = serverChannel(server, c);
+		uint64_t free = 0;
+		if (candidate->owner.compare_exchange_strong(free, process, memory_order_acq_rel))
+		{
+			//a new generation tells the server the vehicles of the last client are gone
+			candidate->generation.fetch_add(1, memory_order_acq_rel);
+			header = server;
+			channel = candidate;
+			channelIndex = c;
+			submitted = waited = channel->submitted.load(memory_order_relaxed);
+			return true;
+		}
+	}
+	segment.close();
+	error = "every channel of the server on " + name + " is taken";
+	return false;
+}
+
+void EmissionClient::close()
+{
+	if (header == nullptr)
+	{
+		return;
+	}
+	ServerSlotArrays results;
+	int32_t calculated;
+	string error;
+	while (inFlight() > 0 && wait(results, calculated, error))
+	{
+	}
+	channel->owner.store(0, memory_order_release);
+	segment.close();
+	header = nullptr;
+	channel = nullptr;
+}
+
+ServerSlotArrays EmissionClient::next() const
+{
+	return serverSlotArrays(serverSlot(header, channelIndex, submitted), header->slotVehicles);
+}
+
+bool EmissionClient::submit(double time, double timeStep, size_t count, size_t killCount, string &error)
+{
+	if (count > header->slotVehicles || killCount > header->slotVehicles)
+	{
+		error = "a step of more than " + to_string(header->slotVehicles) + " vehicles";
+		return false;
+	}
+	if (inFlight() >= header->depth)
+	{
+		error = "every slot of the channel is in flight";
+		return false;
+	}
+	ServerSlot *slot = serverSlot(header, channelIndex, submitted);
+	slot->time = time;
+	slot->timeStep = timeStep;
+	slot->count = (uint32_t)count;
+	slot->killCount = (uint32_t)killCount;
+	channel->submitted.store(++submitted, memory_order_release);
+	return true;
+}
+
+bool EmissionClient::wait(ServerSlotArrays &results, int32_t &calculated, string &error)
+{
+	if (inFlight() == 0)
+	{
+		error = "no step in flight";
+		return false;
+	}
+	for (unsigned polls = 1; channel->completed.load(memory_order_acquire) <= waited; polls++)
+	{
+		if (polls % CLIENT_LIVENESS_POLLS == 0 &&
+			(header->running.load(memory_order_acquire) == 0 || !processAlive((unsigned long)header->serverProcess)))
+		{
+			error = "the server stopped";
+			return false;
+		}
+		if (polls > spinPolls)
+		{
+			this_thread::yield();
+		}
+	}
+	ServerSlot *slot = serverSlot(header, channelIndex, waited);
+	results = serverSlotArrays(slot, header->slotVehicles);
+	calculated = slot->status;
+	waited++;
+	return true;
+}
+
+bool EmissionClient::calculate(double time, double timeStep, size_t count, size_t killCount, string &error)
+{
+	ServerSlotArrays results;
+	int32_t calculated;
+	return submit(time, timeStep, count, killCount, error) && wait(results, calculated, error);
+}
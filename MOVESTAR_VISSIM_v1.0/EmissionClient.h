@@ -0,0 +1,78 @@
+/*========================================================================= */
+/* EmissionClient.h                                  Core module of MOVESTAR */
+/*																			*/
+/* Reference client of the emission server (EmissionServer.h), for			*/
+/* simulators in other processes. A client claims a channel of the server	*/
+/* and hands over one time step at a time: the vehicles are written into	*/
+/* the arrays of the next slot, and the server writes the emissions back	*/
+/* into the same arrays. Up to SERVER_CHANNEL_DEPTH steps may be in flight.	*/
+/*																			*/
+/*	EmissionClient client;													*/
+/*	client.connect(DEFAULT_SERVER_NAME, error);								*/
+/*	ServerSlotArrays step = client.next();									*/
+/*	step.vehicleIds[0] = 1; step.vehicleTypes[0] = 100; ...				*/
+/*	client.calculate(time, timeStep, 1, 0, error);							*/
+/*	double co2 = step.co2[0];												*/
+/*========================================================================= */
+
+#ifndef __EMISSIONCLIENT_H
+#define __EMISSIONCLIENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "EmissionServerProtocol.h"
+#include "SharedMemory.h"
+
+class EmissionClient
+{
+public:
+	EmissionClient();
+
+	//waits for the steps in flight and releases the channel
+	~EmissionClient();
+
+	//claims a channel of the server on <name>; false with a message in <error>
+	//if there is no server, it is of another version or every channel is taken
+	bool connect(const std::string &name, std::string &error);
+	void close();
+	bool isOpen() const { return header != nullptr; }
+
+	//vehicles (and kills) of a step at most
+	std::size_t capacity() const { return header->slotVehicles; }
+
+	//arrays of the slot the next step is written to; valid until the step after
+	//it is submitted SERVER_CHANNEL_DEPTH steps later
+	ServerSlotArrays next() const;
+
+	//hands the step written to next() to the server: <count> vehicles at
+	//simulation time <time> [s] with steps of <timeStep> [s], and before them
+	//<killCount> vehicles that left the network. False with a message in
+	//<error> if the counts exceed capacity() or every slot is in flight
+	bool submit(double time, double timeStep, std::size_t count, std::size_t killCount, std::string &error);
+
+	//waits for the oldest step in flight; its results are in the arrays it was
+	//written to, <calculated> vehicles had a source type (SERVER_SLOT_INVALID
+	//for an invalid time step). False with a message in <error> if the server
+	//stopped or no step is in flight
+	bool wait(ServerSlotArrays &results, int32_t &calculated, std::string &error);
+
+	//submit and wait for one step, the results in the arrays of next()
+	bool calculate(double time, double timeStep, std::size_t count, std::size_t killCount, std::string &error);
+
+	//steps submitted and not waited for
+	std::size_t inFlight() const { return (std::size_t)(submitted - waited); }
+
+private:
+	EmissionClient(const EmissionClient &);
+	EmissionClient &operator=(const EmissionClient &);
+
+	SharedMemory         segment;
+	ServerHeader        *header;
+	ServerChannel       *channel;
+	std::size_t          channelIndex;
+	uint64_t             submitted;		//steps submitted on the channel
+	uint64_t             waited;		//steps whose results were waited for
+};
+
+#endif /* __EMISSIONCLIENT_H */
@@ -0,0 +1,497 @@
+/*========================================================================= */
+/* EmissionEngine.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* Batch calculation of VSP, operating mode and emission rates.			*/
+/*========================================================================= */
+
+#include "EmissionEngine.h"
+#include <cmath>
+using namespace std;
+
+
+EmissionEngine::EmissionEngine(const SourceTypeRegistry &sourceTypes)
+	: sourceTypes(sourceTypes), timeStepValue(1.0), currentSimulationTime(0.0), resampling(false),
+	lastVehicleNumber(0), lastHandle(INVALID_VEHICLE_HANDLE)
+{
+	analyseTimeStep(timeStepValue);
+}
+
+void EmissionEngine::reset()
+{
+	vehicleStates.clear();
+	lastHandle = INVALID_VEHICLE_HANDLE;
+}
+
+void EmissionEngine::setRateGrids(const shared_ptr<const RateGrids> &grids)
+{
+	this->grids = grids;
+	reset();
+}
+
+void EmissionEngine::setHistoryResampling(bool resampling)
+{
+	this->resampling = resampling;
+	vehicleStates.setLayout(compactTypes != nullptr, resampling);
+	reset();
+}
+
+void EmissionEngine::setCompact(const shared_ptr<const CompactSourceTypes> &compactTypes)
+{
+	this->compactTypes = compactTypes;
+	vehicleStates.setLayout(compactTypes != nullptr, resampling);
+	reset();
+}
+
+void EmissionEngine::setDenseVehicleLimit(long limit)
+{
+	vehicleStates.setDenseLimit(limit);
+	reset();
+}
+
+//largest denominator tried for an exact ratio of the time step to one second
+#define TIME_STEP_MAX_DENOMINATOR 1000
+
+//ticks per second of a step without a small exact ratio (microseconds)
+#define TIME_STEP_FALLBACK_TICKS 1000000
+
+void EmissionEngine::analyseTimeStep(double timeStep)
+{
+	timeStepValue = timeStep;
+
+	//calculate how often to push to historical accelerations (closest possible value to one simulation second)
+	pushPeriod = (timeStep > 0.0) ? (int)round(1.0 / timeStep) : 1;
+	if (pushPeriod < 1)
+	{
+		pushPeriod = 1;
+	}
+
+	//smallest q with step * q whole (0.1 s = 1/10, 0.3 s = 3/10, 0.05 s = 1/20)
+	stepTicks = 0;
+	ticksPerSecond = 0;
+	if (!(timeStep > 0.0))
+	{
+		return;
+	}
+	for (long long q = 1; q <= TIME_STEP_MAX_DENOMINATOR; q++)
+	{
+		double p = timeStep * q;
+		if (fabs(p - round(p)) < 1e-9 * q)
+		{
+			stepTicks = llround(p);
+			ticksPerSecond = q;
+			return;
+		}
+	}
+	ticksPerSecond = TIME_STEP_FALLBACK_TICKS;
+	stepTicks = max(llround(timeStep * TIME_STEP_FALLBACK_TICKS), 1LL);
+}
+
+long long EmissionEngine::secondOf(double time) const
+{
+	if (ticksPerSecond == 0)
+	{
+		return (long long)floor(time);
+	}
+
+	//simulation times are whole steps, rounding absorbs their representation error
+	long long ticks = llround(time / timeStepValue) * stepTicks;
+	return ticks >= 0 ? ticks / ticksPerSecond : -((ticksPerSecond - 1 - ticks) / ticksPerSecond);
+}
+
+template <class History> bool EmissionEngine::updateHistory(History &history, VehicleHandle handle, const EmissionBatch &batch,
+	size_t i, bool pushAcceleration)
+{
+	//the ring buffer drops the oldest element once it holds 3
+	if (resampling)
+	{
+		//the mean of a second is pushed once a step of the next second arrives
+		SecondAverage &current = vehicleStates.currentSecond(handle);
+		long long second = secondOf(batch.times != nullptr ? batch.times[i] : currentSimulationTime);
+		if (current.samples > 0 && current.second != second)
+		{
+			history.push(current.accelerationSum / current.samples);
+			current.accelerationSum = 0.0;
+			current.samples = 0;
+		}
+		current.second = second;
+		current.accelerationSum += batch.accelerations[i];
+		current.samples++;
+	}
+	else
+	{
+		if (batch.times != nullptr)
+		{
+			pushAcceleration = ((int)(batch.times[i] / timeStepValue) % pushPeriod == 0);
+		}
+		if (pushAcceleration)
+		{
+			history.push(batch.accelerations[i]);
+		}
+	}
+	return history.braking();
+}
+
+void EmissionEngine::setVehicleType(VehicleState &state, long vehicleType)
+{
+	state.vehicleType = vehicleType;
+	state.sourceType = sourceTypes.find(vehicleType);
+	state.rateGrid = (grids && state.sourceType != nullptr) ? grids->find(state.sourceType) : nullptr;
+	state.compactType = (compactTypes && state.sourceType != nullptr) ? compactTypes->find(state.sourceType) : nullptr;
+}
+
+bool EmissionEngine::createVehicle(long vehicleNumber, long vehicleType)
+{
+	const SourceTypeModel *sourceType = sourceTypes.find(vehicleType);
+	if (sourceType == nullptr)
+	{
+		return false;
+	}
+	setVehicleType(vehicleStates[vehicleStates.create(vehicleNumber)], vehicleType);
+	return true;
+}
+
+void EmissionEngine::killVehicle(long vehicleNumber)
+{
+	vehicleStates.kill(vehicleNumber);
+	if (lastVehicleNumber == vehicleNumber)
+	{
+		lastHandle = INVALID_VEHICLE_HANDLE;
+	}
+}
+
+bool EmissionEngine::history(long vehicleNumber, AccelerationHistory &history) const
+{
+	VehicleHandle handle = vehicleStates.find(vehicleNumber);
+	if (handle == INVALID_VEHICLE_HANDLE)
+	{
+		return false;
+	}
+	if (!vehicleStates.compact())
+	{
+		history = vehicleStates.history(handle);
+		return true;
+	}
+	const CompactAccelerationHistory &compactHistory = vehicleStates.compactHistory(handle);
+	history.clear();
+	for (int k = 0; k < compactHistory.size(); k++)
+	{
+		history.push(compactHistory.at(k));
+	}
+	return true;
+}
+
+void EmissionEngine::saveState(CheckpointWriter &snapshot) const
+{
+	bool compact = vehicleStates.compact();
+	snapshot.put((uint8_t)compact);
+	snapshot.put((uint8_t)resampling);
+	snapshot.put((uint64_t)vehicleStates.liveCount());
+	vehicleStates.forEachLive([&](VehicleHandle handle)
+	{
+		const VehicleState &state = vehicleStates[handle];
+		snapshot.put((int64_t)state.vehicleNumber);
+		snapshot.put((int64_t)state.vehicleType);
+		if (compact)
+		{
+			const CompactAccelerationHistory &history = vehicleStates.compactHistory(handle);
+			for (int k = 0; k < 3; k++)
+			{
+				snapshot.put((int16_t)history.values[k]);
+			}
+			snapshot.put((uint8_t)history.head);
+			snapshot.put((uint8_t)history.count);
+		}
+		else
+		{
+			const AccelerationHistory &history = vehicleStates.history(handle);
+			for (int k = 0; k < 3; k++)
+			{
+				snapshot.put(history.values[k]);
+			}
+			snapshot.put((uint8_t)history.head);
+			snapshot.put((uint8_t)history.count);
+		}
+		if (resampling)
+		{
+			const SecondAverage &second = vehicleStates.currentSecond(handle);
+			snapshot.put((int64_t)second.second);
+			snapshot.put(second.accelerationSum);
+			snapshot.put((int32_t)second.samples);
+		}
+	});
+}
+
+bool EmissionEngine::restoreState(CheckpointReader &snapshot, string &error)
+{
+	uint8_t compact, resampled;
+	uint64_t count;
+	if (!snapshot.get(compact) || !snapshot.get(resampled) || !snapshot.get(count))
+	{
+		error = "the vehicles of the checkpoint are damaged";
+		return false;
+	}
+	if ((compact != 0) != vehicleStates.compact() || (resampled != 0) != resampling)
+	{
+		error = "the checkpoint was taken with another history layout (compact or resampling)";
+		return false;
+	}
+
+	reset();
+	for (uint64_t v = 0; v < count; v++)
+	{
+		int64_t vehicleNumber = 0, vehicleType = 0;
+		uint8_t head = 0, samples = 0;
+		bool complete = snapshot.get(vehicleNumber) && snapshot.get(vehicleType);
+		VehicleHandle handle = vehicleStates.create((long)vehicleNumber);
+		setVehicleType(vehicleStates[handle], (long)vehicleType);
+		if (compact != 0)
+		{
+			CompactAccelerationHistory &history = vehicleStates.compactHistory(handle);
+			int16_t values[3] = { 0, 0, 0 };
+			complete = complete && snapshot.get(values[0]) && snapshot.get(values[1]) && snapshot.get(values[2]);
+			complete = complete && snapshot.get(head) && snapshot.get(samples);
+			for (int k = 0; k < 3; k++)
+			{
+				history.values[k] = values[k];
+			}
+			history.head = head;
+			history.count = samples;
+		}
+		else
+		{
+			AccelerationHistory &history = vehicleStates.history(handle);
+			complete = complete && snapshot.get(history.values[0]) && snapshot.get(history.values[1]) &&
+				snapshot.get(history.values[2]);
+			complete = complete && snapshot.get(head) && snapshot.get(samples);
+			history.head = head;
+			history.count = samples;
+		}
+		if (resampling)
+		{
+			SecondAverage &second = vehicleStates.currentSecond(handle);
+			int64_t secondNumber = 0;
+			int32_t secondSamples = 0;
+			complete = complete && snapshot.get(secondNumber) && snapshot.get(second.accelerationSum) &&
+				snapshot.get(secondSamples);
+			second.second = secondNumber;
+			second.samples = secondSamples;
+		}
+		if (!complete || head > 2 || samples > 3)
+		{
+			reset();
+			error = "the vehicles of the checkpoint are damaged";
+			return false;
+		}
+	}
+	return true;
+}
+
+VehicleHandle EmissionEngine::findOrCreate(long vehicleNumber, long vehicleType)
+{
+	if (lastHandle != INVALID_VEHICLE_HANDLE && lastVehicleNumber == vehicleNumber)
+	{
+		return lastHandle;
+	}
+	VehicleHandle handle = vehicleStates.find(vehicleNumber);
+	if (handle == INVALID_VEHICLE_HANDLE)
+	{
+		handle = vehicleStates.create(vehicleNumber);
+		setVehicleType(vehicleStates[handle], vehicleType);
+	}
+	lastVehicleNumber = vehicleNumber;
+	lastHandle = handle;
+	return handle;
+}
+
+void EmissionEngine::binBatch(const EmissionBatch &batch)
+{
+	size_t count = batch.count;
+
+	bool pushAcceleration = ((int)(currentSimulationTime / timeStepValue) % pushPeriod == 0);
+
+	if (batchOpmodes.size() < count)
+	{
+		batchVehicles.resize(count);
+		batchCoefficients.resize(count);
+		batchVelocities.resize(count);
+		batchAccelerations.resize(count);
+		batchVSP.resize(count);
+		batchBraking.resize(count);
+		batchKernelOpmodes.resize(count);
+		batchOpmodes.resize(count);
+		batchSourceTypes.resize(count);
+	}
+	bool compact = (compactTypes != nullptr);
+	if (compact && batchCompactTypes.size() < count)
+	{
+		batchCompactCoefficients.resize(count);
+		batchCompactVelocities.resize(count);
+		batchCompactAccelerations.resize(count);
+		batchCompactVSP.resize(count);
+		batchCompactTypes.resize(count);
+	}
+
+	//update the acceleration histories, take the opmodes the grids answer and
+	//gather the kernel inputs of the other vehicles
+	size_t kernelCount = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		VehicleHandle handle = findOrCreate(batch.vehicleIds[i], batch.vehicleTypes[i]);
+		VehicleState &state = vehicleStates[handle];
+		if (state.vehicleType != batch.vehicleTypes[i])
+		{
+			setVehicleType(state, batch.vehicleTypes[i]);
+		}
+		batchSourceTypes[i] = state.sourceType;
+		if (state.sourceType == nullptr)
+		{
+			continue;
+		}
+		bool braking = compact ? updateHistory(vehicleStates.compactHistory(handle), handle, batch, i, pushAcceleration) :
+			updateHistory(vehicleStates.history(handle), handle, batch, i, pushAcceleration);
+		if (compact)
+		{
+			batchCompactTypes[i] = state.compactType;
+		}
+
+		//the history keeps the acceleration, the VSP takes the grade as well
+		double acceleration = (batch.slopes != nullptr) ? gradeAcceleration(batch.accelerations[i], batch.slopes[i]) :
+			batch.accelerations[i];
+		if (state.rateGrid != nullptr)
+		{
+			int row = braking ? rateRowOfOpmode(0) : state.rateGrid->row(batch.velocities[i], acceleration);
+			if (row != RATE_GRID_EXACT)
+			{
+				batchOpmodes[i] = opmodeOfRow[row];
+				if (batch.vsp != nullptr)
+				{
+					batch.vsp[i] = compact ?
+						calculateVSP(state.compactType->coefficients, (float)(batch.velocities[i] * 3.6), (float)acceleration) :
+						calculateVSP(state.sourceType->coefficients, batch.velocities[i] * 3.6, acceleration);
+				}
+				continue;
+			}
+		}
+
+		batchVehicles[kernelCount] = i;
+		if (compact)
+		{
+			batchCompactCoefficients[kernelCount] = &state.compactType->coefficients;
+			batchCompactVelocities[kernelCount] = (float)(batch.velocities[i] * 3.6);
+			batchCompactAccelerations[kernelCount] = (float)acceleration;
+		}
+		else
+		{
+			batchCoefficients[kernelCount] = &state.sourceType->coefficients;
+			batchVelocities[kernelCount] = batch.velocities[i] * 3.6;				//FIXME: Change back to m/s
+			batchAccelerations[kernelCount] = acceleration;
+		}
+		batchBraking[kernelCount] = braking;
+		kernelCount++;
+	}
+
+	//calculate VSP and get OpMode
+	if (compact)
+	{
+		calculateVSPBatch(kernelCount, batchCompactCoefficients.data(), batchCompactVelocities.data(),
+			batchCompactAccelerations.data(), batchCompactVSP.data());
+		binOpmodeBatch(kernelCount, batchCompactVelocities.data(), batchCompactVSP.data(), batchBraking.data(),
+			batchKernelOpmodes.data());
+	}
+	else
+	{
+		calculateVSPBatch(kernelCount, batchCoefficients.data(), batchVelocities.data(), batchAccelerations.data(), batchVSP.data());
+		binOpmodeBatch(kernelCount, batchVelocities.data(), batchVSP.data(), batchBraking.data(), batchKernelOpmodes.data());
+	}
+	for (size_t k = 0; k < kernelCount; k++)
+	{
+		batchOpmodes[batchVehicles[k]] = batchKernelOpmodes[k];
+		if (batch.vsp != nullptr)
+		{
+			batch.vsp[batchVehicles[k]] = compact ? (double)batchCompactVSP[k] : batchVSP[k];
+		}
+	}
+}
+
+size_t EmissionEngine::calculate(const EmissionBatch &batch)
+{
+	size_t count = batch.count;
+	binBatch(batch);
+
+	size_t calculated = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		batch.hc[i] = batch.co[i] = batch.nox[i] = batch.co2[i] = batch.energy[i] = batch.pm25[i] = 0.0;
+		if (batchSourceTypes[i] == nullptr)
+		{
+			continue;
+		}
+		if (batch.opmodes != nullptr)
+		{
+			batch.opmodes[i] = batchOpmodes[i];
+		}
+
+		//retrieve the per-second emission rates of the opmode
+		int row = rateRowOfOpmode(batchOpmodes[i]);
+		if (row < 0)
+		{
+			continue;
+		}
+		if (compactTypes != nullptr)
+		{
+			const float *rates = batchCompactTypes[i]->rates.rates[row];
+			batch.hc[i] = rates[0];
+			batch.co[i] = rates[1];
+			batch.nox[i] = rates[2];
+			batch.co2[i] = rates[3];
+			batch.energy[i] = rates[4];
+			batch.pm25[i] = rates[5];
+		}
+		else
+		{
+			const double *rates = batchSourceTypes[i]->rates->rates[row];
+			batch.hc[i] = rates[0];
+			batch.co[i] = rates[1];
+			batch.nox[i] = rates[2];
+			batch.co2[i] = rates[3];
+			batch.energy[i] = rates[4];
+			batch.pm25[i] = rates[5];
+		}
+		calculated++;
+	}
+	return calculated;
+}
+
+void EmissionEngine::updateBraking(const EmissionBatch &batch, unsigned char *braking)
+{
+	bool pushAcceleration = ((int)(currentSimulationTime / timeStepValue) % pushPeriod == 0);
+	bool compact = (compactTypes != nullptr);
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		VehicleHandle handle = findOrCreate(batch.vehicleIds[i], batch.vehicleTypes[i]);
+		braking[i] = compact ? updateHistory(vehicleStates.compactHistory(handle), handle, batch, i, pushAcceleration) :
+			updateHistory(vehicleStates.history(handle), handle, batch, i, pushAcceleration);
+	}
+}
+
+size_t EmissionEngine::calculateOpmodes(const EmissionBatch &batch)
+{
+	size_t count = batch.count;
+	binBatch(batch);
+
+	size_t calculated = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (batchSourceTypes[i] == nullptr)
+		{
+			batch.opmodes[i] = INVALID_OPMODE;
+			continue;
+		}
+		batch.opmodes[i] = batchOpmodes[i];
+		if (rateRowOfOpmode(batchOpmodes[i]) >= 0)
+		{
+			calculated++;
+		}
+	}
+	return calculated;
+}
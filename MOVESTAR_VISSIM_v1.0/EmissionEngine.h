@@ -0,0 +1,195 @@
+/*========================================================================= */
+/* EmissionEngine.h                                  Core module of MOVESTAR */
+/*																			*/
+/* Platform-neutral calculation core: per-vehicle acceleration history,	*/
+/* VSP, operating mode and emission rates for batches of vehicles. The		*/
+/* VISSIM DLL and the command-line tool are frontends over this class.		*/
+/*========================================================================= */
+
+#ifndef __EMISSIONENGINE_H
+#define __EMISSIONENGINE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Checkpoint.h"
+#include "CompactModel.h"
+#include "MovestarKernels.h"
+#include "MovestarRates.h"
+#include "RateGrid.h"
+#include "SourceTypeRegistry.h"
+#include "VehicleStateTable.h"
+
+//structure-of-arrays view of the vehicles calculated in one call
+struct EmissionBatch
+{
+	std::size_t   count;
+	const long   *vehicleIds;
+	const long   *vehicleTypes;
+	const double *velocities;		//[m/s]
+	const double *accelerations;	//[m/s2]
+	const double *slopes;			//rise over run, may be null (level, see gradeAcceleration)
+	const double *times;			//simulation time of each vehicle [s], null for the engine time
+
+	//emissions of each vehicle [g/s], energy [KJ/s]
+	double       *hc;
+	double       *co;
+	double       *nox;
+	double       *co2;
+	double       *energy;
+	double       *pm25;
+
+	double       *vsp;				//may be null
+	int          *opmodes;			//may be null
+};
+
+class EmissionEngine
+{
+public:
+	explicit EmissionEngine(const SourceTypeRegistry &sourceTypes);
+
+	//simulation time step length and current simulation time [s]; a new step
+	//length is analysed once (history push period, exact ratio to one second)
+	void setTimeStep(double timeStep)
+	{
+		if (timeStep != timeStepValue)
+		{
+			analyseTimeStep(timeStep);
+		}
+	}
+	void setTime(double time) { currentSimulationTime = time; }
+	double timeStep() const { return timeStepValue; }
+	double time() const { return currentSimulationTime; }
+
+	//drops every vehicle (start of a simulation run)
+	void reset();
+
+	//looks up the rates of vehicles not braking in <grids> (built from the
+	//registry of this engine), null for the exact calculation only. Drops every
+	//vehicle
+	void setRateGrids(const std::shared_ptr<const RateGrids> &grids);
+	const RateGrids *rateGrids() const { return grids.get(); }
+
+	//samples of the acceleration histories (braking mode): false pushes the
+	//acceleration of the step starting each second, as the VISSIM version always
+	//did; true resamples every vehicle to 1 Hz and pushes the mean acceleration
+	//of each completed second, exact for any step length. Drops every vehicle
+	void setHistoryResampling(bool resampling);
+	bool historyResampling() const { return resampling; }
+
+	//compact mode with <compactTypes> (built from the registry of this engine):
+	//float32 kernels and rate tables and int16 histories, null for the double
+	//path. Drops every vehicle
+	void setCompact(const std::shared_ptr<const CompactSourceTypes> &compactTypes);
+	const CompactSourceTypes *compact() const { return compactTypes.get(); }
+
+	//vehicle numbers indexed directly by the state table (see
+	//VehicleStateTable::setDenseLimit). Drops every vehicle
+	void setDenseVehicleLimit(long limit);
+
+	//hands out a state slot for a vehicle entering the network; false if its
+	//type has no source type (the vehicle is not created)
+	bool createVehicle(long vehicleNumber, long vehicleType);
+
+	//releases the state of a vehicle leaving the network
+	void killVehicle(long vehicleNumber);
+
+	//calculates the vehicles of <batch>; vehicles never created get a slot on
+	//their first calculation, vehicles that cannot be calculated get zero
+	//emissions. Returns the number of vehicles calculated
+	std::size_t calculate(const EmissionBatch &batch);
+
+	//as calculate, but only the opmodes (INVALID_OPMODE for the vehicles that
+	//cannot be calculated) and VSP of <batch> are written, the emissions may be
+	//null. Returns the number of vehicles with an opmode that has rates
+	std::size_t calculateOpmodes(const EmissionBatch &batch);
+
+	//updates the acceleration histories of the vehicles of <batch> as calculate
+	//does, with or without a source type, and writes to <braking> whether the
+	//history puts each in the braking mode. Nothing is binned: the scenario
+	//sweep (ScenarioSweep.h) bins every row under the source types of each scenario
+	void updateBraking(const EmissionBatch &batch, unsigned char *braking);
+
+	//copies the acceleration history of a live vehicle (decoded in compact mode)
+	//to <history>, false if the vehicle is not live
+	bool history(long vehicleNumber, AccelerationHistory &history) const;
+
+	//appends the live vehicles, their types and histories to <snapshot>
+	void saveState(CheckpointWriter &snapshot) const;
+
+	//replaces every vehicle by those saved to <snapshot> by an engine of the same
+	//history layout (compact, resampling); false with a message in <error> if the
+	//layout differs or the snapshot is damaged
+	bool restoreState(CheckpointReader &snapshot, std::string &error);
+
+	//source types (null for the vehicles not calculated) and opmodes of the
+	//vehicles of the last batch calculated
+	const SourceTypeModel *const *lastSourceTypes() const { return batchSourceTypes.data(); }
+	const int *lastOpmodes() const { return batchOpmodes.data(); }
+
+	const VehicleStateTable &vehicles() const { return vehicleStates; }
+	const SourceTypeRegistry &registry() const { return sourceTypes; }
+
+private:
+	EmissionEngine(const EmissionEngine &);
+	EmissionEngine &operator=(const EmissionEngine &);
+
+	VehicleHandle findOrCreate(long vehicleNumber, long vehicleType);
+	void setVehicleType(VehicleState &state, long vehicleType);
+	void analyseTimeStep(double timeStep);
+
+	//second of simulation time <time> [s], counted in whole steps
+	long long secondOf(double time) const;
+
+	//adds the acceleration of vehicle <i> of <batch> to its <history>, the
+	//legacy way if <pushAcceleration>; true if the history puts it in braking
+	template <class History> bool updateHistory(History &history, VehicleHandle handle, const EmissionBatch &batch,
+		std::size_t i, bool pushAcceleration);
+
+	//updates the acceleration histories and bins the vehicles of <batch> into
+	//batchOpmodes and batchSourceTypes
+	void binBatch(const EmissionBatch &batch);
+
+	const SourceTypeRegistry &sourceTypes;
+	std::shared_ptr<const RateGrids> grids;
+	std::shared_ptr<const CompactSourceTypes> compactTypes;
+	VehicleStateTable         vehicleStates;
+	double                    timeStepValue;
+	double                    currentSimulationTime;
+	bool                      resampling;
+
+	//of the time step: steps between two pushes of the legacy history, and the
+	//step as stepTicks / ticksPerSecond [s]
+	int                       pushPeriod;
+	long long                 stepTicks;
+	long long                 ticksPerSecond;
+
+	//last vehicle looked up, consecutive rows of one vehicle skip the hash lookup
+	long                      lastVehicleNumber;
+	VehicleHandle             lastHandle;
+
+	//scratch buffers of the batch kernels, grown to the largest batch seen;
+	//the kernels see only the vehicles the grids do not answer, vehicle
+	//batchVehicles[k] of the batch being their k-th input
+	std::vector<std::size_t>             batchVehicles;
+	std::vector<const VSPCoefficients *> batchCoefficients;
+	std::vector<double>                  batchVelocities;
+	std::vector<double>                  batchAccelerations;
+	std::vector<double>                  batchVSP;
+	std::vector<unsigned char>           batchBraking;
+	std::vector<int>                     batchKernelOpmodes;
+
+	//float32 inputs and VSP of the kernels in compact mode
+	std::vector<const CompactVSPCoefficients *> batchCompactCoefficients;
+	std::vector<float>                   batchCompactVelocities;
+	std::vector<float>                   batchCompactAccelerations;
+	std::vector<float>                   batchCompactVSP;
+
+	//by vehicle of the batch
+	std::vector<int>                     batchOpmodes;
+	std::vector<const SourceTypeModel *> batchSourceTypes;
+	std::vector<const CompactSourceType *> batchCompactTypes;	//compact mode only
+};
+
+#endif /* __EMISSIONENGINE_H */
@@ -0,0 +1,227 @@
+/*========================================================================= */
+/* EmissionLog.cpp                                   Core module of MOVESTAR */
+/*																			*/
+/* Writer thread of the emission log: encoding and compressed output.		*/
+/*========================================================================= */
+
+#include "EmissionLog.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#ifdef MOVESTAR_ZLIB
+#include <zlib.h>
+#endif
+using namespace std;
+
+
+//sleep of the writer thread while the ring is empty [us]
+#define EMISSION_LOG_IDLE_MICROSECONDS 200
+
+//longest CSV line of a record
+#define EMISSION_LOG_LINE_BYTES 512
+
+//appends <count> values of <size> bytes, <stride> bytes apart from <first>, to <to>
+static char *gatherColumn(char *to, const void *first, size_t size, size_t stride, size_t count)
+{
+	const char *from = (const char *)first;
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy(to, from + i * stride, size);
+		to += size;
+	}
+	return to;
+}
+
+
+EmissionLog::EmissionLog()
+	: format(EMISSION_LOG_CSV), overflow(EMISSION_LOG_BLOCK), stopping(false), file(nullptr), compressed(false),
+	buffered(0), failed(false), writtenRecords(0), droppedRecords(0), blockedRecords(0)
+{
+}
+
+EmissionLog::~EmissionLog()
+{
+	string error;
+	close(error);
+}
+
+bool EmissionLog::open(const string &path, EmissionLogFormat format, int compression, size_t capacity,
+	EmissionLogOverflow overflow, string &error)
+{
+	close(error);
+	if (compression < 0 || compression > 9)
+	{
+		error = "invalid compression level " + to_string(compression);
+		return false;
+	}
+	if (compression > 0)
+	{
+#ifdef MOVESTAR_ZLIB
+		char mode[4] = { 'w', 'b', (char)('0' + compression), '\0' };
+		file = gzopen(path.c_str(), mode);
+#else
+		error = "compressed logs need a build with zlib";
+		return false;
+#endif
+	}
+	else
+	{
+		file = fopen(path.c_str(), "wb");
+	}
+	if (file == nullptr)
+	{
+		error = "cannot create " + path;
+		return false;
+	}
+
+	this->path = path;
+	this->format = format;
+	this->overflow = overflow;
+	compressed = (compression > 0);
+	buffer.resize(EMISSION_LOG_WRITE_BYTES + EMISSION_LOG_BLOCK_RECORDS * sizeof(EmissionLogRecord) + EMISSION_LOG_LINE_BYTES);
+	buffered = 0;
+	failed = false;
+	writtenRecords = 0;
+	droppedRecords = 0;
+	blockedRecords = 0;
+	if (format == EMISSION_LOG_CSV)
+	{
+		buffered = (size_t)snprintf(buffer.data(), buffer.size(),
+			"Time(s),Vehicle,Type,VSP,OpMode,HC(g/s),CO(g/s),NOx(g/s),CO2(g/s),Energy(KJ/s),PM2.5(g/s)\n");
+	}
+	else
+	{
+		EmissionLogHeader header;
+		memcpy(header.magic, EMISSION_LOG_MAGIC, sizeof(header.magic));
+		header.version = EMISSION_LOG_VERSION;
+		header.recordSize = (uint32_t)sizeof(EmissionLogRecord);
+		memcpy(buffer.data(), &header, sizeof(header));
+		buffered = sizeof(header);
+	}
+
+	ring.reset(new SpscRing<EmissionLogRecord>(capacity > 0 ? capacity : DEFAULT_EMISSION_LOG_CAPACITY));
+	stopping = false;
+	writer = thread(&EmissionLog::writerLoop, this);
+	return true;
+}
+
+bool EmissionLog::compressionAvailable()
+{
+#ifdef MOVESTAR_ZLIB
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool EmissionLog::close(string &error)
+{
+	if (!ring)
+	{
+		return true;
+	}
+	stopping.store(true, memory_order_release);
+	writer.join();
+	ring.reset();
+
+	if (buffered > 0 && !writeOut(buffer.data(), buffered))
+	{
+		failed = true;
+	}
+	buffered = 0;
+#ifdef MOVESTAR_ZLIB
+	if (compressed)
+	{
+		failed = (gzclose((gzFile)file) != Z_OK) || failed;
+	}
+	else
+#endif
+	{
+		failed = (fclose((FILE *)file) != 0) || failed;
+	}
+	file = nullptr;
+	vector<char>().swap(buffer);
+	if (failed)
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+void EmissionLog::writerLoop()
+{
+	vector<EmissionLogRecord> records(EMISSION_LOG_BLOCK_RECORDS);
+	for (;;)
+	{
+		//read before draining, so the last drain sees every record logged before close
+		bool stop = stopping.load(memory_order_acquire);
+		size_t count = ring->pop(records.data(), records.size());
+		if (count > 0)
+		{
+			encode(records.data(), count);
+			writtenRecords.fetch_add(count, memory_order_relaxed);
+			continue;
+		}
+		if (stop)
+		{
+			return;
+		}
+		this_thread::sleep_for(chrono::microseconds(EMISSION_LOG_IDLE_MICROSECONDS));
+	}
+}
+
+void EmissionLog::encode(const EmissionLogRecord *records, size_t count)
+{
+	if (format == EMISSION_LOG_CSV)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const EmissionLogRecord &record = records[i];
+			const double *values = record.emissions;
+			buffered += (size_t)snprintf(buffer.data() + buffered, EMISSION_LOG_LINE_BYTES,
+				"%.9g,%lld,%d,%.9g,%d,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", record.time, (long long)record.vehicleNumber,
+				(int)record.vehicleType, record.vsp, (int)record.opmode,
+				values[0], values[1], values[2], values[3], values[4], values[5]);
+			if (buffered >= EMISSION_LOG_WRITE_BYTES)
+			{
+				failed = !writeOut(buffer.data(), buffered) || failed;
+				buffered = 0;
+			}
+		}
+		return;
+	}
+
+	//one block of columns per drain
+	char *to = buffer.data() + buffered;
+	uint64_t blockCount = count;
+	memcpy(to, &blockCount, sizeof(blockCount));
+	to += sizeof(blockCount);
+	size_t stride = sizeof(EmissionLogRecord);
+	to = gatherColumn(to, &records[0].time, sizeof(double), stride, count);
+	to = gatherColumn(to, &records[0].vehicleNumber, sizeof(int64_t), stride, count);
+	to = gatherColumn(to, &records[0].vehicleType, sizeof(int32_t), stride, count);
+	to = gatherColumn(to, &records[0].opmode, sizeof(int32_t), stride, count);
+	to = gatherColumn(to, &records[0].vsp, sizeof(double), stride, count);
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		to = gatherColumn(to, &records[0].emissions[k], sizeof(double), stride, count);
+	}
+	buffered = (size_t)(to - buffer.data());
+	if (buffered >= EMISSION_LOG_WRITE_BYTES)
+	{
+		failed = !writeOut(buffer.data(), buffered) || failed;
+		buffered = 0;
+	}
+}
+
+bool EmissionLog::writeOut(const char *data, size_t size)
+{
+#ifdef MOVESTAR_ZLIB
+	if (compressed)
+	{
+		return gzwrite((gzFile)file, data, (unsigned)size) == (int)size;
+	}
+#endif
+	return fwrite(data, 1, size, (FILE *)file) == size;
+}
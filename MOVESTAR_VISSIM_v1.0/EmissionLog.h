@@ -0,0 +1,143 @@
+/*========================================================================= */
+/* EmissionLog.h                                     Core module of MOVESTAR */
+/*																			*/
+/* Per vehicle-step emission log written off the simulation thread. The	*/
+/* simulation thread copies compact binary records into an SpscRing; a		*/
+/* writer thread drains it, encodes the records as CSV or as blocks of		*/
+/* columns, and writes them in large sequential (optionally zlib			*/
+/* compressed) writes. When the ring is full the simulation thread either	*/
+/* waits for the writer or drops the record, and counts either.			*/
+/*========================================================================= */
+
+#ifndef __EMISSIONLOG_H
+#define __EMISSIONLOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MovestarRates.h"
+#include "SpscRing.h"
+
+#define EMISSION_LOG_MAGIC   "MVSTRLOG"
+#define EMISSION_LOG_VERSION 1
+
+//default records of the ring
+#define DEFAULT_EMISSION_LOG_CAPACITY 65536
+
+//records per block of the binary format, and drained from the ring at a time
+#define EMISSION_LOG_BLOCK_RECORDS 4096
+
+//bytes encoded before they are written
+#define EMISSION_LOG_WRITE_BYTES (1u << 20)
+
+enum EmissionLogFormat
+{
+	EMISSION_LOG_CSV,
+	EMISSION_LOG_BINARY
+};
+
+//what the simulation thread does when the ring is full
+enum EmissionLogOverflow
+{
+	EMISSION_LOG_BLOCK,
+	EMISSION_LOG_DROP
+};
+
+//one vehicle in one time step
+struct EmissionLogRecord
+{
+	double  time;							//[s]
+	int64_t vehicleNumber;
+	int32_t vehicleType;
+	int32_t opmode;							//INVALID_OPMODE if not calculated
+	double  vsp;
+	double  emissions[EMISSION_RATE_COUNT];	//[g/s] in the order of EmissionTotals
+};
+
+//binary format (native byte order, little endian on all supported targets):
+//this header, then blocks of a uint64 record count followed by the columns time
+//(double), vehicle (int64), type and opmode (int32), VSP and the emissions
+//(double), each <count> values long
+struct EmissionLogHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t recordSize;		//sizeof(EmissionLogRecord) of the writer, informative
+};
+
+class EmissionLog
+{
+public:
+	EmissionLog();
+	~EmissionLog();
+
+	//starts logging to <path> with a ring of <capacity> records; <compression> is
+	//a zlib level 1..9 (gzip file) or 0 for none. False with a message in <error>
+	//if the file cannot be created or compression is not available in this build
+	bool open(const std::string &path, EmissionLogFormat format, int compression, std::size_t capacity,
+		EmissionLogOverflow overflow, std::string &error);
+	bool isOpen() const { return ring != nullptr; }
+
+	//true if this build writes compressed logs (built with zlib)
+	static bool compressionAvailable();
+
+	//simulation thread: logs <record>
+	void add(const EmissionLogRecord &record)
+	{
+		if (ring->push(record))
+		{
+			return;
+		}
+		if (overflow == EMISSION_LOG_DROP)
+		{
+			droppedRecords.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		blockedRecords.fetch_add(1, std::memory_order_relaxed);
+		while (!ring->push(record))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	//waits for the writer to write every record logged and closes the file;
+	//false with a message in <error> if a write failed
+	bool close(std::string &error);
+
+	//records written, dropped on a full ring, and logged after waiting for space
+	uint64_t written() const { return writtenRecords.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return droppedRecords.load(std::memory_order_relaxed); }
+	uint64_t blocked() const { return blockedRecords.load(std::memory_order_relaxed); }
+
+private:
+	EmissionLog(const EmissionLog &);
+	EmissionLog &operator=(const EmissionLog &);
+
+	void writerLoop();
+	void encode(const EmissionLogRecord *records, std::size_t count);
+	bool writeOut(const char *data, std::size_t size);
+
+	std::unique_ptr<SpscRing<EmissionLogRecord> > ring;
+	EmissionLogFormat                             format;
+	EmissionLogOverflow                           overflow;
+	std::string                                   path;
+	std::thread                                   writer;
+	std::atomic<bool>                             stopping;
+
+	//writer thread only, until it is joined
+	void                                         *file;			//FILE * or gzFile
+	bool                                          compressed;
+	std::vector<char>                             buffer;
+	std::size_t                                   buffered;
+	bool                                          failed;
+
+	std::atomic<uint64_t>                         writtenRecords;
+	std::atomic<uint64_t>                         droppedRecords;
+	std::atomic<uint64_t>                         blockedRecords;
+};
+
+#endif /* __EMISSIONLOG_H */
@@ -12,308 +12,534 @@
 /// PTV VISSIM should be referred to VISSIM manual.
 
 #include "EmissionModel.h"
+#include "Checkpoint.h"
+#include "EmissionAccumulator.h"
+#include "EmissionEngine.h"
+#include "EmissionLog.h"
+#include "EmissionRaster.h"
+#include "Instrumentation.h"
+#include "SourceTypeRegistry.h"
 #include <string>
-#include <vector>
 #include <iostream>
-#include <fstream>
-#include <map>
-#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
 using namespace std;
 
 
-//calculate VSP function
-double calculateVSP(long type, double velocity, double acceleration)
+//vehicles of CALCULATE_VEHICLE not calculated yet (lazy evaluation), in call order
+struct PendingVehicles
 {
-	vector<double> vehicleAttributes;
+	vector<long>   vehicleIds;
+	vector<long>   vehicleTypes;
+	vector<long>   links;
+	vector<double> velocities;
+	vector<double> accelerations;
+	vector<double> slopes;
+	vector<double> xs;
+	vector<double> ys;
 
-	if (type == 100) // Vehicle type is light-duty passenger car (source type 21)
-	{
-		vehicleAttributes = { 0.156461,  0.002002, 0.000493, 1.4788, 1.4788 };
-	}
+	//results of the batch, by vehicle
+	vector<double> hc, co, nox, co2, energy, pm25, vsp;
+	vector<int>    opmodes;
+
+	size_t size() const { return vehicleIds.size(); }
 
-	else if (type == 200) // Vehicle type is transit bus (source type 42)
+	void add(long vehicleNumber, long vehicleType, long link, double velocity, double acceleration, double slope, double x, double y)
 	{
-		vehicleAttributes = { 1.0944, 0, 0.003587, 16.556, 17.1 };
+		vehicleIds.push_back(vehicleNumber);
+		vehicleTypes.push_back(vehicleType);
+		links.push_back(link);
+		velocities.push_back(velocity);
+		accelerations.push_back(acceleration);
+		slopes.push_back(slope);
+		xs.push_back(x);
+		ys.push_back(y);
 	}
 
-	else if (type == 300) // Vehicle type is combination short-haul truck (source type 61)
+	//keeps the capacity, the next time step queues about as many vehicles
+	void clear()
 	{
-		vehicleAttributes = { 1.96354, 0, 0.004031, 29.3275, 17.1 };
+		vehicleIds.clear();
+		vehicleTypes.clear();
+		links.clear();
+		velocities.clear();
+		accelerations.clear();
+		slopes.clear();
+		xs.clear();
+		ys.clear();
 	}
+};
 
-	double A = vehicleAttributes.at(0);  //Rolling (kW-s/m)
-	double B = vehicleAttributes.at(1);  //Rotating (Kw-s**2/m**2)
-	double C = vehicleAttributes.at(2);  //Drag (kW-s**3/m**3)
-	double M = vehicleAttributes.at(3);  //Source Mass (metric tons)
-	double F = vehicleAttributes.at(4);  //Fixed Mass Factor (metric tons)
+//everything of one simulation run; the legacy API works on a default context
+struct MovestarContext
+{
+	//variables for vehicle data
+	long   vehicleNumber;
+	long   vehicleType;
+	double vehicleAcceleration;
+	double vehicleVelocity;
+	double vehicleWeight;
+	double vehicleVSP;
+	int    vehicleOpmode;
+	long   vehicleLink;
+	double vehicleSlope;
+	double vehicleX;
+	double vehicleY;
+	bool   vehiclePositioned;	//a position was set, vehicles are rastered
 
-	double VSP = ((A * velocity) + (B * pow(velocity, 2)) + (C * pow(velocity, 3)) +
-		M * (acceleration)* velocity) / F;
-	return VSP;
-}
+	//variables for emission data
+	double HC;
+	double CO;
+	double NOx;
+	double CO2;
+	double Energy;
+	double PMtwoPointFive;
 
-//determines and returns the opmode
-int getOpmode(vector<double> accelerations, double velocity, double VSP)
-{
-	int OpMode = -99999;
+	//variables for time data
+	double timeStepValue;
+	double currentSimulationTime;
 
-	if (accelerations.size() > 0)
-	{
-		if (accelerations.at(accelerations.size() - 1) <= -2.0)
-		{
-			OpMode = 0;
-			return OpMode;
-		}
-	}
+	//source types known to the model, shared read-only with other contexts, and where to load them from
+	shared_ptr<const SourceTypeRegistry> sourceTypes;
+	string sourceTypeDirectory;
+
+	//calculation core shared with the command-line tool
+	unique_ptr<EmissionEngine> engine;
+
+	//cell size of the rate grids, no grids if the speed step is 0
+	double rateGridSpeedStep;
+	double rateGridAccelerationStep;
+
+	//braking histories of 1 Hz mean accelerations, applied at INIT
+	bool historyResampling;
+
+	//float32 calculation and int16 histories, applied at INIT
+	bool compact;
+
+	//message of the last failed command, for EMISSION_DATA_LAST_ERROR
+	string lastError;
+
+	//lazy evaluation: CALCULATE_VEHICLE only queues the vehicle, the queue is
+	//calculated as one batch once a result is asked for or the time step ends;
+	//currentPending while the last vehicle of CALCULATE_VEHICLE is queued. The
+	//batches calculated and the largest one, for EMISSION_DATA_LAZY_BATCHES
+	bool            lazyEvaluation;
+	PendingVehicles pending;
+	bool            currentPending;
+	size_t          lazyBatches;
+	size_t          largestLazyBatch;
+
+	//totals of the run and their configuration
+	EmissionAccumulator accumulator;
+	double aggregationInterval;
+	string summaryPrefix;
+
+	//log of every vehicle-step, written by a thread of its own, and its configuration
+	EmissionLog         log;
+	string              logFile;
+	EmissionLogFormat   logFormat;
+	int                 logCompression;
+	size_t              logCapacity;
+	EmissionLogOverflow logOverflow;
 
-	if (accelerations.size() == 3)
+	//checkpoints of the run for a warm restart, written every checkpointInterval
+	//seconds of simulation time (0: on EMISSION_COMMAND_CHECKPOINT only) by a
+	//thread of its own; nextCheckpoint is -1 until the first time of the run
+	string           checkpointFile;
+	double           checkpointInterval;
+	double           nextCheckpoint;
+	string           restoreFile;
+	CheckpointWriter checkpoint;
+	CheckpointFile   checkpoints;
+
+	//emissions per cell and time bin, written as each bin ends, and its configuration
+	EmissionRaster raster;
+	string         rasterFile;
+	double         rasterCellSize;
+	double         rasterInterval;
+
+	//VSP and opmodes of EmissionModelCalculateBatch, for the log
+	vector<double> batchVSP;
+	vector<int>    batchOpmodes;
+
+#ifdef MOVESTAR_INSTRUMENTATION
+	//counters of the calls on this context, and where to write their snapshots
+	Instrumentation instrumentation;
+	string instrumentationFile;
+	double instrumentationInterval;
+	string instrumentationSnapshot;
+#endif
+
+	//variables for testing
+	double oldestAcceleration;
+	double middleAcceleration;
+	double newestAcceleration;
+
+	MovestarContext()
+		: vehicleNumber(0), vehicleType(0), vehicleAcceleration(0.0), vehicleVelocity(0.0), vehicleWeight(0.0),
+		vehicleVSP(0.0), vehicleOpmode(0), vehicleLink(0), vehicleSlope(0.0), vehicleX(0.0), vehicleY(0.0), vehiclePositioned(false), HC(0.0), CO(0.0), NOx(0.0), CO2(0.0), Energy(0.0), PMtwoPointFive(0.0),
+		timeStepValue(0.0), currentSimulationTime(0.0), rateGridSpeedStep(0.0),
+		rateGridAccelerationStep(DEFAULT_RATE_GRID_ACCELERATION_STEP), historyResampling(false), compact(false), lazyEvaluation(false), currentPending(false), lazyBatches(0), largestLazyBatch(0), aggregationInterval(DEFAULT_AGGREGATION_INTERVAL),
+		logFormat(EMISSION_LOG_CSV), logCompression(0), logCapacity(DEFAULT_EMISSION_LOG_CAPACITY), logOverflow(EMISSION_LOG_BLOCK),
+		checkpointInterval(0.0), nextCheckpoint(-1.0), rasterCellSize(DEFAULT_RASTER_CELL_SIZE), rasterInterval(DEFAULT_RASTER_INTERVAL),
+#ifdef MOVESTAR_INSTRUMENTATION
+		instrumentationInterval(DEFAULT_SNAPSHOT_INTERVAL),
+#endif
+		oldestAcceleration(-999999), middleAcceleration(-999999), newestAcceleration(-999999)
 	{
-		if (accelerations.at(2) < -1.0 && accelerations.at(1) < -1.0 && accelerations.at(0) < -1.0)
-		{
-			OpMode = 0;
-			return OpMode;
-		}
+		string error;
+		sourceTypes = SourceTypeRegistry::shared("", error);
+		engine.reset(new EmissionEngine(*sourceTypes));
+		accumulator.reset(aggregationInterval);
 	}
 
-	if (-1.0 <= velocity && velocity < 1.0)
+	~MovestarContext()
 	{
-		OpMode = 1;
+		flushPending();
+		finishSummary();
+		closeLog();
+		closeRaster();
+#ifdef MOVESTAR_INSTRUMENTATION
+		instrumentation.closeSnapshots(currentSimulationTime, engine->vehicles());
+#endif
 	}
-	else if (velocity >= 50)
-	{
-		if (VSP >= 30)
-		{
-			OpMode = 40;
-		}
 
-		else if (VSP >= 24)
-		{
-			OpMode = 39;
-		}
+	//calculates the queued vehicles (lazy evaluation)
+	void flushPending();
 
-		else if (VSP >= 18)
-		{
-			OpMode = 38;
-		}
+	//hands the state of the run before the step at the current time to the
+	//checkpoint thread
+	bool writeCheckpoint();
 
-		else if (VSP >= 12)
+	//applies the configuration at the start of <snapshot>; the vehicles and
+	//totals that follow are restored once INIT set up the run
+	bool restoreConfiguration(CheckpointReader &snapshot);
+
+	//waits until the checkpoints handed over are written
+	bool finishCheckpoints()
+	{
+		if (!checkpoints.flush(lastError))
 		{
-			OpMode = 37;
+			lastError = "MOVESTAR: " + lastError;
+			cerr << lastError << endl;
+			return false;
 		}
+		return true;
+	}
 
-		else if (VSP >= 6)
+	//closes the log of the run once the writer wrote every record
+	bool closeLog()
+	{
+		if (!log.isOpen())
 		{
-			OpMode = 35;
+			return true;
 		}
-
-		else
+		if (!log.close(lastError))
 		{
-			OpMode = 33;
+			lastError = "MOVESTAR: " + lastError;
+			cerr << lastError << endl;
+			return false;
 		}
+		return true;
 	}
 
-	else if (velocity >= 25)
+	//writes the time bins of the raster ended by the current time
+	bool advanceRaster()
 	{
-		if (VSP >= 30)
+		if (raster.isOpen() && !raster.advance(currentSimulationTime, lastError))
 		{
-			OpMode = 30;
+			lastError = "MOVESTAR: " + lastError;
+			cerr << lastError << endl;
+			return false;
 		}
+		return true;
+	}
 
-		else if (VSP >= 24)
+	//writes the time bins left and closes the raster of the run
+	bool closeRaster()
+	{
+		if (raster.isOpen() && !raster.close(lastError))
 		{
-			OpMode = 29;
+			lastError = "MOVESTAR: " + lastError;
+			cerr << lastError << endl;
+			return false;
 		}
+		return true;
+	}
 
-		else if (VSP >= 18)
+	//writes the summary of the run if one was started
+	bool finishSummary()
+	{
+		if (!accumulator.summaryOpen())
 		{
-			OpMode = 28;
+			return true;
 		}
-
-		else if (VSP >= 12)
+		if (!accumulator.writeSummary(*sourceTypes, lastError))
 		{
-			OpMode = 27;
+			lastError = "MOVESTAR: " + lastError;
+			cerr << lastError << endl;
+			return false;
 		}
+		return true;
+	}
+};
 
-		else if (VSP >= 9)
-		{
-			OpMode = 25;
-		}
+//context of the functions without a context argument (one VISSIM run per process)
+static MovestarContext defaultContext;
 
-		else if (VSP >= 6)
-		{
-			OpMode = 24;
-		}
+//calculates the vehicles of <batch> for the current time step and adds them
+//to the totals of the run; <links> of the vehicles as for EmissionAccumulator::add,
+//null to keep the link of every vehicle; positions <xs>, <ys> for the raster,
+//null for none
+static size_t calculateVehicles(MovestarContext &context, const EmissionBatch &batch, const long *links,
+	const double *xs = nullptr, const double *ys = nullptr)
+{
+	context.engine->setTimeStep(context.timeStepValue);
+	context.engine->setTime(context.currentSimulationTime);
+	size_t calculated = context.engine->calculate(batch);
+#ifdef MOVESTAR_INSTRUMENTATION
+	context.instrumentation.countOpmodes(batch.count, context.engine->lastSourceTypes(), context.engine->lastOpmodes());
+#endif
 
-		else if (VSP >= 3)
-		{
-			OpMode = 23;
-		}
+	for (size_t i = 0; i < batch.count; i++)
+	{
+		double rates[EMISSION_RATE_COUNT] = { batch.hc[i], batch.co[i], batch.nox[i], batch.co2[i], batch.energy[i], batch.pm25[i] };
+		context.accumulator.add(batch.vehicleIds[i], batch.vehicleTypes[i], links != nullptr ? links[i] : -1, context.currentSimulationTime,
+			context.timeStepValue, batch.velocities[i], rates);
+	}
 
-		else if (VSP >= 0)
+	//the raster takes what a step emits where the vehicle is
+	if (context.raster.isOpen() && xs != nullptr)
+	{
+		const SourceTypeModel *const *sourceTypes = context.engine->lastSourceTypes();
+		EmissionRasterTile &tile = context.raster.tile(0);
+		for (size_t i = 0; i < batch.count; i++)
 		{
-			OpMode = 22;
+			if (sourceTypes[i] == nullptr)
+			{
+				continue;
+			}
+			double emissions[EMISSION_RATE_COUNT] = { batch.hc[i] * context.timeStepValue, batch.co[i] * context.timeStepValue,
+				batch.nox[i] * context.timeStepValue, batch.co2[i] * context.timeStepValue,
+				batch.energy[i] * context.timeStepValue, batch.pm25[i] * context.timeStepValue };
+			tile.add(context.currentSimulationTime, xs[i], ys[i], emissions);
 		}
+	}
 
-		else
+	//the log takes a copy, the writer thread does the rest
+	if (context.log.isOpen())
+	{
+		const SourceTypeModel *const *sourceTypes = context.engine->lastSourceTypes();
+		for (size_t i = 0; i < batch.count; i++)
 		{
-			OpMode = 21;
+			bool known = (sourceTypes[i] != nullptr);
+			EmissionLogRecord record = { context.currentSimulationTime, batch.vehicleIds[i], (int32_t)batch.vehicleTypes[i],
+				known ? batch.opmodes[i] : INVALID_OPMODE, known ? batch.vsp[i] : 0.0,
+				{ batch.hc[i], batch.co[i], batch.nox[i], batch.co2[i], batch.energy[i], batch.pm25[i] } };
+			context.log.add(record);
 		}
 	}
+	return calculated;
+}
 
-	else if (velocity >= 0)
+//copies the acceleration history of the current vehicle to the testing variables
+static void readHistory(MovestarContext &context, long vehicleNumber)
+{
+	AccelerationHistory history;
+	if (!context.engine->history(vehicleNumber, history))
 	{
-		if (VSP >= 12)
-		{
-			OpMode = 16;
-		}
+		return;
+	}
+	if (history.size() >= 1)
+	{
+		context.oldestAcceleration = history.at(0);
+	}
+	if (history.size() >= 2)
+	{
+		context.middleAcceleration = history.at(1);
+	}
+	if (history.size() >= 3)
+	{
+		context.newestAcceleration = history.at(2);
+	}
+}
 
-		else if (VSP >= 9)
-		{
-			OpMode = 15;
-		}
+void MovestarContext::flushPending()
+{
+	size_t count = pending.size();
+	if (count == 0)
+	{
+		return;
+	}
+	if (pending.hc.size() < count)
+	{
+		pending.hc.resize(count);
+		pending.co.resize(count);
+		pending.nox.resize(count);
+		pending.co2.resize(count);
+		pending.energy.resize(count);
+		pending.pm25.resize(count);
+		pending.vsp.resize(count);
+		pending.opmodes.resize(count);
+	}
 
-		else if (VSP >= 6)
-		{
-			OpMode = 14;
-		}
+	//one batch in call order, so histories and totals see the same sequence as
+	//without lazy evaluation
+	EmissionBatch batch = { count, pending.vehicleIds.data(), pending.vehicleTypes.data(), pending.velocities.data(),
+		pending.accelerations.data(), pending.slopes.data(), nullptr,
+		pending.hc.data(), pending.co.data(), pending.nox.data(), pending.co2.data(), pending.energy.data(), pending.pm25.data(),
+		pending.vsp.data(), pending.opmodes.data() };
+	calculateVehicles(*this, batch, pending.links.data(), vehiclePositioned ? pending.xs.data() : nullptr,
+		vehiclePositioned ? pending.ys.data() : nullptr);
+	lazyBatches++;
+	if (count > largestLazyBatch)
+	{
+		largestLazyBatch = count;
+	}
 
-		else if (VSP >= 3)
+	//the current vehicle is the last one queued
+	if (currentPending)
+	{
+		size_t last = count - 1;
+		HC = pending.hc[last];
+		CO = pending.co[last];
+		NOx = pending.nox[last];
+		CO2 = pending.co2[last];
+		Energy = pending.energy[last];
+		PMtwoPointFive = pending.pm25[last];
+		//vehicles without a source type leave VSP and opmode as they were
+		if (engine->registry().find(pending.vehicleTypes[last]) != nullptr)
 		{
-			OpMode = 13;
+			vehicleVSP = pending.vsp[last];
+			vehicleOpmode = pending.opmodes[last];
 		}
+		readHistory(*this, pending.vehicleIds[last]);
+		currentPending = false;
+	}
+	pending.clear();
+}
 
-		else if (VSP >= 0)
-		{
-			OpMode = 12;
-		}
+bool MovestarContext::writeCheckpoint()
+{
+	nextCheckpoint = currentSimulationTime + checkpointInterval;
+	if (checkpointFile.empty())
+	{
+		lastError = "MOVESTAR: no checkpoint file set";
+		cerr << lastError << endl;
+		return false;
+	}
 
-		else
-		{
-			OpMode = 11;
-		}
+	//configuration as restoreConfiguration reads it, then the vehicles and totals
+	checkpoint.clear();
+	checkpoint.putString(sourceTypeDirectory);
+	checkpoint.put(currentSimulationTime);
+	checkpoint.put(timeStepValue);
+	checkpoint.put(aggregationInterval);
+	checkpoint.put(rateGridSpeedStep);
+	checkpoint.put(rateGridAccelerationStep);
+	checkpoint.put((uint8_t)historyResampling);
+	checkpoint.put((uint8_t)compact);
+	engine->saveState(checkpoint);
+	accumulator.saveState(checkpoint);
+
+	if (!checkpoints.write(checkpointFile, checkpoint.data(), lastError))
+	{
+		lastError = "MOVESTAR: " + lastError;
+		cerr << lastError << endl;
+		return false;
 	}
-	return OpMode;
-};
+	return true;
+}
 
-//dictionary for source type 100
-map<int, vector<double> > sourceType100Dictionary
+bool MovestarContext::restoreConfiguration(CheckpointReader &snapshot)
 {
-	{ 0 ,{ 5.65127,57.1901,3.12064,3689.52,51336.2,0.162388 } },
-	{ 1 ,{ 4.16103,65.203,3.72146,3303.21,45961.5,0.14099 } },
-	{ 11,{ 4.49873,72.2148,5.05498,5065.18,70477.3,0.140804 } },
-	{ 12,{ 5.49957,114.721,10.434,6792.71,94514.1,0.181153 } },
-	{ 13,{ 6.9986,166.291,21.2052,9898.89,137734,0.304719 } },
-	{ 14,{ 8.61404,236.629,36.8724,12754,177459,0.368023 } },
-	{ 15,{ 10.289,290.701,54.5185,15525.4,216021,0.511385 } },
-	{ 16,{ 12.292,353.082,77.7222,19353,269278,1.37684 } },
-	{ 21,{ 6.39121,121.101,12.4625,6552.97,91178.8,0.269425 } },
-	{ 22,{ 6.06055,134.493,14.3454,7795.24,108464,0.277939 } },
-	{ 23,{ 7.08482,175.239,22.3094,9860,137193,0.328926 } },
-	{ 24,{ 9.14126,250.723,38.98,12792.3,177992,0.403531 } },
-	{ 25,{ 10.3794,301.015,55.9756,16526.8,229954,0.43782 } },
-	{ 27,{ 14.5963,505.205,89.8475,21600.8,300555,0.833802 } },
-	{ 28,{ 20.9733,860.458,123.158,29132.2,405348,3.81746 } },
-	{ 29,{ 30.9063,1510.07,155.893,39794.4,553702,12.1245 } },
-	{ 30,{ 55.4631,3383.72,217.391,49616,690361,29.7988 } },
-	{ 33,{ 6.40282,112.342,17.4164,9969.44,138715,0.928642 } },
-	{ 35,{ 8.5886,214.588,52.3698,15832.7,220297,0.922485 } },
-	{ 37,{ 10.2377,287.955,75.6242,20520.9,285528,1.01152 } },
-	{ 38,{ 14.6403,560.062,104.028,26654.3,370869,1.75908 } },
-	{ 39,{ 24.3958,906.369,143.246,35381.3,492297,4.48958 } },
-	{ 40,{ 39.5436,2442.32,198.037,44859.7,624180,5.2443 } }
-};
+	string directory;
+	double time, timeStep, interval, speedStep, accelerationStep;
+	uint8_t resampled, compacted;
+	if (!snapshot.getString(directory) || !snapshot.get(time) || !snapshot.get(timeStep) || !snapshot.get(interval) ||
+		!snapshot.get(speedStep) || !snapshot.get(accelerationStep) || !snapshot.get(resampled) || !snapshot.get(compacted))
+	{
+		lastError = "MOVESTAR: the configuration of checkpoint " + restoreFile + " is damaged";
+		cerr << lastError << endl;
+		return false;
+	}
+	sourceTypeDirectory = directory;
+	currentSimulationTime = time;
+	timeStepValue = timeStep;
+	aggregationInterval = interval;
+	rateGridSpeedStep = speedStep;
+	rateGridAccelerationStep = accelerationStep;
+	historyResampling = (resampled != 0);
+	compact = (compacted != 0);
+	return true;
+}
 
-//dictionary for source type 200
-map<int, vector<double> > sourceType200Dictionary
+//index of the pollutant selected by its data type in EmissionTotals, or -1
+static int pollutantIndex(long type)
 {
-	{ 0 ,{ 19.236,92.4235,121.303,15326.9,210592,4.41943 } },
-	{ 1 ,{ 17.9677,49.2354,281.303,7709.02,106380,4.78183 } },
-	{ 11,{ 25.2863,155.676,169.805,10345.9,142771,10.4614 } },
-	{ 12,{ 28.9061,201.415,560.734,29799.4,410370,14.5674 } },
-	{ 13,{ 42.3189,580.049,828.318,56032.8,775733,38.1777 } },
-	{ 14,{ 52.2232,865.575,1097.32,82582.2,1.14554e+006,54.6949 } },
-	{ 15,{ 58.8956,1176.28,1281.25,105324,1.46341e+006,77.8943 } },
-	{ 16,{ 66.5306,1636.93,1424.7,145359,2.02099e+006,78.1251 } },
-	{ 21,{ 28.4361,171.305,162.769,8642.64,120102,15.7278 } },
-	{ 22,{ 32.9324,246.345,706.252,38161.6,525130,31.8557 } },
-	{ 23,{ 38.1365,576.677,1069.67,64843.7,896698,38.5261 } },
-	{ 24,{ 44.0335,820.389,1428.83,92746.5,1.2795e+006,62.3961 } },
-	{ 25,{ 48.7164,1090.84,1600.59,119827,1.65468e+006,87.9118 } },
-	{ 27,{ 57.3304,1551.6,2456.08,165851,2.29116e+006,124.826 } },
-	{ 28,{ 67.1679,2050.35,3438.51,232192,3.20761e+006,200.882 } },
-	{ 29,{ 86.3587,2636.15,4420.93,298532,4.12407e+006,326.447 } },
-	{ 30,{ 105.55,3221.97,5403.37,364872,5.04053e+006,418.537 } },
-	{ 33,{ 49.7724,330.765,590.11,35112.3,486466,27.7863 } },
-	{ 35,{ 53.9466,802.819,1504.05,104780,1.44459e+006,46.0302 } },
-	{ 37,{ 66.2907,1381.65,2662.09,164540,2.26999e+006,71.9717 } },
-	{ 38,{ 99.7145,1615.82,3726.92,230356,3.17799e+006,113.335 } },
-	{ 39,{ 128.205,2077.49,4791.76,296171,4.08598e+006,179.999 } },
-	{ 40,{ 156.694,2539.16,5856.59,361986,4.99397e+006,227.656 } }
-};
+	switch (type)
+	{
+	case EMISSION_DATA_HC:
+		return 0;
+	case EMISSION_DATA_CO:
+		return 1;
+	case EMISSION_DATA_NOX:
+		return 2;
+	case EMISSION_DATA_CO2:
+		return 3;
+	case EMISSION_DATA_FUEL:
+		return 4;
+	case EMISSION_DATA_PART:
+		return 5;
+	default:
+		return -1;
+	}
+}
 
-//dictionary for source type 300
-map<int, vector<double> > sourceType300Dictionary
+//true for the data types of GetValue that are results of the current vehicle
+//or totals, which the queued vehicles (lazy evaluation) change
+static bool resultType(long type)
 {
-	{ 0 ,{ 17.9342,61.6024,153.021,15867.4,216403,4.76104 } },
-	{ 1 ,{ 14.6674,33.4247,143.922,7845.78,107011,5.14933 } },
-	{ 11,{ 22.6629,104.206,135.196,10528.4,143599,11.4434 } },
-	{ 12,{ 23.8828,115.977,469.469,30577.7,417042,15.607 } },
-	{ 13,{ 35.6299,271.354,751.115,56285.8,767742,39.953 } },
-	{ 14,{ 41.5951,368.76,982.122,82291.5,1.12251e+006,55.7104 } },
-	{ 15,{ 45.9337,486.889,1182,104238,1.42192e+006,80.7488 } },
-	{ 16,{ 46.9285,651.346,1681.07,143472,1.95714e+006,80.9949 } },
-	{ 21,{ 25.4088,114.716,100.502,8548.55,116612,15.4937 } },
-	{ 22,{ 29.2006,157.582,595.675,39275.8,535663,30.5977 } },
-	{ 23,{ 32.3917,238.981,959.51,65435.8,892532,38.5478 } },
-	{ 24,{ 34.7385,408.602,1394.02,94496.8,1.28886e+006,61.320 } },
-	{ 25,{ 37.4941,526.539,1692.91,121617,1.65879e+006,84.896 } },
-	{ 27,{ 42.1349,730.506,2372.96,168058,2.29223e+006,117.161 } },
-	{ 28,{ 43.3231,920.788,3197.98,235281,3.20912e+006,182.518 } },
-	{ 29,{ 55.701,1183.87,4030.82,302504,4.126e+006,288.461 } },
-	{ 30,{ 68.079,1446.95,4926.56,369726,5.04289e+006,365.166 } },
-	{ 33,{ 39.8045,196.179,350.483,35163.7,479643,28.3334 } },
-	{ 35,{ 41.7728,345.923,1795.03,107031,1.4598e+006,45.9186 } },
-	{ 37,{ 48.1088,584.837,2543.71,167626,2.28629e+006,68.996 } },
-	{ 38,{ 65.0605,601.128,3422.06,234676,3.2008e+006,105.038 } },
-	{ 39,{ 83.6495,772.881,4327.96,301726,4.1153e+006,162.169 } },
-	{ 40,{ 102.238,944.633,5289.73,368777,5.02981e+006,202.638 } }
-};
+	return (type >= EMISSION_DATA_BENZ && type <= EMISSION_DATA_EVAP) ||
+		(type >= EMISSION_DATA_VEHICLE_TOTAL && type <= EMISSION_DATA_NETWORK_TOTAL);
+}
 
+//writes the total <index2> of <totals> to <double_value>, false if there are no such totals
+static bool getTotal(const EmissionTotals *totals, long index2, double *double_value)
+{
+	int pollutant = pollutantIndex(index2);
+	if (pollutant < 0)
+	{
+		return false;
+	}
+	*double_value = (totals != nullptr) ? totals->values[pollutant] : 0.0;
+	return totals != nullptr;
+}
 
-//variables for vehicle data
-long   vehicleNumber = 0;
-long   vehicleType = 0;
-double vehicleAcceleration = 0.0;
-double vehicleVelocity = 0.0;
-double vehicleWeight = 0.0;
-double vehicleVSP = 0.0;
-int    vehicleOpmode = 0;
-
-//variables for emission data
-double HC = 0.0;
-double CO = 0.0;
-double NOx = 0.0;
-double CO2 = 0.0;
-double Energy = 0.0;
-double PMtwoPointFive = 0.0;
-
-//variables for time data
-int 	frequencyToPushAcceleration = 0;
-int		timeStepsPassed = 0;
-double 	timeStepValue = 0.0;
-double  currentSimulationTime = 0.0;
-
-//dictionary of historical accelerations
-map<long, vector<double> > accelerationsDictionary;
-
-//variables for testing
-double oldestAcceleration = -999999;
-double middleAcceleration = -999999;
-double newestAcceleration = -999999;
-
-//variable to hold list of emissions corresponding to vehicle state
-vector<double> listOfEmissions;
+#ifdef MOVESTAR_INSTRUMENTATION
+//counters of the command <number>
+static InstrumentedCall commandCall(long number)
+{
+	switch (number)
+	{
+	case EMISSION_COMMAND_INIT:
+		return CALL_INIT;
+	case EMISSION_COMMAND_CREATE_VEHICLE:
+		return CALL_CREATE_VEHICLE;
+	case EMISSION_COMMAND_KILL_VEHICLE:
+		return CALL_KILL_VEHICLE;
+	case EMISSION_COMMAND_CALCULATE_VEHICLE:
+		return CALL_CALCULATE_VEHICLE;
+	case EMISSION_COMMAND_WRITE_SUMMARY:
+		return CALL_WRITE_SUMMARY;
+	default:
+		return CALL_OTHER_COMMAND;
+	}
+}
+#endif
 
+#ifdef _WIN32
 //VISSIM
 BOOL APIENTRY DllMain(HANDLE  hModule, DWORD   ul_reason_for_call, LPVOID  lpReserved)
 {
@@ -327,159 +553,585 @@ BOOL APIENTRY DllMain(HANDLE  hModule, DWORD   ul_reason_for_call, LPVOID  lpRes
 	}
 	return TRUE;
 }
+#endif
+
+EMISSIONMODEL_API  MovestarContext *EmissionModelCreateContext(void)
+{
+	try
+	{
+		return new MovestarContext;
+	}
+	catch (const exception &)
+	{
+		return nullptr;
+	}
+}
+
+EMISSIONMODEL_API  void  EmissionModelDestroyContext(MovestarContext *context)
+{
+	if (context != &defaultContext)
+	{
+		delete context;
+	}
+}
 
 //update values of vehicle variables
-EMISSIONMODEL_API  int  EmissionModelSetValue(long type, long index1, long index2, long long_value, double double_value, char *string_value)
+static int setValue(MovestarContext *context, long type, long index1, long index2, long long_value, double double_value, char *string_value)
 {
+	if (context == nullptr)
+	{
+		return false;
+	}
+	INSTRUMENT_COUNT(context->instrumentation, CALL_SET_VALUE);
 	switch (type)
 	{
 	case EMISSION_DATA_TIMESTEP:
-		timeStepValue = double_value;
+		//VISSIM sets the time and the time step for every vehicle, the queue
+		//stays until they change
+		if (double_value != context->timeStepValue)
+		{
+			context->flushPending();
+		}
+		context->timeStepValue = double_value;
 		return true;
 	case EMISSION_DATA_TIME:
-		currentSimulationTime = double_value;
+		//the vehicles queued belong to the time step ending here
+		if (double_value != context->currentSimulationTime)
+		{
+			context->flushPending();
+		}
+		context->currentSimulationTime = double_value;
+		context->advanceRaster();
+		if (context->checkpointInterval > 0.0 && !context->checkpointFile.empty())
+		{
+			if (context->nextCheckpoint < 0.0)
+			{
+				context->nextCheckpoint = double_value + context->checkpointInterval;
+			}
+			else if (double_value >= context->nextCheckpoint)
+			{
+				context->writeCheckpoint();
+			}
+		}
+#ifdef MOVESTAR_INSTRUMENTATION
+		context->instrumentation.snapshotDue(double_value, context->engine->vehicles());
+#endif
 		return true;
 	case EMISSION_DATA_VEH_ID:
-		vehicleNumber = long_value;
+		context->vehicleNumber = long_value;
 		return true;
 	case EMISSION_DATA_VEH_TYPE:
-		vehicleType = long_value;
+		context->vehicleType = long_value;
 		return true;
 	case EMISSION_DATA_VEH_VELOCITY:
-		vehicleVelocity = double_value * 3.6;				//FIXME: Change back to m/s
+		context->vehicleVelocity = double_value;
 		return true;
 	case EMISSION_DATA_VEH_ACCELERATION:
-		vehicleAcceleration = double_value;
+		context->vehicleAcceleration = double_value;
 		return true;
 	case EMISSION_DATA_VEH_WEIGHT:
-		vehicleWeight = double_value;
+		context->vehicleWeight = double_value;
+		return true;
+	case EMISSION_DATA_SOURCE_TYPE_DIR:
+		context->sourceTypeDirectory = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_LINK:
+		context->vehicleLink = long_value;
 		return true;
+	case EMISSION_DATA_AGGREGATION_INTERVAL:
+		context->aggregationInterval = double_value;
+		return double_value >= 0.0;
+	case EMISSION_DATA_SUMMARY_PREFIX:
+		context->summaryPrefix = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_RATE_GRID_SPEED_STEP:
+		context->rateGridSpeedStep = double_value;
+		return double_value >= 0.0;
+	case EMISSION_DATA_RATE_GRID_ACCELERATION_STEP:
+		context->rateGridAccelerationStep = double_value;
+		return double_value > 0.0;
+	case EMISSION_DATA_HISTORY_RESAMPLING:
+		context->historyResampling = (long_value != 0);
+		return true;
+	case EMISSION_DATA_COMPACT:
+		context->compact = (long_value != 0);
+		return true;
+	case EMISSION_DATA_LOG_FILE:
+		context->logFile = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_LOG_FORMAT:
+		context->logFormat = (long_value == 1) ? EMISSION_LOG_BINARY : EMISSION_LOG_CSV;
+		return long_value == 0 || long_value == 1;
+	case EMISSION_DATA_LOG_COMPRESSION:
+		context->logCompression = (int)long_value;
+		return long_value >= 0 && long_value <= 9;
+	case EMISSION_DATA_LOG_CAPACITY:
+		context->logCapacity = (long_value > 0) ? (size_t)long_value : DEFAULT_EMISSION_LOG_CAPACITY;
+		return long_value > 0;
+	case EMISSION_DATA_LOG_OVERFLOW:
+		context->logOverflow = (long_value == 1) ? EMISSION_LOG_DROP : EMISSION_LOG_BLOCK;
+		return long_value == 0 || long_value == 1;
+	case EMISSION_DATA_CHECKPOINT_FILE:
+		context->checkpointFile = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_CHECKPOINT_INTERVAL:
+		context->checkpointInterval = double_value;
+		context->nextCheckpoint = -1.0;
+		return double_value >= 0.0;
+	case EMISSION_DATA_RESTORE_FILE:
+		context->restoreFile = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_LAZY_EVALUATION:
+		context->flushPending();
+		context->lazyEvaluation = (long_value != 0);
+		return true;
+#ifdef MOVESTAR_INSTRUMENTATION
+	case EMISSION_DATA_INSTRUMENTATION_FILE:
+		context->instrumentationFile = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_INSTRUMENTATION_INTERVAL:
+		context->instrumentationInterval = double_value;
+		return double_value > 0.0;
+#endif
 	case EMISSION_DATA_SLOPE:
+		context->vehicleSlope = double_value;
+		return true;
+	case EMISSION_DATA_VEH_POSITION_X:
+		context->vehicleX = double_value;
+		context->vehiclePositioned = true;
+		return true;
+	case EMISSION_DATA_VEH_POSITION_Y:
+		context->vehicleY = double_value;
+		context->vehiclePositioned = true;
+		return true;
+	case EMISSION_DATA_RASTER_FILE:
+		context->rasterFile = (string_value != nullptr) ? string_value : "";
+		return true;
+	case EMISSION_DATA_RASTER_CELL_SIZE:
+		context->rasterCellSize = double_value;
+		return double_value > 0.0;
+	case EMISSION_DATA_RASTER_INTERVAL:
+		context->rasterInterval = double_value;
+		return double_value > 0.0;
 	default:
 		return false;
 	}
 }
 
+//loads the configured source types, built-in types only if no directory is configured
+static bool initializeSourceTypes(MovestarContext &context)
+{
+	string directory = context.sourceTypeDirectory;
+	if (directory.empty() && getenv("MOVESTAR_DATA_DIR") != nullptr)
+	{
+		directory = getenv("MOVESTAR_DATA_DIR");
+	}
+
+	//drop our reference first, so a registry no other context uses is loaded afresh
+	context.engine.reset();
+	context.sourceTypes.reset();
+	bool loaded = true;
+	context.sourceTypes = SourceTypeRegistry::shared(directory, context.lastError);
+	if (!context.sourceTypes)
+	{
+		context.lastError = "MOVESTAR: " + context.lastError;
+		cerr << context.lastError << endl;
+		string error;
+		context.sourceTypes = SourceTypeRegistry::shared("", error);
+		loaded = false;
+	}
+	context.engine.reset(new EmissionEngine(*context.sourceTypes));
+	context.engine->setHistoryResampling(context.historyResampling);
+	if (context.compact)
+	{
+		context.engine->setCompact(make_shared<const CompactSourceTypes>(*context.sourceTypes));
+	}
+
+	if (context.rateGridSpeedStep != 0.0)
+	{
+		if (!RateGrid::validResolution(context.rateGridSpeedStep, context.rateGridAccelerationStep))
+		{
+			context.lastError = "MOVESTAR: invalid rate grid cells of " + to_string(context.rateGridSpeedStep) + " m/s by " +
+				to_string(context.rateGridAccelerationStep) + " m/s2, rates are calculated exactly";
+			cerr << context.lastError << endl;
+			return false;
+		}
+		context.engine->setRateGrids(make_shared<const RateGrids>(*context.sourceTypes, context.rateGridSpeedStep,
+			context.rateGridAccelerationStep));
+	}
+	return loaded;
+}
+
 //update values of VISSIM variables
-EMISSIONMODEL_API  int  EmissionModelGetValue(long type, long index1, long index2, long *long_value, double *double_value, char **string_value)
+static int getValue(MovestarContext *context, long type, long index1, long index2, long *long_value, double *double_value, char **string_value)
 {
+	if (context == nullptr)
+	{
+		return false;
+	}
+	INSTRUMENT_COUNT(context->instrumentation, CALL_GET_VALUE);
+
+	//the results and totals need the queued vehicles, the error message and
+	//the counters do not
+	if (resultType(type))
+	{
+		context->flushPending();
+	}
 
 	switch (type)
 	{
 
 	case EMISSION_DATA_BENZ:
-		*double_value = oldestAcceleration;							//NOTE: Using to output oldestAcceleration
+		*double_value = context->oldestAcceleration;				//NOTE: Using to output oldestAcceleration
 		return true;
 	case EMISSION_DATA_CO:
-		*double_value = CO;
+		*double_value = context->CO;
 		return true;
 	case EMISSION_DATA_CO2:
-		*double_value = CO2;
+		*double_value = context->CO2;
 		return true;
 	case EMISSION_DATA_HC:
-		*double_value = HC;
+		*double_value = context->HC;
 		return true;
 	case EMISSION_DATA_FUEL:									//NOTE: using as Energy Variable
-		*double_value = Energy;
+		*double_value = context->Energy;
 		return true;
 	case EMISSION_DATA_NMOG:
-		*double_value = middleAcceleration;					  //NOTE: Using to output middle Acceleration
+		*double_value = context->middleAcceleration;			  //NOTE: Using to output middle Acceleration
 		return true;
 	case EMISSION_DATA_NMHC:
-		*double_value = newestAcceleration;					 //NOTE: Using to output newest Acceleration
+		*double_value = context->newestAcceleration;			 //NOTE: Using to output newest Acceleration
 		return true;
 	case EMISSION_DATA_NOX:
-		*double_value = NOx;
+		*double_value = context->NOx;
 		return true;
 	case EMISSION_DATA_PART:
-		*double_value = PMtwoPointFive; 					   	 //NOTE: using as PM2.5 variable
+		*double_value = context->PMtwoPointFive; 			   	 //NOTE: using as PM2.5 variable
 		return true;
 	case EMISSION_DATA_SOOT:
-		*double_value = vehicleVSP;								 //NOTE: Using to output VSP
+		*double_value = context->vehicleVSP;					 //NOTE: Using to output VSP
 		return true;
 	case EMISSION_DATA_SO2:
-		*double_value = vehicleOpmode;							//NOTE: Using to output OPMODE
+		*double_value = context->vehicleOpmode;					//NOTE: Using to output OPMODE
 		return true;
 	case EMISSION_DATA_EVAP:
 		*double_value = -1.0;
 		return true;
+	case EMISSION_DATA_LAST_ERROR:
+		*string_value = (char *)context->lastError.c_str();
+		return true;
+	case EMISSION_DATA_VEHICLE_TOTAL:
+	{
+		const VehicleEmissionTotals *vehicle = context->accumulator.vehicle(index1);
+		return getTotal(vehicle != nullptr ? &vehicle->totals : nullptr, index2, double_value);
+	}
+	case EMISSION_DATA_LINK_TOTAL:
+		return getTotal(context->accumulator.link(index1), index2, double_value);
+	case EMISSION_DATA_INTERVAL_TOTAL:
+		return getTotal(context->accumulator.window(index1), index2, double_value);
+	case EMISSION_DATA_TYPE_TOTAL:
+		return getTotal(context->accumulator.vehicleType(index1), index2, double_value);
+	case EMISSION_DATA_NETWORK_TOTAL:
+		return getTotal(&context->accumulator.network(), index2, double_value);
+	case EMISSION_DATA_LOG_WRITTEN:
+		*long_value = (long)context->log.written();
+		return true;
+	case EMISSION_DATA_LOG_DROPPED:
+		*long_value = (long)context->log.dropped();
+		return true;
+	case EMISSION_DATA_LOG_BLOCKED:
+		*long_value = (long)context->log.blocked();
+		return true;
+	case EMISSION_DATA_CHECKPOINTS_WRITTEN:
+		*long_value = (long)context->checkpoints.written();
+		return true;
+	case EMISSION_DATA_RASTER_CELLS:
+		*long_value = (long)context->raster.cellsWritten();
+		return true;
+	case EMISSION_DATA_LAZY_BATCHES:
+		*long_value = (long)context->lazyBatches;
+		return true;
+	case EMISSION_DATA_LAZY_LARGEST_BATCH:
+		*long_value = (long)context->largestLazyBatch;
+		return true;
+#ifdef MOVESTAR_INSTRUMENTATION
+	case EMISSION_DATA_INSTRUMENTATION:
+		context->instrumentationSnapshot = context->instrumentation.snapshot(context->currentSimulationTime, context->engine->vehicles());
+		*string_value = (char *)context->instrumentationSnapshot.c_str();
+		return true;
+#endif
 	default:
 		return false;
 	}
 }
 
-EMISSIONMODEL_API  int  EmissionModelExecuteCommand(long number)
+static int executeCommand(MovestarContext *context, long number)
 {
+	if (context == nullptr)
+	{
+		return false;
+	}
+	INSTRUMENT_CALL(context->instrumentation, commandCall(number));
+
+	//only vehicles calculated during the time step can stay queued
+	if (number != EMISSION_COMMAND_CALCULATE_VEHICLE && number != EMISSION_COMMAND_CREATE_VEHICLE)
+	{
+		context->flushPending();
+	}
+	EmissionEngine &engine = *context->engine;
 	switch (number)
 	{
 	case EMISSION_COMMAND_INIT:
-		return true;
-	case EMISSION_COMMAND_CREATE_VEHICLE:
-		return true;
-	case EMISSION_COMMAND_KILL_VEHICLE:
-		return true;
-	case EMISSION_COMMAND_CALCULATE_VEHICLE:
-
-		//calculate how often to push to historical accelerations and the number of time steps passed
-		frequencyToPushAcceleration = (int)round(1.0 / timeStepValue);
-		timeStepsPassed = (int)(currentSimulationTime / timeStepValue);
+	{
+		//the summary of the previous run is complete once the next one starts
+		bool initialized = context->finishSummary();
+		initialized = context->closeLog() && initialized;
+		initialized = context->closeRaster() && initialized;
+		initialized = context->finishCheckpoints() && initialized;
 
-		//push to historical accelerations if closest possible value to one simulation second has passed
-		if (timeStepsPassed % frequencyToPushAcceleration == 0 )
+		//a warm restart takes the configuration of the checkpoint before the run is set up
+		vector<char> restored;
+		CheckpointReader snapshot(nullptr, 0);
+		bool restoring = !context->restoreFile.empty();
+		if (restoring)
 		{
-			accelerationsDictionary[vehicleNumber].push_back(vehicleAcceleration);
+			restoring = CheckpointFile::read(context->restoreFile, restored, context->lastError);
+			if (!restoring)
+			{
+				context->lastError = "MOVESTAR: " + context->lastError;
+				cerr << context->lastError << endl;
+			}
+			snapshot = CheckpointReader(restored.data(), restored.size());
+			restoring = restoring && context->restoreConfiguration(snapshot);
+			initialized = restoring && initialized;
 		}
-
-		//if the dictionary key has a list greater than 3 pop the oldest element
-		if (accelerationsDictionary[vehicleNumber].size() > 3)
+		context->nextCheckpoint = -1.0;
+		context->accumulator.reset(context->aggregationInterval);
+		if (!context->summaryPrefix.empty() && !context->accumulator.openSummary(context->summaryPrefix, context->lastError))
+		{
+			context->lastError = "MOVESTAR: " + context->lastError;
+			cerr << context->lastError << endl;
+			initialized = false;
+		}
+		//without zlib the log is written uncompressed rather than not at all
+		int logCompression = context->logCompression;
+		if (!context->logFile.empty() && logCompression >= 1 && logCompression <= 9 && !EmissionLog::compressionAvailable())
+		{
+			cerr << "MOVESTAR: warning: no zlib in this build, " << context->logFile << " is written uncompressed" << endl;
+			logCompression = 0;
+		}
+		if (!context->logFile.empty() && !context->log.open(context->logFile, context->logFormat, logCompression,
+			context->logCapacity, context->logOverflow, context->lastError))
+		{
+			context->lastError = "MOVESTAR: " + context->lastError;
+			cerr << context->lastError << endl;
+			initialized = false;
+		}
+		if (!context->rasterFile.empty() && !context->raster.open(context->rasterFile, context->rasterCellSize,
+			context->rasterInterval, 1, context->lastError))
+		{
+			context->lastError = "MOVESTAR: " + context->lastError;
+			cerr << context->lastError << endl;
+			initialized = false;
+		}
+#ifdef MOVESTAR_INSTRUMENTATION
+		context->instrumentation.closeSnapshots(context->currentSimulationTime, engine.vehicles());
+		if (!context->instrumentationFile.empty() && !context->instrumentation.openSnapshots(context->instrumentationFile,
+			context->instrumentationInterval, context->currentSimulationTime, context->lastError))
 		{
-			accelerationsDictionary[vehicleNumber].erase(accelerationsDictionary[vehicleNumber].begin());
+			context->lastError = "MOVESTAR: " + context->lastError;
+			cerr << context->lastError << endl;
+			initialized = false;
 		}
+#endif
+		initialized = initializeSourceTypes(*context) && initialized;
 
-		//assign historical accelerations to variables 	for testing
-		if (accelerationsDictionary[vehicleNumber].size() >= 1)
+		//then its vehicles and totals, in time linear in the size of the checkpoint
+		if (restoring)
 		{
-			oldestAcceleration = accelerationsDictionary[vehicleNumber][0];
+			if (!context->engine->restoreState(snapshot, context->lastError) ||
+				!context->accumulator.restoreState(snapshot, context->lastError))
+			{
+				context->lastError = "MOVESTAR: " + context->lastError;
+				cerr << context->lastError << endl;
+				context->engine->reset();
+				return false;
+			}
+			context->nextCheckpoint = context->currentSimulationTime + context->checkpointInterval;
 		}
-		if (accelerationsDictionary[vehicleNumber].size() >= 2)
+		return initialized;
+	}
+	case EMISSION_COMMAND_CREATE_VEHICLE:
+		//unknown vehicle types are rejected here rather than on every calculation
+		if (!engine.createVehicle(context->vehicleNumber, context->vehicleType))
 		{
-			middleAcceleration = accelerationsDictionary[vehicleNumber][1];
+			context->lastError = "MOVESTAR: unknown vehicle type " + to_string(context->vehicleType) + " (vehicle " +
+				to_string(context->vehicleNumber) + "), no source type registered for it";
+			cerr << context->lastError << endl;
+			return false;
 		}
-		if (accelerationsDictionary[vehicleNumber].size() >= 3)
+		return true;
+	case EMISSION_COMMAND_KILL_VEHICLE:
+		engine.killVehicle(context->vehicleNumber);
+		context->accumulator.removeVehicle(context->vehicleNumber);
+		return true;
+	case EMISSION_COMMAND_CALCULATE_VEHICLE:
+	{
+		//lazy evaluation: queued until a result is asked for, so only a vehicle of
+		//an unknown type fails here
+		if (context->lazyEvaluation)
 		{
-			newestAcceleration = accelerationsDictionary[vehicleNumber][2];
+			context->pending.add(context->vehicleNumber, context->vehicleType, context->vehicleLink, context->vehicleVelocity,
+				context->vehicleAcceleration, context->vehicleSlope, context->vehicleX, context->vehicleY);
+			context->currentPending = true;
+			return engine.registry().find(context->vehicleType) != nullptr;
 		}
 
+		//single vehicle protocol: a batch of one over the values set before
+		EmissionBatch batch = { 1, &context->vehicleNumber, &context->vehicleType, &context->vehicleVelocity,
+			&context->vehicleAcceleration, &context->vehicleSlope, nullptr,
+			&context->HC, &context->CO, &context->NOx, &context->CO2, &context->Energy, &context->PMtwoPointFive,
+			&context->vehicleVSP, &context->vehicleOpmode };
+		bool calculated = (calculateVehicles(*context, batch, &context->vehicleLink,
+			context->vehiclePositioned ? &context->vehicleX : nullptr, context->vehiclePositioned ? &context->vehicleY : nullptr) == 1);
 
-		//calculate VSP and get OpMode
-		vehicleVSP = calculateVSP(vehicleType, vehicleVelocity, vehicleAcceleration);
-		vehicleOpmode = getOpmode(accelerationsDictionary[vehicleNumber], vehicleVelocity, vehicleVSP);
+		//assign historical accelerations to variables 	for testing
+		readHistory(*context, context->vehicleNumber);
+		return calculated;
+	}
+	case EMISSION_COMMAND_WRITE_SUMMARY:
+	{
+		bool written = context->finishSummary();
+		written = context->finishCheckpoints() && written;
+		written = context->closeRaster() && written;
+		return context->closeLog() && written;
+	}
+	case EMISSION_COMMAND_CHECKPOINT:
+		return context->writeCheckpoint();
+	default:
+		return false;
+	}
+}
 
-		//retrieve list of emissions
-		if (vehicleType == 100)
+static long calculateBatch(MovestarContext *context, long count, const long *vehicle_ids,
+	const long *vehicle_types, const double *velocities, const double *accelerations, const double *slopes,
+	double *hc, double *co, double *nox, double *co2, double *energy, double *pm25)
+{
+	if (context == nullptr || count <= 0)
+	{
+		return 0;
+	}
+	INSTRUMENT_CALL(context->instrumentation, CALL_CALCULATE_BATCH);
+	context->flushPending();
+
+	//VSP and opmodes only for the log
+	double *vsp = nullptr;
+	int *opmodes = nullptr;
+	if (context->log.isOpen())
+	{
+		if (context->batchVSP.size() < (size_t)count)
 		{
-			listOfEmissions = sourceType100Dictionary[vehicleOpmode];
+			context->batchVSP.resize((size_t)count);
+			context->batchOpmodes.resize((size_t)count);
 		}
-		else if (vehicleType == 200)
+		vsp = context->batchVSP.data();
+		opmodes = context->batchOpmodes.data();
+	}
+	EmissionBatch batch = { (size_t)count, vehicle_ids, vehicle_types, velocities, accelerations, slopes, nullptr,
+		hc, co, nox, co2, energy, pm25, vsp, opmodes };
+	return (long)calculateVehicles(*context, batch, nullptr);
+}
+
+//an exception must not leave the DLL (it would terminate VISSIM): the call
+//fails with its message as the last error
+static int reportException(MovestarContext *context, const exception &failure)
+{
+	if (context != nullptr)
+	{
+		try
 		{
-			listOfEmissions = sourceType200Dictionary[vehicleOpmode];
+			context->lastError = string("MOVESTAR: ") + failure.what();
+			cerr << context->lastError << endl;
 		}
-		else if (vehicleType == 300)
+		catch (const exception &)
 		{
-			listOfEmissions = sourceType300Dictionary[vehicleOpmode];
+			//no memory left even for the message
 		}
+	}
+	return false;
+}
+
+EMISSIONMODEL_API  int  EmissionModelContextSetValue(MovestarContext *context, long type, long index1, long index2, long long_value, double double_value, char *string_value)
+{
+	try
+	{
+		return setValue(context, type, index1, index2, long_value, double_value, string_value);
+	}
+	catch (const exception &failure)
+	{
+		return reportException(context, failure);
+	}
+}
 
-		//scale emissions data to give output for one second
-		HC = listOfEmissions.at(0) / 3600;
-		CO = listOfEmissions.at(1) / 3600;
-		NOx = listOfEmissions.at(2) / 3600;
-		CO2 = listOfEmissions.at(3) / 3600;
-		Energy = listOfEmissions.at(4) / 3600;
-		PMtwoPointFive = listOfEmissions.at(5) / 3600;
+EMISSIONMODEL_API  int  EmissionModelContextGetValue(MovestarContext *context, long type, long index1, long index2, long *long_value, double *double_value, char **string_value)
+{
+	try
+	{
+		return getValue(context, type, index1, index2, long_value, double_value, string_value);
+	}
+	catch (const exception &failure)
+	{
+		return reportException(context, failure);
+	}
+}
 
+EMISSIONMODEL_API  int  EmissionModelContextExecuteCommand(MovestarContext *context, long number)
+{
+	try
+	{
+		return executeCommand(context, number);
+	}
+	catch (const exception &failure)
+	{
+		return reportException(context, failure);
+	}
+}
 
-		return true;
-	default:
-		return false;
+EMISSIONMODEL_API  long  EmissionModelContextCalculateBatch(MovestarContext *context, long count, const long *vehicle_ids,
+	const long *vehicle_types, const double *velocities, const double *accelerations, const double *slopes,
+	double *hc, double *co, double *nox, double *co2, double *energy, double *pm25)
+{
+	try
+	{
+		return calculateBatch(context, count, vehicle_ids, vehicle_types, velocities, accelerations, slopes, hc, co, nox, co2,
+			energy, pm25);
+	}
+	catch (const exception &failure)
+	{
+		return reportException(context, failure);
 	}
 }
+
+//the VISSIM API on the default context
+EMISSIONMODEL_API  int  EmissionModelSetValue(long type, long index1, long index2, long long_value, double double_value, char *string_value)
+{
+	return EmissionModelContextSetValue(&defaultContext, type, index1, index2, long_value, double_value, string_value);
+}
+
+EMISSIONMODEL_API  int  EmissionModelGetValue(long type, long index1, long index2, long *long_value, double *double_value, char **string_value)
+{
+	return EmissionModelContextGetValue(&defaultContext, type, index1, index2, long_value, double_value, string_value);
+}
+
+EMISSIONMODEL_API  int  EmissionModelExecuteCommand(long number)
+{
+	return EmissionModelContextExecuteCommand(&defaultContext, number);
+}
+
+EMISSIONMODEL_API  long  EmissionModelCalculateBatch(long count, const long *vehicle_ids, const long *vehicle_types,
+	const double *velocities, const double *accelerations, const double *slopes,
+	double *hc, double *co, double *nox, double *co2, double *energy, double *pm25)
+{
+	return EmissionModelContextCalculateBatch(&defaultContext, count, vehicle_ids, vehicle_types, velocities, accelerations,
+		slopes, hc, co, nox, co2, energy, pm25);
+}
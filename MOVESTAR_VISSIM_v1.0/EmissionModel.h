@@ -10,7 +10,7 @@
 #define __EMISSIONMODEL_H
 
 
-#ifndef _CONSOLE
+#if defined(_WIN32) && !defined(_CONSOLE)
 #include <windows.h>
 #endif
 
@@ -19,11 +19,18 @@
 /* Programs that use EmissionModel.DLL must not be compiled        */
 /* with that preprocessor definition.                              */
 
+/* On other platforms the library is a shared object exporting the  */
+/* same C symbols.                                                  */
+
+#if defined(_WIN32)
 #ifdef EMISSIONMODEL_EXPORTS
 #define EMISSIONMODEL_API extern "C" __declspec(dllexport)
 #else
 #define EMISSIONMODEL_API extern "C" __declspec(dllimport)
 #endif
+#else
+#define EMISSIONMODEL_API extern "C" __attribute__((visibility("default")))
+#endif
 
 /*==========================================================================*/
 
@@ -47,6 +54,8 @@
 
 /* link data: */
 #define  EMISSION_DATA_SLOPE                   301
+           /* double: slope at the vehicle, rise over run (0.026 = 2.6 %,  */
+           /*         negative downhill); adds the grade to the VSP        */
 
 /* emission data: */
 /* must be provided by the emission model after EMISSION_COMMAND_CALCULATE */
@@ -76,6 +85,141 @@
 #define  EMISSION_DATA_EVAP                    812
            /* double: evaporation HC emissions [g/s] in the current time step */
 
+/* model configuration (MOVESTAR extension): */
+#define  EMISSION_DATA_SOURCE_TYPE_DIR         901
+           /* string: directory with VehicleSrcCoeff.csv and EmsRate_<type>.csv */
+           /*         loaded at EMISSION_COMMAND_INIT (default: environment     */
+           /*         variable MOVESTAR_DATA_DIR, else built-in types only)    */
+#define  EMISSION_DATA_LAST_ERROR              902
+           /* string: message of the last failed command (GetValue only) */
+#define  EMISSION_DATA_LINK                    903
+           /* long:   link number of the current vehicle (for the link totals; */
+           /*         vehicles of EmissionModelCalculateBatch keep their link)  */
+#define  EMISSION_DATA_AGGREGATION_INTERVAL    904
+           /* double: length of the time windows of EMISSION_DATA_INTERVAL_TOTAL */
+           /*         [s], 0 for none (default 60; applied at EMISSION_COMMAND_INIT) */
+#define  EMISSION_DATA_SUMMARY_PREFIX          905
+           /* string: path prefix of the summary files of the run (default: none). */
+           /*         <prefix>_veh.csv receives each vehicle as it is killed;      */
+           /*         EMISSION_COMMAND_WRITE_SUMMARY (or the next INIT) adds       */
+           /*         <prefix>_link.csv, <prefix>_interval.csv, <prefix>_type.csv  */
+#define  EMISSION_DATA_INSTRUMENTATION_FILE    906
+           /* string: path of the instrumentation snapshot file (default: none), */
+           /*         one JSON line per snapshot; opened at EMISSION_COMMAND_INIT */
+           /*         (only if built with MOVESTAR_INSTRUMENTATION)              */
+#define  EMISSION_DATA_INSTRUMENTATION_INTERVAL 907
+           /* double: simulation time between two snapshots [s] (default 60) */
+#define  EMISSION_DATA_RATE_GRID_SPEED_STEP    908
+           /* double: >0 to look the rates of vehicles not braking up in a    */
+           /*         speed x acceleration grid per source type with cells of */
+           /*         this speed [m/s] (default 0: exact calculation only).   */
+           /*         Results are the same; cells across a speed or VSP       */
+           /*         threshold are calculated exactly. Applied at INIT       */
+#define  EMISSION_DATA_RATE_GRID_ACCELERATION_STEP 909
+           /* double: acceleration of the grid cells [m/s2] (default 0.02) */
+#define  EMISSION_DATA_LAZY_EVALUATION         916
+           /* long:   1 to defer the calculation (default 0): CALCULATE only   */
+           /*         queues the vehicle and fails only for unknown types; the */
+           /*         queue is calculated as one batch when GetValue asks for  */
+           /*         a result or a total, the time or time step changes or    */
+           /*         another command is executed. Results are the same as     */
+           /*         without                                                  */
+#define  EMISSION_DATA_LOG_FILE                917
+           /* string: path of the log of every vehicle-step (default: none):   */
+           /*         time, vehicle, type, VSP, opmode and emissions [g/s],    */
+           /*         written by a background thread. Opened at INIT, complete */
+           /*         after EMISSION_COMMAND_WRITE_SUMMARY or the next INIT    */
+#define  EMISSION_DATA_LOG_FORMAT              918
+           /* long:   0 CSV (default), 1 binary blocks of columns (EmissionLog.h) */
+#define  EMISSION_DATA_LOG_COMPRESSION         919
+           /* long:   zlib level 1..9 to write a gzip file, 0 for none (default); */
+           /*         a build without zlib warns and writes the log uncompressed */
+#define  EMISSION_DATA_LOG_CAPACITY            920
+           /* long:   records buffered for the writer thread (default 65536)   */
+#define  EMISSION_DATA_LOG_OVERFLOW            921
+           /* long:   with the buffer full, 0 waits for the writer (default),   */
+           /*         1 drops the record                                       */
+#define  EMISSION_DATA_HISTORY_RESAMPLING      925
+           /* long:   1 to detect braking on the mean acceleration of each     */
+           /*         completed second, resampled per vehicle for any time     */
+           /*         step (default 0: the acceleration of the step starting   */
+           /*         each second). Applied at INIT                            */
+#define  EMISSION_DATA_COMPACT                 926
+           /* long:   1 to calculate in float32 with int16 acceleration        */
+           /*         histories (default 0): less memory per vehicle, results  */
+           /*         differ from the double path by rounding. Applied at INIT */
+#define  EMISSION_DATA_CHECKPOINT_FILE         927
+           /* string: path of the checkpoint of the run (default: none): the   */
+           /*         configuration, vehicle histories and totals, written by  */
+           /*         a background thread and replaced as a whole each time   */
+#define  EMISSION_DATA_CHECKPOINT_INTERVAL     928
+           /* double: simulation time between two checkpoints [s] (default 0: */
+           /*         only on EMISSION_COMMAND_CHECKPOINT)                     */
+#define  EMISSION_DATA_RESTORE_FILE            929
+           /* string: checkpoint to continue from at INIT (default: none): its */
+           /*         configuration replaces the values set before, and the    */
+           /*         run resumes at the simulation time of the checkpoint     */
+#define  EMISSION_DATA_VEH_POSITION_X          931
+           /* double: x coordinate of the current vehicle [m], for the raster */
+#define  EMISSION_DATA_VEH_POSITION_Y          932
+           /* double: y coordinate of the current vehicle [m]. Vehicles are  */
+           /*         rastered once a position was set; vehicles of          */
+           /*         EmissionModelCalculateBatch have none                  */
+#define  EMISSION_DATA_RASTER_FILE             933
+           /* string: path of the emission raster of the run (default: none): */
+           /*         the emissions of every vehicle-step summed per cell of  */
+           /*         the plane and time bin, only the cells occupied, each   */
+           /*         bin written as it ends (binary format of              */
+           /*         EmissionRaster.h). Opened at INIT, complete after      */
+           /*         EMISSION_COMMAND_WRITE_SUMMARY or the next INIT; not   */
+           /*         part of checkpoints                                    */
+#define  EMISSION_DATA_RASTER_CELL_SIZE        934
+           /* double: side of the raster cells [m] (default 100) */
+#define  EMISSION_DATA_RASTER_INTERVAL         935
+           /* double: length of the raster time bins [s] (default 60) */
+
+/* emission totals of the run (MOVESTAR extension, GetValue only): */
+/* <index2> selects the pollutant by its data type (EMISSION_DATA_HC, */
+/* _CO, _NOX, _CO2, _FUEL for energy [KJ], _PART for PM2.5), results  */
+/* are in [g]. Vehicle totals are kept until the vehicle is killed.   */
+#define  EMISSION_DATA_VEHICLE_TOTAL           910
+           /* double: totals of the vehicle number <index1> */
+#define  EMISSION_DATA_LINK_TOTAL              911
+           /* double: totals of the link number <index1> */
+#define  EMISSION_DATA_INTERVAL_TOTAL          912
+           /* double: totals of the time window <index1>, starting at */
+           /*         <index1> * EMISSION_DATA_AGGREGATION_INTERVAL    */
+#define  EMISSION_DATA_TYPE_TOTAL              913
+           /* double: totals of the vehicle type <index1> */
+#define  EMISSION_DATA_NETWORK_TOTAL           914
+           /* double: totals of the whole network */
+
+/* emission log counters of the open or last log (MOVESTAR extension, */
+/* GetValue only):                                                     */
+#define  EMISSION_DATA_LOG_WRITTEN             922
+           /* long:   records written to the log so far */
+#define  EMISSION_DATA_LOG_DROPPED             923
+           /* long:   records dropped on a full buffer */
+#define  EMISSION_DATA_LOG_BLOCKED             924
+           /* long:   records that waited for the writer */
+#define  EMISSION_DATA_CHECKPOINTS_WRITTEN     930
+           /* long:   checkpoints written since the context was created */
+#define  EMISSION_DATA_RASTER_CELLS            936
+           /* long:   cells written to the open or last raster */
+#define  EMISSION_DATA_LAZY_BATCHES            937
+           /* long:   batches calculated by the lazy evaluation since the */
+           /*         context was created                                 */
+#define  EMISSION_DATA_LAZY_LARGEST_BATCH      938
+           /* long:   vehicles of the largest of these batches */
+
+/* instrumentation (MOVESTAR extension, GetValue only, only if built */
+/* with MOVESTAR_INSTRUMENTATION): calls and sampled latencies per   */
+/* function and command, live vehicles, vehicle state slots and the  */
+/* opmodes calculated per source type, counted since the context was */
+/* created.                                                          */
+#define  EMISSION_DATA_INSTRUMENTATION         915
+           /* string: the counters as a JSON object */
+
 /*--------------------------------------------------------------------------*/
 
 EMISSIONMODEL_API  int  EmissionModelSetValue (long   type,
@@ -125,6 +269,15 @@ EMISSIONMODEL_API  int  EmissionModelGetValue (long   type,
            /* called from VISSIM once per time step during a simulation run */
            /* values set before: all values                                 */
 
+#define  EMISSION_COMMAND_WRITE_SUMMARY     100
+           /* MOVESTAR extension: writes the summary files of the run      */
+           /* value set before: EMISSION_DATA_SUMMARY_PREFIX               */
+
+#define  EMISSION_COMMAND_CHECKPOINT        101
+           /* MOVESTAR extension: checkpoint of the run before the step at  */
+           /* the current time, written in the background                   */
+           /* value set before: EMISSION_DATA_CHECKPOINT_FILE               */
+
 /*--------------------------------------------------------------------------*/
 
 EMISSIONMODEL_API  int  EmissionModelExecuteCommand (long number);
@@ -134,6 +287,93 @@ EMISSIONMODEL_API  int  EmissionModelExecuteCommand (long number);
 
 /*==========================================================================*/
 
+/* batch interface (MOVESTAR extension): */
+
+EMISSIONMODEL_API  long  EmissionModelCalculateBatch (long         count,
+                                                      const long   *vehicle_ids,
+                                                      const long   *vehicle_types,
+                                                      const double *velocities,
+                                                      const double *accelerations,
+                                                      const double *slopes,
+                                                      double       *hc,
+                                                      double       *co,
+                                                      double       *nox,
+                                                      double       *co2,
+                                                      double       *energy,
+                                                      double       *pm25);
+
+/* Calculates the emissions of <count> vehicles for the current time   */
+/* step in one call, equivalent to EMISSION_COMMAND_CALCULATE_VEHICLE  */
+/* for each of them. Inputs are arrays of <count> vehicle numbers,     */
+/* vehicle types, speeds [m/s], accelerations [m/s2] and slopes (may   */
+/* be NULL); the output arrays receive the emissions [g/s] of each     */
+/* vehicle (energy as for EMISSION_DATA_FUEL, PM2.5 as for             */
+/* EMISSION_DATA_PART). EMISSION_DATA_TIMESTEP and EMISSION_DATA_TIME  */
+/* must be set before. Vehicles that cannot be calculated get zero     */
+/* emissions. Return value is the number of vehicles calculated.       */
+
+/*==========================================================================*/
+
+/* context interface (MOVESTAR extension): */
+
+/* The functions above work on one default context per process. A       */
+/* context holds everything of one simulation run (values set, vehicle  */
+/* states, results); contexts are independent, so several runs can be   */
+/* calculated in one process, each context used by one thread at a     */
+/* time. The source type tables are loaded once per directory and      */
+/* shared read-only by all contexts using them.                         */
+
+typedef struct MovestarContext MovestarContext;
+
+EMISSIONMODEL_API  MovestarContext *EmissionModelCreateContext (void);
+
+/* Creates a context with the built-in source types. Return value is    */
+/* the new context, or NULL if it cannot be allocated.                  */
+
+EMISSIONMODEL_API  void  EmissionModelDestroyContext (MovestarContext *context);
+
+/* Releases <context> and everything it holds (NULL is ignored).        */
+
+EMISSIONMODEL_API  int  EmissionModelContextSetValue (MovestarContext *context,
+                                                      long   type,
+                                                      long   index1,
+                                                      long   index2,
+                                                      long   long_value,
+                                                      double double_value,
+                                                      char   *string_value);
+
+EMISSIONMODEL_API  int  EmissionModelContextGetValue (MovestarContext *context,
+                                                      long   type,
+                                                      long   index1,
+                                                      long   index2,
+                                                      long   *long_value,
+                                                      double *double_value,
+                                                      char   **string_value);
+
+EMISSIONMODEL_API  int  EmissionModelContextExecuteCommand (MovestarContext *context,
+                                                            long number);
+
+EMISSIONMODEL_API  long  EmissionModelContextCalculateBatch (MovestarContext *context,
+                                                             long         count,
+                                                             const long   *vehicle_ids,
+                                                             const long   *vehicle_types,
+                                                             const double *velocities,
+                                                             const double *accelerations,
+                                                             const double *slopes,
+                                                             double       *hc,
+                                                             double       *co,
+                                                             double       *nox,
+                                                             double       *co2,
+                                                             double       *energy,
+                                                             double       *pm25);
+
+/* Same as the functions without "Context" on <context>. Strings        */
+/* returned by EmissionModelContextGetValue stay valid until the next   */
+/* command on the same context. Return values are 0 if <context> is     */
+/* NULL.                                                                */
+
+/*==========================================================================*/
+
 #endif /* __EMISSIONMODEL_H */
 
 /*==========================================================================*/
@@ -0,0 +1,225 @@
+/*========================================================================= */
+/* EmissionRaster.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* Sparse tiles, their ordered merge and the chunks of the raster file.	*/
+/*========================================================================= */
+
+#include "EmissionRaster.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+
+//cell index of a coordinate, clamped to the int32 of the records
+static int32_t cellOf(double coordinate, double cellSize)
+{
+	double cell = floor(coordinate / cellSize);
+	if (!(cell >= (double)INT32_MIN))
+	{
+		return INT32_MIN;
+	}
+	return cell > (double)INT32_MAX ? INT32_MAX : (int32_t)cell;
+}
+
+static uint64_t cellKey(int32_t column, int32_t row)
+{
+	return ((uint64_t)(uint32_t)column << 32) | (uint32_t)row;
+}
+
+static bool byRowAndColumn(const EmissionRasterRecord &a, const EmissionRasterRecord &b)
+{
+	return a.row != b.row ? a.row < b.row : a.column < b.column;
+}
+
+EmissionRasterTile::EmissionRasterTile(double cellSize, double interval)
+	: cellSize(cellSize), interval(interval), lastInterval(LLONG_MIN), lastCells(nullptr)
+{
+}
+
+long long EmissionRasterTile::intervalOf(double time) const
+{
+	return (long long)floor(time / interval);
+}
+
+void EmissionRasterTile::add(double time, double x, double y, const double *emissions)
+{
+	long long bin = intervalOf(time);
+	if (lastCells == nullptr || bin != lastInterval)
+	{
+		lastCells = &bins[bin];
+		lastInterval = bin;
+	}
+	EmissionTotals &cell = (*lastCells)[cellKey(cellOf(x, cellSize), cellOf(y, cellSize))];
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		cell.values[k] += emissions[k];
+	}
+}
+
+size_t EmissionRasterTile::cellCount() const
+{
+	size_t count = 0;
+	for (map<long long, RasterCells>::const_iterator it = bins.begin(); it != bins.end(); ++it)
+	{
+		count += it->second.size();
+	}
+	return count;
+}
+
+EmissionRaster::EmissionRaster()
+	: file(nullptr), nextInterval(LLONG_MIN), failed(false), writtenCells(0), writtenChunks(0), heldPeak(0)
+{
+}
+
+EmissionRaster::~EmissionRaster()
+{
+	string error;
+	close(error);
+}
+
+bool EmissionRaster::validGrid(double cellSize, double interval)
+{
+	return cellSize > 0.0 && interval > 0.0 && isfinite(cellSize) && isfinite(interval);
+}
+
+bool EmissionRaster::open(const string &rasterPath, double cellSize, double interval, size_t tileCount, string &error)
+{
+	close(error);
+	if (!validGrid(cellSize, interval))
+	{
+		error = "invalid raster of " + to_string(cellSize) + " m cells and " + to_string(interval) + " s bins";
+		return false;
+	}
+	path = rasterPath;
+	file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		error = "cannot create " + path;
+		return false;
+	}
+	EmissionRasterHeader header;
+	memcpy(header.magic, EMISSION_RASTER_MAGIC, sizeof(header.magic));
+	header.version = EMISSION_RASTER_VERSION;
+	header.pollutants = EMISSION_RATE_COUNT;
+	header.cellSize = cellSize;
+	header.interval = interval;
+	failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+	tiles.clear();
+	for (size_t t = 0; t < max(tileCount, (size_t)1); t++)
+	{
+		tiles.push_back(unique_ptr<EmissionRasterTile>(new EmissionRasterTile(cellSize, interval)));
+	}
+	bins.clear();
+	nextInterval = LLONG_MIN;
+	writtenCells = 0;
+	writtenChunks = 0;
+	heldPeak = 0;
+	return true;
+}
+
+void EmissionRaster::mergeTiles()
+{
+	size_t held = 0;
+	for (map<long long, RasterCells>::const_iterator it = bins.begin(); it != bins.end(); ++it)
+	{
+		held += it->second.size();
+	}
+	for (size_t t = 0; t < tiles.size(); t++)
+	{
+		held += tiles[t]->cellCount();
+	}
+	heldPeak = max(heldPeak, held);
+
+	//a cell adds the tiles up in tile order, whatever order its bins are visited in
+	for (size_t t = 0; t < tiles.size(); t++)
+	{
+		EmissionRasterTile &tile = *tiles[t];
+		for (map<long long, RasterCells>::iterator bin = tile.bins.begin(); bin != tile.bins.end(); ++bin)
+		{
+			RasterCells &cells = bins[bin->first];
+			for (RasterCells::const_iterator cell = bin->second.begin(); cell != bin->second.end(); ++cell)
+			{
+				EmissionTotals &merged = cells[cell->first];
+				for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+				{
+					merged.values[k] += cell->second.values[k];
+				}
+			}
+		}
+		tile.bins.clear();
+		tile.lastCells = nullptr;
+	}
+}
+
+bool EmissionRaster::writeBefore(long long interval)
+{
+	while (!bins.empty() && bins.begin()->first < interval)
+	{
+		const RasterCells &cells = bins.begin()->second;
+		records.resize(cells.size());
+		size_t r = 0;
+		for (RasterCells::const_iterator cell = cells.begin(); cell != cells.end(); ++cell, r++)
+		{
+			EmissionRasterRecord &record = records[r];
+			record.column = (int32_t)(uint32_t)(cell->first >> 32);
+			record.row = (int32_t)(uint32_t)cell->first;
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				record.emissions[k] = (float)cell->second.values[k];
+			}
+		}
+		sort(records.begin(), records.end(), byRowAndColumn);
+		EmissionRasterChunk chunk = { (int64_t)bins.begin()->first, (uint64_t)records.size() };
+		failed = failed || fwrite(&chunk, sizeof(chunk), 1, file) != 1 ||
+			(!records.empty() && fwrite(records.data(), sizeof(EmissionRasterRecord), records.size(), file) != records.size());
+		writtenCells += records.size();
+		writtenChunks++;
+		bins.erase(bins.begin());
+	}
+	return !failed;
+}
+
+bool EmissionRaster::advance(double time, string &error)
+{
+	if (file == nullptr || tiles.empty())
+	{
+		return true;
+	}
+	long long interval = tiles[0]->intervalOf(time);
+	if (interval <= nextInterval)
+	{
+		return true;
+	}
+	mergeTiles();
+	nextInterval = interval;
+	if (!writeBefore(interval))
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+bool EmissionRaster::close(string &error)
+{
+	if (file == nullptr)
+	{
+		return true;
+	}
+	mergeTiles();
+	writeBefore(LLONG_MAX);
+	failed = (fclose(file) != 0) || failed;
+	file = nullptr;
+	tiles.clear();
+	bins.clear();
+	vector<EmissionRasterRecord>().swap(records);
+	if (failed)
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,145 @@
+/*========================================================================= */
+/* EmissionRaster.h                                  Core module of MOVESTAR */
+/*																			*/
+/* Emissions gridded in space and time for hotspot and dispersion studies.	*/
+/* Square cells of the plane are counted from the origin of the			*/
+/* coordinates, time bins from time 0. Every thread adds to a tile of its	*/
+/* own; the tiles only hold the cells something was added to, so memory	*/
+/* follows the occupied cells and not the bounding box of the network.	*/
+/* Once a time bin has ended, the tiles are merged in their order (the		*/
+/* sums are the same for any number of threads) and the bins that ended	*/
+/* are written to a compact binary file and dropped.						*/
+/*========================================================================= */
+
+#ifndef __EMISSIONRASTER_H
+#define __EMISSIONRASTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "EmissionAccumulator.h"
+
+#define EMISSION_RASTER_MAGIC   "MVSTRRST"
+#define EMISSION_RASTER_VERSION 1
+
+//default cell size [m] and time bin [s]
+#define DEFAULT_RASTER_CELL_SIZE 100.0
+#define DEFAULT_RASTER_INTERVAL  60.0
+
+//binary format (little endian): this header, then per time bin a chunk of an
+//EmissionRasterChunk followed by <cellCount> records sorted by row, then
+//column. Cell (column, row) covers [column, column + 1) * cellSize in x and
+//[row, row + 1) * cellSize in y [m], bin i covers [i, i + 1) * interval [s].
+//Bins come in time order; a bin appears again only if something was added to
+//it after it was written (input not ordered by time), its chunks add up
+struct EmissionRasterHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t pollutants;		//EMISSION_RATE_COUNT
+	double   cellSize;			//[m]
+	double   interval;			//[s]
+};
+
+struct EmissionRasterChunk
+{
+	int64_t  interval;			//index of the time bin
+	uint64_t cellCount;
+};
+
+struct EmissionRasterRecord
+{
+	int32_t column;
+	int32_t row;
+	float   emissions[EMISSION_RATE_COUNT];	//[g], energy [KJ], in the order of EmissionTotals
+};
+
+//occupied cells of one time bin, by column (high 32 bits) and row
+typedef std::unordered_map<uint64_t, EmissionTotals> RasterCells;
+
+//cells of one thread
+class EmissionRasterTile
+{
+public:
+	EmissionRasterTile(double cellSize, double interval);
+
+	//adds <emissions> [g], energy [KJ], in the order of EmissionTotals, taken at
+	//time <time> [s] and position <x>, <y> [m]
+	void add(double time, double x, double y, const double *emissions);
+
+	//time bin of <time> [s]
+	long long intervalOf(double time) const;
+
+	std::size_t cellCount() const;
+
+private:
+	friend class EmissionRaster;
+
+	double                        cellSize;
+	double                        interval;
+	std::map<long long, RasterCells> bins;
+
+	//bin added to last, most rows of a thread fall into it
+	long long                     lastInterval;
+	RasterCells                  *lastCells;
+};
+
+class EmissionRaster
+{
+public:
+	EmissionRaster();
+	~EmissionRaster();
+
+	//cell sizes and time bins the format can take
+	static bool validGrid(double cellSize, double interval);
+
+	//creates <path> and its header for <tileCount> threads. False with a
+	//message in <error> on an invalid grid or if the file cannot be created
+	bool open(const std::string &path, double cellSize, double interval, std::size_t tileCount, std::string &error);
+	bool isOpen() const { return file != nullptr; }
+
+	EmissionRasterTile &tile(std::size_t index) { return *tiles[index]; }
+	std::size_t tileCount() const { return tiles.size(); }
+
+	//nothing before <time> [s] is added any more: once the bin of <time> is
+	//past the last one seen, the tiles are merged and the bins that ended are
+	//written. Call between the additions, not during them. False with a
+	//message in <error> if the file cannot be written
+	bool advance(double time, std::string &error);
+
+	//merges the tiles, writes every bin left and closes the file
+	bool close(std::string &error);
+
+	//cells and chunks written, and the most cells held at a time
+	std::size_t cellsWritten() const { return writtenCells; }
+	std::size_t chunksWritten() const { return writtenChunks; }
+	std::size_t peakCells() const { return heldPeak; }
+
+private:
+	EmissionRaster(const EmissionRaster &);
+	EmissionRaster &operator=(const EmissionRaster &);
+
+	//adds every tile to the open bins, in tile order, and empties the tiles
+	void mergeTiles();
+
+	//writes and drops the open bins before <interval>
+	bool writeBefore(long long interval);
+
+	FILE                                        *file;
+	std::string                                  path;
+	std::vector<std::unique_ptr<EmissionRasterTile> > tiles;
+	std::map<long long, RasterCells>             bins;		//merged, not written yet
+	long long                                    nextInterval;	//bins before it were written
+	std::vector<EmissionRasterRecord>            records;
+	bool                                         failed;
+	std::size_t                                  writtenCells;
+	std::size_t                                  writtenChunks;
+	std::size_t                                  heldPeak;
+};
+
+#endif /* __EMISSIONRASTER_H */
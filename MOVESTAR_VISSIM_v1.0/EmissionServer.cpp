@@ -0,0 +1,363 @@
+/*========================================================================= */
+/* EmissionServer.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* Rounds of the emission server: gathering the steps of the clients,		*/
+/* batch calculation and results written back in place.					*/
+/*========================================================================= */
+
+#include "EmissionServer.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+using namespace std;
+
+
+//idle rounds spent spinning, then yielding, before the server sleeps between rounds;
+//no spinning on a single core, where the clients cannot run meanwhile
+#define SERVER_SPIN_ROUNDS  2000
+#define SERVER_YIELD_ROUNDS 20000
+
+//sleep between idle rounds [us]
+#define SERVER_IDLE_MICROSECONDS 50
+
+//interval of the checks for clients that ended without closing their channel [ms],
+//looked at every so many rounds
+#define SERVER_LIVENESS_MILLISECONDS 1000
+#define SERVER_LIVENESS_ROUNDS       256
+
+EmissionServer::EmissionServer(const SourceTypeRegistry &sourceTypes)
+	: sourceTypes(sourceTypes), resampling(false), header(nullptr), slotVehicles(0), nextId(1),
+	servedSteps(0), servedVehicles(0), servedRounds(0)
+{
+}
+
+EmissionServer::~EmissionServer()
+{
+	close();
+}
+
+bool EmissionServer::open(const string &name, unsigned channels, unsigned slotVehicles, string &error)
+{
+	close();
+	if (channels == 0 || slotVehicles == 0)
+	{
+		error = "a server needs at least one channel of one vehicle";
+		return false;
+	}
+
+	//a segment left behind by a server that ended is replaced, a live one is not
+	SharedMemory existing;
+	string ignored;
+	if (existing.open(name, ignored) && existing.size() >= sizeof(ServerHeader))
+	{
+		const ServerHeader *running = (const ServerHeader *)existing.data();
+		if (memcmp(running->magic, EMISSION_SERVER_MAGIC, sizeof(running->magic)) == 0 &&
+			running->running.load(memory_order_acquire) != 0 && processAlive((unsigned long)running->serverProcess))
+		{
+			error = "a server is already running on " + name;
+			return false;
+		}
+	}
+	existing.close();
+
+	if (!segment.create(name, serverSegmentBytes(channels, slotVehicles), error))
+	{
+		return false;
+	}
+	header = (ServerHeader *)segment.data();
+	memcpy(header->magic, EMISSION_SERVER_MAGIC, sizeof(header->magic));
+	header->version = EMISSION_SERVER_VERSION;
+	header->channelCount = channels;
+	header->slotVehicles = slotVehicles;
+	header->depth = SERVER_CHANNEL_DEPTH;
+	header->slotBytes = serverSlotBytes(slotVehicles);
+	header->serverProcess = currentProcessId();
+	this->slotVehicles = slotVehicles;
+
+	channelVehicles.assign(channels, unordered_map<int64_t, ServerVehicle>());
+	knownGenerations.assign(channels, 0);
+	roundCalculated.assign(channels, 0);
+	roundArrays.assign(channels, ServerSlotArrays());
+	header->running.store(1, memory_order_release);
+	return true;
+}
+
+void EmissionServer::close()
+{
+	if (header != nullptr)
+	{
+		header->running.store(0, memory_order_release);
+	}
+	segment.close();
+	header = nullptr;
+	engines.clear();
+	channelVehicles.clear();
+	knownGenerations.clear();
+	freeIds.clear();
+	nextId = 1;
+}
+
+EmissionServer::StepEngine &EmissionServer::engineFor(double timeStep)
+{
+	for (size_t i = 0; i < engines.size(); i++)
+	{
+		if (engines[i]->timeStep == timeStep)
+		{
+			return *engines[i];
+		}
+	}
+	unique_ptr<StepEngine> group(new StepEngine);
+	group->timeStep = timeStep;
+	group->engine.reset(new EmissionEngine(sourceTypes));
+	group->engine->setTimeStep(timeStep);
+	group->engine->setHistoryResampling(resampling);
+	if (compactTypes)
+	{
+		group->engine->setCompact(compactTypes);
+	}
+	if (grids)
+	{
+		group->engine->setRateGrids(grids);
+	}
+	engines.push_back(move(group));
+	return *engines.back();
+}
+
+void EmissionServer::releaseVehicle(ServerVehicle &vehicle)
+{
+	vehicle.engine->engine->killVehicle(vehicle.id);
+	freeIds.push_back(vehicle.id);
+}
+
+void EmissionServer::dropChannel(size_t channel)
+{
+	unordered_map<int64_t, ServerVehicle> &vehicles = channelVehicles[channel];
+	for (unordered_map<int64_t, ServerVehicle>::iterator it = vehicles.begin(); it != vehicles.end(); ++it)
+	{
+		releaseVehicle(it->second);
+	}
+	vehicles.clear();
+}
+
+void EmissionServer::releaseEndedClients()
+{
+	for (size_t c = 0; c < header->channelCount; c++)
+	{
+		ServerChannel &channel = *serverChannel(header, c);
+		uint64_t owner = channel.owner.load(memory_order_acquire);
+		if (owner == 0 || processAlive((unsigned long)owner))
+		{
+			continue;
+		}
+		//the steps the client left are dropped with its vehicles
+		dropChannel(c);
+		channel.completed.store(channel.submitted.load(memory_order_acquire), memory_order_release);
+		channel.owner.compare_exchange_strong(owner, 0, memory_order_acq_rel);
+	}
+}
+
+size_t EmissionServer::serveOnce()
+{
+	for (size_t i = 0; i < engines.size(); i++)
+	{
+		StepEngine &group = *engines[i];
+		group.vehicleIds.clear();
+		group.vehicleTypes.clear();
+		group.speeds.clear();
+		group.accelerations.clear();
+		group.times.clear();
+		group.channels.clear();
+		group.slotRows.clear();
+	}
+	roundChannels.clear();
+
+	//the next step of every channel, each row to the engine of its step length
+	for (uint32_t c = 0; c < header->channelCount; c++)
+	{
+		ServerChannel &channel = *serverChannel(header, c);
+		uint64_t completed = channel.completed.load(memory_order_relaxed);
+		if (channel.submitted.load(memory_order_acquire) == completed)
+		{
+			continue;
+		}
+		uint64_t generation = channel.generation.load(memory_order_acquire);
+		if (generation != knownGenerations[c])
+		{
+			dropChannel(c);
+			knownGenerations[c] = generation;
+		}
+
+		ServerSlot *slot = serverSlot(header, c, completed);
+		ServerSlotArrays &arrays = roundArrays[c];
+		arrays = serverSlotArrays(slot, slotVehicles);
+		unordered_map<int64_t, ServerVehicle> &vehicles = channelVehicles[c];
+		roundChannels.push_back(c);
+		roundCalculated[c] = 0;
+
+		uint32_t killCount = slot->killCount < slotVehicles ? slot->killCount : (uint32_t)slotVehicles;
+		for (uint32_t k = 0; k < killCount; k++)
+		{
+			unordered_map<int64_t, ServerVehicle>::iterator it = vehicles.find(arrays.kills[k]);
+			if (it != vehicles.end())
+			{
+				releaseVehicle(it->second);
+				vehicles.erase(it);
+			}
+		}
+
+		uint32_t count = slot->count < slotVehicles ? slot->count : (uint32_t)slotVehicles;
+		if (!(slot->timeStep > 0.0))
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				arrays.hc[i] = arrays.co[i] = arrays.nox[i] = arrays.co2[i] = arrays.energy[i] = arrays.pm25[i] = arrays.vsp[i] = 0.0;
+				arrays.opmodes[i] = INVALID_OPMODE;
+			}
+			roundCalculated[c] = SERVER_SLOT_INVALID;
+			continue;
+		}
+		StepEngine &group = engineFor(slot->timeStep);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			unordered_map<int64_t, ServerVehicle>::iterator it = vehicles.find(arrays.vehicleIds[i]);
+			if (it == vehicles.end() || it->second.engine != &group)
+			{
+				//a new vehicle, or one of a client that changed its step length
+				long id = nextId;
+				if (freeIds.empty())
+				{
+					nextId++;
+				}
+				else
+				{
+					id = freeIds.back();
+					freeIds.pop_back();
+				}
+				ServerVehicle vehicle = { id, &group };
+				if (it != vehicles.end())
+				{
+					releaseVehicle(it->second);
+					it->second = vehicle;
+				}
+				else
+				{
+					it = vehicles.insert(make_pair(arrays.vehicleIds[i], vehicle)).first;
+				}
+			}
+			group.vehicleIds.push_back(it->second.id);
+			group.vehicleTypes.push_back(arrays.vehicleTypes[i]);
+			group.speeds.push_back(arrays.speeds[i]);
+			group.accelerations.push_back(arrays.accelerations[i]);
+			group.times.push_back(slot->time);
+			group.channels.push_back(c);
+			group.slotRows.push_back(i);
+		}
+	}
+	if (roundChannels.empty())
+	{
+		return 0;
+	}
+
+	for (size_t i = 0; i < engines.size(); i++)
+	{
+		if (!engines[i]->vehicleIds.empty())
+		{
+			calculate(*engines[i]);
+		}
+	}
+
+	//results are in place, the clients may read them
+	for (size_t i = 0; i < roundChannels.size(); i++)
+	{
+		uint32_t c = roundChannels[i];
+		ServerChannel &channel = *serverChannel(header, c);
+		uint64_t completed = channel.completed.load(memory_order_relaxed);
+		ServerSlot *slot = serverSlot(header, c, completed);
+		slot->status = roundCalculated[c];
+		servedVehicles += slot->count;
+		channel.completed.store(completed + 1, memory_order_release);
+	}
+	servedSteps += roundChannels.size();
+	servedRounds++;
+	return roundChannels.size();
+}
+
+void EmissionServer::calculate(StepEngine &group)
+{
+	size_t count = group.vehicleIds.size();
+	if (group.hc.size() < count)
+	{
+		group.hc.resize(count);
+		group.co.resize(count);
+		group.nox.resize(count);
+		group.co2.resize(count);
+		group.energy.resize(count);
+		group.pm25.resize(count);
+		group.vsp.resize(count);
+		group.opmodes.resize(count);
+	}
+	EmissionBatch batch = { count, group.vehicleIds.data(), group.vehicleTypes.data(), group.speeds.data(),
+		group.accelerations.data(), nullptr, group.times.data(),
+		group.hc.data(), group.co.data(), group.nox.data(), group.co2.data(), group.energy.data(), group.pm25.data(),
+		group.vsp.data(), group.opmodes.data() };
+	group.engine->calculate(batch);
+
+	//scattered back into the slots of the clients
+	const SourceTypeModel *const *sourceTypes = group.engine->lastSourceTypes();
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t c = group.channels[i];
+		const ServerSlotArrays &arrays = roundArrays[c];
+		uint32_t row = group.slotRows[i];
+		bool known = (sourceTypes[i] != nullptr);
+		arrays.hc[row] = group.hc[i];
+		arrays.co[row] = group.co[i];
+		arrays.nox[row] = group.nox[i];
+		arrays.co2[row] = group.co2[i];
+		arrays.energy[row] = group.energy[i];
+		arrays.pm25[row] = group.pm25[i];
+		arrays.vsp[row] = known ? group.vsp[i] : 0.0;
+		arrays.opmodes[row] = known ? group.opmodes[i] : INVALID_OPMODE;
+		if (known)
+		{
+			roundCalculated[c]++;
+		}
+	}
+}
+
+void EmissionServer::run(const atomic<bool> &stop)
+{
+	unsigned spinRounds = thread::hardware_concurrency() > 1 ? SERVER_SPIN_ROUNDS : 0;
+	unsigned idleRounds = 0;
+	uint64_t round = 0;
+	chrono::steady_clock::time_point lastCheck = chrono::steady_clock::now();
+	while (!stop.load(memory_order_relaxed))
+	{
+		if (++round % SERVER_LIVENESS_ROUNDS == 0)
+		{
+			chrono::steady_clock::time_point now = chrono::steady_clock::now();
+			if (now - lastCheck >= chrono::milliseconds(SERVER_LIVENESS_MILLISECONDS))
+			{
+				releaseEndedClients();
+				lastCheck = now;
+			}
+		}
+		if (serveOnce() > 0)
+		{
+			idleRounds = 0;
+			continue;
+		}
+		if (idleRounds < spinRounds)
+		{
+			idleRounds++;
+			continue;
+		}
+		if (idleRounds < SERVER_YIELD_ROUNDS)
+		{
+			idleRounds++;
+			this_thread::yield();
+			continue;
+		}
+		this_thread::sleep_for(chrono::microseconds(SERVER_IDLE_MICROSECONDS));
+	}
+}
@@ -0,0 +1,120 @@
+/*========================================================================= */
+/* EmissionServer.h                                  Core module of MOVESTAR */
+/*																			*/
+/* Emission server for simulators that cannot load the VISSIM DLL. Clients	*/
+/* in other processes submit the vehicles of each time step through shared	*/
+/* memory (EmissionServerProtocol.h); every round the server takes the		*/
+/* next step of every client, calculates them as one batch per time step	*/
+/* length and writes the results back into the clients' slots. Vehicle	*/
+/* numbers are per client: the server maps them to vehicles of its own.	*/
+/*========================================================================= */
+
+#ifndef __EMISSIONSERVER_H
+#define __EMISSIONSERVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CompactModel.h"
+#include "EmissionEngine.h"
+#include "EmissionServerProtocol.h"
+#include "RateGrid.h"
+#include "SharedMemory.h"
+#include "SourceTypeRegistry.h"
+
+class EmissionServer
+{
+public:
+	explicit EmissionServer(const SourceTypeRegistry &sourceTypes);
+	~EmissionServer();
+
+	//configuration of the engines, as EmissionEngine; before open
+	void setRateGrids(const std::shared_ptr<const RateGrids> &grids) { this->grids = grids; }
+	void setHistoryResampling(bool resampling) { this->resampling = resampling; }
+	void setCompact(const std::shared_ptr<const CompactSourceTypes> &compactTypes) { this->compactTypes = compactTypes; }
+
+	//creates the segment <name> for <channels> clients of up to <slotVehicles>
+	//vehicles per step; false with a message in <error> if it cannot be created
+	//or another server is running on it
+	bool open(const std::string &name, unsigned channels, unsigned slotVehicles, std::string &error);
+
+	//tells the clients the server stopped and removes the segment
+	void close();
+
+	//serves until <stop> is set: spins while steps arrive, then backs off to
+	//short sleeps; channels of clients that ended without closing are released
+	void run(const std::atomic<bool> &stop);
+
+	//one round: calculates the next step of every channel that submitted one,
+	//returns the steps calculated
+	std::size_t serveOnce();
+
+	//steps and vehicle-steps calculated, and rounds that calculated any
+	uint64_t steps() const { return servedSteps; }
+	uint64_t vehicleSteps() const { return servedVehicles; }
+	uint64_t rounds() const { return servedRounds; }
+
+private:
+	EmissionServer(const EmissionServer &);
+	EmissionServer &operator=(const EmissionServer &);
+
+	//the engine of one time step length and the rows of a round for it
+	struct StepEngine
+	{
+		double                          timeStep;
+		std::unique_ptr<EmissionEngine> engine;
+		std::vector<long>               vehicleIds;
+		std::vector<long>               vehicleTypes;
+		std::vector<double>             speeds;
+		std::vector<double>             accelerations;
+		std::vector<double>             times;
+		std::vector<double>             hc, co, nox, co2, energy, pm25, vsp;
+		std::vector<int>                opmodes;
+		std::vector<uint32_t>           channels;		//channel and slot row of each row
+		std::vector<uint32_t>           slotRows;
+	};
+
+	//server vehicle of a client vehicle
+	struct ServerVehicle
+	{
+		long        id;
+		StepEngine *engine;
+	};
+
+	StepEngine &engineFor(double timeStep);
+	void releaseVehicle(ServerVehicle &vehicle);
+	void dropChannel(std::size_t channel);
+	void releaseEndedClients();
+	void calculate(StepEngine &group);
+
+	const SourceTypeRegistry                  &sourceTypes;
+	std::shared_ptr<const RateGrids>           grids;
+	std::shared_ptr<const CompactSourceTypes>  compactTypes;
+	bool                                       resampling;
+
+	SharedMemory                               segment;
+	ServerHeader                              *header;
+	std::size_t                                slotVehicles;
+
+	std::vector<std::unique_ptr<StepEngine> >  engines;
+	std::vector<std::unordered_map<int64_t, ServerVehicle> > channelVehicles;
+	std::vector<uint64_t>                      knownGenerations;
+	std::vector<long>                          freeIds;
+	long                                       nextId;
+
+	//channels taking part in the current round; by channel, the arrays of its
+	//slot and its vehicles with a source type
+	std::vector<uint32_t>                      roundChannels;
+	std::vector<ServerSlotArrays>              roundArrays;
+	std::vector<int32_t>                       roundCalculated;
+
+	uint64_t                                   servedSteps;
+	uint64_t                                   servedVehicles;
+	uint64_t                                   servedRounds;
+};
+
+#endif /* __EMISSIONSERVER_H */
@@ -0,0 +1,150 @@
+/*========================================================================= */
+/* EmissionServerProtocol.h                          Core module of MOVESTAR */
+/*																			*/
+/* Shared memory layout of the emission server. Each client process claims	*/
+/* a channel, a ring of step slots: it fills the vehicles of a time step	*/
+/* into the next slot and publishes it by advancing <submitted>; the server	*/
+/* calculates the slot in place and advances <completed>. The two counters	*/
+/* are the only synchronisation, on cache lines of their own. Integers are	*/
+/* fixed-width so clients and server may be built by different compilers	*/
+/* of one platform.															*/
+/*========================================================================= */
+
+#ifndef __EMISSIONSERVERPROTOCOL_H
+#define __EMISSIONSERVERPROTOCOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define EMISSION_SERVER_MAGIC   "MVSTRSRV"
+#define EMISSION_SERVER_VERSION 1
+
+#define DEFAULT_SERVER_NAME          "movestar"
+#define DEFAULT_SERVER_CHANNELS      16
+#define DEFAULT_SERVER_SLOT_VEHICLES 4096
+
+//slots of the ring of a channel, steps a client may have in flight
+#define SERVER_CHANNEL_DEPTH 4
+
+#define SERVER_CACHE_LINE 64
+
+//status of a calculated slot with an invalid time step
+#define SERVER_SLOT_INVALID (-1)
+
+//start of the segment
+struct ServerHeader
+{
+	char                  magic[8];
+	uint32_t              version;
+	uint32_t              channelCount;
+	uint32_t              slotVehicles;		//vehicles (and kills) of a step at most
+	uint32_t              depth;				//slots per channel
+	uint64_t              slotBytes;
+	uint64_t              serverProcess;
+	std::atomic<uint32_t> running;			//cleared when the server stops
+};
+
+//one client: the ring of its steps
+struct ServerChannel
+{
+	alignas(SERVER_CACHE_LINE) std::atomic<uint64_t> owner;	//process of the client, 0 if free
+	std::atomic<uint64_t>                            generation;	//claims so far; the server drops the vehicles of the last client on a new one
+	alignas(SERVER_CACHE_LINE) std::atomic<uint64_t> submitted;	//client: steps submitted
+	alignas(SERVER_CACHE_LINE) std::atomic<uint64_t> completed;	//server: steps calculated
+};
+
+//one time step of a client, followed by its arrays (see ServerSlotArrays)
+struct ServerSlot
+{
+	double   time;			//[s]
+	double   timeStep;		//[s]
+	uint32_t count;			//vehicles calculated
+	uint32_t killCount;		//vehicles that left the network, released before the calculation
+	int32_t  status;		//result: vehicles with a source type, or SERVER_SLOT_INVALID
+	uint32_t reserved;
+};
+
+//arrays of a slot: inputs filled by the client, results written by the server
+struct ServerSlotArrays
+{
+	int64_t *vehicleIds;
+	int32_t *vehicleTypes;
+	double  *speeds;			//[m/s]
+	double  *accelerations;		//[m/s2]
+	int64_t *kills;				//vehicles leaving the network
+
+	//emissions [g/s], energy [KJ/s], VSP and opmode (INVALID_OPMODE for vehicles
+	//without a source type) of each vehicle
+	double  *hc;
+	double  *co;
+	double  *nox;
+	double  *co2;
+	double  *energy;
+	double  *pm25;
+	double  *vsp;
+	int32_t *opmodes;
+};
+
+inline std::size_t serverAlign(std::size_t size)
+{
+	return (size + SERVER_CACHE_LINE - 1) / SERVER_CACHE_LINE * SERVER_CACHE_LINE;
+}
+
+//bytes of a slot of <vehicles> vehicles
+inline std::size_t serverSlotBytes(std::size_t vehicles)
+{
+	return serverAlign(sizeof(ServerSlot)) + 11 * serverAlign(vehicles * 8) + 2 * serverAlign(vehicles * 4);
+}
+
+inline std::size_t serverChannelsOffset()
+{
+	return serverAlign(sizeof(ServerHeader));
+}
+
+inline std::size_t serverSlotsOffset(std::size_t channels)
+{
+	return serverChannelsOffset() + serverAlign(channels * sizeof(ServerChannel));
+}
+
+//bytes of the segment
+inline std::size_t serverSegmentBytes(std::size_t channels, std::size_t vehicles)
+{
+	return serverSlotsOffset(channels) + channels * SERVER_CHANNEL_DEPTH * serverSlotBytes(vehicles);
+}
+
+inline ServerChannel *serverChannel(void *segment, std::size_t channel)
+{
+	return (ServerChannel *)((char *)segment + serverChannelsOffset()) + channel;
+}
+
+//slot <index> (a step count, taken modulo the depth) of <channel>
+inline ServerSlot *serverSlot(void *segment, std::size_t channel, uint64_t index)
+{
+	const ServerHeader *header = (const ServerHeader *)segment;
+	std::size_t slot = channel * header->depth + (std::size_t)(index % header->depth);
+	return (ServerSlot *)((char *)segment + serverSlotsOffset(header->channelCount) + slot * header->slotBytes);
+}
+
+inline ServerSlotArrays serverSlotArrays(ServerSlot *slot, std::size_t vehicles)
+{
+	char *next = (char *)slot + serverAlign(sizeof(ServerSlot));
+	std::size_t wide = serverAlign(vehicles * 8), narrow = serverAlign(vehicles * 4);
+	ServerSlotArrays arrays;
+	arrays.vehicleIds = (int64_t *)next;
+	arrays.kills = (int64_t *)(next += wide);
+	arrays.speeds = (double *)(next += wide);
+	arrays.accelerations = (double *)(next += wide);
+	arrays.hc = (double *)(next += wide);
+	arrays.co = (double *)(next += wide);
+	arrays.nox = (double *)(next += wide);
+	arrays.co2 = (double *)(next += wide);
+	arrays.energy = (double *)(next += wide);
+	arrays.pm25 = (double *)(next += wide);
+	arrays.vsp = (double *)(next += wide);
+	arrays.vehicleTypes = (int32_t *)(next += wide);
+	arrays.opmodes = (int32_t *)(next += narrow);
+	return arrays;
+}
+
+#endif /* __EMISSIONSERVERPROTOCOL_H */
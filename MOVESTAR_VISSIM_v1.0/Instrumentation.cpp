@@ -0,0 +1,186 @@
+/*========================================================================= */
+/* Instrumentation.cpp                               Core module of MOVESTAR */
+/*																			*/
+/* Call and opmode counters of a context and their JSON snapshots.			*/
+/*========================================================================= */
+
+#include "Instrumentation.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+
+//names of the calls in the snapshots, in the order of InstrumentedCall
+static const char *const callNames[INSTRUMENTED_CALL_COUNT] =
+{
+	"SetValue", "GetValue", "Init", "CreateVehicle", "KillVehicle", "CalculateVehicle", "WriteSummary", "OtherCommand",
+	"CalculateBatch"
+};
+
+static bool bySourceType(const OpmodeHistogram &a, const OpmodeHistogram &b)
+{
+	return a.sourceTypeId < b.sourceTypeId;
+}
+
+
+Instrumentation::Instrumentation()
+	: lastOpmodes(0), snapshotFile(nullptr), snapshotInterval(DEFAULT_SNAPSHOT_INTERVAL), nextSnapshot(0.0)
+{
+	memset(calls, 0, sizeof(calls));
+}
+
+Instrumentation::~Instrumentation()
+{
+	if (snapshotFile != nullptr)
+	{
+		fclose(snapshotFile);
+	}
+}
+
+void Instrumentation::addLatency(InstrumentedCall call, uint64_t nanoseconds)
+{
+	int bucket = 0;
+	while (bucket < LATENCY_BUCKET_COUNT - 1 && (nanoseconds >> (bucket + 1)) != 0)
+	{
+		bucket++;
+	}
+	CallStatistics &statistics = calls[call];
+	statistics.timedCalls++;
+	statistics.timedNanoseconds += nanoseconds;
+	statistics.latencies[bucket]++;
+}
+
+void Instrumentation::countOpmodeBatch(size_t count, const SourceTypeModel *const *sourceTypes, const int *opmodes)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		if (sourceTypes[i] == nullptr)
+		{
+			continue;
+		}
+
+		//vehicles of one source type tend to come in runs
+		int sourceTypeId = sourceTypes[i]->sourceTypeId;
+		if (lastOpmodes >= this->opmodes.size() || this->opmodes[lastOpmodes].sourceTypeId != sourceTypeId)
+		{
+			lastOpmodes = 0;
+			while (lastOpmodes < this->opmodes.size() && this->opmodes[lastOpmodes].sourceTypeId != sourceTypeId)
+			{
+				lastOpmodes++;
+			}
+			if (lastOpmodes == this->opmodes.size())
+			{
+				OpmodeHistogram created = {};
+				created.sourceTypeId = sourceTypeId;
+				this->opmodes.push_back(created);
+			}
+		}
+		int row = rateRowOfOpmode(opmodes[i]);
+		this->opmodes[lastOpmodes].counts[row < 0 ? OPMODE_ROW_COUNT : row]++;
+	}
+}
+
+string Instrumentation::snapshot(double time, const VehicleStateTable &vehicles) const
+{
+	char buffer[256];
+	string json;
+	snprintf(buffer, sizeof(buffer), "{\"time\":%.9g,\"liveVehicles\":%zu,\"stateSlots\":%zu,\"calls\":{",
+		time, vehicles.liveCount(), vehicles.capacity());
+	json += buffer;
+	for (int call = 0; call < INSTRUMENTED_CALL_COUNT; call++)
+	{
+		const CallStatistics &statistics = calls[call];
+		snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"calls\":%llu,\"timed\":%llu,\"meanNs\":%.6g,\"latencyNs\":{",
+			call > 0 ? "," : "", callNames[call], (unsigned long long)statistics.calls, (unsigned long long)statistics.timedCalls,
+			statistics.timedCalls > 0 ? (double)statistics.timedNanoseconds / statistics.timedCalls : 0.0);
+		json += buffer;
+
+		//non-empty buckets by their lower bound
+		bool first = true;
+		for (int bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++)
+		{
+			if (statistics.latencies[bucket] == 0)
+			{
+				continue;
+			}
+			snprintf(buffer, sizeof(buffer), "%s\"%llu\":%llu", first ? "" : ",", bucket == 0 ? 0ULL : 1ULL << bucket,
+				(unsigned long long)statistics.latencies[bucket]);
+			json += buffer;
+			first = false;
+		}
+		json += "}}";
+	}
+	json += "},\"opmodes\":{";
+
+	vector<OpmodeHistogram> sorted(opmodes);
+	sort(sorted.begin(), sorted.end(), bySourceType);
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		snprintf(buffer, sizeof(buffer), "%s\"%d\":{", i > 0 ? "," : "", sorted[i].sourceTypeId);
+		json += buffer;
+		bool first = true;
+		for (int row = 0; row < OPMODE_BUCKET_COUNT; row++)
+		{
+			if (sorted[i].counts[row] == 0)
+			{
+				continue;
+			}
+			if (row < OPMODE_ROW_COUNT)
+			{
+				snprintf(buffer, sizeof(buffer), "%s\"%d\":%llu", first ? "" : ",", opmodeOfRow[row],
+					(unsigned long long)sorted[i].counts[row]);
+			}
+			else
+			{
+				snprintf(buffer, sizeof(buffer), "%s\"invalid\":%llu", first ? "" : ",", (unsigned long long)sorted[i].counts[row]);
+			}
+			json += buffer;
+			first = false;
+		}
+		json += "}";
+	}
+	json += "}}";
+	return json;
+}
+
+bool Instrumentation::openSnapshots(const string &path, double interval, double time, string &error)
+{
+	if (snapshotFile != nullptr)
+	{
+		fclose(snapshotFile);
+	}
+	snapshotFile = fopen(path.c_str(), "w");
+	if (snapshotFile == nullptr)
+	{
+		error = "cannot create " + path;
+		return false;
+	}
+	snapshotInterval = (interval > 0.0) ? interval : DEFAULT_SNAPSHOT_INTERVAL;
+	nextSnapshot = time + snapshotInterval;
+	return true;
+}
+
+void Instrumentation::writeSnapshot(double time, const VehicleStateTable &vehicles)
+{
+	string json = snapshot(time, vehicles);
+	fprintf(snapshotFile, "%s\n", json.c_str());
+	fflush(snapshotFile);
+
+	//skip the snapshots a jump in time passed over
+	if (nextSnapshot <= time)
+	{
+		nextSnapshot += snapshotInterval * (floor((time - nextSnapshot) / snapshotInterval) + 1.0);
+	}
+}
+
+void Instrumentation::closeSnapshots(double time, const VehicleStateTable &vehicles)
+{
+	if (snapshotFile == nullptr)
+	{
+		return;
+	}
+	writeSnapshot(time, vehicles);
+	fclose(snapshotFile);
+	snapshotFile = nullptr;
+}
@@ -0,0 +1,184 @@
+/*========================================================================= */
+/* Instrumentation.h                                 Core module of MOVESTAR */
+/*																			*/
+/* Counters of the calls into the emission model API: calls and latency	*/
+/* histograms per function and command, the opmodes calculated per source	*/
+/* type, and snapshots of them as JSON. An Instrumentation belongs to one	*/
+/* context, which only one thread uses at a time, so the counters are		*/
+/* plain integers with no locking or atomics. Commands are timed on one	*/
+/* call in LATENCY_SAMPLE_PERIOD, so the clock stays off the hot path;		*/
+/* SetValue and GetValue take less than a clock read and are only counted.	*/
+/*																			*/
+/* The API hooks (INSTRUMENT_CALL, INSTRUMENT_COUNT) compile to nothing	*/
+/* unless MOVESTAR_INSTRUMENTATION is defined.								*/
+/*========================================================================= */
+
+#ifndef __INSTRUMENTATION_H
+#define __INSTRUMENTATION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "MovestarRates.h"
+#include "SourceTypeRegistry.h"
+#include "VehicleStateTable.h"
+
+//calls counted separately
+enum InstrumentedCall
+{
+	CALL_SET_VALUE,
+	CALL_GET_VALUE,
+	CALL_INIT,
+	CALL_CREATE_VEHICLE,
+	CALL_KILL_VEHICLE,
+	CALL_CALCULATE_VEHICLE,
+	CALL_WRITE_SUMMARY,
+	CALL_OTHER_COMMAND,
+	CALL_CALCULATE_BATCH,
+	INSTRUMENTED_CALL_COUNT
+};
+
+//latency bucket b holds the calls taking [2^b, 2^(b+1)) ns (bucket 0 also 0 ns)
+#define LATENCY_BUCKET_COUNT 32
+
+//one call in this many is timed (a power of 2)
+#define LATENCY_SAMPLE_PERIOD 1024
+
+//opmode buckets: one per rate table row, then one for the opmodes without rates
+#define OPMODE_BUCKET_COUNT (OPMODE_ROW_COUNT + 1)
+
+//default simulation time between two snapshots written to the snapshot file [s]
+#define DEFAULT_SNAPSHOT_INTERVAL 60.0
+
+struct CallStatistics
+{
+	uint64_t calls;
+	uint64_t timedCalls;
+	uint64_t timedNanoseconds;
+	uint64_t latencies[LATENCY_BUCKET_COUNT];
+};
+
+struct OpmodeHistogram
+{
+	int      sourceTypeId;
+	uint64_t counts[OPMODE_BUCKET_COUNT];
+};
+
+class Instrumentation
+{
+public:
+	Instrumentation();
+	~Instrumentation();
+
+	//counts a call, true if it is one to time
+	bool count(InstrumentedCall call)
+	{
+		return (calls[call].calls++ & (LATENCY_SAMPLE_PERIOD - 1)) == 0;
+	}
+
+	//counts a call that is never timed
+	void countUntimed(InstrumentedCall call)
+	{
+		calls[call].calls++;
+	}
+
+	void addLatency(InstrumentedCall call, uint64_t nanoseconds);
+
+	//counts the opmodes of <count> vehicles calculated with <sourceTypes>
+	//(null for vehicles not calculated)
+	void countOpmodes(std::size_t count, const SourceTypeModel *const *sourceTypes, const int *opmodes)
+	{
+		//single vehicle protocol: one vehicle of the source type of the last one
+		if (count == 1 && sourceTypes[0] != nullptr && lastOpmodes < this->opmodes.size() &&
+			this->opmodes[lastOpmodes].sourceTypeId == sourceTypes[0]->sourceTypeId)
+		{
+			int row = rateRowOfOpmode(opmodes[0]);
+			this->opmodes[lastOpmodes].counts[row < 0 ? OPMODE_ROW_COUNT : row]++;
+			return;
+		}
+		countOpmodeBatch(count, sourceTypes, opmodes);
+	}
+
+	const CallStatistics &statistics(InstrumentedCall call) const { return calls[call]; }
+
+	//JSON object of the counters at simulation time <time>, with the vehicles
+	//of <vehicles>
+	std::string snapshot(double time, const VehicleStateTable &vehicles) const;
+
+	//starts writing snapshots to <path>, one JSON object per line, every
+	//<interval> [s] of simulation time from <time> on; false with a message in
+	//<error> if the file cannot be created
+	bool openSnapshots(const std::string &path, double interval, double time, std::string &error);
+	bool snapshotsOpen() const { return snapshotFile != nullptr; }
+
+	//writes a snapshot if the simulation time reached the next one
+	void snapshotDue(double time, const VehicleStateTable &vehicles)
+	{
+		if (snapshotFile != nullptr && time >= nextSnapshot)
+		{
+			writeSnapshot(time, vehicles);
+		}
+	}
+
+	//writes a last snapshot and closes the file
+	void closeSnapshots(double time, const VehicleStateTable &vehicles);
+
+private:
+	Instrumentation(const Instrumentation &);
+	Instrumentation &operator=(const Instrumentation &);
+
+	void countOpmodeBatch(std::size_t count, const SourceTypeModel *const *sourceTypes, const int *opmodes);
+	void writeSnapshot(double time, const VehicleStateTable &vehicles);
+
+	CallStatistics               calls[INSTRUMENTED_CALL_COUNT];
+
+	//one histogram per source type seen, the last one used first
+	std::vector<OpmodeHistogram> opmodes;
+	std::size_t                  lastOpmodes;
+
+	FILE                        *snapshotFile;
+	double                       snapshotInterval;
+	double                       nextSnapshot;
+};
+
+//times the rest of the enclosing block as a call of one kind
+class InstrumentedScope
+{
+public:
+	InstrumentedScope(Instrumentation &instrumentation, InstrumentedCall call)
+		: instrumentation(instrumentation), call(call), timed(instrumentation.count(call))
+	{
+		if (timed)
+		{
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~InstrumentedScope()
+	{
+		if (timed)
+		{
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+			instrumentation.addLatency(call, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		}
+	}
+
+private:
+	Instrumentation                       &instrumentation;
+	InstrumentedCall                       call;
+	bool                                   timed;
+	std::chrono::steady_clock::time_point  start;
+};
+
+#ifdef MOVESTAR_INSTRUMENTATION
+#define INSTRUMENT_CALL(instrumentation, call) InstrumentedScope instrumentedScope(instrumentation, call)
+#define INSTRUMENT_COUNT(instrumentation, call) (instrumentation).countUntimed(call)
+#else
+#define INSTRUMENT_CALL(instrumentation, call) ((void)0)
+#define INSTRUMENT_COUNT(instrumentation, call) ((void)0)
+#endif
+
+#endif /* __INSTRUMENTATION_H */
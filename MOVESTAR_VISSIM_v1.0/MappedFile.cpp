@@ -0,0 +1,198 @@
+/*========================================================================= */
+/* MappedFile.cpp                        VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Read-only memory mapping of a whole file (Windows and POSIX).			*/
+/*========================================================================= */
+
+#include "MappedFile.h"
+#include <algorithm>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+
+MappedFile::MappedFile()
+	: data_(nullptr), size_(0)
+#ifdef _WIN32
+	, file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const string &path)
+{
+	close();
+	file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file_, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_ == nullptr)
+	{
+		close();
+		return false;
+	}
+	data_ = (const unsigned char *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+	if (data_ == nullptr)
+	{
+		close();
+		return false;
+	}
+	size_ = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data_ != nullptr)
+	{
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_ != nullptr)
+	{
+		CloseHandle(mapping_);
+	}
+	if (file_ != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file_);
+	}
+	data_ = nullptr;
+	size_ = 0;
+	mapping_ = nullptr;
+	file_ = INVALID_HANDLE_VALUE;
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+	SYSTEM_INFO system;
+	GetSystemInfo(&system);
+	size_t page = system.dwPageSize;
+	size_t first = (offset + page - 1) / page * page;
+	size_t last = min(offset + size, size_) / page * page;
+	if (data_ != nullptr && first < last)
+	{
+		//unlocking pages that are not locked takes them out of the working set
+		VirtualUnlock((void *)(data_ + first), last - first);
+	}
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+#if _WIN32_WINNT >= 0x0602
+	if (data_ != nullptr && offset < size_)
+	{
+		WIN32_MEMORY_RANGE_ENTRY range = { (void *)(data_ + offset), min(size, size_ - offset) };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+#else
+	//before Windows 8 the pages are read as they are touched
+	(void)offset;
+	(void)size;
+#endif
+}
+
+bool statFile(const string &path, unsigned long long &size, long long &modified)
+{
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+	{
+		return false;
+	}
+	size = (unsigned long long)info.st_size;
+	modified = (long long)info.st_mtime;
+	return true;
+}
+
+#else
+
+bool MappedFile::open(const string &path)
+{
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		return false;
+	}
+	data_ = (const unsigned char *)mapped;
+	size_ = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data_ != nullptr)
+	{
+		munmap((void *)data_, size_);
+	}
+	data_ = nullptr;
+	size_ = 0;
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t first = (offset + page - 1) / page * page;
+	size_t last = min(offset + size, size_) / page * page;
+	if (data_ != nullptr && first < last)
+	{
+		madvise((void *)(data_ + first), last - first, MADV_DONTNEED);
+	}
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t first = offset / page * page;
+	size_t last = min(offset + size, size_);
+	if (data_ != nullptr && first < last)
+	{
+		madvise((void *)(data_ + first), last - first, MADV_WILLNEED);
+	}
+}
+
+bool statFile(const string &path, unsigned long long &size, long long &modified)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		return false;
+	}
+	size = (unsigned long long)info.st_size;
+	modified = (long long)info.st_mtime;
+	return true;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*========================================================================= */
+/* MappedFile.h                          VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Read-only memory mapping of a whole file (Windows and POSIX).			*/
+/*========================================================================= */
+
+#ifndef __MAPPEDFILE_H
+#define __MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	//maps <path> read-only, returns false (and leaves the object closed) on failure
+	bool open(const std::string &path);
+	void close();
+
+	bool isOpen() const { return data_ != nullptr; }
+	const unsigned char *data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+	//gives the pages of <size> bytes from <offset> back to the system; they are
+	//read from the file again if touched. Partial pages at the ends are kept
+	void release(std::size_t offset, std::size_t size) const;
+
+	//asks the system to read the pages of <size> bytes from <offset> ahead,
+	//without waiting for them
+	void prefetch(std::size_t offset, std::size_t size) const;
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const unsigned char *data_;
+	std::size_t          size_;
+#ifdef _WIN32
+	void                *file_;
+	void                *mapping_;
+#endif
+};
+
+//size and modification time of a file, false if it does not exist
+bool statFile(const std::string &path, unsigned long long &size, long long &modified);
+
+#endif /* __MAPPEDFILE_H */
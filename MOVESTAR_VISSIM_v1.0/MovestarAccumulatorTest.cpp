@@ -0,0 +1,274 @@
+/*========================================================================= */
+/* MovestarAccumulatorTest.cpp                       Core module of MOVESTAR */
+/*																			*/
+/* movestar_accumulator_test: emission totals of a run through the library.	*/
+/* Vehicles change links and some leave the network; the total of every	*/
+/* vehicle must equal the sum of its rates times the time step bit for bit,	*/
+/* the link, window and type totals must add up to the network total and	*/
+/* to the steps they hold, and every vehicle killed must be dropped from	*/
+/* the run and written to <prefix>_veh.csv with its totals, once, like the	*/
+/* vehicles the summary writes at the end.									*/
+/*========================================================================= */
+
+#include "EmissionModel.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+#define ACCUMULATOR_TEST_VEHICLES 30
+#define ACCUMULATOR_TEST_STEPS    100
+#define ACCUMULATOR_TEST_TIMESTEP 0.1
+#define ACCUMULATOR_TEST_WINDOW   2.0
+#define ACCUMULATOR_TEST_LINKS    3
+
+//every this many vehicles one leaves, at step ACCUMULATOR_TEST_KILL_STEP + its number
+#define ACCUMULATOR_TEST_KILL_EVERY 5
+#define ACCUMULATOR_TEST_KILL_STEP  60
+
+//relative difference allowed between totals summed in a different order
+#define ACCUMULATOR_TEST_TOLERANCE 1e-12
+
+static const long vehicleTypes[3] = { 100, 200, 300 };
+static const long pollutants[6] = { EMISSION_DATA_HC, EMISSION_DATA_CO, EMISSION_DATA_NOX, EMISSION_DATA_CO2,
+	EMISSION_DATA_FUEL, EMISSION_DATA_PART };
+
+//totals of the six pollutants, in the order of pollutants[]
+struct Totals
+{
+	double values[6];
+
+	Totals() { memset(values, 0, sizeof(values)); }
+};
+
+//what the test adds up itself from the rates the model returns
+struct Expected
+{
+	map<long, Totals> vehicles;
+	map<long, Totals> links;
+	map<long, Totals> windows;
+	map<long, Totals> types;
+	Totals            network;
+	map<long, long>   lastLinks;
+};
+
+static bool killed(int vehicle, int step)
+{
+	return vehicle % ACCUMULATOR_TEST_KILL_EVERY == 0 && step >= ACCUMULATOR_TEST_KILL_STEP + vehicle;
+}
+
+static bool agrees(double value, double expected)
+{
+	return fabs(value - expected) <= ACCUMULATOR_TEST_TOLERANCE * fabs(expected);
+}
+
+static void replay(MovestarContext *context, Expected &expected)
+{
+	mt19937_64 random(9);
+	uniform_real_distribution<double> speed(0.0, 30.0), acceleration(-3.0, 2.0);
+	for (int s = 0; s < ACCUMULATOR_TEST_STEPS; s++)
+	{
+		double time = s * ACCUMULATOR_TEST_TIMESTEP;
+		EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, ACCUMULATOR_TEST_TIMESTEP, nullptr);
+		EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, time, nullptr);
+		for (int v = 1; v <= ACCUMULATOR_TEST_VEHICLES; v++)
+		{
+			long type = vehicleTypes[v % 3];
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ID, 0, 0, v, 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_TYPE, 0, 0, type, 0.0, nullptr);
+			if (killed(v, s))
+			{
+				if (!killed(v, s - 1))
+				{
+					EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_KILL_VEHICLE);
+				}
+				continue;
+			}
+			if (s == 0)
+			{
+				EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CREATE_VEHICLE);
+			}
+			long link = 1 + (v + s / 25) % ACCUMULATOR_TEST_LINKS;
+			EmissionModelContextSetValue(context, EMISSION_DATA_LINK, 0, 0, link, 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_VELOCITY, 0, 0, 0, speed(random), nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ACCELERATION, 0, 0, 0, acceleration(random), nullptr);
+			EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CALCULATE_VEHICLE);
+
+			long window = (long)floor(time / ACCUMULATOR_TEST_WINDOW);
+			for (int p = 0; p < 6; p++)
+			{
+				double rate = 0.0;
+				EmissionModelContextGetValue(context, pollutants[p], 0, 0, nullptr, &rate, nullptr);
+				double emission = rate * ACCUMULATOR_TEST_TIMESTEP;
+				expected.vehicles[v].values[p] += emission;
+				expected.links[link].values[p] += emission;
+				expected.windows[window].values[p] += emission;
+				expected.types[type].values[p] += emission;
+				expected.network.values[p] += emission;
+			}
+			expected.lastLinks[v] = link;
+		}
+	}
+}
+
+//totals of the vehicles still on the network, false if one differs from the sum of its steps
+static bool checkVehicles(MovestarContext *context, const Expected &expected, size_t &checked)
+{
+	bool same = true;
+	for (int v = 1; v <= ACCUMULATOR_TEST_VEHICLES; v++)
+	{
+		for (int p = 0; p < 6; p++)
+		{
+			double total = 0.0;
+			bool found = EmissionModelContextGetValue(context, EMISSION_DATA_VEHICLE_TOTAL, v, pollutants[p], nullptr, &total, nullptr) != 0;
+			if (killed(v, ACCUMULATOR_TEST_STEPS))
+			{
+				//dropped when it left
+				same = same && !found;
+				continue;
+			}
+			double sum = expected.vehicles.at(v).values[p];
+			if (!found || memcmp(&total, &sum, sizeof(total)) != 0)
+			{
+				fprintf(stderr, "movestar_accumulator_test: vehicle %d pollutant %ld: total %.17g, steps add up to %.17g\n",
+					v, pollutants[p], total, sum);
+				same = false;
+			}
+			checked++;
+		}
+	}
+	return same;
+}
+
+//link, window and type totals against the steps and the network, false if one differs
+static bool checkGroups(MovestarContext *context, const Expected &expected)
+{
+	struct Group
+	{
+		const char              *name;
+		long                     type;
+		const map<long, Totals> *totals;
+	};
+	const Group groups[3] = { { "link", EMISSION_DATA_LINK_TOTAL, &expected.links },
+		{ "window", EMISSION_DATA_INTERVAL_TOTAL, &expected.windows }, { "type", EMISSION_DATA_TYPE_TOTAL, &expected.types } };
+
+	bool same = true;
+	for (int p = 0; p < 6; p++)
+	{
+		double network = 0.0;
+		EmissionModelContextGetValue(context, EMISSION_DATA_NETWORK_TOTAL, 0, pollutants[p], nullptr, &network, nullptr);
+		if (!agrees(network, expected.network.values[p]))
+		{
+			fprintf(stderr, "movestar_accumulator_test: network pollutant %ld: %.17g, steps add up to %.17g\n",
+				pollutants[p], network, expected.network.values[p]);
+			same = false;
+		}
+		for (int g = 0; g < 3; g++)
+		{
+			double sum = 0.0;
+			for (map<long, Totals>::const_iterator it = groups[g].totals->begin(); it != groups[g].totals->end(); ++it)
+			{
+				double total = 0.0;
+				EmissionModelContextGetValue(context, groups[g].type, it->first, pollutants[p], nullptr, &total, nullptr);
+				if (!agrees(total, it->second.values[p]))
+				{
+					fprintf(stderr, "movestar_accumulator_test: %s %ld pollutant %ld: %.17g, steps add up to %.17g\n",
+						groups[g].name, it->first, pollutants[p], total, it->second.values[p]);
+					same = false;
+				}
+				sum += total;
+			}
+			if (!agrees(sum, network))
+			{
+				fprintf(stderr, "movestar_accumulator_test: %s totals of pollutant %ld add up to %.17g, network %.17g\n",
+					groups[g].name, pollutants[p], sum, network);
+				same = false;
+			}
+		}
+	}
+	return same;
+}
+
+//the vehicles of <prefix>_veh.csv, those killed and those still on the network
+//at the end, false if one is missing, written twice or differs
+static bool checkSummary(const string &prefix, const Expected &expected, size_t &rows)
+{
+	FILE *file = fopen((prefix + "_veh.csv").c_str(), "r");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "movestar_accumulator_test: no %s_veh.csv\n", prefix.c_str());
+		return false;
+	}
+
+	//rows as the accumulator prints them
+	map<long, string> written;
+	char line[1024];
+	bool header = true;
+	rows = 0;
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		if (!header)
+		{
+			written[atol(line)] = line;
+			rows++;
+		}
+		header = false;
+	}
+	fclose(file);
+
+	bool same = (rows == ACCUMULATOR_TEST_VEHICLES);
+	for (int v = 1; v <= ACCUMULATOR_TEST_VEHICLES; v++)
+	{
+		const double *values = expected.vehicles.at(v).values;
+		char row[1024];
+		snprintf(row, sizeof(row), "%d,%ld,%ld,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,", v, vehicleTypes[v % 3], expected.lastLinks.at(v),
+			values[0], values[1], values[2], values[3], values[4], values[5]);
+		if (written.count(v) == 0 || written[v].compare(0, strlen(row), row) != 0)
+		{
+			fprintf(stderr, "movestar_accumulator_test: vehicle %d written as \"%s\", expected \"%s...\"\n",
+				v, written.count(v) != 0 ? written[v].c_str() : "", row);
+			same = false;
+		}
+	}
+	return same;
+}
+
+int main()
+{
+	string prefix = "movestar_accumulator_test";
+	MovestarContext *context = EmissionModelCreateContext();
+	EmissionModelContextSetValue(context, EMISSION_DATA_AGGREGATION_INTERVAL, 0, 0, 0, ACCUMULATOR_TEST_WINDOW, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_SUMMARY_PREFIX, 0, 0, 0, 0.0, (char *)prefix.c_str());
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, ACCUMULATOR_TEST_TIMESTEP, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, 0.0, nullptr);
+	bool initialized = EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_INIT) != 0;
+
+	Expected expected;
+	replay(context, expected);
+	size_t checked = 0, killedCount = 0, rows = 0;
+	bool vehicles = checkVehicles(context, expected, checked);
+	bool groups = checkGroups(context, expected);
+	bool summarized = EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_WRITE_SUMMARY) != 0;
+	EmissionModelDestroyContext(context);
+	bool summary = summarized && checkSummary(prefix, expected, rows);
+
+	static const char *files[4] = { "_veh.csv", "_link.csv", "_interval.csv", "_type.csv" };
+	for (int f = 0; f < 4; f++)
+	{
+		remove((prefix + files[f]).c_str());
+	}
+	for (int v = 1; v <= ACCUMULATOR_TEST_VEHICLES; v++)
+	{
+		killedCount += killed(v, ACCUMULATOR_TEST_STEPS) ? 1 : 0;
+	}
+	printf("movestar_accumulator_test: %zu vehicle totals %s, link, window and type totals %s, %zu vehicles killed and dropped, "
+		"%zu summary rows %s\n", checked, vehicles ? "identical" : "differ", groups ? "agree" : "differ", killedCount, rows,
+		summary ? "identical" : "missing or differ");
+	return initialized && vehicles && groups && summary ? 0 : 1;
+}
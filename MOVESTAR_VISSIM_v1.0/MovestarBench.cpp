@@ -0,0 +1,589 @@
+/*========================================================================= */
+/* MovestarBench.cpp                                 Core module of MOVESTAR */
+/*																			*/
+/* movestar_bench: benchmarks of the emission hot path. Micro-benchmarks	*/
+/* time the VSP and opmode kernels (double and float32), the rate lookup,	*/
+/* the rate grids and the engine exact, with the grids and compact;		*/
+/* macro-benchmarks															*/
+/* replay the VISSIM protocol (SetValue, ExecuteCommand, GetValue) on the	*/
+/* emission model library with synthetic traffic. Results are written as	*/
+/* JSON (ns per vehicle-step, allocations per step, peak RSS) and can be	*/
+/* compared against a baseline file of an earlier run.						*/
+/*========================================================================= */
+
+#include "CompactModel.h"
+#include "EmissionEngine.h"
+#include "EmissionModel.h"
+#include "MovestarKernels.h"
+#include "MovestarRates.h"
+#include "RateGrid.h"
+#include "SourceTypeRegistry.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+
+//every allocation of the process (of the library too where the platform
+//resolves operator new across shared objects, as ELF does)
+static atomic<unsigned long long> allocationCount(0);
+
+void *operator new(size_t size)
+{
+	allocationCount.fetch_add(1, memory_order_relaxed);
+	void *memory = malloc(size != 0 ? size : 1);
+	if (memory == nullptr)
+	{
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept
+{
+	free(memory);
+}
+
+//peak resident set size of the process [KB]
+static unsigned long long peakResidentKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize / 1024;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (unsigned long long)usage.ru_maxrss / 1024;
+#else
+	return (unsigned long long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+struct BenchmarkResult
+{
+	string             name;
+	long               vehicles;			//vehicles per step
+	double             timeStep;			//[s], 0 for micro-benchmarks
+	unsigned long long steps;
+	double             nsPerVehicleStep;
+	double             allocationsPerStep;
+	unsigned long long peakRssKB;
+};
+
+struct Options
+{
+	string outputPath;
+	string baselinePath;
+	double minimumSeconds;		//per benchmark
+	double maxRegression;		//[%], <0 for no limit
+	bool   quick;
+};
+
+static void printUsage()
+{
+	fprintf(stderr,
+		"usage: movestar_bench [options]\n"
+		"\n"
+		"Benchmarks the VSP, opmode and rate lookup kernels and the VISSIM protocol of\n"
+		"the emission model with 1k, 10k, 100k and 1M vehicles at 0.1 s and 1 s steps.\n"
+		"\n"
+		"options:\n"
+		"  --output <file>        results as JSON (default movestar_bench.json)\n"
+		"  --baseline <file>      compare with the results of an earlier run\n"
+		"  --max-regression <%%>   exit with 1 if a benchmark is slower than the\n"
+		"                         baseline by more than this\n"
+		"  --min-time <s>         minimum time per benchmark (default 0.5)\n"
+		"  --quick                macro-benchmarks with 1k and 10k vehicles only\n");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	options.outputPath = "movestar_bench.json";
+	options.minimumSeconds = 0.5;
+	options.maxRegression = -1.0;
+	options.quick = false;
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (option == "--output" && hasValue)
+		{
+			options.outputPath = argv[++i];
+		}
+		else if (option == "--baseline" && hasValue)
+		{
+			options.baselinePath = argv[++i];
+		}
+		else if (option == "--max-regression" && hasValue)
+		{
+			options.maxRegression = atof(argv[++i]);
+		}
+		else if (option == "--min-time" && hasValue)
+		{
+			options.minimumSeconds = atof(argv[++i]);
+		}
+		else if (option == "--quick")
+		{
+			options.quick = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return options.minimumSeconds >= 0.0;
+}
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//deterministic pseudo-random numbers in [0, 1)
+static double nextRandom(unsigned long long &state)
+{
+	state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (double)(state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//synthetic traffic: every vehicle follows a random walk of its acceleration
+struct Traffic
+{
+	vector<long>   vehicleTypes;
+	vector<double> velocities;		//[m/s]
+	vector<double> accelerations;	//[m/s2]
+	unsigned long long state;
+
+	explicit Traffic(size_t vehicles)
+		: vehicleTypes(vehicles), velocities(vehicles), accelerations(vehicles), state(12345)
+	{
+		static const long types[3] = { 100, 200, 300 };
+		for (size_t i = 0; i < vehicles; i++)
+		{
+			vehicleTypes[i] = types[i % 3];
+			velocities[i] = 35.0 * nextRandom(state);
+			accelerations[i] = 0.0;
+		}
+	}
+
+	void advance(double timeStep)
+	{
+		for (size_t i = 0; i < velocities.size(); i++)
+		{
+			double acceleration = accelerations[i] + (nextRandom(state) - 0.5) * 2.0 * timeStep;
+			acceleration = acceleration < -4.0 ? -4.0 : (acceleration > 3.0 ? 3.0 : acceleration);
+			double velocity = velocities[i] + acceleration * timeStep;
+			if (velocity < 0.0 || velocity > 35.0)
+			{
+				acceleration = 0.0;
+				velocity = velocity < 0.0 ? 0.0 : 35.0;
+			}
+			velocities[i] = velocity;
+			accelerations[i] = acceleration;
+		}
+	}
+};
+
+//runs <body> (one step over <vehicles> vehicles) until <minimumSeconds> passed
+template <class Body>
+static BenchmarkResult measure(const string &name, long vehicles, double timeStep, double minimumSeconds, Body body)
+{
+	//first call outside the measurement: caches, lazily grown buffers
+	body();
+
+	BenchmarkResult result;
+	result.name = name;
+	result.vehicles = vehicles;
+	result.timeStep = timeStep;
+	result.steps = 0;
+	double seconds = 0.0;
+	unsigned long long allocations = allocationCount.load();
+	do
+	{
+		seconds += body();
+		result.steps++;
+	} while (seconds < minimumSeconds || result.steps < 3);
+	result.nsPerVehicleStep = seconds * 1e9 / ((double)result.steps * vehicles);
+	result.allocationsPerStep = (double)(allocationCount.load() - allocations) / result.steps;
+	result.peakRssKB = peakResidentKB();
+	return result;
+}
+
+//kernels over a batch of vehicles of the built-in source types
+static void runMicroBenchmarks(const Options &options, vector<BenchmarkResult> &results)
+{
+	const size_t count = 4096;
+	const long types[3] = { 100, 200, 300 };
+	Traffic traffic(count);
+	for (int i = 0; i < 50; i++)
+	{
+		traffic.advance(1.0);
+	}
+
+	vector<const VSPCoefficients *> coefficients(count);
+	vector<const EmissionRateTable *> rates(count);
+	vector<double> velocities(count), vsp(count);
+	vector<unsigned char> braking(count);
+	vector<int> opmodes(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const SourceTypeModel *model = findBuiltinSourceType(types[i % 3]);
+		coefficients[i] = &model->coefficients;
+		rates[i] = model->rates;
+		velocities[i] = traffic.velocities[i] * 3.6;		//the opmode bins take km/h
+		braking[i] = traffic.accelerations[i] <= -2.0;
+	}
+	volatile double sink = 0.0;
+
+	results.push_back(measure("micro/vsp_scalar", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++)
+		{
+			vsp[i] = calculateVSP(*coefficients[i], velocities[i], traffic.accelerations[i]);
+		}
+		return secondsSince(start);
+	}));
+	results.push_back(measure("micro/vsp_batch", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		calculateVSPBatch(count, coefficients.data(), velocities.data(), traffic.accelerations.data(), vsp.data());
+		return secondsSince(start);
+	}));
+	results.push_back(measure("micro/opmode_scalar", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++)
+		{
+			opmodes[i] = binOpmode(velocities[i], vsp[i], braking[i] != 0);
+		}
+		return secondsSince(start);
+	}));
+	results.push_back(measure("micro/opmode_batch", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		binOpmodeBatch(count, velocities.data(), vsp.data(), braking.data(), opmodes.data());
+		return secondsSince(start);
+	}));
+
+	//float32 kernels of the compact mode
+	vector<const CompactVSPCoefficients *> compactCoefficients(count);
+	vector<float> compactVelocities(count), compactAccelerations(count), compactVSP(count);
+	SourceTypeRegistry builtins;
+	CompactSourceTypes compactTypes(builtins);
+	for (size_t i = 0; i < count; i++)
+	{
+		compactCoefficients[i] = &compactTypes.find(builtins.find(types[i % 3]))->coefficients;
+		compactVelocities[i] = (float)velocities[i];
+		compactAccelerations[i] = (float)traffic.accelerations[i];
+	}
+	results.push_back(measure("micro/vsp_batch_float32", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		calculateVSPBatch(count, compactCoefficients.data(), compactVelocities.data(), compactAccelerations.data(), compactVSP.data());
+		return secondsSince(start);
+	}));
+	results.push_back(measure("micro/opmode_batch_float32", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		binOpmodeBatch(count, compactVelocities.data(), compactVSP.data(), braking.data(), opmodes.data());
+		return secondsSince(start);
+	}));
+	results.push_back(measure("micro/rate_lookup", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		double total = 0.0;
+		for (size_t i = 0; i < count; i++)
+		{
+			int row = rateRowOfOpmode(opmodes[i]);
+			if (row >= 0)
+			{
+				const double *rate = rates[i]->rates[row];
+				total += rate[0] + rate[1] + rate[2] + rate[3] + rate[4] + rate[5];
+			}
+		}
+		sink = sink + total;
+		return secondsSince(start);
+	}));
+
+	//the grid lookup replacing VSP, opmode and row of vehicles not braking
+	SourceTypeRegistry registry;
+	shared_ptr<const RateGrids> grids(new RateGrids(registry, DEFAULT_RATE_GRID_SPEED_STEP, DEFAULT_RATE_GRID_ACCELERATION_STEP));
+	vector<const RateGrid *> cellGrids(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		cellGrids[i] = grids->find(registry.find(types[i % 3]));
+	}
+	results.push_back(measure("micro/grid_lookup", (long)count, 0.0, options.minimumSeconds, [&]()
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		double total = 0.0;
+		for (size_t i = 0; i < count; i++)
+		{
+			int row = cellGrids[i]->row(traffic.velocities[i], traffic.accelerations[i]);
+			if (row >= 0)
+			{
+				const double *rate = rates[i]->rates[row];
+				total += rate[0] + rate[1] + rate[2] + rate[3] + rate[4] + rate[5];
+			}
+		}
+		sink = sink + total;
+		return secondsSince(start);
+	}));
+
+	//one step of the engine over the batch, exact and with the grids
+	vector<long> ids(count), vehicleTypes(count);
+	vector<double> outputs(6 * count);
+	for (size_t i = 0; i < count; i++)
+	{
+		ids[i] = (long)i + 1;
+		vehicleTypes[i] = types[i % 3];
+	}
+	EmissionBatch batch = { count, ids.data(), vehicleTypes.data(), traffic.velocities.data(), traffic.accelerations.data(),
+		nullptr, nullptr, &outputs[0], &outputs[count], &outputs[2 * count], &outputs[3 * count], &outputs[4 * count],
+		&outputs[5 * count], nullptr, nullptr };
+	static const char *engineNames[3] = { "micro/engine_exact", "micro/engine_grid", "micro/engine_compact" };
+	shared_ptr<const CompactSourceTypes> compactRegistryTypes(new CompactSourceTypes(registry));
+	for (int mode = 0; mode < 3; mode++)
+	{
+		EmissionEngine engine(registry);
+		if (mode == 1)
+		{
+			engine.setRateGrids(grids);
+		}
+		if (mode == 2)
+		{
+			engine.setCompact(compactRegistryTypes);
+		}
+		engine.calculate(batch);
+		results.push_back(measure(engineNames[mode], (long)count, 0.0, options.minimumSeconds, [&]()
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			engine.calculate(batch);
+			return secondsSince(start);
+		}));
+	}
+}
+
+//the protocol VISSIM runs on the library, <vehicles> vehicles on the network
+static BenchmarkResult runProtocol(const Options &options, long vehicles, double timeStep)
+{
+	MovestarContext *context = EmissionModelCreateContext();
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, timeStep, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, 0.0, nullptr);
+	EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_INIT);
+
+	Traffic traffic((size_t)vehicles);
+	for (long v = 0; v < vehicles; v++)
+	{
+		EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ID, 0, 0, v + 1, 0.0, nullptr);
+		EmissionModelContextSetValue(context, EMISSION_DATA_VEH_TYPE, 0, 0, traffic.vehicleTypes[v], 0.0, nullptr);
+		EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CREATE_VEHICLE);
+	}
+
+	double time = 0.0;
+	volatile double sink = 0.0;
+	char name[64];
+	snprintf(name, sizeof(name), "macro/protocol_%ldveh_%gs", vehicles, timeStep);
+	BenchmarkResult result = measure(name, vehicles, timeStep, options.minimumSeconds, [&]()
+	{
+		//the traffic moves outside the measurement
+		traffic.advance(timeStep);
+		time += timeStep;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		double total = 0.0;
+		EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, time, nullptr);
+		for (long v = 0; v < vehicles; v++)
+		{
+			double value;
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ID, 0, 0, v + 1, 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_TYPE, 0, 0, traffic.vehicleTypes[v], 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_VELOCITY, 0, 0, 0, traffic.velocities[v], nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ACCELERATION, 0, 0, 0, traffic.accelerations[v], nullptr);
+			EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CALCULATE_VEHICLE);
+			EmissionModelContextGetValue(context, EMISSION_DATA_HC, 0, 0, nullptr, &value, nullptr);
+			total += value;
+			EmissionModelContextGetValue(context, EMISSION_DATA_CO, 0, 0, nullptr, &value, nullptr);
+			total += value;
+			EmissionModelContextGetValue(context, EMISSION_DATA_NOX, 0, 0, nullptr, &value, nullptr);
+			total += value;
+			EmissionModelContextGetValue(context, EMISSION_DATA_CO2, 0, 0, nullptr, &value, nullptr);
+			total += value;
+			EmissionModelContextGetValue(context, EMISSION_DATA_FUEL, 0, 0, nullptr, &value, nullptr);
+			total += value;
+			EmissionModelContextGetValue(context, EMISSION_DATA_PART, 0, 0, nullptr, &value, nullptr);
+			total += value;
+		}
+		sink = sink + total;
+		return secondsSince(start);
+	});
+	EmissionModelDestroyContext(context);
+	return result;
+}
+
+static bool writeResults(const string &path, const vector<BenchmarkResult> &results)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	//one result per line, so the file reads back without a JSON parser
+	fprintf(file, "{\n  \"isa\": \"%s\",\n  \"results\": [\n", kernelIsaName(activeKernelIsa()));
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult &result = results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"vehicles\": %ld, \"timestep\": %g, \"steps\": %llu, "
+			"\"ns_per_vehicle_step\": %.4f, \"allocations_per_step\": %.2f, \"peak_rss_kb\": %llu}%s\n",
+			result.name.c_str(), result.vehicles, result.timeStep, result.steps, result.nsPerVehicleStep,
+			result.allocationsPerStep, result.peakRssKB, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+//name and ns per vehicle-step of every result line of a file written by writeResults
+static bool readResults(const string &path, vector<BenchmarkResult> &results)
+{
+	FILE *file = fopen(path.c_str(), "r");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != nullptr)
+	{
+		const char *name = strstr(line, "\"name\": \"");
+		const char *ns = strstr(line, "\"ns_per_vehicle_step\": ");
+		if (name == nullptr || ns == nullptr)
+		{
+			continue;
+		}
+		name += strlen("\"name\": \"");
+		const char *nameEnd = strchr(name, '"');
+		if (nameEnd == nullptr)
+		{
+			continue;
+		}
+		BenchmarkResult result = {};
+		result.name.assign(name, nameEnd);
+		result.nsPerVehicleStep = atof(ns + strlen("\"ns_per_vehicle_step\": "));
+		results.push_back(result);
+	}
+	fclose(file);
+	return true;
+}
+
+//prints the change of every benchmark found in both runs, returns the largest slowdown [%]
+static double compareResults(const vector<BenchmarkResult> &baseline, const vector<BenchmarkResult> &results)
+{
+	double worst = 0.0;
+	printf("\n%-34s %12s %12s %9s\n", "benchmark", "baseline", "current", "change");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		for (size_t b = 0; b < baseline.size(); b++)
+		{
+			if (baseline[b].name != results[i].name || !(baseline[b].nsPerVehicleStep > 0.0))
+			{
+				continue;
+			}
+			double change = (results[i].nsPerVehicleStep / baseline[b].nsPerVehicleStep - 1.0) * 100.0;
+			worst = change > worst ? change : worst;
+			printf("%-34s %12.3f %12.3f %+8.1f%%\n", results[i].name.c_str(), baseline[b].nsPerVehicleStep,
+				results[i].nsPerVehicleStep, change);
+		}
+	}
+	return worst;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 2;
+	}
+	vector<BenchmarkResult> baseline;
+	if (!options.baselinePath.empty() && !readResults(options.baselinePath, baseline))
+	{
+		fprintf(stderr, "movestar_bench: cannot read %s\n", options.baselinePath.c_str());
+		return 1;
+	}
+
+	vector<BenchmarkResult> results;
+	runMicroBenchmarks(options, results);
+
+	//smallest networks first, so the peak RSS of each result is its own
+	static const long vehicleCounts[4] = { 1000, 10000, 100000, 1000000 };
+	static const double timeSteps[2] = { 0.1, 1.0 };
+	for (int n = 0; n < (options.quick ? 2 : 4); n++)
+	{
+		for (int s = 0; s < 2; s++)
+		{
+			results.push_back(runProtocol(options, vehicleCounts[n], timeSteps[s]));
+		}
+	}
+
+	printf("%-34s %12s %10s %12s %12s\n", "benchmark", "ns/veh-step", "steps", "allocs/step", "peak RSS KB");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		printf("%-34s %12.3f %10llu %12.2f %12llu\n", results[i].name.c_str(), results[i].nsPerVehicleStep,
+			results[i].steps, results[i].allocationsPerStep, results[i].peakRssKB);
+	}
+	if (!writeResults(options.outputPath, results))
+	{
+		fprintf(stderr, "movestar_bench: cannot write %s\n", options.outputPath.c_str());
+		return 1;
+	}
+
+	if (!baseline.empty())
+	{
+		double worst = compareResults(baseline, results);
+		if (options.maxRegression >= 0.0 && worst > options.maxRegression)
+		{
+			fprintf(stderr, "movestar_bench: %.1f%% slower than the baseline (limit %.1f%%)\n", worst, options.maxRegression);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*========================================================================= */
+/* MovestarCheckpointTest.cpp                        Core module of MOVESTAR */
+/*																			*/
+/* movestar_checkpoint_test: warm restart through the library. A run		*/
+/* writes a checkpoint part way and goes on; a second context restores the	*/
+/* checkpoint at INIT and replays the rest of the run. Every later opmode,	*/
+/* VSP, emission and acceleration history and the vehicle, link, window,	*/
+/* type and network totals must equal those of the uninterrupted run, in	*/
+/* both history layouts. Truncated checkpoints and one whose header claims	*/
+/* more than the file holds must be rejected at INIT.						*/
+/*========================================================================= */
+
+#include "EmissionModel.h"
+#include "Checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+#define CHECKPOINT_TEST_VEHICLES        60
+#define CHECKPOINT_TEST_STEPS           300
+#define CHECKPOINT_TEST_CHECKPOINT_STEP 137
+#define CHECKPOINT_TEST_TIMESTEP        0.1
+#define CHECKPOINT_TEST_WINDOW          5.0
+#define CHECKPOINT_TEST_LINKS           4
+
+//vehicles enter one after the other and leave after this many steps
+#define CHECKPOINT_TEST_ENTRY_GAP       3
+#define CHECKPOINT_TEST_STAY            200
+
+static const long vehicleTypes[3] = { 100, 200, 300 };
+static const long pollutants[6] = { EMISSION_DATA_HC, EMISSION_DATA_CO, EMISSION_DATA_NOX, EMISSION_DATA_CO2,
+	EMISSION_DATA_FUEL, EMISSION_DATA_PART };
+
+//speed and acceleration of every vehicle-step, by step then vehicle
+struct Traffic
+{
+	vector<double> velocities;
+	vector<double> accelerations;
+
+	Traffic() : velocities(CHECKPOINT_TEST_STEPS * CHECKPOINT_TEST_VEHICLES),
+		accelerations(CHECKPOINT_TEST_STEPS * CHECKPOINT_TEST_VEHICLES)
+	{
+		mt19937_64 random(19);
+		uniform_real_distribution<double> start(0.0, 30.0), change(-3.0, 2.0);
+		for (int v = 0; v < CHECKPOINT_TEST_VEHICLES; v++)
+		{
+			double velocity = start(random);
+			for (int s = 0; s < CHECKPOINT_TEST_STEPS; s++)
+			{
+				double acceleration = change(random);
+				velocity = velocity + acceleration * CHECKPOINT_TEST_TIMESTEP < 0.0 ? 0.0 : velocity + acceleration * CHECKPOINT_TEST_TIMESTEP;
+				velocities[s * CHECKPOINT_TEST_VEHICLES + v] = velocity;
+				accelerations[s * CHECKPOINT_TEST_VEHICLES + v] = acceleration;
+			}
+		}
+	}
+};
+
+static int entryStep(int vehicle)
+{
+	return vehicle * CHECKPOINT_TEST_ENTRY_GAP;
+}
+
+static void setString(MovestarContext *context, long type, const string &value)
+{
+	EmissionModelContextSetValue(context, type, 0, 0, 0, 0.0, (char *)value.c_str());
+}
+
+static double getDouble(MovestarContext *context, long type, long index1 = 0, long index2 = 0)
+{
+	double value = 0.0;
+	return EmissionModelContextGetValue(context, type, index1, index2, nullptr, &value, nullptr) ? value : -1.0;
+}
+
+//the calls VISSIM makes for the steps [first, last); a checkpoint before the
+//step <checkpointStep>. Appends the results of every vehicle-step to <results>
+static void replay(MovestarContext *context, const Traffic &traffic, int first, int last, int checkpointStep,
+	vector<double> &results)
+{
+	static const long outputs[11] = { EMISSION_DATA_SO2, EMISSION_DATA_SOOT, EMISSION_DATA_HC, EMISSION_DATA_CO,
+		EMISSION_DATA_NOX, EMISSION_DATA_CO2, EMISSION_DATA_FUEL, EMISSION_DATA_PART,
+		EMISSION_DATA_BENZ, EMISSION_DATA_NMOG, EMISSION_DATA_NMHC };
+	for (int s = first; s < last; s++)
+	{
+		EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, CHECKPOINT_TEST_TIMESTEP, nullptr);
+		EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, s * CHECKPOINT_TEST_TIMESTEP, nullptr);
+		if (s == checkpointStep)
+		{
+			EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CHECKPOINT);
+		}
+		for (int v = 0; v < CHECKPOINT_TEST_VEHICLES; v++)
+		{
+			long vehicleNumber = v + 1;
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ID, 0, 0, vehicleNumber, 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_TYPE, 0, 0, vehicleTypes[v % 3], 0.0, nullptr);
+			if (s == entryStep(v) + CHECKPOINT_TEST_STAY)
+			{
+				EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_KILL_VEHICLE);
+			}
+			if (s < entryStep(v) || s >= entryStep(v) + CHECKPOINT_TEST_STAY)
+			{
+				continue;
+			}
+			if (s == entryStep(v))
+			{
+				EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CREATE_VEHICLE);
+			}
+			EmissionModelContextSetValue(context, EMISSION_DATA_LINK, 0, 0, 1 + (v + s / 50) % CHECKPOINT_TEST_LINKS, 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_VELOCITY, 0, 0, 0,
+				traffic.velocities[s * CHECKPOINT_TEST_VEHICLES + v], nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ACCELERATION, 0, 0, 0,
+				traffic.accelerations[s * CHECKPOINT_TEST_VEHICLES + v], nullptr);
+			EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CALCULATE_VEHICLE);
+			for (int o = 0; o < 11; o++)
+			{
+				results.push_back(getDouble(context, outputs[o]));
+			}
+		}
+	}
+}
+
+//every total of the run, -1 for those the context does not have
+static void readTotals(MovestarContext *context, vector<double> &totals)
+{
+	int windows = (int)(CHECKPOINT_TEST_STEPS * CHECKPOINT_TEST_TIMESTEP / CHECKPOINT_TEST_WINDOW) + 1;
+	for (int p = 0; p < 6; p++)
+	{
+		totals.push_back(getDouble(context, EMISSION_DATA_NETWORK_TOTAL, 0, pollutants[p]));
+		for (int t = 0; t < 3; t++)
+		{
+			totals.push_back(getDouble(context, EMISSION_DATA_TYPE_TOTAL, vehicleTypes[t], pollutants[p]));
+		}
+		for (int l = 1; l <= CHECKPOINT_TEST_LINKS; l++)
+		{
+			totals.push_back(getDouble(context, EMISSION_DATA_LINK_TOTAL, l, pollutants[p]));
+		}
+		for (int w = 0; w < windows; w++)
+		{
+			totals.push_back(getDouble(context, EMISSION_DATA_INTERVAL_TOTAL, w, pollutants[p]));
+		}
+		for (int v = 1; v <= CHECKPOINT_TEST_VEHICLES; v++)
+		{
+			totals.push_back(getDouble(context, EMISSION_DATA_VEHICLE_TOTAL, v, pollutants[p]));
+		}
+	}
+}
+
+static void configure(MovestarContext *context, bool resampling, const string &checkpointFile)
+{
+	EmissionModelContextSetValue(context, EMISSION_DATA_HISTORY_RESAMPLING, 0, 0, resampling ? 1 : 0, 0.0, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_AGGREGATION_INTERVAL, 0, 0, 0, CHECKPOINT_TEST_WINDOW, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, CHECKPOINT_TEST_TIMESTEP, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, 0.0, nullptr);
+	setString(context, EMISSION_DATA_CHECKPOINT_FILE, checkpointFile);
+}
+
+//runs once without and once with the restart, false if the results differ
+static bool checkRestart(const Traffic &traffic, bool resampling, const string &checkpointFile)
+{
+	//uninterrupted, writing the checkpoint on the way; the checkpoint is complete
+	//once the context is destroyed
+	vector<double> fullResults, fullTotals;
+	MovestarContext *full = EmissionModelCreateContext();
+	configure(full, resampling, checkpointFile);
+	bool initialized = EmissionModelContextExecuteCommand(full, EMISSION_COMMAND_INIT) != 0;
+	vector<double> before;
+	replay(full, traffic, 0, CHECKPOINT_TEST_CHECKPOINT_STEP, CHECKPOINT_TEST_CHECKPOINT_STEP, before);
+	replay(full, traffic, CHECKPOINT_TEST_CHECKPOINT_STEP, CHECKPOINT_TEST_STEPS, CHECKPOINT_TEST_CHECKPOINT_STEP, fullResults);
+	readTotals(full, fullTotals);
+	EmissionModelDestroyContext(full);
+
+	//restarted from the checkpoint, with none of its configuration set
+	vector<double> restartedResults, restartedTotals;
+	MovestarContext *restarted = EmissionModelCreateContext();
+	setString(restarted, EMISSION_DATA_RESTORE_FILE, checkpointFile);
+	bool restored = EmissionModelContextExecuteCommand(restarted, EMISSION_COMMAND_INIT) != 0;
+	if (!restored)
+	{
+		char *error = nullptr;
+		EmissionModelContextGetValue(restarted, EMISSION_DATA_LAST_ERROR, 0, 0, nullptr, nullptr, &error);
+		fprintf(stderr, "movestar_checkpoint_test: restore failed: %s\n", error);
+	}
+	replay(restarted, traffic, CHECKPOINT_TEST_CHECKPOINT_STEP, CHECKPOINT_TEST_STEPS, -1, restartedResults);
+	readTotals(restarted, restartedTotals);
+	EmissionModelDestroyContext(restarted);
+
+	bool same = initialized && restored && fullResults.size() == restartedResults.size() &&
+		memcmp(fullResults.data(), restartedResults.data(), fullResults.size() * sizeof(double)) == 0 &&
+		memcmp(fullTotals.data(), restartedTotals.data(), fullTotals.size() * sizeof(double)) == 0;
+	printf("movestar_checkpoint_test: %s histories, %zu vehicle-steps after the restart, %zu totals %s\n",
+		resampling ? "resampled" : "VISSIM", restartedResults.size() / 11, restartedTotals.size(), same ? "identical" : "differ");
+	return same;
+}
+
+static bool readFile(const string &path, vector<char> &bytes)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	char buffer[65536];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		bytes.insert(bytes.end(), buffer, buffer + read);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool writeFile(const string &path, const char *data, size_t size)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	bool written = fwrite(data, 1, size, file) == size;
+	return fclose(file) == 0 && written;
+}
+
+//true if INIT rejects the checkpoint <path> as damaged
+static bool rejected(const string &path, const char *what)
+{
+	MovestarContext *context = EmissionModelCreateContext();
+	setString(context, EMISSION_DATA_RESTORE_FILE, path);
+	bool initialized = EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_INIT) != 0;
+	char *error = nullptr;
+	EmissionModelContextGetValue(context, EMISSION_DATA_LAST_ERROR, 0, 0, nullptr, nullptr, &error);
+	bool damaged = !initialized && error != nullptr && strstr(error, "damaged") != nullptr;
+	printf("movestar_checkpoint_test: %s checkpoint %s (%s)\n", what, damaged ? "rejected" : "accepted", error != nullptr ? error : "");
+	EmissionModelDestroyContext(context);
+	return damaged;
+}
+
+//damages the checkpoint <path> in two ways, false if a restore accepts either
+static bool checkDamaged(const string &path)
+{
+	vector<char> bytes;
+	if (!readFile(path, bytes) || bytes.size() <= sizeof(CheckpointHeader))
+	{
+		fprintf(stderr, "movestar_checkpoint_test: cannot read %s\n", path.c_str());
+		return false;
+	}
+
+	//the payload cut short
+	string truncated = path + ".truncated";
+	bool rejects = writeFile(truncated, bytes.data(), sizeof(CheckpointHeader) + (bytes.size() - sizeof(CheckpointHeader)) / 2) &&
+		rejected(truncated, "truncated");
+	remove(truncated.c_str());
+
+	//a header claiming far more than the file holds, which must fail before it is allocated
+	string oversized = path + ".oversized";
+	CheckpointHeader header;
+	memcpy(&header, bytes.data(), sizeof(header));
+	header.payloadSize = 1ULL << 62;
+	memcpy(bytes.data(), &header, sizeof(header));
+	rejects = writeFile(oversized, bytes.data(), bytes.size()) && rejected(oversized, "oversized") && rejects;
+	remove(oversized.c_str());
+	return rejects;
+}
+
+int main()
+{
+	Traffic traffic;
+	string checkpointFile = "movestar_checkpoint_test.ckp";
+	bool passed = checkRestart(traffic, false, checkpointFile);
+	passed = checkRestart(traffic, true, checkpointFile) && passed;
+	passed = checkDamaged(checkpointFile) && passed;
+	remove(checkpointFile.c_str());
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,1370 @@
+/*========================================================================= */
+/* MovestarCli.cpp                                   Core module of MOVESTAR */
+/*																			*/
+/* movestar: command-line tool calculating the emissions of recorded		*/
+/* trajectories with the same core as the VISSIM DLL. The trajectory CSV	*/
+/* file (or its columnar conversion) is calculated on all cores; per-second	*/
+/* and per-vehicle emission totals are written as CSV files. Aggregating,	*/
+/* per-vehicle opmode histograms are written instead of per-second totals,	*/
+/* and can be evaluated against other rate tables later. The compact mode	*/
+/* calculates in float32, and --accuracy compares it with the double path.	*/
+/* Sweeping, any number of scenarios are calculated in one pass. Files		*/
+/* larger than the memory are calculated out of core under a memory limit,	*/
+/* and --shards splits the vehicles over worker processes of this tool.	*/
+/* Inputs with positions can be rastered into cells and time bins.			*/
+/*========================================================================= */
+
+#include "Checkpoint.h"
+#include "ChildProcess.h"
+#include "ColumnarTrajectory.h"
+#include "CompactModel.h"
+#include "EmissionRaster.h"
+#include "OpmodeActivity.h"
+#include "ParallelTrajectory.h"
+#include "RateGrid.h"
+#include "ScenarioSweep.h"
+#include "SourceTypeRegistry.h"
+#include "TrajectoryCsv.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+
+struct Options
+{
+	string inputPath;
+	string perSecondPath;
+	string perVehiclePath;
+	string dataDirectory;
+	string convertPath;			//columnar file to convert the input to
+	string perOpmodePath;
+	string evaluationPath;
+	string sweepPath;			//scenarios to sweep
+	string perScenarioPath;
+	vector<string> rateDirectories;	//rate tables to evaluate an opmode histogram file against
+	bool     aggregate;
+	bool     resample;			//braking histories of exact 1 Hz mean accelerations
+	bool     compact;			//float32 kernels and tables, int16 histories
+	bool     accuracy;			//compare the compact mode with the double path
+	double   maxDifference;		//of a total in the comparison, negative for any
+	bool     float32;
+	TrajectoryQuery query;
+	bool     filtered;			//a query was given
+	double   timeStep;
+	long     defaultType;
+	unsigned threads;			//0 for one per hardware thread
+	unsigned scalingThreads;	//>0 to report the scaling from 1 to this many threads
+	double   gridSpeedStep;		//>0 to look the rates up in grids of this cell size [m/s]
+	double   gridAccelerationStep;
+	size_t   memoryLimit;		//bytes of state, 0 for none
+	unsigned shards;			//worker processes the vehicles are split over
+	int      shard;				//>=0 in a worker: the shard it calculates
+	string   shardOutput;		//partial totals of a worker
+	string   rasterPath;		//spatio-temporal raster of the emissions
+	double   rasterCellSize;	//[m]
+	double   rasterInterval;	//[s]
+	bool     quiet;
+};
+
+static void printUsage()
+{
+	fprintf(stderr,
+		"usage: movestar [options] <trajectory.csv | trajectory.mvt>\n"
+		"       movestar --convert <trajectory.mvt> [--float32] <trajectory.csv>\n"
+		"       movestar --evaluate <dir> [--evaluate <dir> ...] <trajectory_opmode.csv>\n"
+		"       movestar --sweep <scenarios.csv> [options] <trajectory.csv | trajectory.mvt>\n"
+		"\n"
+		"Calculates MOVESTAR emissions of recorded trajectories. The CSV header names the\n"
+		"columns: vehicle id, vehicle type, time [s], speed [m/s] and optionally\n"
+		"acceleration [m/s2], position x and y [m] and slope (rise over run, 0.026 for\n"
+		"2.6 %%); without an acceleration column it is derived from the speed by central\n"
+		"difference, as in the Python version. The slope adds the grade to the VSP.\n"
+		"--convert writes the CSV file in the binary columnar format (without positions\n"
+		"and slopes), which is calculated without parsing and can be queried for a time\n"
+		"window and some vehicles. --aggregate counts the opmodes of every vehicle and\n"
+		"writes the histograms, which --evaluate prices against the rate tables of\n"
+		"other data directories without the trajectories. --sweep calculates every\n"
+		"scenario of a file (rate tables, VSP coefficients and vehicle type\n"
+		"reassignments) in one pass and writes the totals per scenario and type.\n"
+		"\n"
+		"options:\n"
+		"  --timestep <s>         sampling interval of the trajectories (default 1)\n"
+		"  --type <n>             vehicle type of files without a type column (default 100)\n"
+		"  --data-dir <dir>       load source types from VehicleSrcCoeff.csv and\n"
+		"                         EmsRate_<VehicleType>.csv (default MOVESTAR_DATA_DIR)\n"
+		"  --per-second <file>    per-second totals (default <trajectory>_sec.csv)\n"
+		"  --per-vehicle <file>   per-vehicle totals (default <trajectory>_veh.csv)\n"
+		"  --threads <n>          worker threads (default one per hardware thread)\n"
+		"  --scaling <n>          run with 1, 2, 4, ... up to n threads and report the\n"
+		"                         scaling and whether the totals are identical\n"
+		"  --convert <file>       convert the CSV input to a columnar file and exit\n"
+		"  --float32              store speeds and accelerations as float32 (--convert)\n"
+		"  --from <s>, --to <s>   rows within this time window only (columnar input)\n"
+		"  --vehicle <n>          this vehicle only, repeatable (columnar input)\n"
+		"  --grid <m/s>           look rates up in a speed x acceleration grid per source\n"
+		"                         type with cells of this speed (same results, cells\n"
+		"                         across a threshold are calculated exactly)\n"
+		"  --grid-acceleration <m/s2>  acceleration of the grid cells (default 0.02)\n"
+		"  --aggregate            opmode histograms per vehicle instead of per-second\n"
+		"                         totals; vehicle totals are evaluated from them\n"
+		"  --per-opmode <file>    histograms (default <trajectory>_opmode.csv)\n"
+		"  --resample             braking detection on the mean acceleration of every\n"
+		"                         second instead of the step starting it\n"
+		"  --compact              float32 kernels and rate tables, int16 histories\n"
+		"  --accuracy             run the double and the compact mode and report the\n"
+		"                         differences of the totals and the speedup\n"
+		"  --max-difference <x>   exit with 1 if a total of the compact mode differs\n"
+		"                         from the double path by more than this (--accuracy)\n"
+		"  --evaluate <dir>       evaluate the histogram file given as input against the\n"
+		"                         rate tables of <dir> (\"builtin\" for the built-in\n"
+		"                         ones), repeatable; totals per rate set and type\n"
+		"  --evaluation <file>    evaluated totals (default <input>_eval.csv)\n"
+		"  --sweep <file>         scenarios with the columns Scenario,DataDirectory,\n"
+		"                         FromType,ToType,Share: the data directory of the\n"
+		"                         scenario (empty for --data-dir, \"builtin\") and a\n"
+		"                         share of the vehicles of a type calculated as another\n"
+		"                         type, one reassignment per row\n"
+		"  --per-scenario <file>  sweep totals (default <trajectory>_sweep.csv)\n"
+		"  --memory-limit <MiB>   out of core (CSV input): keep the vehicle state,\n"
+		"                         per-second totals and buffers within this much;\n"
+		"                         the vehicles seen longest ago are retired and\n"
+		"                         written as the input is read\n"
+		"  --shards <n>           split the vehicles over n worker processes, each\n"
+		"                         reading the input for its own vehicles with its\n"
+		"                         share of the threads and of the memory limit; the\n"
+		"                         vehicles are listed in the order of their first row\n"
+		"  --raster <file>        add the emissions of every row to the cell of its\n"
+		"                         position and time bin (CSV input with x and y\n"
+		"                         columns) and write the occupied cells in the\n"
+		"                         binary format of EmissionRaster.h\n"
+		"  --cell-size <m>        raster cell size (default 100)\n"
+		"  --raster-interval <s>  raster time bin (default 60)\n"
+		"  --quiet                no summary on stderr\n");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	options.timeStep = 1.0;
+	options.defaultType = 100;
+	options.threads = 0;
+	options.scalingThreads = 0;
+	options.gridSpeedStep = 0.0;
+	options.gridAccelerationStep = DEFAULT_RATE_GRID_ACCELERATION_STEP;
+	options.float32 = false;
+	options.aggregate = false;
+	options.resample = false;
+	options.compact = false;
+	options.accuracy = false;
+	options.maxDifference = -1.0;
+	options.filtered = false;
+	options.memoryLimit = 0;
+	options.shards = 1;
+	options.shard = -1;
+	options.rasterCellSize = DEFAULT_RASTER_CELL_SIZE;
+	options.rasterInterval = DEFAULT_RASTER_INTERVAL;
+	options.quiet = false;
+	if (getenv("MOVESTAR_DATA_DIR") != nullptr)
+	{
+		options.dataDirectory = getenv("MOVESTAR_DATA_DIR");
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (option == "--timestep" && hasValue)
+		{
+			options.timeStep = atof(argv[++i]);
+		}
+		else if (option == "--type" && hasValue)
+		{
+			options.defaultType = atol(argv[++i]);
+		}
+		else if (option == "--data-dir" && hasValue)
+		{
+			options.dataDirectory = argv[++i];
+		}
+		else if (option == "--per-second" && hasValue)
+		{
+			options.perSecondPath = argv[++i];
+		}
+		else if (option == "--per-vehicle" && hasValue)
+		{
+			options.perVehiclePath = argv[++i];
+		}
+		else if (option == "--threads" && hasValue)
+		{
+			options.threads = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--scaling" && hasValue)
+		{
+			options.scalingThreads = (unsigned)atoi(argv[++i]);
+			if (options.scalingThreads == 0)
+			{
+				return false;
+			}
+		}
+		else if (option == "--convert" && hasValue)
+		{
+			options.convertPath = argv[++i];
+		}
+		else if (option == "--float32")
+		{
+			options.float32 = true;
+		}
+		else if (option == "--from" && hasValue)
+		{
+			options.query.from = atof(argv[++i]);
+			options.filtered = true;
+		}
+		else if (option == "--to" && hasValue)
+		{
+			options.query.to = atof(argv[++i]);
+			options.filtered = true;
+		}
+		else if (option == "--vehicle" && hasValue)
+		{
+			options.query.vehicles.push_back(atol(argv[++i]));
+			options.filtered = true;
+		}
+		else if (option == "--grid" && hasValue)
+		{
+			options.gridSpeedStep = atof(argv[++i]);
+		}
+		else if (option == "--grid-acceleration" && hasValue)
+		{
+			options.gridAccelerationStep = atof(argv[++i]);
+		}
+		else if (option == "--aggregate")
+		{
+			options.aggregate = true;
+		}
+		else if (option == "--resample")
+		{
+			options.resample = true;
+		}
+		else if (option == "--compact")
+		{
+			options.compact = true;
+		}
+		else if (option == "--accuracy")
+		{
+			options.accuracy = true;
+		}
+		else if (option == "--max-difference" && hasValue)
+		{
+			options.maxDifference = atof(argv[++i]);
+		}
+		else if (option == "--per-opmode" && hasValue)
+		{
+			options.perOpmodePath = argv[++i];
+		}
+		else if (option == "--evaluate" && hasValue)
+		{
+			options.rateDirectories.push_back(argv[++i]);
+		}
+		else if (option == "--evaluation" && hasValue)
+		{
+			options.evaluationPath = argv[++i];
+		}
+		else if (option == "--sweep" && hasValue)
+		{
+			options.sweepPath = argv[++i];
+		}
+		else if (option == "--per-scenario" && hasValue)
+		{
+			options.perScenarioPath = argv[++i];
+		}
+		else if (option == "--memory-limit" && hasValue)
+		{
+			double megabytes = atof(argv[++i]);
+			if (!(megabytes > 0.0))
+			{
+				return false;
+			}
+			options.memoryLimit = (size_t)(megabytes * 1048576.0);
+		}
+		else if (option == "--shards" && hasValue)
+		{
+			options.shards = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--shard" && hasValue)
+		{
+			options.shard = atoi(argv[++i]);
+		}
+		else if (option == "--shard-output" && hasValue)
+		{
+			options.shardOutput = argv[++i];
+		}
+		else if (option == "--raster" && hasValue)
+		{
+			options.rasterPath = argv[++i];
+		}
+		else if (option == "--cell-size" && hasValue)
+		{
+			options.rasterCellSize = atof(argv[++i]);
+		}
+		else if (option == "--raster-interval" && hasValue)
+		{
+			options.rasterInterval = atof(argv[++i]);
+		}
+		else if (option == "--quiet")
+		{
+			options.quiet = true;
+		}
+		else if (option.size() > 1 && option[0] == '-')
+		{
+			return false;
+		}
+		else if (options.inputPath.empty())
+		{
+			options.inputPath = option;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	if (options.inputPath.empty() || !(options.timeStep > 0.0) || (options.float32 && options.convertPath.empty()))
+	{
+		return false;
+	}
+	if (!options.sweepPath.empty() && (options.aggregate || options.compact || options.accuracy || options.scalingThreads > 0))
+	{
+		return false;
+	}
+	bool outOfCore = (options.memoryLimit > 0 || options.shards > 1);
+	if (outOfCore && (options.aggregate || !options.sweepPath.empty() || options.accuracy || options.scalingThreads > 0 ||
+		!options.rateDirectories.empty() || !options.convertPath.empty()))
+	{
+		return false;
+	}
+	if (!options.rasterPath.empty() && (options.aggregate || !options.sweepPath.empty() || options.accuracy ||
+		options.scalingThreads > 0 || options.shards > 1 || !options.rateDirectories.empty() || !options.convertPath.empty() ||
+		!EmissionRaster::validGrid(options.rasterCellSize, options.rasterInterval)))
+	{
+		return false;
+	}
+	if (options.shards == 0 || (options.shard >= 0 && ((unsigned)options.shard >= options.shards || options.shardOutput.empty())))
+	{
+		return false;
+	}
+	if (options.gridSpeedStep != 0.0 && !RateGrid::validResolution(options.gridSpeedStep, options.gridAccelerationStep))
+	{
+		return false;
+	}
+	sort(options.query.vehicles.begin(), options.query.vehicles.end());
+
+	//default outputs next to the input, named as the Python version names them
+	string stem = options.inputPath;
+	if (stem.size() > 4 && (stem.compare(stem.size() - 4, 4, ".csv") == 0 || stem.compare(stem.size() - 4, 4, ".mvt") == 0))
+	{
+		stem.erase(stem.size() - 4);
+	}
+	if (options.perSecondPath.empty())
+	{
+		options.perSecondPath = stem + "_sec.csv";
+	}
+	if (options.perVehiclePath.empty())
+	{
+		options.perVehiclePath = stem + "_veh.csv";
+	}
+	if (options.perOpmodePath.empty())
+	{
+		options.perOpmodePath = stem + "_opmode.csv";
+	}
+	if (options.evaluationPath.empty())
+	{
+		options.evaluationPath = stem + "_eval.csv";
+	}
+	if (options.perScenarioPath.empty())
+	{
+		options.perScenarioPath = stem + "_sweep.csv";
+	}
+	return true;
+}
+
+static bool writePerSecond(const string &path, const TrajectoryTotals &totals)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	fprintf(file, "Time(s),HC(g),CO(g),NOx(g),CO2(g),Energy(KJ),PM2.5(g)\n");
+	for (size_t i = 0; i < totals.seconds.size(); i++)
+	{
+		const double *values = totals.seconds[i].values;
+		fprintf(file, "%lld,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", totals.firstSecond + (long long)i,
+			values[0], values[1], values[2], values[3], values[4], values[5]);
+	}
+	return fclose(file) == 0;
+}
+
+//per-vehicle file with its header, null if it cannot be created
+static FILE *createPerVehicle(const string &path)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (file != nullptr)
+	{
+		fprintf(file, "Vehicle,Type,HC(g),CO(g),NOx(g),CO2(g),Energy(KJ),PM2.5(g),TT(s),TD(m)\n");
+	}
+	return file;
+}
+
+//a worker of --shards puts the input row the vehicle first appeared in
+//before it (<keyed>), by which its parent merges the shards
+static void writeVehicle(FILE *file, const VehicleTrack &track, bool keyed = false)
+{
+	if (keyed)
+	{
+		fprintf(file, "%zu,", track.firstRow);
+	}
+	const double *values = track.totals.values;
+	fprintf(file, "%ld,%ld,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", track.vehicleNumber, track.vehicleType,
+		values[0], values[1], values[2], values[3], values[4], values[5], track.travelTime, track.travelDistance);
+}
+
+static bool writePerVehicle(const string &path, const TrajectoryTotals &totals, bool keyed)
+{
+	FILE *file = createPerVehicle(path);
+	if (file == nullptr)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < totals.vehicles.size(); i++)
+	{
+		writeVehicle(file, totals.vehicles[i], keyed);
+	}
+	return fclose(file) == 0;
+}
+
+static bool writePerOpmode(const string &path, const TrajectoryTotals &totals, double timeStep, string &error)
+{
+	vector<VehicleActivity> vehicles(totals.vehicles.size());
+	for (size_t i = 0; i < totals.vehicles.size(); i++)
+	{
+		const VehicleTrack &track = totals.vehicles[i];
+		VehicleActivity &vehicle = vehicles[i];
+		vehicle.vehicleNumber = track.vehicleNumber;
+		vehicle.vehicleType = track.vehicleType;
+		vehicle.travelTime = track.travelTime;
+		vehicle.travelDistance = track.travelDistance;
+		vehicle.activity = track.activity;
+	}
+	return writeActivities(path, vehicles, timeStep, error);
+}
+
+static bool writePerScenario(const string &path, const SweepScenarios &scenarios, const TrajectoryTotals &totals)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	fprintf(file, "Scenario,Type,SourceType,Vehicles,HC(g),CO(g),NOx(g),CO2(g),Energy(KJ),PM2.5(g),TT(s),TD(m)\n");
+	for (size_t i = 0; i < totals.scenarios.size(); i++)
+	{
+		const ScenarioTypeTotals &group = totals.scenarios[i];
+		const double *values = group.totals.values;
+		fprintf(file, "%s,%ld,%d,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", scenarios[group.scenario].name.c_str(),
+			group.vehicleType, group.sourceTypeId, group.vehicles, values[0], values[1], values[2], values[3], values[4],
+			values[5], group.travelTime, group.travelDistance);
+
+		//the types of a scenario are followed by its total
+		if (i + 1 == totals.scenarios.size() || totals.scenarios[i + 1].scenario != group.scenario)
+		{
+			EmissionTotals all = EmissionTotals();
+			size_t vehicles = 0;
+			for (size_t j = 0; j < totals.scenarios.size(); j++)
+			{
+				if (totals.scenarios[j].scenario == group.scenario)
+				{
+					vehicles += totals.scenarios[j].vehicles;
+					for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+					{
+						all.values[k] += totals.scenarios[j].totals.values[k];
+					}
+				}
+			}
+			values = all.values;
+			fprintf(file, "%s,all,,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,,\n", scenarios[group.scenario].name.c_str(), vehicles,
+				values[0], values[1], values[2], values[3], values[4], values[5]);
+		}
+	}
+	return fclose(file) == 0;
+}
+
+//histograms of one vehicle type
+struct ActivityGroup
+{
+	OpmodeActivity activity;
+	size_t         vehicles;
+	double         travelTime;
+	double         travelDistance;
+};
+
+//evaluates the opmode histogram file given as input against every rate directory,
+//per vehicle type and in total
+static int evaluate(const Options &options)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<VehicleActivity> vehicles;
+	double timeStep = 0.0;
+	string error;
+	if (!readActivities(options.inputPath, vehicles, timeStep, error))
+	{
+		fprintf(stderr, "movestar: %s\n", error.c_str());
+		return 1;
+	}
+
+	//the histograms of a type are summed once, each rate set is then one
+	//histogram x rate matrix product per type
+	map<long, ActivityGroup> groups;
+	for (size_t i = 0; i < vehicles.size(); i++)
+	{
+		ActivityGroup &group = groups[vehicles[i].vehicleType];
+		addActivity(group.activity, vehicles[i].activity);
+		group.vehicles++;
+		group.travelTime += vehicles[i].travelTime;
+		group.travelDistance += vehicles[i].travelDistance;
+	}
+	vector<long> types;
+	vector<OpmodeActivity> activities;
+	for (map<long, ActivityGroup>::const_iterator it = groups.begin(); it != groups.end(); ++it)
+	{
+		types.push_back(it->first);
+		activities.push_back(it->second.activity);
+	}
+
+	FILE *file = fopen(options.evaluationPath.c_str(), "w");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.evaluationPath.c_str());
+		return 1;
+	}
+	fprintf(file, "RateSet,Type,SourceType,Vehicles,HC(g),CO(g),NOx(g),CO2(g),Energy(KJ),PM2.5(g),TT(s),TD(m)\n");
+	vector<const EmissionRateTable *> tables(types.size());
+	vector<EmissionTotals> totals(types.size());
+	size_t unknownVehicles = 0;
+	for (size_t d = 0; d < options.rateDirectories.size(); d++)
+	{
+		const string &directory = options.rateDirectories[d];
+		SourceTypeRegistry sourceTypes;
+		if (directory != "builtin" && !sourceTypes.load(directory, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			fclose(file);
+			return 1;
+		}
+		for (size_t t = 0; t < types.size(); t++)
+		{
+			const SourceTypeModel *model = sourceTypes.find(types[t]);
+			tables[t] = model != nullptr ? model->rates : nullptr;
+			unknownVehicles += model != nullptr ? 0 : groups[types[t]].vehicles;
+		}
+		evaluateActivities(types.size(), activities.data(), tables.data(), timeStep, totals.data());
+
+		EmissionTotals all = EmissionTotals();
+		for (size_t t = 0; t < types.size(); t++)
+		{
+			const ActivityGroup &group = groups[types[t]];
+			const SourceTypeModel *model = sourceTypes.find(types[t]);
+			const double *values = totals[t].values;
+			fprintf(file, "%s,%ld,%d,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", directory.c_str(), types[t],
+				model != nullptr ? model->sourceTypeId : 0, group.vehicles, values[0], values[1], values[2], values[3],
+				values[4], values[5], group.travelTime, group.travelDistance);
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				all.values[k] += values[k];
+			}
+		}
+		const double *values = all.values;
+		fprintf(file, "%s,all,,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,,\n", directory.c_str(), vehicles.size(),
+			values[0], values[1], values[2], values[3], values[4], values[5]);
+	}
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.evaluationPath.c_str());
+		return 1;
+	}
+
+	if (unknownVehicles > 0)
+	{
+		fprintf(stderr, "movestar: %zu vehicles of a type without rates in their rate set got zero emissions\n",
+			unknownVehicles);
+	}
+	if (!options.quiet)
+	{
+		fprintf(stderr, "movestar: %zu vehicles of %zu types against %zu rate sets in %.3f s\n", vehicles.size(),
+			types.size(), options.rateDirectories.size(), chrono::duration<double>(chrono::steady_clock::now() - start).count());
+	}
+	return 0;
+}
+
+//peak resident set size of the process [KB]
+static unsigned long long peakResidentKB()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize / 1024;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (unsigned long long)usage.ru_maxrss / 1024;
+#else
+	return (unsigned long long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+//FNV-1a hash of every total, to compare runs bit by bit
+static unsigned long long hashTotals(const TrajectoryTotals &totals)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	const unsigned char *bytes = (const unsigned char *)totals.seconds.data();
+	size_t size = totals.seconds.size() * sizeof(EmissionTotals);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	for (size_t v = 0; v < totals.vehicles.size(); v++)
+	{
+		bytes = (const unsigned char *)&totals.vehicles[v].totals;
+		for (size_t i = 0; i < sizeof(EmissionTotals); i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+//calculates the whole input (the vehicles of its shard in a worker) with
+//<threads> threads, sweeping <scenarios> if not null, handing the vehicles
+//retired under a memory limit to <sink> and rastering into <raster> if not
+//null; returns the time taken [s] or -1
+static double calculate(const Options &options, const SourceTypeRegistry &sourceTypes, const shared_ptr<const RateGrids> &grids,
+	const shared_ptr<const CompactSourceTypes> &compactTypes, unsigned threads, TrajectoryTotals &totals, unsigned &threadsUsed,
+	string &error, const shared_ptr<const SweepScenarios> &scenarios = nullptr, const RetiredVehicleSink &sink = RetiredVehicleSink(),
+	EmissionRaster *raster = nullptr)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	WorkStealingPool pool(threads);
+	ParallelTrajectoryEngine engine(sourceTypes, options.timeStep, pool);
+	engine.setRateGrids(grids);
+	engine.setAggregate(options.aggregate);
+	engine.setHistoryResampling(options.resample);
+	engine.setCompact(compactTypes);
+	engine.setScenarios(scenarios);
+	engine.setMemoryLimit(options.memoryLimit, sink);
+	engine.setRaster(raster);
+	if (ColumnarTrajectoryReader::isColumnar(options.inputPath))
+	{
+		ColumnarTrajectoryReader reader;
+		if (options.memoryLimit > 0)
+		{
+			error = "--memory-limit needs a CSV input, columnar files are calculated vehicle by vehicle";
+			return -1.0;
+		}
+		if (raster != nullptr)
+		{
+			error = "--raster needs a CSV input with positions, columnar files keep none";
+			return -1.0;
+		}
+		if (!reader.open(options.inputPath, error))
+		{
+			return -1.0;
+		}
+		TrajectoryQuery query = options.query;
+		if (options.shard >= 0)
+		{
+			query.shardIndex = (size_t)options.shard;
+			query.shardCount = options.shards;
+		}
+		engine.run(reader, query);
+	}
+	else
+	{
+		TrajectoryCsvReader reader;
+		if (options.filtered)
+		{
+			error = "--from, --to and --vehicle need a columnar input (see --convert)";
+			return -1.0;
+		}
+		if (!reader.open(options.inputPath, options.defaultType, error))
+		{
+			return -1.0;
+		}
+		if (options.shard >= 0)
+		{
+			reader.setShard((size_t)options.shard, options.shards);
+		}
+		if (!engine.run(reader, error))
+		{
+			return -1.0;
+		}
+	}
+	engine.totals(totals);
+	threadsUsed = pool.size();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//runs the input with 1, 2, 4, ... threads up to <maxThreads> and prints speedup and efficiency
+static int reportScaling(const Options &options, const SourceTypeRegistry &sourceTypes, const shared_ptr<const RateGrids> &grids,
+	const shared_ptr<const CompactSourceTypes> &compactTypes)
+{
+	vector<unsigned> counts;
+	for (unsigned threads = 1; threads < options.scalingThreads; threads *= 2)
+	{
+		counts.push_back(threads);
+	}
+	counts.push_back(options.scalingThreads);
+
+	printf("threads,seconds,Mrows/s,speedup,efficiency,totals\n");
+	double serialSeconds = 0.0;
+	unsigned long long serialHash = 0;
+	bool identical = true;
+	for (size_t i = 0; i < counts.size(); i++)
+	{
+		TrajectoryTotals totals;
+		unsigned threadsUsed = 0;
+		string error;
+		double seconds = calculate(options, sourceTypes, grids, compactTypes, counts[i], totals, threadsUsed, error);
+		if (seconds < 0.0)
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			return 1;
+		}
+		unsigned long long hash = hashTotals(totals);
+		if (i == 0)
+		{
+			serialSeconds = seconds;
+			serialHash = hash;
+		}
+		identical = identical && (hash == serialHash);
+		double speedup = seconds > 0.0 ? serialSeconds / seconds : 0.0;
+		printf("%u,%.3f,%.2f,%.2f,%.2f,%016llx\n", threadsUsed, seconds, seconds > 0.0 ? totals.rows / seconds * 1e-6 : 0.0,
+			speedup, speedup / threadsUsed, hash);
+		fflush(stdout);
+	}
+	fprintf(stderr, "movestar: totals %s for every thread count\n", identical ? "bit-identical" : "DIFFER");
+	return identical ? 0 : 1;
+}
+
+//relative difference of <value> to <reference>, 0 if both are 0
+static double relativeDifference(double value, double reference)
+{
+	if (reference == 0.0)
+	{
+		return value == 0.0 ? 0.0 : 1.0;
+	}
+	return fabs(value - reference) / fabs(reference);
+}
+
+//runs the input in double and in compact mode and prints the relative
+//differences of the total and of the vehicle totals per pollutant
+static int reportAccuracy(const Options &options, const SourceTypeRegistry &sourceTypes, const shared_ptr<const RateGrids> &grids,
+	const shared_ptr<const CompactSourceTypes> &compactTypes)
+{
+	TrajectoryTotals exact, compact;
+	unsigned threadsUsed = 0;
+	string error;
+	double exactSeconds = calculate(options, sourceTypes, grids, nullptr, options.threads, exact, threadsUsed, error);
+	double compactSeconds = exactSeconds < 0.0 ? -1.0 :
+		calculate(options, sourceTypes, grids, compactTypes, options.threads, compact, threadsUsed, error);
+	if (compactSeconds < 0.0)
+	{
+		fprintf(stderr, "movestar: %s\n", error.c_str());
+		return 1;
+	}
+
+	static const char *names[EMISSION_RATE_COUNT] = { "HC(g)", "CO(g)", "NOx(g)", "CO2(g)", "Energy(KJ)", "PM2.5(g)" };
+	printf("Pollutant,Double,Compact,Difference,MaxVehicleDifference\n");
+	double worstTotal = 0.0;
+	double worstVehicle = 0.0;
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		double exactTotal = 0.0, compactTotal = 0.0, vehicleDifference = 0.0;
+		for (size_t v = 0; v < exact.vehicles.size() && v < compact.vehicles.size(); v++)
+		{
+			double exactValue = exact.vehicles[v].totals.values[k];
+			double compactValue = compact.vehicles[v].totals.values[k];
+			exactTotal += exactValue;
+			compactTotal += compactValue;
+			vehicleDifference = max(vehicleDifference, relativeDifference(compactValue, exactValue));
+		}
+		double difference = relativeDifference(compactTotal, exactTotal);
+		printf("%s,%.9g,%.9g,%.3g,%.3g\n", names[k], exactTotal, compactTotal, difference, vehicleDifference);
+		worstTotal = max(worstTotal, difference);
+		worstVehicle = max(worstVehicle, vehicleDifference);
+	}
+	fprintf(stderr, "movestar: compact totals within %.3g of the double path (vehicles within %.3g), %.3f s against %.3f s\n",
+		worstTotal, worstVehicle, compactSeconds, exactSeconds);
+	if (options.maxDifference >= 0.0 && !(worstTotal <= options.maxDifference))
+	{
+		fprintf(stderr, "movestar: the compact totals differ by more than %g\n", options.maxDifference);
+		return 1;
+	}
+	return 0;
+}
+
+//what a worker of --shards hands back besides its per-vehicle file
+struct ShardPartial
+{
+	TrajectoryTotals   totals;		//per-second totals and counters, no vehicles
+	size_t             vehicles;
+	unsigned long long peakResidentKB;
+};
+
+static bool writeShardPartial(const string &path, const TrajectoryTotals &totals, string &error)
+{
+	CheckpointWriter writer;
+	writer.put((uint64_t)totals.rows);
+	writer.put((uint64_t)totals.unknownTypeRows);
+	writer.put((uint64_t)(totals.vehicles.size() + totals.retiredVehicles));
+	writer.put((uint64_t)totals.retiredVehicles);
+	writer.put((uint64_t)totals.reenteredVehicles);
+	writer.put((uint64_t)totals.peakStateBytes);
+	writer.put((uint64_t)peakResidentKB());
+	writer.put((int64_t)totals.firstSecond);
+	writer.put((uint64_t)totals.seconds.size());
+	for (size_t i = 0; i < totals.seconds.size(); i++)
+	{
+		for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+		{
+			writer.put(totals.seconds[i].values[k]);
+		}
+	}
+	CheckpointFile file;
+	return file.write(path, writer.data(), error) && file.flush(error);
+}
+
+static bool readShardPartial(const string &path, ShardPartial &partial, string &error)
+{
+	vector<char> snapshot;
+	if (!CheckpointFile::read(path, snapshot, error))
+	{
+		return false;
+	}
+	CheckpointReader reader(snapshot.data(), snapshot.size());
+	uint64_t rows, unknownRows, vehicles, retired, reentered, peakState, peakKB, secondCount;
+	int64_t firstSecond;
+	bool complete = reader.get(rows) && reader.get(unknownRows) && reader.get(vehicles) && reader.get(retired) &&
+		reader.get(reentered) && reader.get(peakState) && reader.get(peakKB) && reader.get(firstSecond) && reader.get(secondCount);
+	if (complete && secondCount <= snapshot.size() / sizeof(EmissionTotals))
+	{
+		partial.totals.seconds.resize((size_t)secondCount);
+		for (size_t i = 0; i < partial.totals.seconds.size() && complete; i++)
+		{
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				complete = complete && reader.get(partial.totals.seconds[i].values[k]);
+			}
+		}
+	}
+	if (!complete || !reader.atEnd())
+	{
+		error = path + ": partial totals of a shard damaged";
+		return false;
+	}
+	partial.totals.rows = (size_t)rows;
+	partial.totals.unknownTypeRows = (size_t)unknownRows;
+	partial.totals.retiredVehicles = (size_t)retired;
+	partial.totals.reenteredVehicles = (size_t)reentered;
+	partial.totals.peakStateBytes = (size_t)peakState;
+	partial.totals.firstSecond = (long long)firstSecond;
+	partial.vehicles = (size_t)vehicles;
+	partial.peakResidentKB = peakKB;
+	return true;
+}
+
+//adds the per-second totals and counters of <from> to <to>
+static void addTotals(const TrajectoryTotals &from, TrajectoryTotals &to)
+{
+	if (!from.seconds.empty())
+	{
+		if (to.seconds.empty())
+		{
+			to.firstSecond = from.firstSecond;
+		}
+		if (from.firstSecond < to.firstSecond)
+		{
+			to.seconds.insert(to.seconds.begin(), (size_t)(to.firstSecond - from.firstSecond), EmissionTotals());
+			to.firstSecond = from.firstSecond;
+		}
+		size_t offset = (size_t)(from.firstSecond - to.firstSecond);
+		if (offset + from.seconds.size() > to.seconds.size())
+		{
+			to.seconds.resize(offset + from.seconds.size(), EmissionTotals());
+		}
+		for (size_t i = 0; i < from.seconds.size(); i++)
+		{
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				to.seconds[offset + i].values[k] += from.seconds[i].values[k];
+			}
+		}
+	}
+	to.rows += from.rows;
+	to.unknownTypeRows += from.unknownTypeRows;
+	to.retiredVehicles += from.retiredVehicles;
+	to.reenteredVehicles += from.reenteredVehicles;
+	to.peakStateBytes = max(to.peakStateBytes, from.peakStateBytes);
+}
+
+//a line of <file> with its newline into <line>, false at the end of the file
+static bool readLine(FILE *file, string &line)
+{
+	line.clear();
+	char buffer[256];
+	while (fgets(buffer, sizeof(buffer), file) != nullptr)
+	{
+		line += buffer;
+		if (line[line.size() - 1] == '\n')
+		{
+			return true;
+		}
+	}
+	return !line.empty();
+}
+
+//merges the rows of the per-vehicle files of the shards <paths> after their
+//headers into <file>, in the order of the first input rows they are keyed by
+//(see writeVehicle) and without them, so the vehicles are listed as a run
+//without shards lists them. False if a file cannot be read or <file> written
+static bool mergeVehicles(FILE *file, const vector<string> &paths)
+{
+	vector<FILE *> parts(paths.size(), nullptr);
+	vector<string> lines(paths.size());
+	vector<bool> pending(paths.size(), false);
+	bool merged = true;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		parts[i] = fopen(paths[i].c_str(), "rb");
+		merged = merged && parts[i] != nullptr;
+		pending[i] = parts[i] != nullptr && readLine(parts[i], lines[i]) && readLine(parts[i], lines[i]);
+	}
+	while (merged)
+	{
+		//the smallest key at the head of a shard, the first shard on a tie
+		size_t next = paths.size();
+		unsigned long long nextKey = 0;
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			unsigned long long key = pending[i] ? strtoull(lines[i].c_str(), nullptr, 10) : 0;
+			if (pending[i] && (next == paths.size() || key < nextKey))
+			{
+				next = i;
+				nextKey = key;
+			}
+		}
+		if (next == paths.size())
+		{
+			break;
+		}
+		size_t comma = lines[next].find(',');
+		merged = comma != string::npos && fputs(lines[next].c_str() + comma + 1, file) >= 0;
+		pending[next] = readLine(parts[next], lines[next]);
+	}
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (parts[i] != nullptr)
+		{
+			fclose(parts[i]);
+		}
+	}
+	return merged;
+}
+
+//share of the thread time of the run every stage took; the slowest stage
+//bounds the rate, the rest was idle (waiting for a segment or a serial step)
+static void reportStages(const Options &options, const TrajectoryTotals &totals)
+{
+	static const char *const names[TRAJECTORY_STAGE_COUNT] = { "ingest", "resample", "kernel", "aggregate" };
+	double threadSeconds = totals.stages.wall * totals.stages.threads;
+	if (options.quiet || threadSeconds <= 0.0)
+	{
+		return;
+	}
+	string line;
+	double idle = 1.0;
+	for (int stage = 0; stage < TRAJECTORY_STAGE_COUNT; stage++)
+	{
+		double share = totals.stages.busy[stage] / threadSeconds;
+		char figure[64];
+		snprintf(figure, sizeof(figure), "%s %.1f%% (%.3f s), ", names[stage], share * 100.0, totals.stages.busy[stage]);
+		line += figure;
+		idle -= share;
+	}
+	fprintf(stderr, "movestar: stages %sidle %.1f%% of %u threads\n", line.c_str(), max(idle, 0.0) * 100.0, totals.stages.threads);
+}
+
+//the out-of-core figures: state against the limit (of each of <shards>),
+//retired vehicles and the peak memory of a process
+static void reportMemory(const Options &options, unsigned shards, const TrajectoryTotals &totals, unsigned long long peakKB)
+{
+	if (!options.quiet && options.memoryLimit > 0)
+	{
+		fprintf(stderr, "movestar: state peaked at %.1f MiB of a %.1f MiB limit%s, %zu vehicles retired before the end\n",
+			totals.peakStateBytes / 1048576.0, options.memoryLimit / 1048576.0 / shards, shards > 1 ? " per shard" : "",
+			totals.retiredVehicles);
+	}
+	if (totals.reenteredVehicles > 0)
+	{
+		fprintf(stderr, "movestar: %zu vehicles were seen again after their retirement and are listed twice; "
+			"a larger --memory-limit keeps them\n", totals.reenteredVehicles);
+	}
+	if (!options.quiet)
+	{
+		fprintf(stderr, "movestar: peak resident memory %.1f MiB\n", peakKB / 1024.0);
+	}
+}
+
+//--shards: a worker per shard runs this executable on the vehicles of its
+//shard; their per-second totals are merged in shard order, so they only
+//depend on the shard count, and their per-vehicle files by first input row
+static int runShards(int argc, char **argv, const Options &options)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	string executable = currentExecutablePath();
+	if (executable.empty())
+	{
+		fprintf(stderr, "movestar: cannot find the executable to start the shards\n");
+		return 1;
+	}
+	unsigned hardware = max(1u, thread::hardware_concurrency());
+	unsigned threads = max(1u, (options.threads > 0 ? options.threads : hardware) / options.shards);
+	char limit[32];
+	snprintf(limit, sizeof(limit), "%.6f", options.memoryLimit / 1048576.0 / options.shards);
+
+	vector<ChildProcess> workers(options.shards);
+	vector<string> partials(options.shards), parts(options.shards);
+	string error;
+	bool succeeded = true;
+	for (unsigned i = 0; i < options.shards && succeeded; i++)
+	{
+		partials[i] = options.perSecondPath + ".shard" + to_string(i);
+		parts[i] = options.perVehiclePath + ".shard" + to_string(i);
+		vector<string> arguments(argv + 1, argv + argc);
+		const char *extra[] = { "--shard", nullptr, "--shard-output", nullptr, "--per-vehicle", nullptr, "--threads", nullptr };
+		string shard = to_string(i), threadCount = to_string(threads);
+		extra[1] = shard.c_str();
+		extra[3] = partials[i].c_str();
+		extra[5] = parts[i].c_str();
+		extra[7] = threadCount.c_str();
+		arguments.insert(arguments.end(), extra, extra + 8);
+		arguments.push_back("--quiet");
+		if (options.memoryLimit > 0)
+		{
+			arguments.push_back("--memory-limit");
+			arguments.push_back(limit);
+		}
+		if (!workers[i].start(executable, arguments, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			succeeded = false;
+		}
+	}
+	for (unsigned i = 0; i < options.shards; i++)
+	{
+		if (workers[i].started() && workers[i].wait() != 0)
+		{
+			fprintf(stderr, "movestar: shard %u failed\n", i);
+			succeeded = false;
+		}
+	}
+
+	//merged in shard order, the output is the same for any thread count
+	TrajectoryTotals totals = TrajectoryTotals();
+	size_t vehicles = 0;
+	unsigned long long peakKB = peakResidentKB();
+	FILE *vehicleFile = succeeded ? createPerVehicle(options.perVehiclePath) : nullptr;
+	if (succeeded && vehicleFile == nullptr)
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.perVehiclePath.c_str());
+		succeeded = false;
+	}
+	for (unsigned i = 0; i < options.shards && succeeded; i++)
+	{
+		ShardPartial partial;
+		if (!readShardPartial(partials[i], partial, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			succeeded = false;
+			break;
+		}
+		addTotals(partial.totals, totals);
+		vehicles += partial.vehicles;
+		peakKB = max(peakKB, partial.peakResidentKB);
+	}
+	if (succeeded && !mergeVehicles(vehicleFile, parts))
+	{
+		fprintf(stderr, "movestar: cannot merge the vehicles of the shards into %s\n", options.perVehiclePath.c_str());
+		succeeded = false;
+	}
+	if (vehicleFile != nullptr && fclose(vehicleFile) != 0 && succeeded)
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.perVehiclePath.c_str());
+		succeeded = false;
+	}
+	for (unsigned i = 0; i < options.shards; i++)
+	{
+		remove(partials[i].c_str());
+		remove(parts[i].c_str());
+	}
+	if (!succeeded)
+	{
+		return 1;
+	}
+	if (!writePerSecond(options.perSecondPath, totals))
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.perSecondPath.c_str());
+		return 1;
+	}
+
+	if (totals.unknownTypeRows > 0)
+	{
+		fprintf(stderr, "movestar: %zu rows of vehicles with an unknown vehicle type got zero emissions\n",
+			totals.unknownTypeRows);
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (!options.quiet)
+	{
+		fprintf(stderr, "movestar: %zu rows, %zu vehicles in %.3f s on %u shards of %u threads (%.1f M rows/s)\n", totals.rows,
+			vehicles, seconds, options.shards, threads, seconds > 0.0 ? totals.rows / seconds * 1e-6 : 0.0);
+	}
+	reportMemory(options, options.shards, totals, peakKB);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 2;
+	}
+
+	if (!options.rateDirectories.empty())
+	{
+		return evaluate(options);
+	}
+	if (options.shards > 1 && options.shard < 0)
+	{
+		return runShards(argc, argv, options);
+	}
+
+	SourceTypeRegistry sourceTypes;
+	string error;
+	if (!options.dataDirectory.empty() && !sourceTypes.load(options.dataDirectory, error))
+	{
+		fprintf(stderr, "movestar: %s\n", error.c_str());
+		return 1;
+	}
+	if (!options.convertPath.empty())
+	{
+		TrajectoryCsvReader reader;
+		if (!reader.open(options.inputPath, options.defaultType, error) ||
+			!convertTrajectoryCsv(reader, options.convertPath, options.float32, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	//the grids are built once and shared by every partition
+	shared_ptr<const RateGrids> grids;
+	if (options.gridSpeedStep > 0.0)
+	{
+		grids.reset(new RateGrids(sourceTypes, options.gridSpeedStep, options.gridAccelerationStep));
+		if (!options.quiet)
+		{
+			fprintf(stderr, "movestar: rate grids of %zu source types, %.1f%% of the cells calculated exactly\n",
+				grids->size(), grids->exactShare() * 100.0);
+		}
+	}
+
+	//as the grids, the float32 copies of the source types are shared
+	shared_ptr<const CompactSourceTypes> compactTypes;
+	if (options.compact || options.accuracy)
+	{
+		compactTypes.reset(new CompactSourceTypes(sourceTypes));
+	}
+	if (options.accuracy)
+	{
+		return reportAccuracy(options, sourceTypes, grids, compactTypes);
+	}
+	if (options.scalingThreads > 0)
+	{
+		return reportScaling(options, sourceTypes, grids, compactTypes);
+	}
+
+	shared_ptr<SweepScenarios> scenarios;
+	if (!options.sweepPath.empty())
+	{
+		scenarios.reset(new SweepScenarios);
+		if (!readScenarios(options.sweepPath, options.dataDirectory, *scenarios, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			return 1;
+		}
+	}
+
+	//under a memory limit the vehicles are written as they are retired
+	FILE *vehicleFile = nullptr;
+	RetiredVehicleSink sink;
+	if (options.memoryLimit > 0)
+	{
+		vehicleFile = createPerVehicle(options.perVehiclePath);
+		if (vehicleFile == nullptr)
+		{
+			fprintf(stderr, "movestar: cannot write %s\n", options.perVehiclePath.c_str());
+			return 1;
+		}
+		bool keyed = (options.shard >= 0);
+		sink = [vehicleFile, keyed](const VehicleTrack &track) { writeVehicle(vehicleFile, track, keyed); };
+	}
+
+	//a tile per partition, merged as the time bins end
+	EmissionRaster raster;
+	if (!options.rasterPath.empty() && !raster.open(options.rasterPath, options.rasterCellSize, options.rasterInterval,
+		TRAJECTORY_PARTITIONS, error))
+	{
+		fprintf(stderr, "movestar: %s\n", error.c_str());
+		if (vehicleFile != nullptr)
+		{
+			fclose(vehicleFile);
+			remove(options.perVehiclePath.c_str());
+		}
+		return 1;
+	}
+
+	TrajectoryTotals totals;
+	unsigned threadsUsed = 0;
+	double seconds = calculate(options, sourceTypes, grids, compactTypes, options.threads, totals, threadsUsed, error, scenarios, sink,
+		raster.isOpen() ? &raster : nullptr);
+	if (seconds >= 0.0 && raster.isOpen() && !raster.close(error))
+	{
+		seconds = -1.0;
+	}
+	if (seconds < 0.0)
+	{
+		fprintf(stderr, "movestar: %s\n", error.c_str());
+		if (vehicleFile != nullptr)
+		{
+			fclose(vehicleFile);
+			remove(options.perVehiclePath.c_str());
+		}
+		if (!options.rasterPath.empty())
+		{
+			raster.close(error);
+			remove(options.rasterPath.c_str());
+		}
+		return 1;
+	}
+
+	if (scenarios)
+	{
+		if (!writePerScenario(options.perScenarioPath, *scenarios, totals))
+		{
+			fprintf(stderr, "movestar: cannot write %s\n", options.perScenarioPath.c_str());
+			return 1;
+		}
+		if (!options.quiet)
+		{
+			fprintf(stderr, "movestar: %zu rows, %zu scenarios in %.3f s on %u threads (%.2f opmodes binned per row)\n",
+				totals.rows, scenarios->size(), seconds, threadsUsed, totals.rows > 0 ? (double)totals.binnedRows / totals.rows : 0.0);
+		}
+		reportStages(options, totals);
+		return 0;
+	}
+
+	if (options.aggregate)
+	{
+		if (!writePerOpmode(options.perOpmodePath, totals, options.timeStep, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			return 1;
+		}
+	}
+	else if (options.shard < 0 && !writePerSecond(options.perSecondPath, totals))
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.perSecondPath.c_str());
+		return 1;
+	}
+	bool vehiclesWritten;
+	if (vehicleFile != nullptr)
+	{
+		for (size_t i = 0; i < totals.vehicles.size(); i++)
+		{
+			writeVehicle(vehicleFile, totals.vehicles[i], options.shard >= 0);
+		}
+		vehiclesWritten = (fclose(vehicleFile) == 0);
+	}
+	else
+	{
+		vehiclesWritten = writePerVehicle(options.perVehiclePath, totals, options.shard >= 0);
+	}
+	if (!vehiclesWritten)
+	{
+		fprintf(stderr, "movestar: cannot write %s\n", options.perVehiclePath.c_str());
+		return 1;
+	}
+
+	//a worker of --shards leaves the per-second totals and the report to its parent
+	if (options.shard >= 0)
+	{
+		if (!writeShardPartial(options.shardOutput, totals, error))
+		{
+			fprintf(stderr, "movestar: %s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (totals.unknownTypeRows > 0)
+	{
+		fprintf(stderr, "movestar: %zu rows of vehicles with an unknown vehicle type got zero emissions\n",
+			totals.unknownTypeRows);
+	}
+	if (!options.quiet && totals.skippedBlocks > 0)
+	{
+		fprintf(stderr, "movestar: %zu blocks outside the query skipped\n", totals.skippedBlocks);
+	}
+	if (!options.quiet)
+	{
+		fprintf(stderr, "movestar: %zu rows, %zu vehicles in %.3f s on %u threads (%.1f M rows/s)\n", totals.rows,
+			totals.vehicles.size() + totals.retiredVehicles, seconds, threadsUsed, seconds > 0.0 ? totals.rows / seconds * 1e-6 : 0.0);
+	}
+	reportStages(options, totals);
+	if (!options.quiet && !options.rasterPath.empty())
+	{
+		fprintf(stderr, "movestar: raster of %zu cells in %zu time bins, at most %zu cells held\n", raster.cellsWritten(),
+			raster.chunksWritten(), raster.peakCells());
+	}
+	reportMemory(options, 1, totals, peakResidentKB());
+	return 0;
+}
@@ -0,0 +1,401 @@
+/*========================================================================= */
+/* MovestarCliTest.cpp                               Core module of MOVESTAR */
+/*																			*/
+/* movestar_cli_test: modes of the movestar tool against a plain run of the	*/
+/* same trajectories. Runs the executable it is given on a copy of the		*/
+/* input, once plainly and once in the mode tested, and compares their		*/
+/* outputs: --shards and --memory-limit (with room for every vehicle) must	*/
+/* write the per-vehicle file of the plain run byte for byte, and the		*/
+/* totals per type of a sweep scenario without reassignments must be those	*/
+/* the per-vehicle file of the plain run adds up to. Rastering, the input	*/
+/* is given positions along a line per vehicle; the cells must add up to	*/
+/* the per-vehicle totals, and the raster file must be the same for 1, 4	*/
+/* and 8 threads.															*/
+/*========================================================================= */
+
+#include "ChildProcess.h"
+#include "EmissionRaster.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+//relative difference allowed between totals printed with 9 digits (or
+//added up from float32 raster cells)
+#define CLI_TEST_TOLERANCE 1e-6
+
+//thread counts the raster must be the same for, and the distance between the
+//lines the vehicles are placed on [m]
+static const char *const rasterThreads[3] = { "1", "4", "8" };
+#define CLI_TEST_LANE_SPACING 40.0
+
+//the values of a per-vehicle row from the emissions on, or of a group of them
+struct GroupTotals
+{
+	size_t vehicles;
+	double values[8];		//six pollutants, travel time and distance
+
+	GroupTotals() : vehicles(0) { memset(values, 0, sizeof(values)); }
+};
+
+//runs <movestar> with <arguments>, false if it fails
+static bool runMovestar(const string &movestar, const vector<string> &arguments)
+{
+	ChildProcess process;
+	string error;
+	if (!process.start(movestar, arguments, error))
+	{
+		fprintf(stderr, "movestar_cli_test: %s\n", error.c_str());
+		return false;
+	}
+	int code = process.wait();
+	if (code != 0)
+	{
+		fprintf(stderr, "movestar_cli_test: movestar exited with %d\n", code);
+		return false;
+	}
+	return true;
+}
+
+//the whole of <path> into <contents>, false if it cannot be read
+static bool readFile(const string &path, string &contents)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "movestar_cli_test: cannot read %s\n", path.c_str());
+		return false;
+	}
+	contents.clear();
+	char buffer[1 << 16];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		contents.append(buffer, size);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool writeFile(const string &path, const string &contents)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "movestar_cli_test: cannot write %s\n", path.c_str());
+		return false;
+	}
+	bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+	return fclose(file) == 0 && written;
+}
+
+//false if the files differ, reporting the first line that does
+static bool sameFiles(const string &path, const string &expectedPath)
+{
+	string contents, expected;
+	if (!readFile(path, contents) || !readFile(expectedPath, expected))
+	{
+		return false;
+	}
+	if (contents == expected)
+	{
+		return true;
+	}
+	size_t position = 0, line = 1;
+	while (position < contents.size() && position < expected.size() && contents[position] == expected[position])
+	{
+		line += contents[position] == '\n' ? 1 : 0;
+		position++;
+	}
+	fprintf(stderr, "movestar_cli_test: %s differs from %s at line %zu\n", path.c_str(), expectedPath.c_str(), line);
+	return false;
+}
+
+//the rows of the CSV file <path> after its header, split into fields
+static bool readRows(const string &path, vector<vector<string> > &rows)
+{
+	string contents, line;
+	if (!readFile(path, contents))
+	{
+		return false;
+	}
+	istringstream lines(contents);
+	getline(lines, line);
+	rows.clear();
+	while (getline(lines, line))
+	{
+		vector<string> fields;
+		string field;
+		istringstream row(line);
+		while (getline(row, field, ','))
+		{
+			fields.push_back(field);
+		}
+		rows.push_back(fields);
+	}
+	return true;
+}
+
+static bool agrees(double value, double expected)
+{
+	return fabs(value - expected) <= CLI_TEST_TOLERANCE * fabs(expected);
+}
+
+//the plain run of <input> writing <prefix>_veh.csv and <prefix>_sec.csv, with <extra> arguments
+static bool runPlain(const string &movestar, const string &input, const string &prefix, const vector<string> &extra)
+{
+	vector<string> arguments(extra);
+	const char *outputs[] = { "--per-vehicle", nullptr, "--per-second", nullptr, "--quiet" };
+	string vehicles = prefix + "_veh.csv", seconds = prefix + "_sec.csv";
+	outputs[1] = vehicles.c_str();
+	outputs[3] = seconds.c_str();
+	arguments.insert(arguments.end(), outputs, outputs + 5);
+	arguments.push_back(input);
+	return runMovestar(movestar, arguments);
+}
+
+//totals per type of scenario "base" in the sweep file <path> against the
+//sums per type of the per-vehicle file <vehiclePath>, false if one differs
+static bool checkSweep(const string &path, const string &vehiclePath, size_t &types)
+{
+	vector<vector<string> > vehicles, groups;
+	if (!readRows(vehiclePath, vehicles) || !readRows(path, groups))
+	{
+		return false;
+	}
+	map<string, GroupTotals> expected;
+	for (size_t i = 0; i < vehicles.size(); i++)
+	{
+		GroupTotals &group = expected[vehicles[i].at(1)];
+		group.vehicles++;
+		for (int k = 0; k < 8; k++)
+		{
+			group.values[k] += atof(vehicles[i].at(2 + k).c_str());
+		}
+	}
+
+	//Scenario,Type,SourceType,Vehicles, then the values of the group
+	bool same = true;
+	types = 0;
+	for (size_t i = 0; i < groups.size(); i++)
+	{
+		const vector<string> &row = groups[i];
+		if (row.at(0) != "base" || row.at(1) == "all")
+		{
+			continue;
+		}
+		types++;
+		map<string, GroupTotals>::const_iterator it = expected.find(row[1]);
+		bool agreeing = it != expected.end() && (size_t)atol(row.at(3).c_str()) == it->second.vehicles;
+		for (int k = 0; k < 8 && agreeing; k++)
+		{
+			agreeing = agrees(atof(row.at(4 + k).c_str()), it->second.values[k]);
+		}
+		if (!agreeing)
+		{
+			fprintf(stderr, "movestar_cli_test: type %s of the sweep differs from the per-vehicle totals\n", row[1].c_str());
+			same = false;
+		}
+	}
+	if (types != expected.size())
+	{
+		fprintf(stderr, "movestar_cli_test: %zu types in the sweep, %zu in the per-vehicle file\n", types, expected.size());
+		same = false;
+	}
+	return same;
+}
+
+//<contents> of a trajectory file with the columns of test.csv, with x and y
+//columns added: vehicle n drives along y = n * CLI_TEST_LANE_SPACING from x = 0
+static bool addPositions(const string &path, string &contents)
+{
+	vector<vector<string> > rows;
+	if (!readRows(path, rows))
+	{
+		return false;
+	}
+	contents = "VehNr,VehType,SimSec,Speed(m/s),x,y\n";
+	map<long, double> distances, times;
+	for (size_t i = 0; i < rows.size(); i++)
+	{
+		const vector<string> &row = rows[i];
+		long vehicle = atol(row.at(0).c_str());
+		double time = atof(row.at(2).c_str()), speed = atof(row.at(3).c_str());
+		double &distance = distances[vehicle];
+		if (times.count(vehicle) != 0)
+		{
+			distance += speed * (time - times[vehicle]);
+		}
+		times[vehicle] = time;
+		char line[256];
+		snprintf(line, sizeof(line), "%s,%s,%s,%s,%.3f,%.1f\n", row[0].c_str(), row[1].c_str(), row[2].c_str(), row[3].c_str(),
+			distance, vehicle * CLI_TEST_LANE_SPACING);
+		contents += line;
+	}
+	return true;
+}
+
+//the cells of the raster file <path> added up per pollutant against the totals
+//of the per-vehicle file <vehiclePath>, false if one differs or the file is damaged
+static bool checkRaster(const string &path, const string &vehiclePath, size_t &cells)
+{
+	string contents;
+	vector<vector<string> > vehicles;
+	if (!readFile(path, contents) || !readRows(vehiclePath, vehicles))
+	{
+		return false;
+	}
+	double expected[EMISSION_RATE_COUNT] = { 0.0 }, sums[EMISSION_RATE_COUNT] = { 0.0 };
+	for (size_t i = 0; i < vehicles.size(); i++)
+	{
+		for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+		{
+			expected[k] += atof(vehicles[i].at(2 + k).c_str());
+		}
+	}
+
+	EmissionRasterHeader header;
+	bool intact = contents.size() >= sizeof(header);
+	if (intact)
+	{
+		memcpy(&header, contents.data(), sizeof(header));
+		intact = memcmp(header.magic, EMISSION_RASTER_MAGIC, sizeof(header.magic)) == 0 && header.pollutants == EMISSION_RATE_COUNT;
+	}
+	size_t position = sizeof(header);
+	cells = 0;
+	while (intact && position < contents.size())
+	{
+		EmissionRasterChunk chunk;
+		intact = contents.size() - position >= sizeof(chunk);
+		if (intact)
+		{
+			memcpy(&chunk, contents.data() + position, sizeof(chunk));
+			position += sizeof(chunk);
+			intact = chunk.cellCount <= (contents.size() - position) / sizeof(EmissionRasterRecord);
+		}
+		for (uint64_t c = 0; intact && c < chunk.cellCount; c++)
+		{
+			EmissionRasterRecord record;
+			memcpy(&record, contents.data() + position, sizeof(record));
+			position += sizeof(record);
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				sums[k] += record.emissions[k];
+			}
+			cells++;
+		}
+	}
+	if (!intact)
+	{
+		fprintf(stderr, "movestar_cli_test: %s is damaged\n", path.c_str());
+		return false;
+	}
+
+	bool same = true;
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		if (!agrees(sums[k], expected[k]))
+		{
+			fprintf(stderr, "movestar_cli_test: pollutant %d: the cells add up to %.9g, the vehicles to %.9g\n", k, sums[k], expected[k]);
+			same = false;
+		}
+	}
+	return same;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 4)
+	{
+		fprintf(stderr, "usage: movestar_cli_test <shards | memory-limit | sweep | raster> <movestar> <trajectory.csv>\n");
+		return 2;
+	}
+	string mode = argv[1], movestar = argv[2];
+
+	//a copy of the input per mode, so the tests can run concurrently
+	string prefix = "movestar_cli_test_" + mode, input = prefix + ".csv", contents;
+	if (!readFile(argv[3], contents) || !writeFile(input, contents))
+	{
+		return 1;
+	}
+
+	bool same = false;
+	vector<string> outputs;
+	if (mode == "shards" || mode == "memory-limit")
+	{
+		vector<string> tested;
+		tested.push_back("--" + mode);
+		tested.push_back(mode == "shards" ? "3" : "48");
+		same = runPlain(movestar, input, prefix + "_plain", vector<string>()) &&
+			runPlain(movestar, input, prefix + "_tested", tested) &&
+			sameFiles(prefix + "_tested_veh.csv", prefix + "_plain_veh.csv");
+		outputs.push_back(prefix + "_plain");
+		outputs.push_back(prefix + "_tested");
+		printf("movestar_cli_test: --%s %s, per-vehicle file %s\n", tested[0].c_str() + 2, tested[1].c_str(),
+			same ? "identical to the plain run" : "differs");
+	}
+	else if (mode == "sweep")
+	{
+		//the data directory of the run, no reassignment
+		string scenarioPath = prefix + "_scenarios.csv", sweepPath = prefix + "_sweep.csv";
+		size_t types = 0;
+		vector<string> sweep;
+		sweep.push_back("--sweep");
+		sweep.push_back(scenarioPath);
+		sweep.push_back("--per-scenario");
+		sweep.push_back(sweepPath);
+		sweep.push_back("--quiet");
+		sweep.push_back(input);
+		same = writeFile(scenarioPath, "Scenario,DataDirectory,FromType,ToType,Share\nbase,,,,\n") &&
+			runPlain(movestar, input, prefix + "_plain", vector<string>()) && runMovestar(movestar, sweep) &&
+			checkSweep(sweepPath, prefix + "_plain_veh.csv", types);
+		outputs.push_back(prefix + "_plain");
+		remove(scenarioPath.c_str());
+		remove(sweepPath.c_str());
+		printf("movestar_cli_test: %zu types of the base scenario %s\n", types,
+			same ? "agree with the plain run" : "differ from the plain run");
+	}
+	else if (mode == "raster")
+	{
+		size_t cells = 0;
+		same = addPositions(input, contents) && writeFile(input, contents);
+		for (int t = 0; t < 3 && same; t++)
+		{
+			string threadPrefix = prefix + "_" + rasterThreads[t];
+			vector<string> raster;
+			raster.push_back("--threads");
+			raster.push_back(rasterThreads[t]);
+			raster.push_back("--raster");
+			raster.push_back(threadPrefix + ".rst");
+			same = runPlain(movestar, input, threadPrefix, raster) &&
+				(t == 0 ? checkRaster(threadPrefix + ".rst", threadPrefix + "_veh.csv", cells) :
+				sameFiles(threadPrefix + ".rst", prefix + "_1.rst"));
+			outputs.push_back(threadPrefix);
+		}
+		for (int t = 0; t < 3; t++)
+		{
+			remove((prefix + "_" + rasterThreads[t] + ".rst").c_str());
+		}
+		printf("movestar_cli_test: %zu raster cells %s\n", cells,
+			same ? "add up to the vehicle totals, identical for 1, 4 and 8 threads" : "differ");
+	}
+	else
+	{
+		fprintf(stderr, "movestar_cli_test: unknown mode %s\n", mode.c_str());
+		return 2;
+	}
+
+	remove(input.c_str());
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		remove((outputs[i] + "_veh.csv").c_str());
+		remove((outputs[i] + "_sec.csv").c_str());
+	}
+	return same ? 0 : 1;
+}
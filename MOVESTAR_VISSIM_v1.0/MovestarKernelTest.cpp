@@ -0,0 +1,253 @@
+/*========================================================================= */
+/* MovestarKernelTest.cpp                            Core module of MOVESTAR */
+/*																			*/
+/* movestar_kernel_test: parity of the VSP and opmode kernels with the		*/
+/* formulas of the original model (pow() powers and the branch chain of	*/
+/* getOpmode). Runs the kernels of the instruction set MOVESTAR_ISA selects	*/
+/* over a speed x acceleration sweep, accelerations that put the VSP on	*/
+/* and next to every threshold, random speeds and invalid inputs, and		*/
+/* checks every VSP bit for bit. The float32 kernels are checked against	*/
+/* their scalar versions. Exits with 77 (skipped) if the CPU lacks the		*/
+/* requested instruction set.												*/
+/*========================================================================= */
+
+#include "MovestarKernels.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+using namespace std;
+
+
+//exit code ctest reports as a skipped test
+#define TEST_SKIPPED 77
+
+//VSP coefficients of the three vehicle types of the original model
+static const VSPCoefficients baselineCoefficients[3] =
+{
+	{ 0.156461, 0.002002, 0.000493, 1.4788, 1.4788 },	//light-duty passenger car
+	{ 1.0944, 0, 0.003587, 16.556, 17.1 },				//transit bus
+	{ 1.96354, 0, 0.004031, 29.3275, 17.1 }				//combination short-haul truck
+};
+
+//calculateVSP of the original model
+static double baselineVSP(const VSPCoefficients &c, double velocity, double acceleration)
+{
+	double A = c.A, B = c.B, C = c.C, M = c.M, F = c.F;
+	double VSP = ((A * velocity) + (B * pow(velocity, 2)) + (C * pow(velocity, 3)) +
+		M * (acceleration)* velocity) / F;
+	return VSP;
+}
+
+//getOpmode of the original model, the acceleration history reduced to <braking>
+static int baselineOpmode(bool braking, double velocity, double VSP)
+{
+	if (braking)
+	{
+		return 0;
+	}
+	if (-1.0 <= velocity && velocity < 1.0)
+	{
+		return 1;
+	}
+	if (velocity >= 50)
+	{
+		return VSP >= 30 ? 40 : VSP >= 24 ? 39 : VSP >= 18 ? 38 : VSP >= 12 ? 37 : VSP >= 6 ? 35 : 33;
+	}
+	if (velocity >= 25)
+	{
+		return VSP >= 30 ? 30 : VSP >= 24 ? 29 : VSP >= 18 ? 28 : VSP >= 12 ? 27 : VSP >= 9 ? 25 :
+			VSP >= 6 ? 24 : VSP >= 3 ? 23 : VSP >= 0 ? 22 : 21;
+	}
+	if (velocity >= 0)
+	{
+		return VSP >= 12 ? 16 : VSP >= 9 ? 15 : VSP >= 6 ? 14 : VSP >= 3 ? 13 : VSP >= 0 ? 12 : 11;
+	}
+	return INVALID_OPMODE;
+}
+
+//vehicles of the test, one entry per vehicle-step
+struct Steps
+{
+	vector<const VSPCoefficients *> coefficients;
+	vector<double>                  velocities;
+	vector<double>                  accelerations;
+	vector<unsigned char>           braking;
+
+	void add(int type, double velocity, double acceleration, bool brake)
+	{
+		coefficients.push_back(&baselineCoefficients[type]);
+		velocities.push_back(velocity);
+		accelerations.push_back(acceleration);
+		braking.push_back(brake ? 1 : 0);
+	}
+};
+
+static bool sameBits(double a, double b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0 || (std::isnan(a) && std::isnan(b));
+}
+
+static bool sameBits(float a, float b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0 || (std::isnan(a) && std::isnan(b));
+}
+
+static void buildSteps(Steps &steps)
+{
+	static const double thresholds[] = { 0, 3, 6, 9, 12, 18, 24, 30 };
+	mt19937_64 random(20240101);
+
+	//speed x acceleration sweep, speeds across the three speed classes
+	for (int type = 0; type < 3; type++)
+	{
+		for (int s = 0; s <= 1300; s++)
+		{
+			double velocity = s * 0.1;
+			for (int a = -100; a <= 100; a++)
+			{
+				steps.add(type, velocity, a * 0.05, false);
+			}
+
+			//accelerations that put the VSP on every threshold, and next to it
+			if (velocity == 0.0)
+			{
+				continue;
+			}
+			const VSPCoefficients &c = baselineCoefficients[type];
+			for (size_t t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++)
+			{
+				double acceleration = (thresholds[t] * c.F - c.A * velocity - c.B * pow(velocity, 2) - c.C * pow(velocity, 3)) /
+					(c.M * velocity);
+				double below = acceleration, above = acceleration;
+				steps.add(type, velocity, acceleration, false);
+				for (int k = 0; k < 4; k++)
+				{
+					below = nextafter(below, -DBL_MAX);
+					above = nextafter(above, DBL_MAX);
+					steps.add(type, velocity, below, false);
+					steps.add(type, velocity, above, false);
+				}
+			}
+		}
+	}
+
+	//random speeds, where pow() rounds near ties, and random braking
+	uniform_real_distribution<double> speed(0.0, 160.0), acceleration(-6.0, 6.0);
+	for (int i = 0; i < 2000000; i++)
+	{
+		steps.add((int)(random() % 3), speed(random), acceleration(random), random() % 8 == 0);
+	}
+
+	//speed class bounds, idle range, negative speeds and values outside the range of the kernels
+	static const double edges[] = { -1.0, 1.0, 25.0, 50.0 };
+	for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++)
+	{
+		double below = edges[e], above = edges[e];
+		steps.add(0, edges[e], 0.5, false);
+		for (int k = 0; k < 3; k++)
+		{
+			below = nextafter(below, -DBL_MAX);
+			above = nextafter(above, DBL_MAX);
+			steps.add(0, below, 0.5, false);
+			steps.add(0, above, 0.5, false);
+		}
+	}
+	static const double invalid[] = { -0.0, -0.5, -1.5, -30.0, -70.0, 1e-300, 1e70, 1e300, INFINITY, -INFINITY, NAN };
+	for (size_t v = 0; v < sizeof(invalid) / sizeof(invalid[0]); v++)
+	{
+		for (int type = 0; type < 3; type++)
+		{
+			steps.add(type, invalid[v], 1.0, false);
+			steps.add(type, 30.0, invalid[v], false);
+		}
+	}
+}
+
+//compares the double kernels with the original formulas, returns the mismatches
+static size_t checkDouble(const Steps &steps)
+{
+	size_t count = steps.velocities.size();
+	vector<double> vsp(count);
+	vector<int> opmodes(count);
+	calculateVSPBatch(count, steps.coefficients.data(), steps.velocities.data(), steps.accelerations.data(), vsp.data());
+	binOpmodeBatch(count, steps.velocities.data(), vsp.data(), steps.braking.data(), opmodes.data());
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		double expected = baselineVSP(*steps.coefficients[i], steps.velocities[i], steps.accelerations[i]);
+		int expectedOpmode = baselineOpmode(steps.braking[i] != 0, steps.velocities[i], expected);
+		if (!sameBits(vsp[i], expected) || opmodes[i] != expectedOpmode)
+		{
+			if (mismatches < 10)
+			{
+				fprintf(stderr, "movestar_kernel_test: speed %.17g acceleration %.17g: VSP %.17g opmode %d, expected %.17g opmode %d\n",
+					steps.velocities[i], steps.accelerations[i], vsp[i], opmodes[i], expected, expectedOpmode);
+			}
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+//compares the float32 kernels with their scalar versions, returns the mismatches
+static size_t checkFloat(const Steps &steps)
+{
+	size_t count = steps.velocities.size();
+	CompactVSPCoefficients compact[3];
+	for (int type = 0; type < 3; type++)
+	{
+		const VSPCoefficients &c = baselineCoefficients[type];
+		compact[type] = { (float)c.A, (float)c.B, (float)c.C, (float)c.M, (float)c.F };
+	}
+	vector<const CompactVSPCoefficients *> coefficients(count);
+	vector<float> velocities(count), accelerations(count), vsp(count);
+	vector<int> opmodes(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		coefficients[i] = &compact[steps.coefficients[i] - baselineCoefficients];
+		velocities[i] = (float)steps.velocities[i];
+		accelerations[i] = (float)steps.accelerations[i];
+	}
+	calculateVSPBatch(count, coefficients.data(), velocities.data(), accelerations.data(), vsp.data());
+	binOpmodeBatch(count, velocities.data(), vsp.data(), steps.braking.data(), opmodes.data());
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		float expected = calculateVSP(*coefficients[i], velocities[i], accelerations[i]);
+		if (!sameBits(vsp[i], expected) || opmodes[i] != binOpmode(velocities[i], expected, steps.braking[i] != 0))
+		{
+			if (mismatches < 10)
+			{
+				fprintf(stderr, "movestar_kernel_test: float32 speed %.9g acceleration %.9g: VSP %.9g opmode %d, expected %.9g\n",
+					velocities[i], accelerations[i], vsp[i], opmodes[i], expected);
+			}
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main()
+{
+	KernelIsa isa = activeKernelIsa();
+	const char *requested = getenv("MOVESTAR_ISA");
+	if (requested != nullptr && strcmp(requested, kernelIsaName(isa)) != 0)
+	{
+		printf("movestar_kernel_test: %s not supported by the CPU, skipped\n", requested);
+		return TEST_SKIPPED;
+	}
+
+	Steps steps;
+	buildSteps(steps);
+	size_t mismatches = checkDouble(steps);
+	size_t floatMismatches = checkFloat(steps);
+	printf("movestar_kernel_test: %s, %zu vehicle-steps, %zu differ from the original model, %zu float32 differ from scalar\n",
+		kernelIsaName(isa), steps.velocities.size(), mismatches, floatMismatches);
+	return mismatches == 0 && floatMismatches == 0 ? 0 : 1;
+}
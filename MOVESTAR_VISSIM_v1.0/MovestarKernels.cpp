@@ -0,0 +1,607 @@
+/*========================================================================= */
+/* MovestarKernels.cpp                   VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Scalar, SSE2 and AVX2 implementations of the VSP and opmode kernels,	*/
+/* in double and in float32.												*/
+/* All of them perform the same IEEE operations in the same order (no		*/
+/* FMA), so their results are bit-identical. The double VSP kernels take	*/
+/* the powers of pow(): the SIMD lanes square and cube the velocity with	*/
+/* correct rounding, and redo with pow() the lanes whose cube lies too		*/
+/* close to a rounding tie to tell which way pow() rounds it.				*/
+/*========================================================================= */
+
+#include "MovestarKernels.h"
+#include <atomic>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MOVESTAR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MOVESTAR_TARGET_AVX2
+#else
+#define MOVESTAR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+using namespace std;
+
+
+//VSP thresholds of the three speed classes, padded to 8 by repeating the last
+//one (the opmode table repeats the top bin, so padding never changes the result)
+static const double vspThresholds[3][8] =
+{
+	{ 0, 3, 6, 9, 12, 12, 12, 12 },		//0 <= speed < 25
+	{ 0, 3, 6, 9, 12, 18, 24, 30 },		//25 <= speed < 50
+	{ 6, 12, 18, 24, 30, 30, 30, 30 }	//speed >= 50
+};
+
+//opmode by row index: speed class * 9 + number of VSP thresholds reached,
+//followed by the idle, invalid and braking rows
+#define ROW_IDLE	27
+#define ROW_INVALID	28
+#define ROW_BRAKING	29
+static const int opmodeByRow[32] =
+{
+	11, 12, 13, 14, 15, 16, 16, 16, 16,
+	21, 22, 23, 24, 25, 27, 28, 29, 30,
+	33, 35, 37, 38, 39, 40, 40, 40, 40,
+	1, INVALID_OPMODE, 0, 0, 0
+};
+
+int binOpmode(double velocity, double VSP, bool braking)
+{
+	if (braking)
+	{
+		return 0;
+	}
+	if (-1.0 <= velocity && velocity < 1.0)
+	{
+		return 1;
+	}
+	if (!(velocity >= 0))
+	{
+		return INVALID_OPMODE;
+	}
+
+	int speedClass = (velocity >= 25) + (velocity >= 50);
+	int reached = 0;
+	for (int j = 0; j < 8; j++)
+	{
+		reached += (VSP >= vspThresholds[speedClass][j]);
+	}
+	return opmodeByRow[speedClass * 9 + reached];
+}
+
+static void calculateVSPScalar(size_t begin, size_t count, const VSPCoefficients *const *coefficients,
+	const double *velocities, const double *accelerations, double *vsp)
+{
+	for (size_t i = begin; i < count; i++)
+	{
+		vsp[i] = calculateVSP(*coefficients[i], velocities[i], accelerations[i]);
+	}
+}
+
+static void binOpmodeScalar(size_t begin, size_t count, const double *velocities, const double *vsp,
+	const unsigned char *braking, int *opmodes)
+{
+	for (size_t i = begin; i < count; i++)
+	{
+		opmodes[i] = binOpmode(velocities[i], vsp[i], braking[i] != 0);
+	}
+}
+
+static void calculateVSPScalar(size_t begin, size_t count, const CompactVSPCoefficients *const *coefficients,
+	const float *velocities, const float *accelerations, float *vsp)
+{
+	for (size_t i = begin; i < count; i++)
+	{
+		vsp[i] = calculateVSP(*coefficients[i], velocities[i], accelerations[i]);
+	}
+}
+
+static void binOpmodeScalar(size_t begin, size_t count, const float *velocities, const float *vsp,
+	const unsigned char *braking, int *opmodes)
+{
+	for (size_t i = begin; i < count; i++)
+	{
+		opmodes[i] = binOpmode(velocities[i], vsp[i], braking[i] != 0);
+	}
+}
+
+#ifdef MOVESTAR_X86
+
+//transposes the coefficient records <c[0..3]> into A, B, C, M and F vectors
+static inline void transposeCoefficients(const CompactVSPCoefficients *const *c, __m128 &A, __m128 &B, __m128 &C, __m128 &M, __m128 &F)
+{
+	A = _mm_loadu_ps(&c[0]->A);
+	B = _mm_loadu_ps(&c[1]->A);
+	C = _mm_loadu_ps(&c[2]->A);
+	M = _mm_loadu_ps(&c[3]->A);
+	_MM_TRANSPOSE4_PS(A, B, C, M);
+	F = _mm_set_ps(c[3]->F, c[2]->F, c[1]->F, c[0]->F);
+}
+
+static void calculateVSPSSE2(size_t count, const CompactVSPCoefficients *const *coefficients,
+	const float *velocities, const float *accelerations, float *vsp)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 A, B, C, M, F;
+		transposeCoefficients(coefficients + i, A, B, C, M, F);
+
+		__m128 v = _mm_loadu_ps(velocities + i);
+		__m128 a = _mm_loadu_ps(accelerations + i);
+		__m128 v2 = _mm_mul_ps(v, v);
+		__m128 sum = _mm_add_ps(_mm_mul_ps(A, v), _mm_mul_ps(B, v2));
+		sum = _mm_add_ps(sum, _mm_mul_ps(C, _mm_mul_ps(v2, v)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(M, a), v));
+		_mm_storeu_ps(vsp + i, _mm_div_ps(sum, F));
+	}
+	calculateVSPScalar(i, count, coefficients, velocities, accelerations, vsp);
+}
+
+MOVESTAR_TARGET_AVX2
+static void calculateVSPAVX2(size_t count, const CompactVSPCoefficients *const *coefficients,
+	const float *velocities, const float *accelerations, float *vsp)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		//two transposed halves of four records each
+		__m128 A0, B0, C0, M0, F0, A1, B1, C1, M1, F1;
+		transposeCoefficients(coefficients + i, A0, B0, C0, M0, F0);
+		transposeCoefficients(coefficients + i + 4, A1, B1, C1, M1, F1);
+		__m256 A = _mm256_insertf128_ps(_mm256_castps128_ps256(A0), A1, 1);
+		__m256 B = _mm256_insertf128_ps(_mm256_castps128_ps256(B0), B1, 1);
+		__m256 C = _mm256_insertf128_ps(_mm256_castps128_ps256(C0), C1, 1);
+		__m256 M = _mm256_insertf128_ps(_mm256_castps128_ps256(M0), M1, 1);
+		__m256 F = _mm256_insertf128_ps(_mm256_castps128_ps256(F0), F1, 1);
+
+		__m256 v = _mm256_loadu_ps(velocities + i);
+		__m256 a = _mm256_loadu_ps(accelerations + i);
+		__m256 v2 = _mm256_mul_ps(v, v);
+		__m256 sum = _mm256_add_ps(_mm256_mul_ps(A, v), _mm256_mul_ps(B, v2));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(C, _mm256_mul_ps(v2, v)));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_mul_ps(M, a), v));
+		_mm256_storeu_ps(vsp + i, _mm256_div_ps(sum, F));
+	}
+	calculateVSPScalar(i, count, coefficients, velocities, accelerations, vsp);
+}
+
+MOVESTAR_TARGET_AVX2
+static void binOpmodeAVX2(size_t count, const float *velocities, const float *vsp,
+	const unsigned char *braking, int *opmodes)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 v = _mm256_loadu_ps(velocities + i);
+		__m256 p = _mm256_loadu_ps(vsp + i);
+		__m256 class1 = _mm256_cmp_ps(v, _mm256_set1_ps(25), _CMP_GE_OQ);
+		__m256 class2 = _mm256_cmp_ps(v, _mm256_set1_ps(50), _CMP_GE_OQ);
+
+		//count the thresholds of the lane's speed class reached by its VSP
+		__m256 reached = _mm256_setzero_ps();
+		for (int j = 0; j < 8; j++)
+		{
+			__m256 threshold = _mm256_blendv_ps(_mm256_set1_ps((float)vspThresholds[0][j]), _mm256_set1_ps((float)vspThresholds[1][j]), class1);
+			threshold = _mm256_blendv_ps(threshold, _mm256_set1_ps((float)vspThresholds[2][j]), class2);
+			reached = _mm256_add_ps(reached, _mm256_and_ps(_mm256_cmp_ps(p, threshold, _CMP_GE_OQ), one));
+		}
+		__m256 row = _mm256_add_ps(reached, _mm256_mul_ps(_mm256_add_ps(_mm256_and_ps(class1, one), _mm256_and_ps(class2, one)), _mm256_set1_ps(9)));
+
+		//special rows, applied in reverse order of precedence
+		__m256 valid = _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ);
+		__m256 idle = _mm256_and_ps(_mm256_cmp_ps(v, _mm256_set1_ps(-1.0f), _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LT_OQ));
+		__m256i brakeBytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(braking + i)));
+		__m256 brake = _mm256_castsi256_ps(_mm256_cmpgt_epi32(brakeBytes, _mm256_setzero_si256()));
+		row = _mm256_blendv_ps(_mm256_set1_ps(ROW_INVALID), row, valid);
+		row = _mm256_blendv_ps(row, _mm256_set1_ps(ROW_IDLE), idle);
+		row = _mm256_blendv_ps(row, _mm256_set1_ps(ROW_BRAKING), brake);
+
+		__m256i opmode = _mm256_i32gather_epi32(opmodeByRow, _mm256_cvttps_epi32(row), 4);
+		_mm256_storeu_si256((__m256i *)(opmodes + i), opmode);
+	}
+	binOpmodeScalar(i, count, velocities, vsp, braking, opmodes);
+}
+
+//libm pow() is within POW_ROUNDING_MARGIN ulp of correct rounding (glibc
+//documents 0.52 ulp), so a correctly rounded power that is further than
+//that from a tie is the one pow() returns; the other lanes are redone by
+//pow(). Velocities beyond 10^+-60 (and NaN) are redone as well, which keeps
+//the error terms below clear of overflow and underflow
+#define POW_ROUNDING_MARGIN (1.0 / 32)
+#define POW_EXACT_RANGE 1e60
+
+//product <x> * <y> = <product> + <error> exactly (Dekker, without FMA)
+static inline __m128d exactProductSSE2(__m128d x, __m128d y, __m128d product)
+{
+	const __m128d splitter = _mm_set1_pd(134217729.0);	//2^27 + 1
+	__m128d t = _mm_mul_pd(splitter, x);
+	__m128d xHigh = _mm_sub_pd(t, _mm_sub_pd(t, x));
+	__m128d xLow = _mm_sub_pd(x, xHigh);
+	t = _mm_mul_pd(splitter, y);
+	__m128d yHigh = _mm_sub_pd(t, _mm_sub_pd(t, y));
+	__m128d yLow = _mm_sub_pd(y, yHigh);
+	__m128d error = _mm_sub_pd(_mm_mul_pd(xHigh, yHigh), product);
+	error = _mm_add_pd(error, _mm_mul_pd(xHigh, yLow));
+	error = _mm_add_pd(error, _mm_mul_pd(xLow, yHigh));
+	return _mm_add_pd(error, _mm_mul_pd(xLow, yLow));
+}
+
+//true where <error> (the exact value minus <rounded>) may be within the
+//margin of a tie: away from a power of two a tie is half an ulp of <rounded>
+//off, at a power of two the ulp below is half as large
+static inline __m128d nearTieSSE2(__m128d rounded, __m128d error)
+{
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d exponent = _mm_castsi128_pd(_mm_set1_epi64x(0x7ff0000000000000LL));
+	__m128d magnitude = _mm_andnot_pd(sign, rounded);
+	__m128d power = _mm_and_pd(magnitude, exponent);
+	__m128d bound = _mm_mul_pd(power, _mm_set1_pd((0.5 - POW_ROUNDING_MARGIN) * DBL_EPSILON));
+	__m128d inexact = _mm_cmpneq_pd(error, _mm_setzero_pd());
+	return _mm_or_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign, error), bound), _mm_and_pd(_mm_cmpeq_pd(magnitude, power), inexact));
+}
+
+//pow(v, 2) and pow(v, 3) correctly rounded; the mask has the lanes pow() may
+//round otherwise. The compilers expand pow(v, 2) to v * v, the correctly
+//rounded square, so only the cube can differ
+static inline int powersSSE2(__m128d v, __m128d &v2, __m128d &v3)
+{
+	v2 = _mm_mul_pd(v, v);
+	__m128d e2 = exactProductSSE2(v, v, v2);
+	__m128d cube = _mm_mul_pd(v2, v);
+	__m128d e3 = exactProductSSE2(v2, v, cube);
+
+	//v^3 = cube + e3 + e2 * v; the rounding of the small terms is far below the margin
+	__m128d tail = _mm_add_pd(e3, _mm_mul_pd(e2, v));
+	v3 = _mm_add_pd(cube, tail);
+	__m128d residual = _mm_sub_pd(tail, _mm_sub_pd(v3, cube));
+
+	__m128d magnitude = _mm_andnot_pd(_mm_set1_pd(-0.0), v);
+	__m128d inRange = _mm_and_pd(_mm_cmple_pd(magnitude, _mm_set1_pd(POW_EXACT_RANGE)), _mm_cmpge_pd(magnitude, _mm_set1_pd(1.0 / POW_EXACT_RANGE)));
+	inRange = _mm_or_pd(inRange, _mm_cmpeq_pd(v, _mm_setzero_pd()));
+	return (~_mm_movemask_pd(inRange) & 3) | _mm_movemask_pd(nearTieSSE2(v3, residual));
+}
+
+//recalculates with calculateVSP() the lanes of <lanes> in the batch at <begin>
+static void redoLanes(int lanes, size_t begin, const VSPCoefficients *const *coefficients,
+	const double *velocities, const double *accelerations, double *vsp)
+{
+	for (size_t i = begin; lanes != 0; i++, lanes >>= 1)
+	{
+		if (lanes & 1)
+		{
+			vsp[i] = calculateVSP(*coefficients[i], velocities[i], accelerations[i]);
+		}
+	}
+}
+
+static void calculateVSPSSE2(size_t count, const VSPCoefficients *const *coefficients,
+	const double *velocities, const double *accelerations, double *vsp)
+{
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		const VSPCoefficients *c0 = coefficients[i];
+		const VSPCoefficients *c1 = coefficients[i + 1];
+
+		//transpose the two coefficient records into A, B, C, M, F vectors
+		__m128d ab0 = _mm_loadu_pd(&c0->A);
+		__m128d ab1 = _mm_loadu_pd(&c1->A);
+		__m128d cm0 = _mm_loadu_pd(&c0->C);
+		__m128d cm1 = _mm_loadu_pd(&c1->C);
+		__m128d A = _mm_unpacklo_pd(ab0, ab1);
+		__m128d B = _mm_unpackhi_pd(ab0, ab1);
+		__m128d C = _mm_unpacklo_pd(cm0, cm1);
+		__m128d M = _mm_unpackhi_pd(cm0, cm1);
+		__m128d F = _mm_set_pd(c1->F, c0->F);
+
+		__m128d v = _mm_loadu_pd(velocities + i);
+		__m128d a = _mm_loadu_pd(accelerations + i);
+		__m128d v2, v3;
+		int redo = powersSSE2(v, v2, v3);
+		__m128d sum = _mm_add_pd(_mm_mul_pd(A, v), _mm_mul_pd(B, v2));
+		sum = _mm_add_pd(sum, _mm_mul_pd(C, v3));
+		sum = _mm_add_pd(sum, _mm_mul_pd(_mm_mul_pd(M, a), v));
+		_mm_storeu_pd(vsp + i, _mm_div_pd(sum, F));
+		if (redo != 0)
+		{
+			redoLanes(redo, i, coefficients, velocities, accelerations, vsp);
+		}
+	}
+	calculateVSPScalar(i, count, coefficients, velocities, accelerations, vsp);
+}
+
+//exactProductSSE2(), nearTieSSE2() and powersSSE2() on four lanes
+MOVESTAR_TARGET_AVX2
+static inline __m256d exactProductAVX2(__m256d x, __m256d y, __m256d product)
+{
+	const __m256d splitter = _mm256_set1_pd(134217729.0);
+	__m256d t = _mm256_mul_pd(splitter, x);
+	__m256d xHigh = _mm256_sub_pd(t, _mm256_sub_pd(t, x));
+	__m256d xLow = _mm256_sub_pd(x, xHigh);
+	t = _mm256_mul_pd(splitter, y);
+	__m256d yHigh = _mm256_sub_pd(t, _mm256_sub_pd(t, y));
+	__m256d yLow = _mm256_sub_pd(y, yHigh);
+	__m256d error = _mm256_sub_pd(_mm256_mul_pd(xHigh, yHigh), product);
+	error = _mm256_add_pd(error, _mm256_mul_pd(xHigh, yLow));
+	error = _mm256_add_pd(error, _mm256_mul_pd(xLow, yHigh));
+	return _mm256_add_pd(error, _mm256_mul_pd(xLow, yLow));
+}
+
+MOVESTAR_TARGET_AVX2
+static inline __m256d nearTieAVX2(__m256d rounded, __m256d error)
+{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d exponent = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7ff0000000000000LL));
+	__m256d magnitude = _mm256_andnot_pd(sign, rounded);
+	__m256d power = _mm256_and_pd(magnitude, exponent);
+	__m256d bound = _mm256_mul_pd(power, _mm256_set1_pd((0.5 - POW_ROUNDING_MARGIN) * DBL_EPSILON));
+	__m256d inexact = _mm256_cmp_pd(error, _mm256_setzero_pd(), _CMP_NEQ_UQ);
+	return _mm256_or_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, error), bound, _CMP_GT_OQ),
+		_mm256_and_pd(_mm256_cmp_pd(magnitude, power, _CMP_EQ_OQ), inexact));
+}
+
+MOVESTAR_TARGET_AVX2
+static inline int powersAVX2(__m256d v, __m256d &v2, __m256d &v3)
+{
+	v2 = _mm256_mul_pd(v, v);
+	__m256d e2 = exactProductAVX2(v, v, v2);
+	__m256d cube = _mm256_mul_pd(v2, v);
+	__m256d e3 = exactProductAVX2(v2, v, cube);
+
+	__m256d tail = _mm256_add_pd(e3, _mm256_mul_pd(e2, v));
+	v3 = _mm256_add_pd(cube, tail);
+	__m256d residual = _mm256_sub_pd(tail, _mm256_sub_pd(v3, cube));
+
+	__m256d magnitude = _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+	__m256d inRange = _mm256_and_pd(_mm256_cmp_pd(magnitude, _mm256_set1_pd(POW_EXACT_RANGE), _CMP_LE_OQ),
+		_mm256_cmp_pd(magnitude, _mm256_set1_pd(1.0 / POW_EXACT_RANGE), _CMP_GE_OQ));
+	inRange = _mm256_or_pd(inRange, _mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_EQ_OQ));
+	return (~_mm256_movemask_pd(inRange) & 15) | _mm256_movemask_pd(nearTieAVX2(v3, residual));
+}
+
+MOVESTAR_TARGET_AVX2
+static void calculateVSPAVX2(size_t count, const VSPCoefficients *const *coefficients,
+	const double *velocities, const double *accelerations, double *vsp)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const VSPCoefficients *c0 = coefficients[i];
+		const VSPCoefficients *c1 = coefficients[i + 1];
+		const VSPCoefficients *c2 = coefficients[i + 2];
+		const VSPCoefficients *c3 = coefficients[i + 3];
+
+		//transpose the four coefficient records into A, B, C, M, F vectors
+		__m256d r0 = _mm256_loadu_pd(&c0->A);
+		__m256d r1 = _mm256_loadu_pd(&c1->A);
+		__m256d r2 = _mm256_loadu_pd(&c2->A);
+		__m256d r3 = _mm256_loadu_pd(&c3->A);
+		__m256d t0 = _mm256_unpacklo_pd(r0, r1);
+		__m256d t1 = _mm256_unpackhi_pd(r0, r1);
+		__m256d t2 = _mm256_unpacklo_pd(r2, r3);
+		__m256d t3 = _mm256_unpackhi_pd(r2, r3);
+		__m256d A = _mm256_permute2f128_pd(t0, t2, 0x20);
+		__m256d B = _mm256_permute2f128_pd(t1, t3, 0x20);
+		__m256d C = _mm256_permute2f128_pd(t0, t2, 0x31);
+		__m256d M = _mm256_permute2f128_pd(t1, t3, 0x31);
+		__m256d F = _mm256_set_pd(c3->F, c2->F, c1->F, c0->F);
+
+		__m256d v = _mm256_loadu_pd(velocities + i);
+		__m256d a = _mm256_loadu_pd(accelerations + i);
+		__m256d v2, v3;
+		int redo = powersAVX2(v, v2, v3);
+		__m256d sum = _mm256_add_pd(_mm256_mul_pd(A, v), _mm256_mul_pd(B, v2));
+		sum = _mm256_add_pd(sum, _mm256_mul_pd(C, v3));
+		sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_mul_pd(M, a), v));
+		_mm256_storeu_pd(vsp + i, _mm256_div_pd(sum, F));
+		if (redo != 0)
+		{
+			redoLanes(redo, i, coefficients, velocities, accelerations, vsp);
+		}
+	}
+	calculateVSPScalar(i, count, coefficients, velocities, accelerations, vsp);
+}
+
+MOVESTAR_TARGET_AVX2
+static void binOpmodeAVX2(size_t count, const double *velocities, const double *vsp,
+	const unsigned char *braking, int *opmodes)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256d v = _mm256_loadu_pd(velocities + i);
+		__m256d p = _mm256_loadu_pd(vsp + i);
+		__m256d class1 = _mm256_cmp_pd(v, _mm256_set1_pd(25), _CMP_GE_OQ);
+		__m256d class2 = _mm256_cmp_pd(v, _mm256_set1_pd(50), _CMP_GE_OQ);
+
+		//count the thresholds of the lane's speed class reached by its VSP
+		__m256d reached = _mm256_setzero_pd();
+		for (int j = 0; j < 8; j++)
+		{
+			__m256d threshold = _mm256_blendv_pd(_mm256_set1_pd(vspThresholds[0][j]), _mm256_set1_pd(vspThresholds[1][j]), class1);
+			threshold = _mm256_blendv_pd(threshold, _mm256_set1_pd(vspThresholds[2][j]), class2);
+			reached = _mm256_add_pd(reached, _mm256_and_pd(_mm256_cmp_pd(p, threshold, _CMP_GE_OQ), one));
+		}
+		__m256d row = _mm256_add_pd(reached, _mm256_mul_pd(_mm256_add_pd(_mm256_and_pd(class1, one), _mm256_and_pd(class2, one)), _mm256_set1_pd(9)));
+
+		//special rows, applied in reverse order of precedence
+		__m256d valid = _mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_GE_OQ);
+		__m256d idle = _mm256_and_pd(_mm256_cmp_pd(v, _mm256_set1_pd(-1.0), _CMP_GE_OQ), _mm256_cmp_pd(v, one, _CMP_LT_OQ));
+		int flags;
+		memcpy(&flags, braking + i, sizeof(flags));
+		__m256i brakeBytes = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(flags));
+		__m256d brake = _mm256_castsi256_pd(_mm256_cmpgt_epi64(brakeBytes, _mm256_setzero_si256()));
+		row = _mm256_blendv_pd(_mm256_set1_pd(ROW_INVALID), row, valid);
+		row = _mm256_blendv_pd(row, _mm256_set1_pd(ROW_IDLE), idle);
+		row = _mm256_blendv_pd(row, _mm256_set1_pd(ROW_BRAKING), brake);
+
+		__m128i opmode = _mm_i32gather_epi32(opmodeByRow, _mm256_cvttpd_epi32(row), 4);
+		_mm_storeu_si128((__m128i *)(opmodes + i), opmode);
+	}
+	binOpmodeScalar(i, count, velocities, vsp, braking, opmodes);
+}
+
+#endif /* MOVESTAR_X86 */
+
+KernelIsa detectKernelIsa()
+{
+#ifdef MOVESTAR_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (osAvx && maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse2 = __builtin_cpu_supports("sse2");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2)
+	{
+		return KERNEL_ISA_AVX2;
+	}
+	if (sse2)
+	{
+		return KERNEL_ISA_SSE2;
+	}
+#endif
+	return KERNEL_ISA_SCALAR;
+}
+
+//-1 until the first kernel call resolves it; engines on several threads read it
+static atomic<int> selectedIsa(-1);
+
+KernelIsa activeKernelIsa()
+{
+	int selected = selectedIsa.load(memory_order_relaxed);
+	if (selected < 0)
+	{
+		KernelIsa isa = detectKernelIsa();
+		const char *requested = getenv("MOVESTAR_ISA");
+		if (requested != nullptr)
+		{
+			for (int candidate = KERNEL_ISA_SCALAR; candidate <= isa; candidate++)
+			{
+				if (strcmp(requested, kernelIsaName((KernelIsa)candidate)) == 0)
+				{
+					isa = (KernelIsa)candidate;
+					break;
+				}
+			}
+		}
+		selected = isa;
+		selectedIsa.store(selected, memory_order_relaxed);
+	}
+	return (KernelIsa)selected;
+}
+
+bool setKernelIsa(KernelIsa isa)
+{
+	if (isa > detectKernelIsa())
+	{
+		return false;
+	}
+	selectedIsa.store(isa, memory_order_relaxed);
+	return true;
+}
+
+const char *kernelIsaName(KernelIsa isa)
+{
+	switch (isa)
+	{
+	case KERNEL_ISA_AVX2:
+		return "avx2";
+	case KERNEL_ISA_SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+void calculateVSPBatch(size_t count, const VSPCoefficients *const *coefficients,
+	const double *velocities, const double *accelerations, double *vsp)
+{
+	switch (activeKernelIsa())
+	{
+#ifdef MOVESTAR_X86
+	case KERNEL_ISA_AVX2:
+		calculateVSPAVX2(count, coefficients, velocities, accelerations, vsp);
+		return;
+	case KERNEL_ISA_SSE2:
+		calculateVSPSSE2(count, coefficients, velocities, accelerations, vsp);
+		return;
+#endif
+	default:
+		calculateVSPScalar(0, count, coefficients, velocities, accelerations, vsp);
+		return;
+	}
+}
+
+void binOpmodeBatch(size_t count, const double *velocities, const double *vsp,
+	const unsigned char *braking, int *opmodes)
+{
+	//two SSE2 lanes do not beat the table lookup of the scalar binning
+	switch (activeKernelIsa())
+	{
+#ifdef MOVESTAR_X86
+	case KERNEL_ISA_AVX2:
+		binOpmodeAVX2(count, velocities, vsp, braking, opmodes);
+		return;
+#endif
+	default:
+		binOpmodeScalar(0, count, velocities, vsp, braking, opmodes);
+		return;
+	}
+}
+
+void calculateVSPBatch(size_t count, const CompactVSPCoefficients *const *coefficients,
+	const float *velocities, const float *accelerations, float *vsp)
+{
+	switch (activeKernelIsa())
+	{
+#ifdef MOVESTAR_X86
+	case KERNEL_ISA_AVX2:
+		calculateVSPAVX2(count, coefficients, velocities, accelerations, vsp);
+		return;
+	case KERNEL_ISA_SSE2:
+		calculateVSPSSE2(count, coefficients, velocities, accelerations, vsp);
+		return;
+#endif
+	default:
+		calculateVSPScalar(0, count, coefficients, velocities, accelerations, vsp);
+		return;
+	}
+}
+
+void binOpmodeBatch(size_t count, const float *velocities, const float *vsp,
+	const unsigned char *braking, int *opmodes)
+{
+	switch (activeKernelIsa())
+	{
+#ifdef MOVESTAR_X86
+	case KERNEL_ISA_AVX2:
+		binOpmodeAVX2(count, velocities, vsp, braking, opmodes);
+		return;
+#endif
+	default:
+		binOpmodeScalar(0, count, velocities, vsp, braking, opmodes);
+		return;
+	}
+}
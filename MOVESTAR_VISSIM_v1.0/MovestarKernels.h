@@ -0,0 +1,112 @@
+/*========================================================================= */
+/* MovestarKernels.h                     VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Batched VSP and operating mode kernels, in double precision and in		*/
+/* float32 for the compact mode. The kernels have scalar, SSE2 and AVX2	*/
+/* implementations with identical results; the widest one the CPU supports	*/
+/* is picked at runtime.													*/
+/*========================================================================= */
+
+#ifndef __MOVESTARKERNELS_H
+#define __MOVESTARKERNELS_H
+
+#include <cmath>
+#include <cstddef>
+
+//opmode of a vehicle whose speed falls outside every bin (negative speed)
+#define INVALID_OPMODE (-99999)
+
+//standard gravity [m/s2], for the grade term of the VSP
+#define GRAVITY_ACCELERATION 9.81
+
+//VSP coefficients of a source type
+struct VSPCoefficients
+{
+	double A;	//Rolling (kW-s/m)
+	double B;	//Rotating (Kw-s**2/m**2)
+	double C;	//Drag (kW-s**3/m**3)
+	double M;	//Source Mass (metric tons)
+	double F;	//Fixed Mass Factor (metric tons)
+};
+
+//VSP coefficients in single precision (compact mode)
+struct CompactVSPCoefficients
+{
+	float A;
+	float B;
+	float C;
+	float M;
+	float F;
+};
+
+//instruction sets the kernels are implemented for
+enum KernelIsa
+{
+	KERNEL_ISA_SCALAR = 0,
+	KERNEL_ISA_SSE2 = 1,
+	KERNEL_ISA_AVX2 = 2
+};
+
+//widest instruction set supported by the CPU
+KernelIsa detectKernelIsa();
+
+//instruction set used by the batch kernels; defaults to detectKernelIsa(),
+//or to the value of the MOVESTAR_ISA environment variable (scalar, sse2, avx2)
+KernelIsa activeKernelIsa();
+
+//selects the instruction set used by the batch kernels, returns false if
+//the CPU does not support it
+bool setKernelIsa(KernelIsa isa);
+
+const char *kernelIsaName(KernelIsa isa);
+
+//VSP of one vehicle, velocity in the unit the opmode bins use. The powers
+//come from pow(), as in the original model, and the batch kernels match them
+inline double calculateVSP(const VSPCoefficients &coefficients, double velocity, double acceleration)
+{
+	return ((coefficients.A * velocity) + (coefficients.B * std::pow(velocity, 2)) + (coefficients.C * std::pow(velocity, 3)) +
+		coefficients.M * acceleration * velocity) / coefficients.F;
+}
+
+//single-precision VSP of one vehicle, the operations of calculateVSP in float
+inline float calculateVSP(const CompactVSPCoefficients &coefficients, float velocity, float acceleration)
+{
+	float velocitySquared = velocity * velocity;
+	return ((coefficients.A * velocity) + (coefficients.B * velocitySquared) + (coefficients.C * (velocitySquared * velocity)) +
+		coefficients.M * acceleration * velocity) / coefficients.F;
+}
+
+//acceleration the VSP takes on a grade: the MOVES term M * (a + g * sin(theta)) * v
+//folded into the acceleration, so every VSP kernel and rate grid applies it.
+//<slope> is rise over run (0.026 = 2.6 %, negative downhill); a level road
+//returns <acceleration> unchanged
+inline double gradeAcceleration(double acceleration, double slope)
+{
+	if (slope == 0.0)
+	{
+		return acceleration;
+	}
+	return acceleration + GRAVITY_ACCELERATION * slope / std::sqrt(1.0 + slope * slope);
+}
+
+//opmode of one vehicle using the threshold tables; <braking> is true when the
+//acceleration history alone puts the vehicle in the braking mode (opmode 0)
+int binOpmode(double velocity, double VSP, bool braking);
+
+//VSP of <count> vehicles, each with its own coefficients
+void calculateVSPBatch(std::size_t count, const VSPCoefficients *const *coefficients,
+	const double *velocities, const double *accelerations, double *vsp);
+
+//opmodes of <count> vehicles, same results as binOpmode()
+void binOpmodeBatch(std::size_t count, const double *velocities, const double *vsp,
+	const unsigned char *braking, int *opmodes);
+
+//float32 kernels of the compact mode, twice the lanes of the double ones. The
+//thresholds are whole numbers, so the opmodes are those binOpmode() gives for
+//the float values
+void calculateVSPBatch(std::size_t count, const CompactVSPCoefficients *const *coefficients,
+	const float *velocities, const float *accelerations, float *vsp);
+void binOpmodeBatch(std::size_t count, const float *velocities, const float *vsp,
+	const unsigned char *braking, int *opmodes);
+
+#endif /* __MOVESTARKERNELS_H */
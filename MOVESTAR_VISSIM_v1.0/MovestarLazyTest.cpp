@@ -0,0 +1,96 @@
+/*========================================================================= */
+/* MovestarLazyTest.cpp                              Core module of MOVESTAR */
+/*																			*/
+/* movestar_lazy_test: batching of the lazy evaluation. Replays the calls	*/
+/* VISSIM makes for every vehicle (time, time step, vehicle values,		*/
+/* CALCULATE, and GetValue of the error message and the log counters) on a	*/
+/* context with lazy evaluation and checks that each time step is			*/
+/* calculated as one batch of all its vehicles, and that the totals match	*/
+/* those of a context without.												*/
+/*========================================================================= */
+
+#include "EmissionModel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+
+#define LAZY_TEST_VEHICLES 100
+#define LAZY_TEST_STEPS    20
+#define LAZY_TEST_TIMESTEP 0.1
+
+//network totals of every pollutant after the replay on <context>
+static void replay(MovestarContext *context, bool lazy, vector<double> &totals)
+{
+	static const long types[3] = { 100, 200, 300 };
+	static const long pollutants[6] = { EMISSION_DATA_HC, EMISSION_DATA_CO, EMISSION_DATA_NOX, EMISSION_DATA_CO2,
+		EMISSION_DATA_FUEL, EMISSION_DATA_PART };
+	EmissionModelContextSetValue(context, EMISSION_DATA_LAZY_EVALUATION, 0, 0, lazy ? 1 : 0, 0.0, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, LAZY_TEST_TIMESTEP, nullptr);
+	EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, 0.0, nullptr);
+	EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_INIT);
+
+	srand(7);
+	double velocities[LAZY_TEST_VEHICLES];
+	for (int v = 0; v < LAZY_TEST_VEHICLES; v++)
+	{
+		velocities[v] = rand() % 30;
+	}
+	for (int s = 0; s < LAZY_TEST_STEPS; s++)
+	{
+		for (int v = 0; v < LAZY_TEST_VEHICLES; v++)
+		{
+			double acceleration = ((rand() % 1000) / 1000.0 - 0.6) * 6;
+			velocities[v] = velocities[v] + acceleration * LAZY_TEST_TIMESTEP < 0.0 ? 0.0 : velocities[v] + acceleration * LAZY_TEST_TIMESTEP;
+
+			EmissionModelContextSetValue(context, EMISSION_DATA_TIMESTEP, 0, 0, 0, LAZY_TEST_TIMESTEP, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_TIME, 0, 0, 0, s * LAZY_TEST_TIMESTEP, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ID, 0, 0, v + 1, 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_TYPE, 0, 0, types[v % 3], 0.0, nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_VELOCITY, 0, 0, 0, velocities[v], nullptr);
+			EmissionModelContextSetValue(context, EMISSION_DATA_VEH_ACCELERATION, 0, 0, 0, acceleration, nullptr);
+			EmissionModelContextExecuteCommand(context, EMISSION_COMMAND_CALCULATE_VEHICLE);
+
+			char *error = nullptr;
+			long written = 0;
+			EmissionModelContextGetValue(context, EMISSION_DATA_LAST_ERROR, 0, 0, nullptr, nullptr, &error);
+			EmissionModelContextGetValue(context, EMISSION_DATA_LOG_WRITTEN, 0, 0, &written, nullptr, nullptr);
+		}
+
+		//every other step reads a result at its end, the others end with the time
+		if (s % 2 == 0)
+		{
+			double co = 0.0;
+			EmissionModelContextGetValue(context, EMISSION_DATA_CO, 0, 0, nullptr, &co, nullptr);
+		}
+	}
+	for (int p = 0; p < 6; p++)
+	{
+		double total = 0.0;
+		EmissionModelContextGetValue(context, EMISSION_DATA_NETWORK_TOTAL, 0, pollutants[p], nullptr, &total, nullptr);
+		totals.push_back(total);
+	}
+}
+
+int main()
+{
+	MovestarContext *lazy = EmissionModelCreateContext();
+	MovestarContext *direct = EmissionModelCreateContext();
+	vector<double> lazyTotals, directTotals;
+	replay(lazy, true, lazyTotals);
+	replay(direct, false, directTotals);
+
+	long batches = 0, largest = 0;
+	EmissionModelContextGetValue(lazy, EMISSION_DATA_LAZY_BATCHES, 0, 0, &batches, nullptr, nullptr);
+	EmissionModelContextGetValue(lazy, EMISSION_DATA_LAZY_LARGEST_BATCH, 0, 0, &largest, nullptr, nullptr);
+	EmissionModelDestroyContext(lazy);
+	EmissionModelDestroyContext(direct);
+
+	//every vehicle is calculated once, so <steps> batches of at most all vehicles are all full
+	bool batched = (batches == LAZY_TEST_STEPS && largest == LAZY_TEST_VEHICLES);
+	bool same = (lazyTotals == directTotals);
+	printf("movestar_lazy_test: %ld batches of up to %ld vehicles for %d steps of %d vehicles, totals %s\n",
+		batches, largest, LAZY_TEST_STEPS, LAZY_TEST_VEHICLES, same ? "identical" : "differ");
+	return batched && same ? 0 : 1;
+}
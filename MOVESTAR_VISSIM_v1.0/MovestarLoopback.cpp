@@ -0,0 +1,352 @@
+/*========================================================================= */
+/* MovestarLoopback.cpp                              Core module of MOVESTAR */
+/*																			*/
+/* movestar_loopback: test client of the emission server. Several client	*/
+/* threads drive synthetic vehicles through a server (one of its own on a	*/
+/* private name, or a running movestar_server) and compare every result	*/
+/* with a local engine calculating the same steps, bit for bit. Reports	*/
+/* the round-trip latency of a step, the throughput and how many steps the	*/
+/* server calculated together.												*/
+/*========================================================================= */
+
+#include "CompactModel.h"
+#include "EmissionClient.h"
+#include "EmissionServer.h"
+#include "SourceTypeRegistry.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+
+//type of the vehicles without a source type among the synthetic ones
+#define LOOPBACK_UNKNOWN_TYPE 999
+
+struct Options
+{
+	string   name;				//running server to test, empty for a server of its own
+	string   dataDirectory;
+	unsigned clients;
+	unsigned vehicles;			//per client
+	unsigned steps;
+	double   timeStep;
+	bool     resample;
+	bool     compact;
+	bool     quiet;
+};
+
+//outcome of one client thread
+struct ClientReport
+{
+	string           error;
+	size_t           mismatches;
+	size_t           vehicleSteps;
+	vector<double>   latencies;		//round trip of each step [us]
+};
+
+static void printUsage()
+{
+	fprintf(stderr,
+		"usage: movestar_loopback [options]\n"
+		"\n"
+		"Drives synthetic vehicles of several client threads through the emission\n"
+		"server and checks every result against a local engine calculating the same\n"
+		"steps. Without --name a server of its own runs in a thread of this process;\n"
+		"with it, a running movestar_server with the same options is tested. Exits 1\n"
+		"if a result differs.\n"
+		"\n"
+		"options:\n"
+		"  --name <name>          test the server running on this segment\n"
+		"  --clients <n>          client threads (default 4)\n"
+		"  --vehicles <n>         vehicles of each client (default 256)\n"
+		"  --steps <n>            time steps (default 2000)\n"
+		"  --timestep <s>         simulation time step (default 0.1)\n"
+		"  --data-dir <dir>       load source types from VehicleSrcCoeff.csv and\n"
+		"                         EmsRate_<VehicleType>.csv (default MOVESTAR_DATA_DIR)\n"
+		"  --resample             braking detection on the mean acceleration of every\n"
+		"                         second, as movestar_server --resample\n"
+		"  --compact              compact mode, as movestar_server --compact\n"
+		"  --quiet                no report unless a result differs\n");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	options.clients = 4;
+	options.vehicles = 256;
+	options.steps = 2000;
+	options.timeStep = 0.1;
+	options.resample = false;
+	options.compact = false;
+	options.quiet = false;
+	if (getenv("MOVESTAR_DATA_DIR") != nullptr)
+	{
+		options.dataDirectory = getenv("MOVESTAR_DATA_DIR");
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (option == "--name" && hasValue)
+		{
+			options.name = argv[++i];
+		}
+		else if (option == "--clients" && hasValue)
+		{
+			options.clients = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--vehicles" && hasValue)
+		{
+			options.vehicles = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--steps" && hasValue)
+		{
+			options.steps = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--timestep" && hasValue)
+		{
+			options.timeStep = atof(argv[++i]);
+		}
+		else if (option == "--data-dir" && hasValue)
+		{
+			options.dataDirectory = argv[++i];
+		}
+		else if (option == "--resample")
+		{
+			options.resample = true;
+		}
+		else if (option == "--compact")
+		{
+			options.compact = true;
+		}
+		else if (option == "--quiet")
+		{
+			options.quiet = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return options.clients > 0 && options.vehicles > 0 && options.steps > 0 && options.timeStep > 0.0;
+}
+
+//vehicle <v> of client <client> leaves the network at step <step> and enters again the step after
+static bool leaves(unsigned client, unsigned v, unsigned step)
+{
+	return step > 0 && (step + v * 37 + client * 11) % 600 == 0;
+}
+
+static bool sameValue(double a, double b)
+{
+	return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+//one client: the same vehicle numbers as every other client, kinematics of its own
+static void runClient(const Options &options, const SourceTypeRegistry &sourceTypes,
+	const shared_ptr<const CompactSourceTypes> &compactTypes, unsigned client, ClientReport &report)
+{
+	report.mismatches = 0;
+	report.vehicleSteps = 0;
+
+	EmissionClient connection;
+	if (!connection.connect(options.name, report.error))
+	{
+		return;
+	}
+	if (connection.capacity() < options.vehicles)
+	{
+		report.error = "the server takes " + to_string(connection.capacity()) + " vehicles per step";
+		return;
+	}
+
+	EmissionEngine reference(sourceTypes);
+	reference.setTimeStep(options.timeStep);
+	reference.setHistoryResampling(options.resample);
+	if (compactTypes)
+	{
+		reference.setCompact(compactTypes);
+	}
+
+	size_t vehicles = options.vehicles;
+	vector<long> ids(vehicles), types(vehicles), kills;
+	vector<double> speeds(vehicles), accelerations(vehicles), times(vehicles);
+	vector<double> hc(vehicles), co(vehicles), nox(vehicles), co2(vehicles), energy(vehicles), pm25(vehicles), vsp(vehicles);
+	vector<int> opmodes(vehicles);
+	report.latencies.reserve(options.steps);
+
+	for (unsigned step = 0; step < options.steps; step++)
+	{
+		double time = step * options.timeStep;
+		ServerSlotArrays slot = connection.next();
+		size_t count = 0;
+		kills.clear();
+		for (unsigned v = 0; v < vehicles; v++)
+		{
+			if (leaves(client, v, step))
+			{
+				slot.kills[kills.size()] = v + 1;
+				kills.push_back(v + 1);
+				continue;
+			}
+			//speeds and accelerations crossing every opmode, braking included
+			double phase = 0.013 * (client + 1) * step + 0.7 * v;
+			double speed = 12.0 + 11.0 * sin(phase);
+			double acceleration = 2.5 * sin(3.1 * phase + client);
+			long type = (v % 29 == 28) ? LOOPBACK_UNKNOWN_TYPE : 100 + 100 * (long)(v % 3);
+			slot.vehicleIds[count] = v + 1;
+			slot.vehicleTypes[count] = (int32_t)type;
+			slot.speeds[count] = speed;
+			slot.accelerations[count] = acceleration;
+			ids[count] = v + 1;
+			types[count] = type;
+			speeds[count] = speed;
+			accelerations[count] = acceleration;
+			times[count] = time;
+			count++;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		ServerSlotArrays results;
+		int32_t calculated = 0;
+		if (!connection.submit(time, options.timeStep, count, kills.size(), report.error) ||
+			!connection.wait(results, calculated, report.error))
+		{
+			return;
+		}
+		report.latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+		report.vehicleSteps += count;
+
+		for (size_t k = 0; k < kills.size(); k++)
+		{
+			reference.killVehicle(kills[k]);
+		}
+		EmissionBatch batch = { count, ids.data(), types.data(), speeds.data(), accelerations.data(), nullptr, times.data(),
+			hc.data(), co.data(), nox.data(), co2.data(), energy.data(), pm25.data(), vsp.data(), opmodes.data() };
+		reference.calculate(batch);
+		const SourceTypeModel *const *known = reference.lastSourceTypes();
+		int32_t expected = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			bool typed = (known[i] != nullptr);
+			expected += typed ? 1 : 0;
+			if (!sameValue(results.hc[i], hc[i]) || !sameValue(results.co[i], co[i]) || !sameValue(results.nox[i], nox[i]) ||
+				!sameValue(results.co2[i], co2[i]) || !sameValue(results.energy[i], energy[i]) ||
+				!sameValue(results.pm25[i], pm25[i]) || !sameValue(results.vsp[i], typed ? vsp[i] : 0.0) ||
+				results.opmodes[i] != (typed ? opmodes[i] : INVALID_OPMODE))
+			{
+				report.mismatches++;
+			}
+		}
+		if (calculated != expected)
+		{
+			report.mismatches++;
+		}
+	}
+}
+
+static double percentile(const vector<double> &sorted, double share)
+{
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+	size_t index = (size_t)(share * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 2;
+	}
+
+	SourceTypeRegistry sourceTypes;
+	string error;
+	if (!options.dataDirectory.empty() && !sourceTypes.load(options.dataDirectory, error))
+	{
+		fprintf(stderr, "movestar_loopback: %s\n", error.c_str());
+		return 1;
+	}
+	shared_ptr<const CompactSourceTypes> compactTypes;
+	if (options.compact)
+	{
+		compactTypes = make_shared<const CompactSourceTypes>(sourceTypes);
+	}
+
+	//a server of its own on a name of this process unless a running one is tested
+	unique_ptr<EmissionServer> server;
+	atomic<bool> stop(false);
+	thread serverThread;
+	if (options.name.empty())
+	{
+		options.name = "loopback-" + to_string(currentProcessId());
+		server.reset(new EmissionServer(sourceTypes));
+		server->setHistoryResampling(options.resample);
+		server->setCompact(compactTypes);
+		if (!server->open(options.name, options.clients, options.vehicles, error))
+		{
+			fprintf(stderr, "movestar_loopback: %s\n", error.c_str());
+			return 1;
+		}
+		serverThread = thread([&server, &stop]() { server->run(stop); });
+	}
+
+	vector<ClientReport> reports(options.clients);
+	vector<thread> clients;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (unsigned c = 0; c < options.clients; c++)
+	{
+		clients.push_back(thread(runClient, cref(options), cref(sourceTypes), cref(compactTypes), c, ref(reports[c])));
+	}
+	for (size_t c = 0; c < clients.size(); c++)
+	{
+		clients[c].join();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (server)
+	{
+		stop.store(true);
+		serverThread.join();
+	}
+
+	size_t mismatches = 0, vehicleSteps = 0;
+	vector<double> latencies;
+	for (size_t c = 0; c < reports.size(); c++)
+	{
+		if (!reports[c].error.empty())
+		{
+			fprintf(stderr, "movestar_loopback: client %zu: %s\n", c, reports[c].error.c_str());
+			return 1;
+		}
+		mismatches += reports[c].mismatches;
+		vehicleSteps += reports[c].vehicleSteps;
+		latencies.insert(latencies.end(), reports[c].latencies.begin(), reports[c].latencies.end());
+	}
+	sort(latencies.begin(), latencies.end());
+
+	if (!options.quiet || mismatches > 0)
+	{
+		fprintf(stderr, "movestar_loopback: %u clients, %zu vehicle-steps in %.3f s (%.2f M vehicle-steps/s), %zu mismatches\n",
+			options.clients, vehicleSteps, seconds, seconds > 0.0 ? vehicleSteps / seconds * 1e-6 : 0.0, mismatches);
+		fprintf(stderr, "movestar_loopback: round trip p50 %.1f us, p99 %.1f us, max %.1f us\n", percentile(latencies, 0.5),
+			percentile(latencies, 0.99), latencies.empty() ? 0.0 : latencies.back());
+		if (server && server->rounds() > 0)
+		{
+			fprintf(stderr, "movestar_loopback: %.2f steps, %.0f vehicles calculated together per round\n",
+				(double)server->steps() / server->rounds(), (double)server->vehicleSteps() / server->rounds());
+		}
+	}
+	return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/*========================================================================= */
+/* MovestarNative.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* Spd2Acc and OMCal of movestar.py, operation for operation.				*/
+/*========================================================================= */
+
+#include "MovestarNative.h"
+#include <cmath>
+using namespace std;
+
+
+//m/s to mph, and m/s2 to mph/s
+#define MPH_PER_METER_PER_SECOND 2.23693629
+
+int32_t movestar_native_version(void)
+{
+	return MOVESTAR_NATIVE_VERSION;
+}
+
+void movestar_speed_to_acceleration(int64_t count, const double *speed, double *acceleration)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+	acceleration[0] = 0.0;
+	for (int64_t i = 1; i < count - 1; i++)
+	{
+		acceleration[i] = (speed[i + 1] - speed[i - 1]) / 2;
+	}
+	acceleration[count - 1] = 0.0;
+}
+
+void movestar_opmode_bins(int64_t count, const double *speed, const double *acceleration, const double *vsp,
+	int32_t *bins, double *sizeBin)
+{
+	for (int k = 0; k < MOVESTAR_NATIVE_BIN_COUNT; k++)
+	{
+		sizeBin[k] = 0.0;
+	}
+	if (count <= 0)
+	{
+		return;
+	}
+
+	//upper bound of the last VSP bin of each speed range, NaN as np.max gives it
+	double maxVSP = vsp[0];
+	for (int64_t i = 0; i < count && !std::isnan(maxVSP); i++)
+	{
+		maxVSP = (std::isnan(vsp[i]) || vsp[i] > maxVSP) ? vsp[i] : maxVSP;
+	}
+	maxVSP += 1;
+
+	const double below25[] = { 0, 3, 6, 9, 12, maxVSP };
+	const double below50[] = { 0, 3, 6, 9, 12, 18, 24, 30, maxVSP };
+	const double from50[] = { 6, 12, 18, 24, 30, maxVSP };
+	const double c1 = MPH_PER_METER_PER_SECOND;
+	for (int64_t i = 0; i < count; i++)
+	{
+		double sc1 = speed[i] * c1;
+		int binselector = 0;
+		if (acceleration[i] * c1 <= -2)
+		{
+			binselector = 1;	//deceleration/braking
+		}
+		else if (i >= 3 && acceleration[i - 2] * c1 < -1 && acceleration[i - 1] * c1 < -1)
+		{
+			binselector = 1;	//deceleration/braking
+		}
+		else if (sc1 < 1)
+		{
+			binselector = 2;	//idle
+		}
+		else
+		{
+			const double *thresholds = from50;
+			int size = 6, binoffset = 18;
+			if (sc1 < 25)
+			{
+				thresholds = below25;
+				binoffset = 3;
+			}
+			else if (sc1 < 50)
+			{
+				thresholds = below50;
+				size = 9;
+				binoffset = 9;
+			}
+			for (int index = 0; index < size; index++)
+			{
+				if (vsp[i] < thresholds[index])
+				{
+					binselector = binoffset + index;
+					break;
+				}
+			}
+		}
+
+		//1-based to 0-based; a VSP in no bin (NaN) counts in the last bin, as
+		//size_bin[-1] does in Python
+		int bin = binselector - 1;
+		if (bin < 0)
+		{
+			bin = MOVESTAR_NATIVE_BIN_COUNT - 1;
+		}
+		sizeBin[bin] += 1;
+		if (bins != nullptr)
+		{
+			bins[i] = bin;
+		}
+	}
+}
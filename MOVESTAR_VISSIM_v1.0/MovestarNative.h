@@ -0,0 +1,45 @@
+/*========================================================================= */
+/* MovestarNative.h                                  Core module of MOVESTAR */
+/*																			*/
+/* C interface of the kernels of the Python version (movestar.py): the	*/
+/* acceleration estimate of Spd2Acc and the opmode binning of OMCal, with	*/
+/* their results bit for bit. Arrays are contiguous float64 (int32 for the	*/
+/* bins) as NumPy holds them, read and written in place; the library keeps	*/
+/* no state, so any thread may call it. movestar.py loads it with ctypes.	*/
+/*========================================================================= */
+
+#ifndef __MOVESTARNATIVE_H
+#define __MOVESTARNATIVE_H
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+#ifdef MOVESTAR_NATIVE_EXPORTS
+#define MOVESTAR_NATIVE_API extern "C" __declspec(dllexport)
+#else
+#define MOVESTAR_NATIVE_API extern "C" __declspec(dllimport)
+#endif
+#else
+#define MOVESTAR_NATIVE_API extern "C" __attribute__((visibility("default")))
+#endif
+
+//version of the interface below, raised on every incompatible change
+#define MOVESTAR_NATIVE_VERSION 1
+
+//bins of OMCal, in the rows of EmsRate_<VehicleType>.csv: 0 braking, 1 idle,
+//2..7 below 25 mph, 8..16 below 50 mph, 17..22 from 50 mph
+#define MOVESTAR_NATIVE_BIN_COUNT 23
+
+MOVESTAR_NATIVE_API int32_t movestar_native_version(void);
+
+//Spd2Acc: <acceleration> [m/s2] of <count> speeds [m/s] sampled once per
+//second, by central difference, 0 for the first and the last sample
+MOVESTAR_NATIVE_API void movestar_speed_to_acceleration(int64_t count, const double *speed, double *acceleration);
+
+//OMCal: adds each of <count> samples of speed [m/s], acceleration [m/s2] and
+//VSP [kW/tonne] to <sizeBin> (MOVESTAR_NATIVE_BIN_COUNT counts, zeroed first)
+//and writes its bin to <bins> unless null
+MOVESTAR_NATIVE_API void movestar_opmode_bins(int64_t count, const double *speed, const double *acceleration,
+	const double *vsp, int32_t *bins, double *sizeBin);
+
+#endif /* __MOVESTARNATIVE_H */
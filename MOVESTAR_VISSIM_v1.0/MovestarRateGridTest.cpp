@@ -0,0 +1,156 @@
+/*========================================================================= */
+/* MovestarRateGridTest.cpp                          Core module of MOVESTAR */
+/*																			*/
+/* movestar_rate_grid_test: parity of the rate grids with the exact		*/
+/* calculation. Every cell a grid answers is probed at its edges, next to	*/
+/* them and inside, and must give the rate row of the exact VSP and opmode;	*/
+/* then engines with and without the grids calculate the same traffic		*/
+/* (braking histories included) and must agree bit for bit.				*/
+/*========================================================================= */
+
+#include "EmissionEngine.h"
+#include "MovestarKernels.h"
+#include "RateGrid.h"
+#include "SourceTypeRegistry.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+using namespace std;
+
+
+//cell sizes checked [m/s], [m/s2]: the default one, coarse and fine
+static const double gridResolutions[][2] =
+{
+	{ DEFAULT_RATE_GRID_SPEED_STEP, DEFAULT_RATE_GRID_ACCELERATION_STEP },
+	{ 1.0, 0.1 },
+	{ 0.1, 0.01 }
+};
+
+//rate row of the exact calculation of a vehicle not braking
+static int exactRow(const SourceTypeModel &model, double speed, double acceleration)
+{
+	double velocity = speed * 3.6;
+	return rateRowOfOpmode(binOpmode(velocity, calculateVSP(model.coefficients, velocity, acceleration), false));
+}
+
+//points of the cell [low, low + step): the edges, their neighbours and the middle
+static void cellPoints(double low, double step, double *points)
+{
+	double high = low + step;
+	points[0] = low;
+	points[1] = nextafter(low, DBL_MAX);
+	points[2] = low + 0.5 * step;
+	points[3] = nextafter(high, -DBL_MAX);
+	points[4] = nextafter(points[3], -DBL_MAX);
+}
+
+//probes every cell of the grids, returns the mismatches
+static size_t checkCells(const SourceTypeRegistry &registry, double speedStep, double accelerationStep, size_t &answered)
+{
+	RateGrids grids(registry, speedStep, accelerationStep);
+	vector<const SourceTypeModel *> models = registry.list();
+	size_t speedCells = (size_t)ceil(RATE_GRID_MAX_SPEED / speedStep);
+	size_t accelerationCells = (size_t)ceil(2.0 * RATE_GRID_MAX_ACCELERATION / accelerationStep);
+	size_t mismatches = 0;
+	for (size_t m = 0; m < models.size(); m++)
+	{
+		const RateGrid *grid = grids.find(models[m]);
+		for (size_t i = 0; i < speedCells; i++)
+		{
+			double speeds[5];
+			cellPoints(i * speedStep, speedStep, speeds);
+			for (size_t j = 0; j < accelerationCells; j++)
+			{
+				double accelerations[5];
+				cellPoints(j * accelerationStep - RATE_GRID_MAX_ACCELERATION, accelerationStep, accelerations);
+				for (int s = 0; s < 5; s++)
+				{
+					for (int a = 0; a < 5; a++)
+					{
+						int row = grid->row(speeds[s], accelerations[a]);
+						if (row == RATE_GRID_EXACT)
+						{
+							continue;
+						}
+						answered++;
+						int expected = exactRow(*models[m], speeds[s], accelerations[a]);
+						if (row != expected)
+						{
+							if (mismatches < 10)
+							{
+								fprintf(stderr, "movestar_rate_grid_test: grid %g x %g, speed %.17g acceleration %.17g: row %d, exact %d\n",
+									speedStep, accelerationStep, speeds[s], accelerations[a], row, expected);
+							}
+							mismatches++;
+						}
+					}
+				}
+			}
+		}
+	}
+	return mismatches;
+}
+
+//emissions and opmodes of <steps> steps of random traffic, with or without grids
+static void runTraffic(const SourceTypeRegistry &registry, const shared_ptr<const RateGrids> &grids, int steps,
+	vector<double> &outputs, vector<int> &opmodes)
+{
+	static const long types[4] = { 100, 200, 300, 999 };
+	const size_t count = 4096;
+	mt19937_64 random(7);
+	uniform_real_distribution<double> speed(-0.5, 55.0), acceleration(-6.0, 6.0);
+
+	EmissionEngine engine(registry);
+	engine.setRateGrids(grids);
+	engine.setTimeStep(0.5);
+	vector<long> ids(count), vehicleTypes(count);
+	vector<double> velocities(count), accelerations(count), results(6 * count);
+	vector<int> stepOpmodes(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		ids[i] = (long)i + 1;
+		vehicleTypes[i] = types[i % 4];
+	}
+	for (int s = 0; s < steps; s++)
+	{
+		engine.setTime(s * 0.5);
+		for (size_t i = 0; i < count; i++)
+		{
+			//every 8th vehicle sits on a grid line
+			velocities[i] = i % 8 == 0 ? (double)(random() % 200) * 0.25 : speed(random);
+			accelerations[i] = i % 8 == 1 ? (double)(random() % 500) * 0.02 - 5.0 : acceleration(random);
+		}
+		EmissionBatch batch = { count, ids.data(), vehicleTypes.data(), velocities.data(), accelerations.data(),
+			nullptr, nullptr, &results[0], &results[count], &results[2 * count], &results[3 * count], &results[4 * count],
+			&results[5 * count], nullptr, stepOpmodes.data() };
+		engine.calculate(batch);
+		outputs.insert(outputs.end(), results.begin(), results.end());
+		opmodes.insert(opmodes.end(), stepOpmodes.begin(), stepOpmodes.end());
+	}
+}
+
+int main()
+{
+	SourceTypeRegistry registry;
+	size_t mismatches = 0, answered = 0;
+	for (size_t r = 0; r < sizeof(gridResolutions) / sizeof(gridResolutions[0]); r++)
+	{
+		mismatches += checkCells(registry, gridResolutions[r][0], gridResolutions[r][1], answered);
+	}
+
+	vector<double> exactOutputs, gridOutputs;
+	vector<int> exactOpmodes, gridOpmodes;
+	shared_ptr<const RateGrids> grids(new RateGrids(registry, DEFAULT_RATE_GRID_SPEED_STEP, DEFAULT_RATE_GRID_ACCELERATION_STEP));
+	runTraffic(registry, nullptr, 40, exactOutputs, exactOpmodes);
+	runTraffic(registry, grids, 40, gridOutputs, gridOpmodes);
+	bool engineSame = exactOpmodes == gridOpmodes &&
+		memcmp(exactOutputs.data(), gridOutputs.data(), exactOutputs.size() * sizeof(double)) == 0;
+
+	printf("movestar_rate_grid_test: %zu cell points answered by the grids, %zu differ from the exact calculation; engine %s\n",
+		answered, mismatches, engineSame ? "identical" : "differs");
+	return mismatches == 0 && engineSame ? 0 : 1;
+}
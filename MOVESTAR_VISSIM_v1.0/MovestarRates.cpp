@@ -0,0 +1,23 @@
+/*========================================================================= */
+/* MovestarRates.cpp                     VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Lookup of the built-in source types.										*/
+/*========================================================================= */
+
+#include "MovestarRates.h"
+
+
+const SourceTypeModel *findBuiltinSourceType(long vehicleType)
+{
+	switch (vehicleType)
+	{
+	case 100:
+		return &builtinSourceType<100>();
+	case 200:
+		return &builtinSourceType<200>();
+	case 300:
+		return &builtinSourceType<300>();
+	default:
+		return nullptr;
+	}
+}
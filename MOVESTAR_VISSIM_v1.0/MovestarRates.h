@@ -0,0 +1,197 @@
+/*========================================================================= */
+/* MovestarRates.h                       VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Built-in source types: VSP coefficients and MOVES emission rates,		*/
+/* converted to per-second rates at compile time and stored as one flat	*/
+/* table per source type with a row per opmode.								*/
+/*========================================================================= */
+
+#ifndef __MOVESTARRATES_H
+#define __MOVESTARRATES_H
+
+#include "MovestarKernels.h"
+
+//number of emission rates per opmode: HC, CO, NOx, CO2, Energy, PM2.5
+#define EMISSION_RATE_COUNT 6
+
+//number of opmodes defined by MOVES (rows of a rate table)
+#define OPMODE_ROW_COUNT 23
+
+//highest opmode defined by MOVES
+#define MAX_OPMODE 40
+
+//row of each opmode 0..40 in the rate tables, -1 for opmodes MOVES does not define
+constexpr signed char opmodeRow[MAX_OPMODE + 1] =
+{
+	0, 1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 2, 3, 4, 5, 6, 7, -1, -1, -1,
+	-1, 8, 9, 10, 11, 12, -1, 13, 14, 15,
+	16, -1, -1, 17, -1, 18, -1, 19, 20, 21,
+	22
+};
+
+//opmode of each rate table row
+constexpr int opmodeOfRow[OPMODE_ROW_COUNT] =
+{
+	0, 1, 11, 12, 13, 14, 15, 16, 21, 22, 23, 24, 25, 27, 28, 29, 30, 33, 35, 37, 38, 39, 40
+};
+
+//row of an opmode, -1 if the opmode has no rates (including INVALID_OPMODE)
+inline int rateRowOfOpmode(int opmode)
+{
+	return (unsigned)opmode <= MAX_OPMODE ? opmodeRow[opmode] : -1;
+}
+
+//emission rates of one source type, one row per opmode
+struct EmissionRateTable
+{
+	double rates[OPMODE_ROW_COUNT][EMISSION_RATE_COUNT];
+};
+
+//converts rates given per hour (as MOVES reports them) to per second
+constexpr EmissionRateTable perSecondRates(EmissionRateTable hourly)
+{
+	for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+	{
+		for (int rate = 0; rate < EMISSION_RATE_COUNT; rate++)
+		{
+			hourly.rates[row][rate] /= 3600;
+		}
+	}
+	return hourly;
+}
+
+//everything the calculation needs to know about a source type
+struct SourceTypeModel
+{
+	long                     vehicleType;	//vehicle type number used by the simulator
+	int                      sourceTypeId;	//MOVES source type
+	VSPCoefficients          coefficients;
+	const EmissionRateTable *rates;
+};
+
+//compile-time description of the built-in source types, specialised per vehicle type
+template <long VehicleType> struct BuiltinSourceType;
+
+//source type 100: light-duty passenger car (source type 21)
+template <> struct BuiltinSourceType<100>
+{
+	static constexpr int sourceTypeId = 21;
+	static constexpr VSPCoefficients coefficients = { 0.156461,  0.002002, 0.000493, 1.4788, 1.4788 };
+
+	//rates [g/s, KJ/s] by opmode row (opmodes 0, 1, 11-16, 21-25, 27-30, 33, 35, 37-40)
+	static constexpr EmissionRateTable rates = perSecondRates(
+	{ {
+		{ 5.65127,57.1901,3.12064,3689.52,51336.2,0.162388 },	//0
+		{ 4.16103,65.203,3.72146,3303.21,45961.5,0.14099 },	//1
+		{ 4.49873,72.2148,5.05498,5065.18,70477.3,0.140804 },	//11
+		{ 5.49957,114.721,10.434,6792.71,94514.1,0.181153 },	//12
+		{ 6.9986,166.291,21.2052,9898.89,137734,0.304719 },	//13
+		{ 8.61404,236.629,36.8724,12754,177459,0.368023 },	//14
+		{ 10.289,290.701,54.5185,15525.4,216021,0.511385 },	//15
+		{ 12.292,353.082,77.7222,19353,269278,1.37684 },	//16
+		{ 6.39121,121.101,12.4625,6552.97,91178.8,0.269425 },	//21
+		{ 6.06055,134.493,14.3454,7795.24,108464,0.277939 },	//22
+		{ 7.08482,175.239,22.3094,9860,137193,0.328926 },	//23
+		{ 9.14126,250.723,38.98,12792.3,177992,0.403531 },	//24
+		{ 10.3794,301.015,55.9756,16526.8,229954,0.43782 },	//25
+		{ 14.5963,505.205,89.8475,21600.8,300555,0.833802 },	//27
+		{ 20.9733,860.458,123.158,29132.2,405348,3.81746 },	//28
+		{ 30.9063,1510.07,155.893,39794.4,553702,12.1245 },	//29
+		{ 55.4631,3383.72,217.391,49616,690361,29.7988 },	//30
+		{ 6.40282,112.342,17.4164,9969.44,138715,0.928642 },	//33
+		{ 8.5886,214.588,52.3698,15832.7,220297,0.922485 },	//35
+		{ 10.2377,287.955,75.6242,20520.9,285528,1.01152 },	//37
+		{ 14.6403,560.062,104.028,26654.3,370869,1.75908 },	//38
+		{ 24.3958,906.369,143.246,35381.3,492297,4.48958 },	//39
+		{ 39.5436,2442.32,198.037,44859.7,624180,5.2443 }	//40
+	} });
+};
+
+//source type 200: transit bus (source type 42)
+template <> struct BuiltinSourceType<200>
+{
+	static constexpr int sourceTypeId = 42;
+	static constexpr VSPCoefficients coefficients = { 1.0944, 0, 0.003587, 16.556, 17.1 };
+
+	//rates [g/s, KJ/s] by opmode row (opmodes 0, 1, 11-16, 21-25, 27-30, 33, 35, 37-40)
+	static constexpr EmissionRateTable rates = perSecondRates(
+	{ {
+		{ 19.236,92.4235,121.303,15326.9,210592,4.41943 },	//0
+		{ 17.9677,49.2354,281.303,7709.02,106380,4.78183 },	//1
+		{ 25.2863,155.676,169.805,10345.9,142771,10.4614 },	//11
+		{ 28.9061,201.415,560.734,29799.4,410370,14.5674 },	//12
+		{ 42.3189,580.049,828.318,56032.8,775733,38.1777 },	//13
+		{ 52.2232,865.575,1097.32,82582.2,1.14554e+006,54.6949 },	//14
+		{ 58.8956,1176.28,1281.25,105324,1.46341e+006,77.8943 },	//15
+		{ 66.5306,1636.93,1424.7,145359,2.02099e+006,78.1251 },	//16
+		{ 28.4361,171.305,162.769,8642.64,120102,15.7278 },	//21
+		{ 32.9324,246.345,706.252,38161.6,525130,31.8557 },	//22
+		{ 38.1365,576.677,1069.67,64843.7,896698,38.5261 },	//23
+		{ 44.0335,820.389,1428.83,92746.5,1.2795e+006,62.3961 },	//24
+		{ 48.7164,1090.84,1600.59,119827,1.65468e+006,87.9118 },	//25
+		{ 57.3304,1551.6,2456.08,165851,2.29116e+006,124.826 },	//27
+		{ 67.1679,2050.35,3438.51,232192,3.20761e+006,200.882 },	//28
+		{ 86.3587,2636.15,4420.93,298532,4.12407e+006,326.447 },	//29
+		{ 105.55,3221.97,5403.37,364872,5.04053e+006,418.537 },	//30
+		{ 49.7724,330.765,590.11,35112.3,486466,27.7863 },	//33
+		{ 53.9466,802.819,1504.05,104780,1.44459e+006,46.0302 },	//35
+		{ 66.2907,1381.65,2662.09,164540,2.26999e+006,71.9717 },	//37
+		{ 99.7145,1615.82,3726.92,230356,3.17799e+006,113.335 },	//38
+		{ 128.205,2077.49,4791.76,296171,4.08598e+006,179.999 },	//39
+		{ 156.694,2539.16,5856.59,361986,4.99397e+006,227.656 }	//40
+	} });
+};
+
+//source type 300: combination short-haul truck (source type 61)
+template <> struct BuiltinSourceType<300>
+{
+	static constexpr int sourceTypeId = 61;
+	static constexpr VSPCoefficients coefficients = { 1.96354, 0, 0.004031, 29.3275, 17.1 };
+
+	//rates [g/s, KJ/s] by opmode row (opmodes 0, 1, 11-16, 21-25, 27-30, 33, 35, 37-40)
+	static constexpr EmissionRateTable rates = perSecondRates(
+	{ {
+		{ 17.9342,61.6024,153.021,15867.4,216403,4.76104 },	//0
+		{ 14.6674,33.4247,143.922,7845.78,107011,5.14933 },	//1
+		{ 22.6629,104.206,135.196,10528.4,143599,11.4434 },	//11
+		{ 23.8828,115.977,469.469,30577.7,417042,15.607 },	//12
+		{ 35.6299,271.354,751.115,56285.8,767742,39.953 },	//13
+		{ 41.5951,368.76,982.122,82291.5,1.12251e+006,55.7104 },	//14
+		{ 45.9337,486.889,1182,104238,1.42192e+006,80.7488 },	//15
+		{ 46.9285,651.346,1681.07,143472,1.95714e+006,80.9949 },	//16
+		{ 25.4088,114.716,100.502,8548.55,116612,15.4937 },	//21
+		{ 29.2006,157.582,595.675,39275.8,535663,30.5977 },	//22
+		{ 32.3917,238.981,959.51,65435.8,892532,38.5478 },	//23
+		{ 34.7385,408.602,1394.02,94496.8,1.28886e+006,61.320 },	//24
+		{ 37.4941,526.539,1692.91,121617,1.65879e+006,84.896 },	//25
+		{ 42.1349,730.506,2372.96,168058,2.29223e+006,117.161 },	//27
+		{ 43.3231,920.788,3197.98,235281,3.20912e+006,182.518 },	//28
+		{ 55.701,1183.87,4030.82,302504,4.126e+006,288.461 },	//29
+		{ 68.079,1446.95,4926.56,369726,5.04289e+006,365.166 },	//30
+		{ 39.8045,196.179,350.483,35163.7,479643,28.3334 },	//33
+		{ 41.7728,345.923,1795.03,107031,1.4598e+006,45.9186 },	//35
+		{ 48.1088,584.837,2543.71,167626,2.28629e+006,68.996 },	//37
+		{ 65.0605,601.128,3422.06,234676,3.2008e+006,105.038 },	//38
+		{ 83.6495,772.881,4327.96,301726,4.1153e+006,162.169 },	//39
+		{ 102.238,944.633,5289.73,368777,5.02981e+006,202.638 }	//40
+	} });
+};
+
+//model of a built-in source type, instantiated once per vehicle type
+template <long VehicleType> const SourceTypeModel &builtinSourceType()
+{
+	static const SourceTypeModel model =
+	{
+		VehicleType,
+		BuiltinSourceType<VehicleType>::sourceTypeId,
+		BuiltinSourceType<VehicleType>::coefficients,
+		&BuiltinSourceType<VehicleType>::rates
+	};
+	return model;
+}
+
+//built-in model of a vehicle type (100, 200 or 300), or nullptr if the type is unknown
+const SourceTypeModel *findBuiltinSourceType(long vehicleType);
+
+#endif /* __MOVESTARRATES_H */
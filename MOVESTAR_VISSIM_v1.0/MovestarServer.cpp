@@ -0,0 +1,187 @@
+/*========================================================================= */
+/* MovestarServer.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* movestar_server: emission server for simulators that cannot load the	*/
+/* VISSIM DLL (SUMO and others). Clients linked with EmissionClient submit	*/
+/* the vehicles of every time step through shared memory and read the		*/
+/* emissions back in place; the steps of all clients are calculated		*/
+/* together. Runs until interrupted.										*/
+/*========================================================================= */
+
+#include "CompactModel.h"
+#include "EmissionServer.h"
+#include "RateGrid.h"
+#include "SourceTypeRegistry.h"
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+using namespace std;
+
+
+struct Options
+{
+	string   name;
+	string   dataDirectory;
+	unsigned channels;
+	unsigned slotVehicles;
+	bool     resample;
+	bool     compact;
+	double   gridSpeedStep;
+	double   gridAccelerationStep;
+	bool     quiet;
+};
+
+static atomic<bool> stopRequested(false);
+
+static void requestStop(int)
+{
+	stopRequested.store(true);
+}
+
+static void printUsage()
+{
+	fprintf(stderr,
+		"usage: movestar_server [options]\n"
+		"\n"
+		"Serves MOVESTAR emissions to simulators in other processes through shared\n"
+		"memory, until interrupted. Clients (EmissionClient) claim a channel each and\n"
+		"submit the vehicles of every time step; the steps of all clients are\n"
+		"calculated as one batch per time step length and the emissions are written\n"
+		"back into the clients' slots.\n"
+		"\n"
+		"options:\n"
+		"  --name <name>          name of the shared memory segment (default movestar)\n"
+		"  --channels <n>         client processes served at once (default 16)\n"
+		"  --vehicles <n>         vehicles of a step of one client at most (default 4096)\n"
+		"  --data-dir <dir>       load source types from VehicleSrcCoeff.csv and\n"
+		"                         EmsRate_<VehicleType>.csv (default MOVESTAR_DATA_DIR)\n"
+		"  --resample             braking detection on the mean acceleration of every\n"
+		"                         second instead of the step starting it\n"
+		"  --compact              float32 kernels and rate tables, int16 histories\n"
+		"  --grid <m/s>           look rates up in a speed x acceleration grid per source\n"
+		"                         type with cells of this speed\n"
+		"  --grid-acceleration <m/s2>  acceleration of the grid cells (default 0.02)\n"
+		"  --quiet                no summary on stderr\n");
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+	options.name = DEFAULT_SERVER_NAME;
+	options.channels = DEFAULT_SERVER_CHANNELS;
+	options.slotVehicles = DEFAULT_SERVER_SLOT_VEHICLES;
+	options.resample = false;
+	options.compact = false;
+	options.gridSpeedStep = 0.0;
+	options.gridAccelerationStep = DEFAULT_RATE_GRID_ACCELERATION_STEP;
+	options.quiet = false;
+	if (getenv("MOVESTAR_DATA_DIR") != nullptr)
+	{
+		options.dataDirectory = getenv("MOVESTAR_DATA_DIR");
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (option == "--name" && hasValue)
+		{
+			options.name = argv[++i];
+		}
+		else if (option == "--channels" && hasValue)
+		{
+			options.channels = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--vehicles" && hasValue)
+		{
+			options.slotVehicles = (unsigned)atoi(argv[++i]);
+		}
+		else if (option == "--data-dir" && hasValue)
+		{
+			options.dataDirectory = argv[++i];
+		}
+		else if (option == "--resample")
+		{
+			options.resample = true;
+		}
+		else if (option == "--compact")
+		{
+			options.compact = true;
+		}
+		else if (option == "--grid" && hasValue)
+		{
+			options.gridSpeedStep = atof(argv[++i]);
+		}
+		else if (option == "--grid-acceleration" && hasValue)
+		{
+			options.gridAccelerationStep = atof(argv[++i]);
+		}
+		else if (option == "--quiet")
+		{
+			options.quiet = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	if (options.name.empty() || options.channels == 0 || options.slotVehicles == 0)
+	{
+		return false;
+	}
+	return options.gridSpeedStep == 0.0 || RateGrid::validResolution(options.gridSpeedStep, options.gridAccelerationStep);
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 2;
+	}
+
+	SourceTypeRegistry sourceTypes;
+	string error;
+	if (!options.dataDirectory.empty() && !sourceTypes.load(options.dataDirectory, error))
+	{
+		fprintf(stderr, "movestar_server: %s\n", error.c_str());
+		return 1;
+	}
+
+	EmissionServer server(sourceTypes);
+	server.setHistoryResampling(options.resample);
+	if (options.gridSpeedStep > 0.0)
+	{
+		server.setRateGrids(make_shared<const RateGrids>(sourceTypes, options.gridSpeedStep, options.gridAccelerationStep));
+	}
+	if (options.compact)
+	{
+		server.setCompact(make_shared<const CompactSourceTypes>(sourceTypes));
+	}
+	if (!server.open(options.name, options.channels, options.slotVehicles, error))
+	{
+		fprintf(stderr, "movestar_server: %s\n", error.c_str());
+		return 1;
+	}
+
+	signal(SIGINT, requestStop);
+	signal(SIGTERM, requestStop);
+	if (!options.quiet)
+	{
+		fprintf(stderr, "movestar_server: serving on %s, %u channels of %u vehicles\n", options.name.c_str(),
+			options.channels, options.slotVehicles);
+	}
+	server.run(stopRequested);
+	server.close();
+
+	if (!options.quiet)
+	{
+		fprintf(stderr, "movestar_server: %llu steps, %llu vehicle-steps in %llu rounds (%.1f steps per round)\n",
+			(unsigned long long)server.steps(), (unsigned long long)server.vehicleSteps(), (unsigned long long)server.rounds(),
+			server.rounds() > 0 ? (double)server.steps() / server.rounds() : 0.0);
+	}
+	return 0;
+}
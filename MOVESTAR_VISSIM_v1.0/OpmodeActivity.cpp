@@ -0,0 +1,155 @@
+/*========================================================================= */
+/* OpmodeActivity.cpp                                Core module of MOVESTAR */
+/*																			*/
+/* Evaluation of opmode histograms and the activity files.					*/
+/*========================================================================= */
+
+#include "OpmodeActivity.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+
+#define ACTIVITY_FIXED_COLUMNS 5
+
+void evaluateActivities(size_t count, const OpmodeActivity *activities, const EmissionRateTable *const *tables,
+	double timeStep, EmissionTotals *totals)
+{
+	for (size_t n = 0; n < count; n++)
+	{
+		double sums[EMISSION_RATE_COUNT] = { 0.0 };
+		if (tables[n] != nullptr)
+		{
+			const unsigned long long *samples = activities[n].samples;
+			for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+			{
+				if (samples[row] == 0)
+				{
+					continue;
+				}
+				double weight = (double)samples[row];
+				const double *rates = tables[n]->rates[row];
+				for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+				{
+					sums[k] += weight * rates[k];
+				}
+			}
+		}
+		for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+		{
+			totals[n].values[k] = sums[k] * timeStep;
+		}
+	}
+}
+
+bool writeActivities(const string &path, const vector<VehicleActivity> &vehicles, double timeStep, string &error)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+	{
+		error = "cannot create " + path;
+		return false;
+	}
+	fprintf(file, "Vehicle,Type,TimeStep(s),TT(s),TD(m)");
+	for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+	{
+		fprintf(file, ",OpMode%d", opmodeOfRow[row]);
+	}
+	fprintf(file, "\n");
+	for (size_t i = 0; i < vehicles.size(); i++)
+	{
+		const VehicleActivity &vehicle = vehicles[i];
+		fprintf(file, "%ld,%ld,%.17g,%.17g,%.17g", vehicle.vehicleNumber, vehicle.vehicleType, timeStep,
+			vehicle.travelTime, vehicle.travelDistance);
+		for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+		{
+			fprintf(file, ",%llu", vehicle.activity.samples[row]);
+		}
+		fprintf(file, "\n");
+	}
+	if (fclose(file) != 0)
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}
+
+bool readActivities(const string &path, vector<VehicleActivity> &vehicles, double &timeStep, string &error)
+{
+	ifstream file(path.c_str());
+	if (!file)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	//the opmode columns must be those of the rate tables, in their order
+	string line;
+	getline(file, line);
+	istringstream header(line);
+	string column;
+	int columns = 0;
+	while (getline(header, column, ','))
+	{
+		if (column.size() > 0 && column[column.size() - 1] == '\r')
+		{
+			column.erase(column.size() - 1);
+		}
+		if (columns >= ACTIVITY_FIXED_COLUMNS && (columns - ACTIVITY_FIXED_COLUMNS >= OPMODE_ROW_COUNT ||
+			column != "OpMode" + to_string(opmodeOfRow[columns - ACTIVITY_FIXED_COLUMNS])))
+		{
+			error = path + ": unexpected column \"" + column + "\", not an opmode histogram file";
+			return false;
+		}
+		columns++;
+	}
+	if (columns != ACTIVITY_FIXED_COLUMNS + OPMODE_ROW_COUNT)
+	{
+		error = path + ": not an opmode histogram file";
+		return false;
+	}
+
+	vehicles.clear();
+	timeStep = 0.0;
+	int lineNumber = 1;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		if (line.find_first_not_of(" \t\r") == string::npos)
+		{
+			continue;
+		}
+		VehicleActivity vehicle;
+		double step;
+		const char *text = line.c_str();
+		char *end = nullptr;
+		bool valid = true;
+		vehicle.vehicleNumber = strtol(text, &end, 10);
+		valid = valid && end != text && *end == ',';
+		vehicle.vehicleType = valid ? strtol(text = end + 1, &end, 10) : 0;
+		valid = valid && end != text && *end == ',';
+		step = valid ? strtod(text = end + 1, &end) : 0.0;
+		valid = valid && end != text && *end == ',';
+		vehicle.travelTime = valid ? strtod(text = end + 1, &end) : 0.0;
+		valid = valid && end != text && *end == ',';
+		vehicle.travelDistance = valid ? strtod(text = end + 1, &end) : 0.0;
+		for (int row = 0; valid && row < OPMODE_ROW_COUNT; row++)
+		{
+			valid = end != text && *end == ',';
+			vehicle.activity.samples[row] = valid ? strtoull(text = end + 1, &end, 10) : 0;
+		}
+		valid = valid && end != text && (*end == '\0' || *end == '\r');
+		if (!valid || !(step > 0.0) || (timeStep != 0.0 && step != timeStep))
+		{
+			error = path + " line " + to_string(lineNumber) + ": expected " + to_string(ACTIVITY_FIXED_COLUMNS + OPMODE_ROW_COUNT) +
+				" numeric columns with one time step";
+			return false;
+		}
+		timeStep = step;
+		vehicles.push_back(vehicle);
+	}
+	return true;
+}
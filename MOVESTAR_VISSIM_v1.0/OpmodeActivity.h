@@ -0,0 +1,56 @@
+/*========================================================================= */
+/* OpmodeActivity.h                                  Core module of MOVESTAR */
+/*																			*/
+/* Opmode histograms: the samples a vehicle (or a group of vehicles) spent	*/
+/* in each opmode, as the size_bin vector of OMCal in the Python version.	*/
+/* Totals follow from one histogram x rate matrix product, so histograms	*/
+/* kept from one pass over the trajectories can be evaluated against any	*/
+/* number of rate tables (model years, fuels) without reading them again.	*/
+/*========================================================================= */
+
+#ifndef __OPMODEACTIVITY_H
+#define __OPMODEACTIVITY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "EmissionAccumulator.h"
+#include "MovestarRates.h"
+
+//samples in each opmode, by rate table row (samples of opmodes without rates are not counted)
+struct OpmodeActivity
+{
+	unsigned long long samples[OPMODE_ROW_COUNT];
+};
+
+//histogram of one vehicle as stored in an activity file
+struct VehicleActivity
+{
+	long           vehicleNumber;
+	long           vehicleType;
+	double         travelTime;			//[s]
+	double         travelDistance;		//[m]
+	OpmodeActivity activity;
+};
+
+inline void addActivity(OpmodeActivity &to, const OpmodeActivity &from)
+{
+	for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+	{
+		to.samples[row] += from.samples[row];
+	}
+}
+
+//totals of <count> histograms, each sample standing for <timeStep> [s], with
+//the rate table of each (null for zero emissions)
+void evaluateActivities(std::size_t count, const OpmodeActivity *activities, const EmissionRateTable *const *tables,
+	double timeStep, EmissionTotals *totals);
+
+//writes <vehicles> to <path> as CSV: vehicle, type, time step, travel time and
+//distance, then the samples of each opmode; false with a message in <error>
+bool writeActivities(const std::string &path, const std::vector<VehicleActivity> &vehicles, double timeStep, std::string &error);
+
+//reads a file written by writeActivities; false with a message in <error>
+bool readActivities(const std::string &path, std::vector<VehicleActivity> &vehicles, double &timeStep, std::string &error);
+
+#endif /* __OPMODEACTIVITY_H */
@@ -0,0 +1,637 @@
+/*========================================================================= */
+/* ParallelTrajectory.cpp                            Core module of MOVESTAR */
+/*																			*/
+/* Segment decoding, vehicle partitioning and the fixed-order reduction.	*/
+/*========================================================================= */
+
+#include "ParallelTrajectory.h"
+#include <algorithm>
+using namespace std;
+
+
+static bool byFirstRow(const VehicleTrack &a, const VehicleTrack &b)
+{
+	return a.firstRow < b.firstRow;
+}
+
+ParallelTrajectoryEngine::ParallelTrajectoryEngine(const SourceTypeRegistry &sourceTypes, double timeStep, WorkStealingPool &pool)
+	: pool(pool), skippedBlocks(TRAJECTORY_PARTITIONS, 0), memoryLimit(0), foldedFirstSecond(0), retiredCount(0), peakState(0),
+	limitedState(0), segmentGrowth(0), raster(nullptr), segmentBytes(TRAJECTORY_SEGMENT_BYTES), partitionQueueing(TRAJECTORY_PARTITIONS, chrono::steady_clock::duration(0)),
+	runTime(0)
+{
+	for (size_t i = 0; i < TRAJECTORY_PARTITIONS; i++)
+	{
+		partitions.push_back(unique_ptr<TrajectoryProcessor>(new TrajectoryProcessor(sourceTypes, timeStep)));
+	}
+	fill(serialTime, serialTime + TRAJECTORY_STAGE_COUNT, chrono::steady_clock::duration(0));
+}
+
+void ParallelTrajectoryEngine::setRateGrids(const shared_ptr<const RateGrids> &grids)
+{
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->setRateGrids(grids);
+	}
+}
+
+void ParallelTrajectoryEngine::setAggregate(bool aggregate)
+{
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->setAggregate(aggregate);
+	}
+}
+
+void ParallelTrajectoryEngine::setScenarios(const shared_ptr<const SweepScenarios> &scenarios)
+{
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->setScenarios(scenarios);
+	}
+}
+
+void ParallelTrajectoryEngine::setHistoryResampling(bool resampling)
+{
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->setHistoryResampling(resampling);
+	}
+}
+
+void ParallelTrajectoryEngine::setCompact(const shared_ptr<const CompactSourceTypes> &compactTypes)
+{
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->setCompact(compactTypes);
+	}
+}
+
+void ParallelTrajectoryEngine::setMemoryLimit(size_t bytes, const RetiredVehicleSink &sink)
+{
+	memoryLimit = bytes;
+	retiredSink = sink;
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->setDenseIndexLimit(bytes > 0 ? 0 : DENSE_VEHICLE_NUMBER_LIMIT);
+		partitions[p]->setRetiredNumbers(bytes > 0 ? &retiredNumbers : nullptr);
+	}
+}
+
+void ParallelTrajectoryEngine::setRaster(EmissionRaster *emissionRaster)
+{
+	raster = emissionRaster;
+}
+
+bool ParallelTrajectoryEngine::run(TrajectoryCsvReader &reader, string &error)
+{
+	chrono::steady_clock::time_point runStart = chrono::steady_clock::now();
+	bool accelerations = reader.hasAccelerations();
+	bool positions = reader.hasPositions();
+	bool placed = positions || reader.hasSlopes();
+	if (raster != nullptr && (!positions || raster->tileCount() != TRAJECTORY_PARTITIONS))
+	{
+		error = positions ? "the raster needs a tile per partition" : "a raster needs the x and y columns of the positions";
+		return false;
+	}
+	if (placed)
+	{
+		for (size_t p = 0; p < partitions.size(); p++)
+		{
+			partitions[p]->setPlaces(raster != nullptr ? &raster->tile(p) : nullptr);
+		}
+	}
+	workerDecoding.resize(pool.size(), chrono::steady_clock::duration(0));
+
+	//under a memory limit, the segments in flight hold at most TRAJECTORY_BUFFER_SHARE
+	//of it: every byte of a segment may be a row of the block and of its partition
+	segmentBytes = TRAJECTORY_SEGMENT_BYTES;
+	if (memoryLimit > 0)
+	{
+		size_t rowBytes = reader.blockRowBytes() + sizeof(PartitionRow) + (placed ? sizeof(TrajectoryPlace) : 0);
+		size_t bufferBytes = (size_t)(memoryLimit * TRAJECTORY_BUFFER_SHARE) / TRAJECTORY_PIPELINE_DEPTH;
+		segmentBytes = min(max(bufferBytes / rowBytes * reader.minimumRowBytes(), (size_t)TRAJECTORY_RANGE_BYTES), segmentBytes);
+	}
+
+	//step k takes and decodes segment k and calculates segment k - TRAJECTORY_PIPELINE_DEPTH + 1
+	size_t taken = 0, nextRow = 0;
+	bool taking = true;
+	for (size_t step = 0; ; step++)
+	{
+		chrono::steady_clock::time_point serialStart = chrono::steady_clock::now();
+		Segment *decoded = nullptr;
+		if (taking)
+		{
+			decoded = &segments[step % TRAJECTORY_PIPELINE_DEPTH];
+			taking = reader.nextSegment(segmentBytes, TRAJECTORY_RANGE_BYTES, decoded->ranges);
+			if (taking)
+			{
+				taken++;
+				reader.prefetch(segmentBytes);
+			}
+			else
+			{
+				decoded = nullptr;
+			}
+		}
+		size_t calculatedIndex = step + 1 - TRAJECTORY_PIPELINE_DEPTH;
+		const Segment *calculated = (step + 1 >= TRAJECTORY_PIPELINE_DEPTH && calculatedIndex < taken) ?
+			&segments[calculatedIndex % TRAJECTORY_PIPELINE_DEPTH] : nullptr;
+		if (decoded == nullptr && calculated == nullptr)
+		{
+			break;
+		}
+		serialTime[STAGE_INGEST] += chrono::steady_clock::now() - serialStart;
+
+		//the partitions take their rows of one segment while the ranges of a later one are decoded
+		size_t partitionTasks = calculated != nullptr ? (size_t)TRAJECTORY_PARTITIONS : 0;
+		size_t rangeTasks = 0;
+		if (decoded != nullptr)
+		{
+			rangeTasks = decoded->ranges.size();
+			decoded->blocks.resize(max(decoded->blocks.size(), rangeTasks));
+			decoded->partitionRows.resize(max(decoded->partitionRows.size(), rangeTasks));
+			decoded->partitionPlaces.resize(placed ? decoded->partitionRows.size() : 0);
+			decoded->errors.assign(rangeTasks, string());
+		}
+		pool.parallelFor(partitionTasks + rangeTasks, [&](size_t i, unsigned worker)
+		{
+			if (i < partitionTasks)
+			{
+				calculatePartition(*calculated, i, accelerations);
+			}
+			else
+			{
+				decodeRange(reader, *decoded, i - partitionTasks, worker);
+			}
+		});
+
+		if (decoded != nullptr)
+		{
+			serialStart = chrono::steady_clock::now();
+			for (size_t r = 0; r < rangeTasks; r++)
+			{
+				if (!decoded->errors[r].empty())
+				{
+					error = decoded->errors[r];
+					return false;
+				}
+			}
+
+			//input position of the first row of every range, rows left to other shards included
+			decoded->firstRows.resize(rangeTasks);
+			for (size_t r = 0; r < rangeTasks; r++)
+			{
+				decoded->firstRows[r] = nextRow;
+				nextRow += decoded->blocks[r].rangeRows;
+			}
+			decoded->endRow = nextRow;
+			if (memoryLimit > 0)
+			{
+				reader.releaseTaken();
+			}
+			serialTime[STAGE_INGEST] += chrono::steady_clock::now() - serialStart;
+		}
+		if (calculated == nullptr)
+		{
+			continue;
+		}
+
+		//retiring vehicles runs the kernel on their last rows, timed by the processors
+		serialStart = chrono::steady_clock::now();
+		chrono::steady_clock::duration processorStart = processorTime();
+		if (memoryLimit > 0 && !limitMemory(calculated->endRow, error))
+		{
+			return false;
+		}
+
+		//rows still to come of an input ordered by time are not earlier than the
+		//last one calculated, nor than the rows waiting for their acceleration
+		if (raster != nullptr)
+		{
+			size_t r = calculated->ranges.size();
+			while (r > 0 && calculated->blocks[r - 1].size() == 0)
+			{
+				r--;
+			}
+			if (r > 0)
+			{
+				double time = calculated->blocks[r - 1].times.back();
+				for (size_t p = 0; p < partitions.size(); p++)
+				{
+					time = partitions[p]->earliestPendingTime(time);
+				}
+				if (!raster->advance(time, error))
+				{
+					return false;
+				}
+			}
+		}
+		serialTime[STAGE_AGGREGATE] += (chrono::steady_clock::now() - serialStart) - (processorTime() - processorStart);
+	}
+
+	//the last rows of the vehicles may span the whole file: under a memory limit
+	//the partitions finish a pool's worth at a time, their per-second totals
+	//folded in between
+	size_t finishing = memoryLimit > 0 ? (size_t)pool.size() : (size_t)TRAJECTORY_PARTITIONS;
+	for (size_t first = 0; first < TRAJECTORY_PARTITIONS; first += finishing)
+	{
+		pool.parallelFor(min(finishing, TRAJECTORY_PARTITIONS - first), [&](size_t i, unsigned)
+		{
+			size_t p = first + i;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			chrono::steady_clock::duration processorStart = partitions[p]->kernelTime() + partitions[p]->aggregateTime();
+			partitions[p]->finish();
+			partitionQueueing[p] += (chrono::steady_clock::now() - start) -
+				(partitions[p]->kernelTime() + partitions[p]->aggregateTime() - processorStart);
+		});
+		if (memoryLimit > 0)
+		{
+			peakState = max(peakState, stateBytes());
+			foldSeconds();
+		}
+	}
+	runTime += chrono::steady_clock::now() - runStart;
+	return true;
+}
+
+void ParallelTrajectoryEngine::decodeRange(const TrajectoryCsvReader &reader, Segment &segment, size_t r, unsigned worker)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool accelerations = reader.hasAccelerations();
+	bool positions = reader.hasPositions();
+	bool slopes = reader.hasSlopes();
+	TrajectoryBlock &block = segment.blocks[r];
+	if (!reader.read(segment.ranges[r], block, (size_t)-1, segment.errors[r]) && !segment.errors[r].empty())
+	{
+		return;
+	}
+	vector<vector<PartitionRow> > &rowsByPartition = segment.partitionRows[r];
+	rowsByPartition.resize(TRAJECTORY_PARTITIONS);
+	for (size_t p = 0; p < TRAJECTORY_PARTITIONS; p++)
+	{
+		rowsByPartition[p].clear();
+	}
+	for (size_t i = 0; i < block.size(); i++)
+	{
+		PartitionRow row = { block.vehicleIds[i], block.vehicleTypes[i], block.times[i], block.speeds[i],
+			accelerations ? block.accelerations[i] : 0.0, block.rangeIndices.empty() ? i : block.rangeIndices[i] };
+		rowsByPartition[partitionOf(row.vehicleNumber)].push_back(row);
+	}
+	if (positions || slopes)
+	{
+		vector<vector<TrajectoryPlace> > &placesByPartition = segment.partitionPlaces[r];
+		placesByPartition.resize(TRAJECTORY_PARTITIONS);
+		for (size_t p = 0; p < TRAJECTORY_PARTITIONS; p++)
+		{
+			placesByPartition[p].clear();
+		}
+		for (size_t i = 0; i < block.size(); i++)
+		{
+			TrajectoryPlace place = { positions ? block.xs[i] : 0.0, positions ? block.ys[i] : 0.0, slopes ? block.slopes[i] : 0.0 };
+			placesByPartition[partitionOf(block.vehicleIds[i])].push_back(place);
+		}
+	}
+	workerDecoding[worker] += chrono::steady_clock::now() - start;
+}
+
+void ParallelTrajectoryEngine::calculatePartition(const Segment &segment, size_t p, bool accelerations)
+{
+	//the partition takes its rows range by range, so a vehicle's rows stay in file order
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	TrajectoryProcessor &processor = *partitions[p];
+	chrono::steady_clock::duration processorStart = processor.kernelTime() + processor.aggregateTime();
+	bool placed = !segment.partitionPlaces.empty();
+	for (size_t r = 0; r < segment.ranges.size(); r++)
+	{
+		const vector<PartitionRow> &rows = segment.partitionRows[r][p];
+		const TrajectoryPlace *places = placed ? segment.partitionPlaces[r][p].data() : nullptr;
+		for (size_t k = 0; k < rows.size(); k++)
+		{
+			const PartitionRow &row = rows[k];
+			if (accelerations)
+			{
+				processor.addRow(row.vehicleNumber, row.vehicleType, row.time, row.speed, row.acceleration,
+					segment.firstRows[r] + row.row, placed ? places[k] : TrajectoryPlace());
+			}
+			else
+			{
+				processor.addSpeedRow(row.vehicleNumber, row.vehicleType, row.time, row.speed, segment.firstRows[r] + row.row,
+					placed ? places[k] : TrajectoryPlace());
+			}
+		}
+	}
+	processor.flush();
+	partitionQueueing[p] += (chrono::steady_clock::now() - start) -
+		(processor.kernelTime() + processor.aggregateTime() - processorStart);
+}
+
+void ParallelTrajectoryEngine::run(const ColumnarTrajectoryReader &reader, const TrajectoryQuery &query)
+{
+	chrono::steady_clock::time_point runStart = chrono::steady_clock::now();
+	workerDecoding.resize(pool.size(), chrono::steady_clock::duration(0));
+
+	//the selected vehicles of every partition, in file order
+	vector<vector<size_t> > partitionVehicles(TRAJECTORY_PARTITIONS);
+	for (size_t v = 0; v < reader.vehicleCount(); v++)
+	{
+		long vehicleNumber = (long)reader.vehicle(v).vehicleNumber;
+		if (query.selects(vehicleNumber))
+		{
+			partitionVehicles[partitionOf(vehicleNumber)].push_back(v);
+		}
+		else
+		{
+			skippedBlocks[0] += (size_t)reader.vehicle(v).blockCount;
+		}
+	}
+
+	serialTime[STAGE_INGEST] += chrono::steady_clock::now() - runStart;
+
+	//the spans are decoded block by block, right before the processor takes them
+	pool.parallelFor(TRAJECTORY_PARTITIONS, [&](size_t p, unsigned worker)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		chrono::steady_clock::duration decoding(0);
+		TrajectoryProcessor &processor = *partitions[p];
+		chrono::steady_clock::duration processorStart = processor.kernelTime() + processor.aggregateTime();
+		vector<double> scratch;
+		const vector<size_t> &vehicles = partitionVehicles[p];
+		for (size_t k = 0; k < vehicles.size(); k++)
+		{
+			const ColumnarVehicle &vehicle = reader.vehicle(vehicles[k]);
+			for (size_t b = 0; b < vehicle.blockCount; b++)
+			{
+				const ColumnarBlock &block = reader.block((size_t)(vehicle.firstBlock + b));
+				if (!query.overlaps(block))
+				{
+					skippedBlocks[p]++;
+					continue;
+				}
+				chrono::steady_clock::time_point spanStart = chrono::steady_clock::now();
+				TrajectorySpan span;
+				reader.span(block, query.from, query.to, span, scratch);
+				decoding += chrono::steady_clock::now() - spanStart;
+				processor.addSpan((long)vehicle.vehicleNumber, (long)vehicle.vehicleType, (size_t)vehicle.firstInputRow,
+					span.count, span.times, span.speeds, span.accelerations);
+			}
+		}
+		processor.finish();
+		workerDecoding[worker] += decoding;
+		partitionQueueing[p] += (chrono::steady_clock::now() - start) - decoding -
+			(processor.kernelTime() + processor.aggregateTime() - processorStart);
+	});
+	runTime += chrono::steady_clock::now() - runStart;
+}
+
+size_t ParallelTrajectoryEngine::stateBytes() const
+{
+	size_t bytes = foldedSeconds.capacity() * sizeof(EmissionTotals) + retiredNumbers.capacity() / 8;
+	for (size_t s = 0; s < TRAJECTORY_PIPELINE_DEPTH; s++)
+	{
+		const Segment &segment = segments[s];
+		for (size_t r = 0; r < segment.blocks.size(); r++)
+		{
+			const TrajectoryBlock &block = segment.blocks[r];
+			bytes += (block.vehicleIds.capacity() + block.vehicleTypes.capacity()) * sizeof(long) +
+				(block.times.capacity() + block.speeds.capacity() + block.accelerations.capacity() + block.xs.capacity() +
+				block.ys.capacity() + block.slopes.capacity()) * sizeof(double) + block.rangeIndices.capacity() * sizeof(size_t);
+		}
+		for (size_t r = 0; r < segment.partitionRows.size(); r++)
+		{
+			for (size_t p = 0; p < segment.partitionRows[r].size(); p++)
+			{
+				bytes += segment.partitionRows[r][p].capacity() * sizeof(PartitionRow);
+			}
+		}
+		for (size_t r = 0; r < segment.partitionPlaces.size(); r++)
+		{
+			for (size_t p = 0; p < segment.partitionPlaces[r].size(); p++)
+			{
+				bytes += segment.partitionPlaces[r][p].capacity() * sizeof(TrajectoryPlace);
+			}
+		}
+	}
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		const TrajectoryProcessor &processor = *partitions[p];
+		bytes += processor.liveVehicles() * processor.vehicleBytes() + processor.indexBytes() + processor.secondBytes() + processor.queueBytes();
+	}
+	return bytes;
+}
+
+void ParallelTrajectoryEngine::foldSeconds()
+{
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		TrajectoryProcessor &processor = *partitions[p];
+		const vector<EmissionTotals> &seconds = processor.secondTotals();
+		if (seconds.empty())
+		{
+			continue;
+		}
+		long long first = processor.firstSecond();
+		if (foldedSeconds.empty())
+		{
+			foldedFirstSecond = first;
+		}
+		if (first < foldedFirstSecond)
+		{
+			foldedSeconds.insert(foldedSeconds.begin(), (size_t)(foldedFirstSecond - first), EmissionTotals());
+			foldedFirstSecond = first;
+		}
+		size_t offset = (size_t)(first - foldedFirstSecond);
+		if (offset + seconds.size() > foldedSeconds.size())
+		{
+			foldedSeconds.resize(offset + seconds.size(), EmissionTotals());
+		}
+		for (size_t i = 0; i < seconds.size(); i++)
+		{
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				foldedSeconds[offset + i].values[k] += seconds[i].values[k];
+			}
+		}
+		processor.clearSecondTotals();
+	}
+}
+
+chrono::steady_clock::duration ParallelTrajectoryEngine::processorTime() const
+{
+	chrono::steady_clock::duration time(0);
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		time += partitions[p]->kernelTime() + partitions[p]->aggregateTime();
+	}
+	return time;
+}
+
+bool ParallelTrajectoryEngine::limitMemory(size_t nextRow, string &error)
+{
+	//the largest growth of a segment (after the first, which allocates the
+	//buffers) is kept free, so the next segment stays within the limit
+	size_t bytes = stateBytes();
+	peakState = max(peakState, bytes);
+	if (limitedState > 0 && bytes > limitedState)
+	{
+		segmentGrowth = max(segmentGrowth, bytes - limitedState);
+	}
+	limitedState = bytes;
+	size_t target = min((size_t)(memoryLimit * TRAJECTORY_RETIRE_SHARE), memoryLimit - min(memoryLimit, segmentGrowth));
+	if (bytes <= memoryLimit - min(memoryLimit, segmentGrowth))
+	{
+		return true;
+	}
+
+	//per-second totals first, they are usually spread over every partition
+	foldSeconds();
+	bytes = limitedState = stateBytes();
+	if (bytes <= target)
+	{
+		return true;
+	}
+
+	size_t vehicles = 0, vehicleBytes = 0;
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		vehicles += partitions[p]->liveVehicles();
+		vehicleBytes += partitions[p]->liveVehicles() * partitions[p]->vehicleBytes() + partitions[p]->indexBytes();
+	}
+	size_t fixedBytes = bytes - vehicleBytes;
+	if (fixedBytes >= target)
+	{
+		error = "the memory limit leaves no room for vehicles, the buffers and per-second totals take " +
+			to_string((fixedBytes >> 20) + 1) + " MiB and a segment adds up to " + to_string((segmentGrowth >> 20) + 1) + " MiB";
+		return false;
+	}
+
+	//the vehicles seen longest ago go; every vehicle has a last row of its own,
+	//so the <retire> smallest ones are those before the one that follows them
+	size_t keep = (size_t)((double)vehicles * (double)(target - fixedBytes) / (double)vehicleBytes);
+	size_t retire = vehicles - min(keep, vehicles);
+	vector<size_t> lastRows;
+	lastRows.reserve(vehicles);
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		partitions[p]->appendLastRows(lastRows);
+	}
+	size_t before = nextRow;
+	if (retire < lastRows.size())
+	{
+		nth_element(lastRows.begin(), lastRows.begin() + retire, lastRows.end());
+		before = lastRows[retire];
+	}
+	pool.parallelFor(TRAJECTORY_PARTITIONS, [&](size_t p, unsigned)
+	{
+		partitions[p]->retireBefore(before);
+	});
+
+	//handed over in partition order, their numbers marked for the re-entry count
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		vector<VehicleTrack> &retired = partitions[p]->retired();
+		for (size_t i = 0; i < retired.size(); i++)
+		{
+			long vehicleNumber = retired[i].vehicleNumber;
+			if (vehicleNumber >= 0 && vehicleNumber < DENSE_VEHICLE_NUMBER_LIMIT)
+			{
+				if ((size_t)vehicleNumber >= retiredNumbers.size())
+				{
+					retiredNumbers.resize(max((size_t)vehicleNumber + 1, retiredNumbers.size() * 2), false);
+				}
+				retiredNumbers[vehicleNumber] = true;
+			}
+			retiredSink(retired[i]);
+		}
+		retiredCount += retired.size();
+		vector<VehicleTrack>().swap(retired);
+	}
+	limitedState = stateBytes();
+	return true;
+}
+
+void ParallelTrajectoryEngine::totals(TrajectoryTotals &totals) const
+{
+	totals.seconds.clear();
+	totals.firstSecond = 0;
+	totals.vehicles.clear();
+	totals.rows = 0;
+	totals.unknownTypeRows = 0;
+	totals.skippedBlocks = 0;
+	totals.scenarios.clear();
+	totals.binnedRows = 0;
+	totals.retiredVehicles = retiredCount;
+	totals.reenteredVehicles = 0;
+	totals.peakStateBytes = max(peakState, stateBytes());
+
+	//the kernel and aggregation times of the processors, whichever thread ran them
+	chrono::steady_clock::duration busy[TRAJECTORY_STAGE_COUNT];
+	copy(serialTime, serialTime + TRAJECTORY_STAGE_COUNT, busy);
+	for (size_t w = 0; w < workerDecoding.size(); w++)
+	{
+		busy[STAGE_INGEST] += workerDecoding[w];
+	}
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		busy[STAGE_RESAMPLE] += partitionQueueing[p];
+		busy[STAGE_KERNEL] += partitions[p]->kernelTime();
+		busy[STAGE_AGGREGATE] += partitions[p]->aggregateTime();
+	}
+	for (int stage = 0; stage < TRAJECTORY_STAGE_COUNT; stage++)
+	{
+		totals.stages.busy[stage] = chrono::duration<double>(busy[stage]).count();
+	}
+	totals.stages.wall = chrono::duration<double>(runTime).count();
+	totals.stages.threads = pool.size();
+
+	//span of seconds over all partitions and the seconds folded out of them
+	bool any = !foldedSeconds.empty();
+	long long lastSecond = foldedFirstSecond + (long long)foldedSeconds.size() - 1;
+	totals.firstSecond = any ? foldedFirstSecond : 0;
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		const TrajectoryProcessor &processor = *partitions[p];
+		if (processor.secondTotals().empty())
+		{
+			continue;
+		}
+		long long first = processor.firstSecond();
+		long long last = first + (long long)processor.secondTotals().size() - 1;
+		totals.firstSecond = any ? min(totals.firstSecond, first) : first;
+		lastSecond = any ? max(lastSecond, last) : last;
+		any = true;
+	}
+	if (any)
+	{
+		totals.seconds.assign((size_t)(lastSecond - totals.firstSecond + 1), EmissionTotals());
+	}
+	for (size_t i = 0; i < foldedSeconds.size(); i++)
+	{
+		totals.seconds[(size_t)(foldedFirstSecond - totals.firstSecond) + i] = foldedSeconds[i];
+	}
+
+	//partition order fixes the order of the floating-point additions
+	for (size_t p = 0; p < partitions.size(); p++)
+	{
+		const TrajectoryProcessor &processor = *partitions[p];
+		const vector<EmissionTotals> &seconds = processor.secondTotals();
+		size_t offset = (size_t)(processor.firstSecond() - totals.firstSecond);
+		for (size_t i = 0; i < seconds.size(); i++)
+		{
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				totals.seconds[offset + i].values[k] += seconds[i].values[k];
+			}
+		}
+		totals.vehicles.insert(totals.vehicles.end(), processor.vehicles().begin(), processor.vehicles().end());
+		totals.rows += processor.rowCount();
+		totals.unknownTypeRows += processor.unknownTypeRows();
+		totals.reenteredVehicles += processor.reenteredVehicles();
+		totals.skippedBlocks += skippedBlocks[p];
+		if (processor.scenarioSweep() != nullptr)
+		{
+			mergeScenarioTotals(processor.scenarioSweep()->totals(), totals.scenarios);
+			totals.binnedRows += processor.scenarioSweep()->binnedCount();
+		}
+	}
+	sort(totals.vehicles.begin(), totals.vehicles.end(), byFirstRow);
+}
@@ -0,0 +1,245 @@
+/*========================================================================= */
+/* ParallelTrajectory.h                              Core module of MOVESTAR */
+/*																			*/
+/* Multi-threaded calculation of trajectory files. The file is taken in	*/
+/* segments whose row ranges are decoded concurrently; the rows are then	*/
+/* partitioned by vehicle, every partition owning its TrajectoryProcessor	*/
+/* (engine, vehicle states and accumulators). Partitions run as tasks of a	*/
+/* WorkStealingPool. Segments flow through a ring of reused buffers: while	*/
+/* the partitions calculate one segment, the next one is read and decoded	*/
+/* by tasks of the same pool, so the threads need not wait for the file	*/
+/* between segments. The partition of a vehicle depends on its number only	*/
+/* and the partial totals are reduced in partition order, so the totals	*/
+/* are bit-identical for any number of threads. Columnar files are			*/
+/* calculated vehicle by vehicle on the same partitions. Under a memory		*/
+/* limit, the pages of the file already read are given back and the		*/
+/* vehicles seen longest ago are retired between segments. Rastering,		*/
+/* every partition adds to a tile of its own.								*/
+/*========================================================================= */
+
+#ifndef __PARALLELTRAJECTORY_H
+#define __PARALLELTRAJECTORY_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ColumnarTrajectory.h"
+#include "TrajectoryCsv.h"
+#include "TrajectoryProcessor.h"
+#include "WorkStealingPool.h"
+
+//number of vehicle partitions, independent of the thread count
+#define TRAJECTORY_PARTITIONS 64
+
+//bytes of the file decoded per segment, and per task within a segment; a
+//segment's decoded rows stay in cache until its partitions consumed them
+#define TRAJECTORY_SEGMENT_BYTES (2u << 20)
+#define TRAJECTORY_RANGE_BYTES   (64u << 10)
+
+//segments in flight: one calculated, the others decoded ahead of it
+#define TRAJECTORY_PIPELINE_DEPTH 2
+
+//share of the memory limit the state is brought back to once it exceeds it,
+//so vehicles are retired in batches rather than after every segment
+#define TRAJECTORY_RETIRE_SHARE 0.75
+
+//share of the memory limit the buffers of the segments in flight may take at
+//most; under a smaller limit the segments are cut smaller, down to one range
+#define TRAJECTORY_BUFFER_SHARE 0.25
+
+//stages a row passes through
+enum TrajectoryStage
+{
+	STAGE_INGEST,		//file read, rows decoded and sorted by partition
+	STAGE_RESAMPLE,		//rows queued per vehicle, accelerations derived from the speeds
+	STAGE_KERNEL,		//VSP, opmodes and rates of the queued blocks
+	STAGE_AGGREGATE,	//totals, histograms and raster tiles; raster written, vehicles retired
+	TRAJECTORY_STAGE_COUNT
+};
+
+//thread time spent in every stage [s], and the time of the runs [s] on <threads>
+//threads; the rest of threads * wall the threads were idle
+struct TrajectoryStageTimes
+{
+	double   busy[TRAJECTORY_STAGE_COUNT];
+	double   wall;
+	unsigned threads;
+};
+
+//network totals of a run
+struct TrajectoryTotals
+{
+	std::vector<EmissionTotals> seconds;		//element i holds second firstSecond + i
+	long long                   firstSecond;
+	std::vector<VehicleTrack>   vehicles;		//in the order of their first row, with their activity if aggregating
+	std::size_t                 rows;
+	std::size_t                 unknownTypeRows;
+	std::size_t                 skippedBlocks;		//blocks of a columnar file outside the query
+
+	//sweeping: totals by scenario and type, and the VSP and opmode evaluations of the rows
+	std::vector<ScenarioTypeTotals> scenarios;
+	std::size_t                 binnedRows;
+
+	//under a memory limit: vehicles handed to the sink (not in <vehicles>),
+	//vehicles seen again after their retirement (counted twice), and the peak
+	//of the state held [bytes]
+	std::size_t                 retiredVehicles;
+	std::size_t                 reenteredVehicles;
+	std::size_t                 peakStateBytes;
+
+	TrajectoryStageTimes        stages;
+};
+
+//takes the vehicles retired under a memory limit
+typedef std::function<void(const VehicleTrack &track)> RetiredVehicleSink;
+
+class ParallelTrajectoryEngine
+{
+public:
+	ParallelTrajectoryEngine(const SourceTypeRegistry &sourceTypes, double timeStep, WorkStealingPool &pool);
+
+	//rate grids of every partition's engine (see EmissionEngine::setRateGrids)
+	void setRateGrids(const std::shared_ptr<const RateGrids> &grids);
+
+	//opmode histograms per vehicle instead of per-row totals on every partition
+	//(see TrajectoryProcessor::setAggregate)
+	void setAggregate(bool aggregate);
+
+	//scenario sweep on every partition (see TrajectoryProcessor::setScenarios)
+	void setScenarios(const std::shared_ptr<const SweepScenarios> &scenarios);
+
+	//1 Hz resampled braking histories on every partition
+	//(see EmissionEngine::setHistoryResampling)
+	void setHistoryResampling(bool resampling);
+
+	//compact mode of every partition's engine (see EmissionEngine::setCompact)
+	void setCompact(const std::shared_ptr<const CompactSourceTypes> &compactTypes);
+
+	//out of core, CSV input only and neither aggregating nor sweeping: keeps the
+	//state of the run (vehicles, per-second totals and the segment buffers)
+	//within <bytes>. The segments are sized so their buffers, sized for the
+	//most rows the bytes of a segment can hold, take at most
+	//TRAJECTORY_BUFFER_SHARE of the limit. The state is checked between segments, with room left for
+	//the largest growth of a segment seen so far: beyond that, the per-second
+	//totals of the partitions are folded into one array (the per-second sums
+	//may then differ in the last digits from a run without limit) and, if that is
+	//not enough, the vehicles seen longest ago are retired
+	//(TrajectoryProcessor::retireBefore) and handed to <sink>, partition by
+	//partition, until the state is back to TRAJECTORY_RETIRE_SHARE of the limit.
+	//Vehicle numbers are hashed rather than indexed. The totals are the same
+	//for any number of threads, but a vehicle retired while still moving is cut in two
+	void setMemoryLimit(std::size_t bytes, const RetiredVehicleSink &sink);
+
+	//emissions of the rows of a CSV input with positions added to <raster>,
+	//opened with TRAJECTORY_PARTITIONS tiles, partition p to tile p; neither
+	//aggregating nor sweeping. After every segment the raster advances to the
+	//earliest time still to come if the input is ordered by time: the last
+	//time of the segment or of a row waiting for its acceleration. The raster
+	//is left open
+	void setRaster(EmissionRaster *raster);
+
+	//calculates every row of <reader>, false with a message in <error> on a
+	//malformed row, a memory limit below the buffers of the run, a raster without
+	//positions in the input or a raster file that cannot be written. Segment
+	//k + TRAJECTORY_PIPELINE_DEPTH - 1 is decoded while segment k is calculated,
+	//and the file is read ahead by one segment more; the rows reach every
+	//partition in file order all the same, whatever the size of the segments
+	bool run(TrajectoryCsvReader &reader, std::string &error);
+
+	//calculates the rows of <reader> selected by <query>, in place
+	void run(const ColumnarTrajectoryReader &reader, const TrajectoryQuery &query);
+
+	//reduces the partitions into network totals, in partition order, with the
+	//stage times of the runs so far
+	void totals(TrajectoryTotals &totals) const;
+
+private:
+	ParallelTrajectoryEngine(const ParallelTrajectoryEngine &);
+	ParallelTrajectoryEngine &operator=(const ParallelTrajectoryEngine &);
+
+	static std::size_t partitionOf(long vehicleNumber)
+	{
+		unsigned long long hash = (unsigned long long)vehicleNumber * 0x9E3779B97F4A7C15ULL;
+		return (std::size_t)(hash >> 32) % TRAJECTORY_PARTITIONS;
+	}
+
+	//state held by the run [bytes], see setMemoryLimit
+	std::size_t stateBytes() const;
+
+	//brings the state back under the memory limit after the segment before
+	//input row <nextRow>; false with a message in <error> if it cannot be
+	bool limitMemory(std::size_t nextRow, std::string &error);
+
+	//adds the per-second totals of every partition to foldedSeconds, in partition order
+	void foldSeconds();
+
+	//time the processors spent in the kernel and aggregation stages
+	std::chrono::steady_clock::duration processorTime() const;
+
+	//a decoded row, copied out so a partition reads its rows contiguously
+	struct PartitionRow
+	{
+		long        vehicleNumber;
+		long        vehicleType;
+		double      time;
+		double      speed;
+		double      acceleration;
+		std::size_t row;
+	};
+
+	//a segment of the file: its ranges, their decoded rows, then the rows of
+	//every partition and, for inputs with positions or slopes, their places
+	struct Segment
+	{
+		std::vector<TrajectoryCsvRange>                        ranges;
+		std::vector<TrajectoryBlock>                           blocks;
+		std::vector<std::vector<std::vector<PartitionRow> > >  partitionRows;
+		std::vector<std::vector<std::vector<TrajectoryPlace> > > partitionPlaces;
+		std::vector<std::string>                               errors;		//per range, empty if decoded
+		std::vector<std::size_t>                               firstRows;	//input position of the first row of every range
+		std::size_t                                            endRow;		//input position of the row after the segment
+	};
+
+	//decodes range <r> of <segment> and sorts its rows by partition, on <worker>
+	void decodeRange(const TrajectoryCsvReader &reader, Segment &segment, std::size_t r, unsigned worker);
+
+	//hands the rows of <segment> of partition <p> to its processor
+	void calculatePartition(const Segment &segment, std::size_t p, bool accelerations);
+
+	WorkStealingPool                                      &pool;
+	std::vector<std::unique_ptr<TrajectoryProcessor> >     partitions;
+	std::vector<std::size_t>                               skippedBlocks;		//per partition
+
+	//memory limit: per-second totals folded out of the partitions, numbers of
+	//the vehicles retired, the peak of the state, the state left by the last
+	//check and the largest growth of a segment since
+	std::size_t                                            memoryLimit;
+	RetiredVehicleSink                                     retiredSink;
+	std::vector<EmissionTotals>                            foldedSeconds;
+	long long                                              foldedFirstSecond;
+	std::vector<bool>                                      retiredNumbers;
+	std::size_t                                            retiredCount;
+	std::size_t                                            peakState;
+	std::size_t                                            limitedState;
+	std::size_t                                            segmentGrowth;
+
+	EmissionRaster                                        *raster;
+
+	//segment k of a run in element k % TRAJECTORY_PIPELINE_DEPTH, and the bytes
+	//of the file taken per segment
+	Segment                                                segments[TRAJECTORY_PIPELINE_DEPTH];
+	std::size_t                                            segmentBytes;
+
+	//busy time of the stages: decoding per worker, queueing per partition (the
+	//kernel and aggregation are timed by the processors), the serial steps
+	//between segments, and the time of the runs
+	std::vector<std::chrono::steady_clock::duration>       workerDecoding;
+	std::vector<std::chrono::steady_clock::duration>       partitionQueueing;
+	std::chrono::steady_clock::duration                    serialTime[TRAJECTORY_STAGE_COUNT];
+	std::chrono::steady_clock::duration                    runTime;
+};
+
+#endif /* __PARALLELTRAJECTORY_H */
@@ -0,0 +1,125 @@
+/*========================================================================= */
+/* RateGrid.cpp                                      Core module of MOVESTAR */
+/*																			*/
+/* Construction of the rate grids.											*/
+/*========================================================================= */
+
+#include "RateGrid.h"
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+
+//relative widening of the cell bounds and VSP ranges, far above the rounding
+//of the index and VSP calculation
+#define RATE_GRID_MARGIN 1e-9
+
+//range of <factor> * [low, high]
+static void scale(double factor, double low, double high, double &minimum, double &maximum)
+{
+	minimum = min(factor * low, factor * high);
+	maximum = max(factor * low, factor * high);
+}
+
+
+RateGrid::RateGrid(const VSPCoefficients &coefficients, double speedStep, double accelerationStep)
+	: speedStep(speedStep), accelerationStep(accelerationStep), inverseSpeedStep(1.0 / speedStep),
+	inverseAccelerationStep(1.0 / accelerationStep),
+	speedCells((size_t)ceil(RATE_GRID_MAX_SPEED / speedStep)),
+	accelerationCells((size_t)ceil(2.0 * RATE_GRID_MAX_ACCELERATION / accelerationStep))
+{
+	cells.resize(speedCells * accelerationCells);
+	for (size_t i = 0; i < speedCells; i++)
+	{
+		for (size_t j = 0; j < accelerationCells; j++)
+		{
+			cells[i * accelerationCells + j] = (signed char)cellRow(coefficients, i, j);
+		}
+	}
+}
+
+bool RateGrid::validResolution(double speedStep, double accelerationStep)
+{
+	if (!(speedStep > 0.0 && accelerationStep > 0.0))
+	{
+		return false;
+	}
+	return ceil(RATE_GRID_MAX_SPEED / speedStep) * ceil(2.0 * RATE_GRID_MAX_ACCELERATION / accelerationStep) <= RATE_GRID_MAX_CELLS;
+}
+
+int RateGrid::cellRow(const VSPCoefficients &coefficients, size_t speedCell, size_t accelerationCell) const
+{
+	//speeds of the cell in the unit of the bins (km/h, as the engine converts them)
+	double lowSpeed = speedCell * speedStep * 3.6;
+	double highSpeed = (speedCell + 1) * speedStep * 3.6;
+	lowSpeed = max(lowSpeed - RATE_GRID_MARGIN * (1.0 + lowSpeed), 0.0);
+	highSpeed += RATE_GRID_MARGIN * (1.0 + highSpeed);
+	double lowAcceleration = accelerationCell * accelerationStep - RATE_GRID_MAX_ACCELERATION - RATE_GRID_MARGIN;
+	double highAcceleration = (accelerationCell + 1) * accelerationStep - RATE_GRID_MAX_ACCELERATION + RATE_GRID_MARGIN;
+
+	if (!(coefficients.F > 0.0))
+	{
+		return RATE_GRID_EXACT;
+	}
+
+	//VSP range of the cell, term by term (speeds are not negative)
+	double terms[4][2];
+	scale(coefficients.A, lowSpeed, highSpeed, terms[0][0], terms[0][1]);
+	scale(coefficients.B, lowSpeed * lowSpeed, highSpeed * highSpeed, terms[1][0], terms[1][1]);
+	scale(coefficients.C, lowSpeed * lowSpeed * lowSpeed, highSpeed * highSpeed * highSpeed, terms[2][0], terms[2][1]);
+	double lowPush, highPush;
+	scale(coefficients.M, lowAcceleration, highAcceleration, lowPush, highPush);
+	terms[3][0] = min(lowPush * lowSpeed, lowPush * highSpeed);
+	terms[3][1] = max(highPush * lowSpeed, highPush * highSpeed);
+
+	double lowVSP = 0.0, highVSP = 0.0, magnitude = 0.0;
+	for (int t = 0; t < 4; t++)
+	{
+		lowVSP += terms[t][0];
+		highVSP += terms[t][1];
+		magnitude += max(fabs(terms[t][0]), fabs(terms[t][1]));
+	}
+	double margin = RATE_GRID_MARGIN * (1.0 + magnitude);
+	lowVSP = (lowVSP - margin) / coefficients.F;
+	highVSP = (highVSP + margin) / coefficients.F;
+	if (!(lowVSP <= highVSP))
+	{
+		return RATE_GRID_EXACT;
+	}
+
+	//the speed class rises with the speed and the opmode of a class with the
+	//VSP, so the cell has one opmode if the corners of its range agree
+	int opmode = binOpmode(lowSpeed, lowVSP, false);
+	if (binOpmode(lowSpeed, highVSP, false) != opmode || binOpmode(highSpeed, lowVSP, false) != opmode ||
+		binOpmode(highSpeed, highVSP, false) != opmode)
+	{
+		return RATE_GRID_EXACT;
+	}
+	int row = rateRowOfOpmode(opmode);
+	return row < 0 ? RATE_GRID_EXACT : row;
+}
+
+double RateGrid::exactShare() const
+{
+	return cells.empty() ? 0.0 : (double)count(cells.begin(), cells.end(), (signed char)RATE_GRID_EXACT) / cells.size();
+}
+
+RateGrids::RateGrids(const SourceTypeRegistry &sourceTypes, double speedStep, double accelerationStep)
+{
+	vector<const SourceTypeModel *> models = sourceTypes.list();
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		index[models[i]] = grids.size();
+		grids.push_back(unique_ptr<RateGrid>(new RateGrid(models[i]->coefficients, speedStep, accelerationStep)));
+	}
+}
+
+double RateGrids::exactShare() const
+{
+	double share = 0.0;
+	for (size_t i = 0; i < grids.size(); i++)
+	{
+		share += grids[i]->exactShare();
+	}
+	return grids.empty() ? 0.0 : share / grids.size();
+}
@@ -0,0 +1,104 @@
+/*========================================================================= */
+/* RateGrid.h                                        Core module of MOVESTAR */
+/*																			*/
+/* Precomputed rate table row per speed and acceleration cell of a source	*/
+/* type, so a vehicle not braking needs no VSP or opmode calculation.		*/
+/* A cell gets a row only if every speed and acceleration within it bins	*/
+/* to the same opmode; the VSP range of the cell is bounded by interval	*/
+/* arithmetic with a margin for rounding, so cells touching a speed or VSP	*/
+/* threshold are left to the exact calculation. Results are therefore		*/
+/* identical to the exact path.												*/
+/*========================================================================= */
+
+#ifndef __RATEGRID_H
+#define __RATEGRID_H
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "MovestarRates.h"
+#include "SourceTypeRegistry.h"
+
+//range covered by the grids: speeds 0 .. RATE_GRID_MAX_SPEED [m/s] and
+//accelerations -RATE_GRID_MAX_ACCELERATION .. RATE_GRID_MAX_ACCELERATION [m/s2]
+#define RATE_GRID_MAX_SPEED        50.0
+#define RATE_GRID_MAX_ACCELERATION 5.0
+
+//default cell size [m/s], [m/s2]
+#define DEFAULT_RATE_GRID_SPEED_STEP        0.25
+#define DEFAULT_RATE_GRID_ACCELERATION_STEP 0.02
+
+//largest number of cells of a grid
+#define RATE_GRID_MAX_CELLS (1 << 24)
+
+//row of a cell that needs the exact calculation
+#define RATE_GRID_EXACT (-1)
+
+class RateGrid
+{
+public:
+	RateGrid(const VSPCoefficients &coefficients, double speedStep, double accelerationStep);
+
+	//true if cells of <speedStep> [m/s] by <accelerationStep> [m/s2] make a grid
+	//of at most RATE_GRID_MAX_CELLS
+	static bool validResolution(double speedStep, double accelerationStep);
+
+	//rate table row of a vehicle not braking at <speed> [m/s] and <acceleration>
+	//[m/s2], RATE_GRID_EXACT outside the grid or in a cell across a threshold
+	int row(double speed, double acceleration) const
+	{
+		double x = speed * inverseSpeedStep;
+		double y = (acceleration + RATE_GRID_MAX_ACCELERATION) * inverseAccelerationStep;
+		if (!(x >= 0.0 && x < speedCells && y >= 0.0 && y < accelerationCells))
+		{
+			return RATE_GRID_EXACT;
+		}
+		return cells[(std::size_t)x * accelerationCells + (std::size_t)y];
+	}
+
+	//share of the cells left to the exact calculation
+	double exactShare() const;
+
+private:
+	int cellRow(const VSPCoefficients &coefficients, std::size_t speedCell, std::size_t accelerationCell) const;
+
+	double                   speedStep;
+	double                   accelerationStep;
+	double                   inverseSpeedStep;
+	double                   inverseAccelerationStep;
+	std::size_t              speedCells;
+	std::size_t              accelerationCells;
+	std::vector<signed char> cells;		//speed cell major
+};
+
+//grids of every source type of a registry at one resolution, immutable once
+//built and shared by any number of engines
+class RateGrids
+{
+public:
+	//grids of the source types of <sourceTypes> with cells of <speedStep> [m/s]
+	//by <accelerationStep> [m/s2], a valid resolution
+	RateGrids(const SourceTypeRegistry &sourceTypes, double speedStep, double accelerationStep);
+
+	//grid of a source type of the registry, or nullptr
+	const RateGrid *find(const SourceTypeModel *sourceType) const
+	{
+		std::unordered_map<const SourceTypeModel *, std::size_t>::const_iterator it = index.find(sourceType);
+		return it == index.end() ? nullptr : grids[it->second].get();
+	}
+
+	std::size_t size() const { return grids.size(); }
+
+	//share of the cells of all grids left to the exact calculation
+	double exactShare() const;
+
+private:
+	RateGrids(const RateGrids &);
+	RateGrids &operator=(const RateGrids &);
+
+	std::vector<std::unique_ptr<RateGrid>>                 grids;
+	std::unordered_map<const SourceTypeModel *, std::size_t> index;
+};
+
+#endif /* __RATEGRID_H */
@@ -0,0 +1,343 @@
+/*========================================================================= */
+/* ScenarioSweep.cpp                                 Core module of MOVESTAR */
+/*																			*/
+/* Scenario files, vehicle plans and the fan-out of a block of rows.		*/
+/*========================================================================= */
+
+#include "ScenarioSweep.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+
+//columns of a scenario file
+#define SCENARIO_COLUMNS 5
+
+static string trimmed(const string &text)
+{
+	size_t first = text.find_first_not_of(" \t\r");
+	if (first == string::npos)
+	{
+		return string();
+	}
+	return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool readScenarios(const string &path, const string &defaultDirectory, SweepScenarios &scenarios, string &error)
+{
+	ifstream file(path.c_str());
+	if (!file)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+	string line;
+	getline(file, line);
+	static const char *names[SCENARIO_COLUMNS] = { "Scenario", "DataDirectory", "FromType", "ToType", "Share" };
+	istringstream header(line);
+	string column;
+	for (int c = 0; c < SCENARIO_COLUMNS; c++)
+	{
+		if (!getline(header, column, ',') || trimmed(column) != names[c])
+		{
+			error = path + ": expected the columns Scenario,DataDirectory,FromType,ToType,Share";
+			return false;
+		}
+	}
+
+	scenarios.clear();
+	int lineNumber = 1;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		if (trimmed(line).empty())
+		{
+			continue;
+		}
+		vector<string> fields;
+		istringstream row(line);
+		while (getline(row, column, ','))
+		{
+			fields.push_back(trimmed(column));
+		}
+		fields.resize(max(fields.size(), (size_t)SCENARIO_COLUMNS));
+		string where = path + " line " + to_string(lineNumber);
+		if (fields.size() != SCENARIO_COLUMNS || fields[0].empty())
+		{
+			error = where + ": expected a scenario name and " + to_string(SCENARIO_COLUMNS - 1) + " more columns";
+			return false;
+		}
+
+		string directory = fields[1].empty() ? defaultDirectory : fields[1];
+		if (directory == SWEEP_BUILTIN_RATES)
+		{
+			directory.clear();
+		}
+		SweepScenario *scenario = nullptr;
+		for (size_t s = 0; s < scenarios.size(); s++)
+		{
+			if (scenarios[s].name == fields[0])
+			{
+				scenario = &scenarios[s];
+			}
+		}
+		if (scenario == nullptr)
+		{
+			SweepScenario added;
+			added.name = fields[0];
+			added.dataDirectory = directory;
+			added.sourceTypes = SourceTypeRegistry::shared(directory, error);
+			if (!added.sourceTypes)
+			{
+				return false;
+			}
+			scenarios.push_back(added);
+			scenario = &scenarios.back();
+		}
+		else if (scenario->dataDirectory != directory)
+		{
+			error = where + ": scenario " + fields[0] + " has another data directory on an earlier line";
+			return false;
+		}
+
+		if (fields[2].empty() && fields[3].empty() && fields[4].empty())
+		{
+			continue;
+		}
+		TypeReassignment reassignment;
+		char *fromEnd = nullptr, *toEnd = nullptr, *shareEnd = nullptr;
+		reassignment.fromType = strtol(fields[2].c_str(), &fromEnd, 10);
+		reassignment.toType = strtol(fields[3].c_str(), &toEnd, 10);
+		reassignment.share = strtod(fields[4].c_str(), &shareEnd);
+		if (fields[2].empty() || *fromEnd != '\0' || fields[3].empty() || *toEnd != '\0' || fields[4].empty() ||
+			*shareEnd != '\0' || !(reassignment.share >= 0.0 && reassignment.share <= 1.0))
+		{
+			error = where + ": expected two vehicle types and a share from 0 to 1";
+			return false;
+		}
+		scenario->reassignments.push_back(reassignment);
+	}
+	if (scenarios.empty())
+	{
+		error = path + ": no scenario";
+		return false;
+	}
+	return true;
+}
+
+double reassignmentDraw(long vehicleNumber)
+{
+	//splitmix64 finaliser, the top 53 bits as a fraction
+	unsigned long long z = (unsigned long long)vehicleNumber + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return (double)(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+long scenarioVehicleType(const SweepScenario &scenario, long vehicleNumber, long vehicleType)
+{
+	for (size_t r = 0; r < scenario.reassignments.size(); r++)
+	{
+		const TypeReassignment &reassignment = scenario.reassignments[r];
+		if (reassignment.fromType == vehicleType)
+		{
+			return reassignmentDraw(vehicleNumber) < reassignment.share ? reassignment.toType : vehicleType;
+		}
+	}
+	return vehicleType;
+}
+
+static bool byScenarioAndType(const ScenarioTypeTotals &a, const ScenarioTypeTotals &b)
+{
+	return a.scenario != b.scenario ? a.scenario < b.scenario : a.vehicleType < b.vehicleType;
+}
+
+void mergeScenarioTotals(const vector<ScenarioTypeTotals> &from, vector<ScenarioTypeTotals> &to)
+{
+	for (size_t i = 0; i < from.size(); i++)
+	{
+		vector<ScenarioTypeTotals>::iterator it = lower_bound(to.begin(), to.end(), from[i], byScenarioAndType);
+		if (it == to.end() || it->scenario != from[i].scenario || it->vehicleType != from[i].vehicleType)
+		{
+			to.insert(it, from[i]);
+			continue;
+		}
+		it->vehicles += from[i].vehicles;
+		it->rows += from[i].rows;
+		it->travelTime += from[i].travelTime;
+		it->travelDistance += from[i].travelDistance;
+		for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+		{
+			it->totals.values[k] += from[i].totals.values[k];
+		}
+	}
+}
+
+ScenarioSweep::ScenarioSweep(const shared_ptr<const SweepScenarios> &scenarios, double timeStep)
+	: scenarios(scenarios), timeStep(timeStep), rows(0), binned(0)
+{
+}
+
+size_t ScenarioSweep::binOf(size_t scenario, long vehicleType, const SourceTypeModel *sourceType)
+{
+	pair<size_t, long> key(scenario, vehicleType);
+	map<pair<size_t, long>, size_t>::const_iterator it = binIndex.find(key);
+	if (it != binIndex.end())
+	{
+		return it->second;
+	}
+	ScenarioTypeTotals bin = {};
+	bin.scenario = scenario;
+	bin.vehicleType = vehicleType;
+	bin.sourceTypeId = sourceType != nullptr ? sourceType->sourceTypeId : 0;
+	bins.push_back(bin);
+	binIndex[key] = bins.size() - 1;
+	return bins.size() - 1;
+}
+
+int ScenarioSweep::planOf(int track, long vehicleNumber, long vehicleType)
+{
+	if ((size_t)track < trackPlans.size() && trackPlans[track] >= 0)
+	{
+		return trackPlans[track];
+	}
+	if ((size_t)track >= trackPlans.size())
+	{
+		trackPlans.resize(max((size_t)track + 1, trackPlans.size() * 2), -1);
+	}
+
+	//vehicles of the same type in every scenario share a plan
+	const SweepScenarios &all = *scenarios;
+	vector<long> types(all.size());
+	for (size_t s = 0; s < all.size(); s++)
+	{
+		types[s] = scenarioVehicleType(all[s], vehicleNumber, vehicleType);
+	}
+	map<vector<long>, int>::const_iterator it = planIndex.find(types);
+	int plan;
+	if (it != planIndex.end())
+	{
+		plan = it->second;
+	}
+	else
+	{
+		SweepPlan added = { planClasses.size(), 0, planScenarios.size() };
+		for (size_t s = 0; s < all.size(); s++)
+		{
+			const SourceTypeModel *sourceType = all[s].sourceTypes->find(types[s]);
+			PlanScenario entry = { -1, nullptr, binOf(s, types[s], sourceType) };
+			if (sourceType != nullptr)
+			{
+				//scenarios with equal coefficients share the opmode of a row
+				size_t c = 0;
+				while (c < added.classCount && memcmp(planClasses[added.firstClass + c], &sourceType->coefficients,
+					sizeof(VSPCoefficients)) != 0)
+				{
+					c++;
+				}
+				if (c == added.classCount)
+				{
+					planClasses.push_back(&sourceType->coefficients);
+					added.classCount++;
+				}
+				entry.coefficientClass = (int)c;
+				entry.rates = sourceType->rates;
+			}
+			planScenarios.push_back(entry);
+		}
+		plan = (int)plans.size();
+		plans.push_back(added);
+		planIndex[types] = plan;
+	}
+
+	//the vehicle counts once in every scenario
+	for (size_t s = 0; s < all.size(); s++)
+	{
+		bins[planScenarios[plans[plan].firstScenario + s].bin].vehicles++;
+	}
+	trackPlans[track] = plan;
+	return plan;
+}
+
+void ScenarioSweep::add(size_t count, const int *tracks, const long *vehicleNumbers, const long *vehicleTypes,
+	const double *speeds, const double *accelerations, const double *slopes, const unsigned char *braking)
+{
+	if (rowPlans.size() < count)
+	{
+		rowPlans.resize(count);
+		rowFirstKernel.resize(count);
+	}
+
+	//one kernel input per row and distinct coefficients of its vehicle
+	size_t kernelCount = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		int plan = planOf(tracks[i], vehicleNumbers[i], vehicleTypes[i]);
+		const SweepPlan &rowPlan = plans[plan];
+		rowPlans[i] = plan;
+		rowFirstKernel[i] = kernelCount;
+		if (kernelCoefficients.size() < kernelCount + rowPlan.classCount)
+		{
+			size_t size = max(kernelCount + rowPlan.classCount, kernelCoefficients.size() * 2);
+			kernelCoefficients.resize(size);
+			kernelVelocities.resize(size);
+			kernelAccelerations.resize(size);
+			kernelBraking.resize(size);
+			kernelVSP.resize(size);
+			kernelOpmodes.resize(size);
+		}
+		for (size_t c = 0; c < rowPlan.classCount; c++)
+		{
+			kernelCoefficients[kernelCount] = planClasses[rowPlan.firstClass + c];
+			kernelVelocities[kernelCount] = speeds[i] * 3.6;				//FIXME: Change back to m/s
+			kernelAccelerations[kernelCount] = (slopes != nullptr) ? gradeAcceleration(accelerations[i], slopes[i]) : accelerations[i];
+			kernelBraking[kernelCount] = braking[i];
+			kernelCount++;
+		}
+	}
+	calculateVSPBatch(kernelCount, kernelCoefficients.data(), kernelVelocities.data(), kernelAccelerations.data(), kernelVSP.data());
+	binOpmodeBatch(kernelCount, kernelVelocities.data(), kernelVSP.data(), kernelBraking.data(), kernelOpmodes.data());
+
+	//the rates of every scenario for the opmode of its coefficients
+	size_t scenarioCount = scenarios->size();
+	for (size_t i = 0; i < count; i++)
+	{
+		const PlanScenario *entries = &planScenarios[plans[rowPlans[i]].firstScenario];
+		double distance = speeds[i] * timeStep;
+		for (size_t s = 0; s < scenarioCount; s++)
+		{
+			const PlanScenario &entry = entries[s];
+			ScenarioTypeTotals &bin = bins[entry.bin];
+			bin.rows++;
+			bin.travelTime += timeStep;
+			bin.travelDistance += distance;
+			if (entry.coefficientClass < 0)
+			{
+				continue;
+			}
+			int row = rateRowOfOpmode(kernelOpmodes[rowFirstKernel[i] + entry.coefficientClass]);
+			if (row < 0)
+			{
+				continue;
+			}
+			const double *rates = entry.rates->rates[row];
+			for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+			{
+				bin.totals.values[k] += rates[k] * timeStep;
+			}
+		}
+	}
+	rows += count;
+	binned += kernelCount;
+}
+
+vector<ScenarioTypeTotals> ScenarioSweep::totals() const
+{
+	vector<ScenarioTypeTotals> sorted(bins);
+	sort(sorted.begin(), sorted.end(), byScenarioAndType);
+	return sorted;
+}
@@ -0,0 +1,147 @@
+/*========================================================================= */
+/* ScenarioSweep.h                                   Core module of MOVESTAR */
+/*																			*/
+/* Several scenarios of one trajectory set in a single pass: each scenario	*/
+/* has its own source types (rate tables and VSP coefficients) and may		*/
+/* reassign a share of the vehicles of a type to another type (penetration	*/
+/* rates). The kinematics and braking history of a row are taken once; the	*/
+/* row is binned once per distinct set of VSP coefficients its vehicle has	*/
+/* across the scenarios, and the rates of every scenario are looked up for	*/
+/* the opmode of its coefficients. Totals are kept per scenario and type.	*/
+/*========================================================================= */
+
+#ifndef __SCENARIOSWEEP_H
+#define __SCENARIOSWEEP_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "EmissionAccumulator.h"
+#include "MovestarKernels.h"
+#include "SourceTypeRegistry.h"
+
+//data directory of a scenario naming the built-in source types
+#define SWEEP_BUILTIN_RATES "builtin"
+
+//a share of the vehicles of one type calculated as another type
+struct TypeReassignment
+{
+	long   fromType;
+	long   toType;
+	double share;		//0..1
+};
+
+struct SweepScenario
+{
+	std::string                               name;
+	std::string                               dataDirectory;		//empty for the built-in source types
+	std::vector<TypeReassignment>             reassignments;
+	std::shared_ptr<const SourceTypeRegistry> sourceTypes;
+};
+
+typedef std::vector<SweepScenario> SweepScenarios;
+
+//reads the scenarios of <path>, a CSV file with the columns Scenario,
+//DataDirectory, FromType, ToType and Share: one row per reassignment, rows of
+//one scenario share its name; FromType, ToType and Share are empty for a
+//scenario without reassignment. An empty DataDirectory stands for
+//<defaultDirectory>, "builtin" for the built-in source types. Registries of
+//one directory are loaded once. False with a message in <error>
+bool readScenarios(const std::string &path, const std::string &defaultDirectory, SweepScenarios &scenarios, std::string &error);
+
+//position of a vehicle in [0, 1) among the vehicles of its type: a share s
+//reassigns the vehicles below s, so the vehicles reassigned at a share are
+//also reassigned at every larger one
+double reassignmentDraw(long vehicleNumber);
+
+//type vehicle <vehicleNumber> of <vehicleType> is calculated as in <scenario>
+long scenarioVehicleType(const SweepScenario &scenario, long vehicleNumber, long vehicleType);
+
+//totals of the vehicles of one type (after reassignment) in one scenario
+struct ScenarioTypeTotals
+{
+	std::size_t    scenario;			//index in the scenarios
+	long           vehicleType;
+	int            sourceTypeId;		//0 if the scenario has no source type for the type
+	std::size_t    vehicles;
+	std::size_t    rows;
+	double         travelTime;			//[s]
+	double         travelDistance;		//[m]
+	EmissionTotals totals;
+};
+
+//adds <from> to <to>, entries of one scenario and type are summed in the order
+//given; <to> stays sorted by scenario and type
+void mergeScenarioTotals(const std::vector<ScenarioTypeTotals> &from, std::vector<ScenarioTypeTotals> &to);
+
+class ScenarioSweep
+{
+public:
+	//<timeStep> is the time one row stands for [s]
+	ScenarioSweep(const std::shared_ptr<const SweepScenarios> &scenarios, double timeStep);
+
+	//adds <count> rows: track (a dense index of the vehicle, see
+	//TrajectoryProcessor), vehicle number and type, speed [m/s], acceleration
+	//[m/s2], slope (rise over run, null for level roads) and braking flag from
+	//the history of the vehicle
+	void add(std::size_t count, const int *tracks, const long *vehicleNumbers, const long *vehicleTypes,
+		const double *speeds, const double *accelerations, const double *slopes, const unsigned char *braking);
+
+	//totals by scenario and type, sorted
+	std::vector<ScenarioTypeTotals> totals() const;
+
+	//rows added, and VSP and opmode evaluations they took
+	std::size_t rowCount() const { return rows; }
+	std::size_t binnedCount() const { return binned; }
+
+private:
+	ScenarioSweep(const ScenarioSweep &);
+	ScenarioSweep &operator=(const ScenarioSweep &);
+
+	//what a vehicle needs in every scenario, shared by the vehicles of one plan
+	struct PlanScenario
+	{
+		int                      coefficientClass;	//index in the classes of the plan, -1 without a source type
+		const EmissionRateTable *rates;
+		std::size_t              bin;
+	};
+	struct SweepPlan
+	{
+		std::size_t firstClass;		//distinct coefficients in planClasses
+		std::size_t classCount;
+		std::size_t firstScenario;	//one entry per scenario in planScenarios
+	};
+
+	int planOf(int track, long vehicleNumber, long vehicleType);
+	std::size_t binOf(std::size_t scenario, long vehicleType, const SourceTypeModel *sourceType);
+
+	std::shared_ptr<const SweepScenarios>    scenarios;
+	double                                   timeStep;
+
+	std::vector<SweepPlan>                   plans;
+	std::vector<const VSPCoefficients *>     planClasses;
+	std::vector<PlanScenario>                planScenarios;
+	std::map<std::vector<long>, int>         planIndex;		//by the type of the vehicle in each scenario
+	std::vector<int>                         trackPlans;	//by track, -1 before its first row
+
+	std::vector<ScenarioTypeTotals>          bins;
+	std::map<std::pair<std::size_t, long>, std::size_t> binIndex;
+
+	//kernel inputs and outputs of a block, one entry per row and class of its plan
+	std::vector<int>                         rowPlans;
+	std::vector<std::size_t>                 rowFirstKernel;
+	std::vector<const VSPCoefficients *>     kernelCoefficients;
+	std::vector<double>                      kernelVelocities;
+	std::vector<double>                      kernelAccelerations;
+	std::vector<unsigned char>               kernelBraking;
+	std::vector<double>                      kernelVSP;
+	std::vector<int>                         kernelOpmodes;
+
+	std::size_t                              rows;
+	std::size_t                              binned;
+};
+
+#endif /* __SCENARIOSWEEP_H */
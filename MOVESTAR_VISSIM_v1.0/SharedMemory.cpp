@@ -0,0 +1,208 @@
+/*========================================================================= */
+/* SharedMemory.cpp                                  Core module of MOVESTAR */
+/*																			*/
+/* Named shared memory segment of several processes (Windows and POSIX).	*/
+/*========================================================================= */
+
+#include "SharedMemory.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+
+SharedMemory::SharedMemory()
+	: data_(nullptr), size_(0)
+#ifdef _WIN32
+	, mapping_(nullptr)
+#endif
+{
+}
+
+SharedMemory::~SharedMemory()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+//segments live in the session namespace, as the processes of one user do
+static string systemName(const string &name)
+{
+	return "Local\\movestar-" + name;
+}
+
+bool SharedMemory::create(const string &name, size_t size, string &error)
+{
+	close();
+	mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32),
+		(DWORD)(size & 0xffffffffu), systemName(name).c_str());
+	if (mapping_ == nullptr || GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		close();
+		error = "cannot create shared memory " + name + " (in use by another server?)";
+		return false;
+	}
+	data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (data_ == nullptr)
+	{
+		close();
+		error = "cannot map shared memory " + name;
+		return false;
+	}
+	size_ = size;
+	name_ = systemName(name);
+	return true;
+}
+
+bool SharedMemory::open(const string &name, string &error)
+{
+	close();
+	mapping_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, systemName(name).c_str());
+	if (mapping_ == nullptr)
+	{
+		error = "no server on shared memory " + name;
+		return false;
+	}
+	data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if (data_ == nullptr || VirtualQuery(data_, &info, sizeof(info)) == 0)
+	{
+		close();
+		error = "cannot map shared memory " + name;
+		return false;
+	}
+	size_ = info.RegionSize;
+	return true;
+}
+
+void SharedMemory::close()
+{
+	if (data_ != nullptr)
+	{
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_ != nullptr)
+	{
+		CloseHandle(mapping_);
+	}
+	data_ = nullptr;
+	size_ = 0;
+	mapping_ = nullptr;
+	name_.clear();
+}
+
+bool processAlive(unsigned long id)
+{
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, id);
+	if (process == nullptr)
+	{
+		return GetLastError() == ERROR_ACCESS_DENIED;
+	}
+	bool running = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+	CloseHandle(process);
+	return running;
+}
+
+unsigned long currentProcessId()
+{
+	return GetCurrentProcessId();
+}
+
+#else
+
+static string systemName(const string &name)
+{
+	return "/movestar-" + name;
+}
+
+bool SharedMemory::create(const string &name, size_t size, string &error)
+{
+	close();
+	string path = systemName(name);
+	shm_unlink(path.c_str());
+	int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+	{
+		error = "cannot create shared memory " + name + ": " + strerror(errno);
+		return false;
+	}
+	void *mapped = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0)
+	{
+		mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		shm_unlink(path.c_str());
+		error = "cannot map shared memory " + name;
+		return false;
+	}
+	data_ = mapped;
+	size_ = size;
+	name_ = path;
+	return true;
+}
+
+bool SharedMemory::open(const string &name, string &error)
+{
+	close();
+	int fd = shm_open(systemName(name).c_str(), O_RDWR, 0);
+	if (fd < 0)
+	{
+		error = "no server on shared memory " + name;
+		return false;
+	}
+	struct stat info;
+	void *mapped = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		error = "cannot map shared memory " + name;
+		return false;
+	}
+	data_ = mapped;
+	size_ = (size_t)info.st_size;
+	return true;
+}
+
+void SharedMemory::close()
+{
+	if (data_ != nullptr)
+	{
+		munmap(data_, size_);
+	}
+	if (!name_.empty())
+	{
+		shm_unlink(name_.c_str());
+	}
+	data_ = nullptr;
+	size_ = 0;
+	name_.clear();
+}
+
+bool processAlive(unsigned long id)
+{
+	return kill((pid_t)id, 0) == 0 || errno != ESRCH;
+}
+
+unsigned long currentProcessId()
+{
+	return (unsigned long)getpid();
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*========================================================================= */
+/* SharedMemory.h                                    Core module of MOVESTAR */
+/*																			*/
+/* Named shared memory segment of several processes (Windows and POSIX).	*/
+/* The creator owns the name: it is removed when the creator closes it.	*/
+/*========================================================================= */
+
+#ifndef __SHAREDMEMORY_H
+#define __SHAREDMEMORY_H
+
+#include <cstddef>
+#include <string>
+
+class SharedMemory
+{
+public:
+	SharedMemory();
+	~SharedMemory();
+
+	//creates the zeroed segment <name> of <size> bytes, replacing a segment left
+	//behind by a creator that did not close it; false with a message in <error>
+	bool create(const std::string &name, std::size_t size, std::string &error);
+
+	//maps the existing segment <name>; false with a message in <error>
+	bool open(const std::string &name, std::string &error);
+
+	void close();
+
+	bool isOpen() const { return data_ != nullptr; }
+	void *data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+private:
+	SharedMemory(const SharedMemory &);
+	SharedMemory &operator=(const SharedMemory &);
+
+	void        *data_;
+	std::size_t  size_;
+	std::string  name_;		//system name, set if this object created the segment
+#ifdef _WIN32
+	void        *mapping_;
+#endif
+};
+
+//process <id> still running (or not known to have ended)
+bool processAlive(unsigned long id);
+
+//id of the calling process
+unsigned long currentProcessId();
+
+#endif /* __SHAREDMEMORY_H */
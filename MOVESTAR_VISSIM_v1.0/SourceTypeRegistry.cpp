@@ -0,0 +1,438 @@
+/*========================================================================= */
+/* SourceTypeRegistry.cpp                VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Loading of source types from CSV files and the binary rate cache.		*/
+/*========================================================================= */
+
+#include "SourceTypeRegistry.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+using namespace std;
+
+
+//binary cache layout: a header followed by one record per coefficient row
+#define RATE_CACHE_MAGIC   "MVSTRATE"
+#define RATE_CACHE_VERSION 1
+
+struct RateCacheHeader
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t recordCount;
+	uint64_t sourceStamp;	//hash of the size and time stamp of every source CSV file
+	uint64_t checksum;		//FNV-1a hash of the records
+};
+
+struct RateCacheRecord
+{
+	int64_t           vehicleType;
+	int32_t           sourceTypeId;
+	int32_t           hasRates;		//0 if the type has no EmsRate table
+	VSPCoefficients   coefficients;
+	EmissionRateTable rates;
+};
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static string joinPath(const string &directory, const string &name)
+{
+	if (directory.empty())
+	{
+		return name;
+	}
+	char last = directory[directory.size() - 1];
+	return (last == '/' || last == '\\') ? directory + name : directory + "/" + name;
+}
+
+static string rateFileName(long vehicleType)
+{
+	return "EmsRate_" + to_string(vehicleType) + ".csv";
+}
+
+//hash of the size and modification time of the coefficient file and the rate
+//file of every listed type (a missing rate file hashes differently from any file)
+static uint64_t sourceStamp(const string &directory, const vector<long> &vehicleTypes)
+{
+	unsigned long long size = 0;
+	long long modified = 0;
+	uint64_t hash = fnv1a(nullptr, 0);
+	if (statFile(joinPath(directory, "VehicleSrcCoeff.csv"), size, modified))
+	{
+		hash = fnv1a(&size, sizeof(size), hash);
+		hash = fnv1a(&modified, sizeof(modified), hash);
+	}
+	for (size_t i = 0; i < vehicleTypes.size(); i++)
+	{
+		size = 0;
+		modified = -1;
+		statFile(joinPath(directory, rateFileName(vehicleTypes[i])), size, modified);
+		hash = fnv1a(&vehicleTypes[i], sizeof(vehicleTypes[i]), hash);
+		hash = fnv1a(&size, sizeof(size), hash);
+		hash = fnv1a(&modified, sizeof(modified), hash);
+	}
+	return hash;
+}
+
+static vector<string> splitCsvLine(const string &line)
+{
+	vector<string> fields;
+	string field;
+	istringstream stream(line);
+	while (getline(stream, field, ','))
+	{
+		size_t begin = field.find_first_not_of(" \t\r\"");
+		size_t end = field.find_last_not_of(" \t\r\"");
+		fields.push_back(begin == string::npos ? string() : field.substr(begin, end - begin + 1));
+	}
+	return fields;
+}
+
+static bool parseNumber(const string &text, double &value)
+{
+	char *end = nullptr;
+	value = strtod(text.c_str(), &end);
+	return !text.empty() && end == text.c_str() + text.size();
+}
+
+//reads VehicleSrcCoeff.csv into records without rates
+static bool readCoefficients(const string &directory, vector<RateCacheRecord> &records, string &error)
+{
+	string path = joinPath(directory, "VehicleSrcCoeff.csv");
+	ifstream file(path.c_str());
+	if (!file)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	//columns are found by name, as in the Python tool
+	static const char *columnNames[7] = { "VehicleType", "Source TypeID", "A", "B", "C", "M", "f" };
+	int columns[7];
+	string line;
+	getline(file, line);
+	vector<string> header = splitCsvLine(line);
+	for (int c = 0; c < 7; c++)
+	{
+		columns[c] = -1;
+		for (size_t h = 0; h < header.size(); h++)
+		{
+			if (header[h] == columnNames[c])
+			{
+				columns[c] = (int)h;
+			}
+		}
+		if (columns[c] < 0)
+		{
+			error = path + ": missing column \"" + columnNames[c] + "\"";
+			return false;
+		}
+	}
+
+	int lineNumber = 1;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		if (line.find_first_not_of(" \t\r") == string::npos)
+		{
+			continue;
+		}
+		vector<string> fields = splitCsvLine(line);
+		double values[7];
+		for (int c = 0; c < 7; c++)
+		{
+			if (columns[c] >= (int)fields.size() || !parseNumber(fields[columns[c]], values[c]))
+			{
+				error = path + " line " + to_string(lineNumber) + ": bad or missing value for \"" + columnNames[c] + "\"";
+				return false;
+			}
+		}
+		if (values[6] == 0)
+		{
+			error = path + " line " + to_string(lineNumber) + ": fixed mass factor f is zero";
+			return false;
+		}
+
+		RateCacheRecord record;
+		memset(&record, 0, sizeof(record));
+		record.vehicleType = (int64_t)values[0];
+		record.sourceTypeId = (int32_t)values[1];
+		record.coefficients.A = values[2];
+		record.coefficients.B = values[3];
+		record.coefficients.C = values[4];
+		record.coefficients.M = values[5];
+		record.coefficients.F = values[6];
+		for (size_t r = 0; r < records.size(); r++)
+		{
+			if (records[r].vehicleType == record.vehicleType)
+			{
+				error = path + " line " + to_string(lineNumber) + ": duplicate VehicleType " + to_string(record.vehicleType);
+				return false;
+			}
+		}
+		records.push_back(record);
+	}
+	return true;
+}
+
+//reads EmsRate_<VehicleType>.csv (opmode, CO, HC, NOx, PM2.5 elemental, PM2.5 organic,
+//energy, CO2, all per hour) into the rate table of <record>, if the file exists
+static bool readRates(const string &directory, RateCacheRecord &record, string &error)
+{
+	string path = joinPath(directory, rateFileName((long)record.vehicleType));
+	ifstream file(path.c_str());
+	if (!file)
+	{
+		return true;
+	}
+
+	bool seen[OPMODE_ROW_COUNT] = { false };
+	int lineNumber = 0;
+	string line;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		if (line.find_first_not_of(" \t\r") == string::npos)
+		{
+			continue;
+		}
+		vector<string> fields = splitCsvLine(line);
+		double values[8];
+		bool valid = fields.size() >= 8;
+		for (int c = 0; valid && c < 8; c++)
+		{
+			valid = parseNumber(fields[c], values[c]);
+		}
+		if (!valid)
+		{
+			error = path + " line " + to_string(lineNumber) + ": expected 8 numeric columns";
+			return false;
+		}
+		int row = rateRowOfOpmode((int)values[0]);
+		if (row < 0 || values[0] != (int)values[0] || seen[row])
+		{
+			error = path + " line " + to_string(lineNumber) + ": invalid or duplicate opmode " + fields[0];
+			return false;
+		}
+		seen[row] = true;
+
+		//reorder to HC, CO, NOx, CO2, Energy, PM2.5 and scale to per second
+		double *rates = record.rates.rates[row];
+		rates[0] = values[2] / 3600;
+		rates[1] = values[1] / 3600;
+		rates[2] = values[3] / 3600;
+		rates[3] = values[7] / 3600;
+		rates[4] = values[6] / 3600;
+		rates[5] = (values[4] + values[5]) / 3600;
+	}
+	for (int row = 0; row < OPMODE_ROW_COUNT; row++)
+	{
+		if (!seen[row])
+		{
+			error = path + ": no rates for opmode " + to_string(opmodeOfRow[row]);
+			return false;
+		}
+	}
+	record.hasRates = 1;
+	return true;
+}
+
+static bool writeCache(const string &path, const vector<RateCacheRecord> &records, uint64_t stamp)
+{
+	RateCacheHeader header;
+	memcpy(header.magic, RATE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = RATE_CACHE_VERSION;
+	header.recordCount = (uint32_t)records.size();
+	header.sourceStamp = stamp;
+	header.checksum = fnv1a(records.data(), records.size() * sizeof(RateCacheRecord));
+
+	//write next to the target and rename, so a concurrent reader never sees half a file
+	string temporary = path + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		(records.empty() || fwrite(records.data(), sizeof(RateCacheRecord), records.size(), file) == records.size());
+	written = (fclose(file) == 0) && written;
+	if (written)
+	{
+		remove(path.c_str());
+		written = rename(temporary.c_str(), path.c_str()) == 0;
+	}
+	if (!written)
+	{
+		remove(temporary.c_str());
+	}
+	return written;
+}
+
+
+SourceTypeRegistry::SourceTypeRegistry()
+	: cacheHit(false)
+{
+	registerBuiltins();
+}
+
+void SourceTypeRegistry::registerBuiltins()
+{
+	static const long builtinTypes[3] = { 100, 200, 300 };
+	for (int i = 0; i < 3; i++)
+	{
+		models[builtinTypes[i]] = findBuiltinSourceType(builtinTypes[i]);
+	}
+}
+
+void SourceTypeRegistry::reset()
+{
+	models.clear();
+	loadedModels.clear();
+	uncachedRates.clear();
+	cache.close();
+	cacheHit = false;
+	registerBuiltins();
+}
+
+vector<const SourceTypeModel *> SourceTypeRegistry::list() const
+{
+	vector<long> vehicleTypes;
+	vehicleTypes.reserve(models.size());
+	for (unordered_map<long, const SourceTypeModel *>::const_iterator it = models.begin(); it != models.end(); ++it)
+	{
+		vehicleTypes.push_back(it->first);
+	}
+	sort(vehicleTypes.begin(), vehicleTypes.end());
+	vector<const SourceTypeModel *> list;
+	list.reserve(vehicleTypes.size());
+	for (size_t i = 0; i < vehicleTypes.size(); i++)
+	{
+		list.push_back(models.find(vehicleTypes[i])->second);
+	}
+	return list;
+}
+
+//maps the cache at <path> and registers its types if it is intact and newer than the CSV files
+bool SourceTypeRegistry::mapCache(const string &path, const string &directory)
+{
+	if (!cache.open(path))
+	{
+		return false;
+	}
+	const RateCacheHeader *header = (const RateCacheHeader *)cache.data();
+	const RateCacheRecord *records = (const RateCacheRecord *)(cache.data() + sizeof(RateCacheHeader));
+	bool valid = cache.size() >= sizeof(RateCacheHeader) &&
+		memcmp(header->magic, RATE_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == RATE_CACHE_VERSION &&
+		cache.size() == sizeof(RateCacheHeader) + (size_t)header->recordCount * sizeof(RateCacheRecord) &&
+		header->checksum == fnv1a(records, (size_t)header->recordCount * sizeof(RateCacheRecord));
+	if (valid)
+	{
+		vector<long> vehicleTypes;
+		for (uint32_t r = 0; r < header->recordCount; r++)
+		{
+			vehicleTypes.push_back((long)records[r].vehicleType);
+		}
+		valid = header->sourceStamp == sourceStamp(directory, vehicleTypes);
+	}
+	if (!valid)
+	{
+		cache.close();
+		return false;
+	}
+
+	for (uint32_t r = 0; r < header->recordCount; r++)
+	{
+		if (records[r].hasRates)
+		{
+			SourceTypeModel model = { (long)records[r].vehicleType, records[r].sourceTypeId, records[r].coefficients, &records[r].rates };
+			loadedModels.push_back(model);
+		}
+	}
+	return true;
+}
+
+bool SourceTypeRegistry::load(const string &directory, string &error)
+{
+	reset();
+	string cachePath = joinPath(directory, RATE_CACHE_FILE_NAME);
+
+	cacheHit = mapCache(cachePath, directory);
+	if (!cacheHit)
+	{
+		//compile the CSV files
+		vector<RateCacheRecord> records;
+		if (!readCoefficients(directory, records, error))
+		{
+			return false;
+		}
+		vector<long> vehicleTypes;
+		for (size_t r = 0; r < records.size(); r++)
+		{
+			if (!readRates(directory, records[r], error))
+			{
+				return false;
+			}
+			vehicleTypes.push_back((long)records[r].vehicleType);
+		}
+
+		//serve the tables from the fresh cache, or from memory if it cannot be written
+		if (!writeCache(cachePath, records, sourceStamp(directory, vehicleTypes)) || !mapCache(cachePath, directory))
+		{
+			cerr << "MOVESTAR: cannot write rate cache " << cachePath << ", using uncached tables" << endl;
+			uncachedRates.reserve(records.size());
+			for (size_t r = 0; r < records.size(); r++)
+			{
+				if (records[r].hasRates)
+				{
+					uncachedRates.push_back(records[r].rates);
+					SourceTypeModel model = { (long)records[r].vehicleType, records[r].sourceTypeId, records[r].coefficients, &uncachedRates.back() };
+					loadedModels.push_back(model);
+				}
+			}
+		}
+	}
+
+	for (size_t m = 0; m < loadedModels.size(); m++)
+	{
+		models[loadedModels[m].vehicleType] = &loadedModels[m];
+	}
+	return true;
+}
+
+shared_ptr<const SourceTypeRegistry> SourceTypeRegistry::shared(const string &directory, string &error)
+{
+	//registries alive in the process by directory, loaded under the lock so the
+	//binary cache is written once
+	static mutex registriesLock;
+	static unordered_map<string, weak_ptr<const SourceTypeRegistry> > registries;
+
+	lock_guard<mutex> guard(registriesLock);
+	shared_ptr<const SourceTypeRegistry> registry = registries[directory].lock();
+	if (registry)
+	{
+		return registry;
+	}
+	shared_ptr<SourceTypeRegistry> loaded(new SourceTypeRegistry);
+	if (!directory.empty() && !loaded->load(directory, error))
+	{
+		return shared_ptr<const SourceTypeRegistry>();
+	}
+	registries[directory] = loaded;
+	return loaded;
+}
@@ -0,0 +1,75 @@
+/*========================================================================= */
+/* SourceTypeRegistry.h                  VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Source types known to the model: the built-in ones plus any number		*/
+/* loaded at EMISSION_COMMAND_INIT from the CSV files of the Python tool	*/
+/* (VehicleSrcCoeff.csv and EmsRate_<VehicleType>.csv). The CSV files are	*/
+/* compiled into a versioned, checksummed binary cache on first load; later	*/
+/* runs memory-map the cache instead of parsing text. Registries are		*/
+/* immutable once loaded and can be shared by any number of engines.		*/
+/*========================================================================= */
+
+#ifndef __SOURCETYPEREGISTRY_H
+#define __SOURCETYPEREGISTRY_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "MappedFile.h"
+#include "MovestarRates.h"
+
+//name of the binary cache written next to the CSV files
+#define RATE_CACHE_FILE_NAME "movestar_rates.bin"
+
+class SourceTypeRegistry
+{
+public:
+	//registry holding the built-in source types (100, 200, 300)
+	SourceTypeRegistry();
+
+	//registers every source type of <directory>/VehicleSrcCoeff.csv that has an
+	//EmsRate_<VehicleType>.csv table, on top of the built-in ones. Loaded types
+	//replace built-in types with the same number. Returns false with a message in
+	//<error> if a file is malformed; the registry then keeps the built-in types only
+	bool load(const std::string &directory, std::string &error);
+
+	//back to the built-in source types only
+	void reset();
+
+	//read-only registry of <directory> (built-in types only if empty), loaded on
+	//first use and shared by every caller until the last reference is dropped;
+	//nullptr with a message in <error> if the files are malformed. Thread-safe
+	static std::shared_ptr<const SourceTypeRegistry> shared(const std::string &directory, std::string &error);
+
+	//model of a vehicle type, or nullptr if the type is unknown
+	const SourceTypeModel *find(long vehicleType) const
+	{
+		std::unordered_map<long, const SourceTypeModel *>::const_iterator it = models.find(vehicleType);
+		return it == models.end() ? nullptr : it->second;
+	}
+
+	std::size_t size() const { return models.size(); }
+
+	//models of every vehicle type, by vehicle type
+	std::vector<const SourceTypeModel *> list() const;
+
+	//true if the last load was served from the binary cache without parsing CSV
+	bool loadedFromCache() const { return cacheHit; }
+
+private:
+	SourceTypeRegistry(const SourceTypeRegistry &);
+	SourceTypeRegistry &operator=(const SourceTypeRegistry &);
+
+	bool mapCache(const std::string &path, const std::string &directory);
+	void registerBuiltins();
+
+	std::unordered_map<long, const SourceTypeModel *> models;
+	std::vector<SourceTypeModel>                      loadedModels;
+	std::vector<EmissionRateTable>                    uncachedRates;	//used when the cache cannot be written
+	MappedFile                                        cache;
+	bool                                              cacheHit;
+};
+
+#endif /* __SOURCETYPEREGISTRY_H */
@@ -0,0 +1,91 @@
+/*========================================================================= */
+/* SpscRing.h                                        Core module of MOVESTAR */
+/*																			*/
+/* Bounded lock-free ring buffer of one producer and one consumer thread.	*/
+/* Each side owns one index and only reads the other's; the indices live	*/
+/* on separate cache lines, and each side caches the other's index so the	*/
+/* shared line is only read when the ring looks full (or empty).			*/
+/*========================================================================= */
+
+#ifndef __SPSCRING_H
+#define __SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#define SPSC_CACHE_LINE 64
+
+template <typename T> class SpscRing
+{
+public:
+	//ring of at least <capacity> elements, rounded up to a power of 2
+	explicit SpscRing(std::size_t capacity)
+		: head(0), cachedTail(0), tail(0), cachedHead(0)
+	{
+		std::size_t size = 2;
+		while (size < capacity)
+		{
+			size *= 2;
+		}
+		elements.resize(size);
+		mask = size - 1;
+	}
+
+	std::size_t capacity() const { return elements.size(); }
+
+	//producer: appends <element>, false if the ring is full
+	bool push(const T &element)
+	{
+		std::size_t position = head.load(std::memory_order_relaxed);
+		if (position - cachedTail == elements.size())
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (position - cachedTail == elements.size())
+			{
+				return false;
+			}
+		}
+		elements[position & mask] = element;
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer: moves up to <count> elements to <to>, returns how many
+	std::size_t pop(T *to, std::size_t count)
+	{
+		std::size_t position = tail.load(std::memory_order_relaxed);
+		if (cachedHead - position < count)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+		}
+		std::size_t available = cachedHead - position;
+		if (count > available)
+		{
+			count = available;
+		}
+		for (std::size_t i = 0; i < count; i++)
+		{
+			to[i] = elements[(position + i) & mask];
+		}
+		tail.store(position + count, std::memory_order_release);
+		return count;
+	}
+
+private:
+	SpscRing(const SpscRing &);
+	SpscRing &operator=(const SpscRing &);
+
+	std::vector<T>                                 elements;
+	std::size_t                                    mask;
+
+	//producer side
+	alignas(SPSC_CACHE_LINE) std::atomic<std::size_t> head;
+	std::size_t                                    cachedTail;
+
+	//consumer side
+	alignas(SPSC_CACHE_LINE) std::atomic<std::size_t> tail;
+	std::size_t                                    cachedHead;
+};
+
+#endif /* __SPSCRING_H */
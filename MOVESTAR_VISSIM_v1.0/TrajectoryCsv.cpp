@@ -0,0 +1,624 @@
+/*========================================================================= */
+/* TrajectoryCsv.cpp                                 Core module of MOVESTAR */
+/*																			*/
+/* Header matching and number decoding of trajectory CSV files.				*/
+/*========================================================================= */
+
+#include "TrajectoryCsv.h"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+using namespace std;
+
+
+//digits are decoded 8 at a time from little-endian 64-bit loads
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define MOVESTAR_SWAR_DIGITS 1
+#endif
+
+//a row is decoded with 8-byte loads while at least this many bytes are left
+#define SWAR_MARGIN 24
+
+//fields are only looked for in the first columns of a row
+#define MAX_TRAJECTORY_COLUMNS 64
+
+
+//destination array of a CSV column, both null for a skipped column
+struct ColumnTarget
+{
+	long   *integers;
+	double *decimals;
+};
+
+//role of a CSV column
+enum TrajectoryField
+{
+	FIELD_SKIP,
+	FIELD_ID,
+	FIELD_TYPE,
+	FIELD_TIME,
+	FIELD_SPEED,
+	FIELD_ACCELERATION,
+	FIELD_X,
+	FIELD_Y,
+	FIELD_SLOPE
+};
+
+//powers of ten that are exact in a double, for the fast decimal path
+static const double exactPowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c)
+{
+	return (unsigned)(c - '0') < 10;
+}
+
+static inline const char *skipBlanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+	{
+		p++;
+	}
+	return p;
+}
+
+#ifdef MOVESTAR_SWAR_DIGITS
+static inline uint64_t loadWord(const char *p)
+{
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+//number of leading decimal digits of a word (0..8). A byte sets its high bit when it is
+//below '0' or above '9'; the digits before the first such byte carry or borrow nothing
+static inline int countDigits(uint64_t word)
+{
+	uint64_t nonDigits = ((word + 0x4646464646464646ULL) | (word - 0x3030303030303030ULL)) & 0x8080808080808080ULL;
+	if (nonDigits == 0)
+	{
+		return 8;
+	}
+#ifdef _MSC_VER
+	unsigned long bit;
+	_BitScanForward64(&bit, nonDigits);
+	return (int)(bit >> 3);
+#else
+	return __builtin_ctzll(nonDigits) >> 3;
+#endif
+}
+
+//value of the first <digits> (1..8) decimal digits of a word
+static inline uint32_t decodeDigits(uint64_t word, int digits)
+{
+	//shifting the digits to the top leaves zeros as leading digits
+	uint64_t value = (word - 0x3030303030303030ULL) << (8 * (8 - digits));
+	value = (value * 10) + (value >> 8);
+	value = (((value & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+		(((value >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+	return (uint32_t)value;
+}
+
+static const uint64_t powersOfTen[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+
+//fast path of parseDouble for plain decimals with at most 7 digits on either side of the
+//point; needs SWAR_MARGIN readable bytes at <p>. Returns nullptr to defer to parseDouble
+static inline const char *parseDecimalWords(const char *p, double &value)
+{
+	bool negative = (*p == '-');
+	p += negative;
+	int integerDigits = countDigits(loadWord(p));
+	if (integerDigits == 8)
+	{
+		return nullptr;
+	}
+	uint64_t mantissa = integerDigits > 0 ? decodeDigits(loadWord(p), integerDigits) : 0;
+	p += integerDigits;
+	int fractionDigits = 0;
+	if (*p == '.')
+	{
+		p++;
+		uint64_t word = loadWord(p);
+		fractionDigits = countDigits(word);
+		if (fractionDigits == 8)
+		{
+			return nullptr;
+		}
+		if (fractionDigits > 0)
+		{
+			mantissa = mantissa * powersOfTen[fractionDigits] + decodeDigits(word, fractionDigits);
+		}
+		p += fractionDigits;
+	}
+	if (integerDigits + fractionDigits == 0 || *p == 'e' || *p == 'E')
+	{
+		return nullptr;
+	}
+
+	//mantissa < 10^14, exact in a double, so one division rounds correctly
+	double result = (double)mantissa / exactPowersOfTen[fractionDigits];
+	value = negative ? -result : result;
+	return p;
+}
+#endif /* MOVESTAR_SWAR_DIGITS */
+
+//decodes a decimal number starting at <p>, returns the end of the number or nullptr.
+//Plain decimals of up to 19 digits whose mantissa fits in 53 bits are exact with a single
+//division (Clinger's fast path); exponents, long mantissas, nan and inf go through from_chars
+static const char *parseDouble(const char *p, const char *end, double &value)
+{
+#ifdef MOVESTAR_SWAR_DIGITS
+	if (end - p >= SWAR_MARGIN)
+	{
+		const char *next = parseDecimalWords(p, value);
+		if (next != nullptr)
+		{
+			return next;
+		}
+	}
+#endif
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+	const char *number = p;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	while (p < end && isDigit(*p))
+	{
+		mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+		digits++;
+		p++;
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && isDigit(*p))
+		{
+			mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+			digits++;
+			exponent--;
+			p++;
+		}
+	}
+	bool exact = digits > 0 && digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22;
+	if (exact && !(p < end && (*p == 'e' || *p == 'E')))
+	{
+		double result = (double)mantissa;
+		if (exponent < 0)
+		{
+			result /= exactPowersOfTen[-exponent];
+		}
+		value = negative ? -result : result;
+		return p;
+	}
+
+	//from_chars takes no leading '+'
+	from_chars_result parsed = from_chars(*start == '+' ? number : start, end, value);
+	if (parsed.ec != errc() && parsed.ec != errc::result_out_of_range)
+	{
+		return nullptr;
+	}
+	return parsed.ptr;
+}
+
+//decodes an integer starting at <p>, a fractional part (as in "12.0") is dropped
+static const char *parseInteger(const char *p, const char *end, long &value)
+{
+#ifdef MOVESTAR_SWAR_DIGITS
+	if (end - p >= SWAR_MARGIN && *p != '-' && *p != '+')
+	{
+		uint64_t word = loadWord(p);
+		int digits = countDigits(word);
+		if (digits > 0 && digits < 8 && p[digits] != '.')
+		{
+			value = (long)decodeDigits(word, digits);
+			return p + digits;
+		}
+	}
+#endif
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+	if (p >= end || !isDigit(*p))
+	{
+		return nullptr;
+	}
+	long result = 0;
+	while (p < end && isDigit(*p))
+	{
+		result = result * 10 + (*p - '0');
+		p++;
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && isDigit(*p))
+		{
+			p++;
+		}
+	}
+	value = negative ? -result : result;
+	return p;
+}
+
+//role of a header name, matched case-insensitively and ignoring units
+//in brackets, e.g. "VehNr", "Speed(m/s)" or "Acceleration [m/s2]"
+static TrajectoryField fieldOfHeader(const string &header)
+{
+	string name;
+	for (size_t i = 0; i < header.size(); i++)
+	{
+		char c = header[i];
+		if (c == '(' || c == '[')
+		{
+			break;
+		}
+		if (c >= 'A' && c <= 'Z')
+		{
+			name += (char)(c - 'A' + 'a');
+		}
+		else if ((c >= 'a' && c <= 'z') || isDigit(c))
+		{
+			name += c;
+		}
+	}
+	if (name.find("type") != string::npos)
+	{
+		return FIELD_TYPE;
+	}
+	if (name == "id" || name == "no" || name == "veh" || name == "vehid" || name == "vehnr" || name == "vehno" ||
+		name == "vehicle" || name == "vehicleid" || name == "vehicleno" || name == "vehiclenumber")
+	{
+		return FIELD_ID;
+	}
+	if (name == "t" || name.compare(0, 4, "time") == 0 || name == "simsec" || name == "sec")
+	{
+		return FIELD_TIME;
+	}
+	if (name == "v" || name.compare(0, 5, "speed") == 0 || name.compare(0, 3, "spd") == 0 || name.compare(0, 3, "vel") == 0)
+	{
+		return FIELD_SPEED;
+	}
+	if (name == "a" || name.compare(0, 3, "acc") == 0)
+	{
+		return FIELD_ACCELERATION;
+	}
+	if (name == "x" || name == "posx" || name == "worldx" || name == "coordx" || name == "easting")
+	{
+		return FIELD_X;
+	}
+	if (name == "y" || name == "posy" || name == "worldy" || name == "coordy" || name == "northing")
+	{
+		return FIELD_Y;
+	}
+	if (name == "slope" || name == "grade" || name == "gradient")
+	{
+		return FIELD_SLOPE;
+	}
+	return FIELD_SKIP;
+}
+
+TrajectoryCsvReader::TrajectoryCsvReader()
+	: cursor(nullptr), rows(nullptr), end(nullptr), released(nullptr), defaultType(0), shardIndex(0), shardCount(1),
+	idColumn(-1), typeColumn(-1), timeColumn(-1), speedColumn(-1), accelerationColumn(-1), xColumn(-1), yColumn(-1),
+	slopeColumn(-1), columnCount(0)
+{
+}
+
+void TrajectoryCsvReader::close()
+{
+	file.close();
+	cursor = rows = end = released = nullptr;
+	idColumn = typeColumn = timeColumn = speedColumn = accelerationColumn = xColumn = yColumn = slopeColumn = -1;
+	columnCount = 0;
+}
+
+bool TrajectoryCsvReader::open(const string &trajectoryPath, long vehicleType, string &error)
+{
+	close();
+	path = trajectoryPath;
+	defaultType = vehicleType;
+	if (!file.open(path))
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+	cursor = released = (const char *)file.data();
+	end = cursor + file.size();
+
+	//skip a UTF-8 byte order mark
+	if (end - cursor >= 3 && (unsigned char)cursor[0] == 0xEF && (unsigned char)cursor[1] == 0xBB && (unsigned char)cursor[2] == 0xBF)
+	{
+		cursor += 3;
+	}
+
+	//header line
+	const char *lineEnd = cursor;
+	while (lineEnd < end && *lineEnd != '\n')
+	{
+		lineEnd++;
+	}
+	string header(cursor, lineEnd);
+	cursor = (lineEnd < end) ? lineEnd + 1 : end;
+	rows = cursor;
+
+	size_t start = 0;
+	for (int column = 0; start <= header.size(); column++)
+	{
+		size_t comma = header.find(',', start);
+		if (comma == string::npos)
+		{
+			comma = header.size();
+		}
+		int *field = nullptr;
+		switch (fieldOfHeader(header.substr(start, comma - start)))
+		{
+		case FIELD_ID:           field = &idColumn; break;
+		case FIELD_TYPE:         field = &typeColumn; break;
+		case FIELD_TIME:         field = &timeColumn; break;
+		case FIELD_SPEED:        field = &speedColumn; break;
+		case FIELD_ACCELERATION: field = &accelerationColumn; break;
+		case FIELD_X:            field = &xColumn; break;
+		case FIELD_Y:            field = &yColumn; break;
+		case FIELD_SLOPE:        field = &slopeColumn; break;
+		default:                 break;
+		}
+		if (field != nullptr && *field < 0 && column < MAX_TRAJECTORY_COLUMNS)
+		{
+			*field = column;
+		}
+		columnCount = column + 1;
+		start = comma + 1;
+	}
+
+	if (idColumn < 0 || timeColumn < 0 || speedColumn < 0)
+	{
+		error = path + ": the header must name a vehicle id, a time and a speed column";
+		close();
+		return false;
+	}
+
+	//a position takes both coordinates
+	if ((xColumn < 0) != (yColumn < 0))
+	{
+		xColumn = yColumn = -1;
+	}
+	return true;
+}
+
+size_t TrajectoryCsvReader::lineOf(const char *position) const
+{
+	size_t line = 1;
+	for (const char *p = (const char *)file.data(); p < position; p++)
+	{
+		line += (*p == '\n');
+	}
+	return line;
+}
+
+bool TrajectoryCsvReader::read(TrajectoryBlock &block, size_t maxRows, string &error)
+{
+	TrajectoryCsvRange range = { cursor, end };
+	bool decoded = read(range, block, maxRows, error);
+	cursor = range.begin;
+	return decoded;
+}
+
+void TrajectoryCsvReader::releaseTaken()
+{
+	file.release((size_t)(released - (const char *)file.data()), (size_t)(cursor - released));
+	released = cursor;
+}
+
+void TrajectoryCsvReader::prefetch(size_t bytes) const
+{
+	file.prefetch((size_t)(cursor - (const char *)file.data()), bytes);
+}
+
+bool TrajectoryCsvReader::nextSegment(size_t segmentBytes, size_t rangeBytes, vector<TrajectoryCsvRange> &ranges)
+{
+	ranges.clear();
+	const char *segmentEnd = (size_t)(end - cursor) > segmentBytes ? cursor + segmentBytes : end;
+	while (cursor < segmentEnd)
+	{
+		//cut after the line holding the last byte of the range
+		const char *cut = (size_t)(segmentEnd - cursor) > rangeBytes ? cursor + rangeBytes : segmentEnd;
+		while (cut < end && cut[-1] != '\n')
+		{
+			cut++;
+		}
+		TrajectoryCsvRange range = { cursor, cut };
+		ranges.push_back(range);
+		cursor = cut;
+	}
+	return !ranges.empty();
+}
+
+int TrajectoryCsvReader::lastColumn() const
+{
+	int last = idColumn;
+	int roleColumns[] = { typeColumn, timeColumn, speedColumn, accelerationColumn, xColumn, yColumn, slopeColumn };
+	for (int i = 0; i < 7; i++)
+	{
+		if (roleColumns[i] > last)
+		{
+			last = roleColumns[i];
+		}
+	}
+	return last;
+}
+
+size_t TrajectoryCsvReader::minimumRowBytes() const
+{
+	return 2 * (size_t)(lastColumn() + 1);
+}
+
+size_t TrajectoryCsvReader::blockRowBytes() const
+{
+	size_t decimals = 2 + (hasAccelerations() ? 1 : 0) + (hasPositions() ? 2 : 0) + (hasSlopes() ? 1 : 0);
+	return 2 * sizeof(long) + decimals * sizeof(double) + (shardCount > 1 ? sizeof(size_t) : 0);
+}
+
+bool TrajectoryCsvReader::read(TrajectoryCsvRange &range, TrajectoryBlock &block, size_t maxRows, string &error) const
+{
+	//destination of each column up to the last one used, null for skipped columns
+	int lastColumn = this->lastColumn();
+
+	size_t rangeRows = (size_t)(range.end - range.begin) / minimumRowBytes() + 1;
+	if (maxRows > rangeRows)
+	{
+		maxRows = rangeRows;
+	}
+	block.vehicleIds.resize(maxRows);
+	block.vehicleTypes.resize(maxRows);
+	block.times.resize(maxRows);
+	block.speeds.resize(maxRows);
+	block.accelerations.resize(hasAccelerations() ? maxRows : 0);
+	block.xs.resize(hasPositions() ? maxRows : 0);
+	block.ys.resize(hasPositions() ? maxRows : 0);
+	block.slopes.resize(hasSlopes() ? maxRows : 0);
+	bool sharded = (shardCount > 1);
+	block.rangeIndices.resize(sharded ? maxRows : 0);
+	ColumnTarget targets[MAX_TRAJECTORY_COLUMNS];
+	for (int column = 0; column <= lastColumn; column++)
+	{
+		targets[column].integers = nullptr;
+		targets[column].decimals = nullptr;
+	}
+	targets[idColumn].integers = block.vehicleIds.data();
+	targets[timeColumn].decimals = block.times.data();
+	targets[speedColumn].decimals = block.speeds.data();
+	if (typeColumn >= 0)
+	{
+		targets[typeColumn].integers = block.vehicleTypes.data();
+	}
+	if (accelerationColumn >= 0)
+	{
+		targets[accelerationColumn].decimals = block.accelerations.data();
+	}
+	if (hasPositions())
+	{
+		targets[xColumn].decimals = block.xs.data();
+		targets[yColumn].decimals = block.ys.data();
+	}
+	if (slopeColumn >= 0)
+	{
+		targets[slopeColumn].decimals = block.slopes.data();
+	}
+	long *types = block.vehicleTypes.data();
+	bool typed = (typeColumn >= 0);
+
+	size_t rows = 0;
+	size_t skipped = 0;
+	const char *p = range.begin;
+	const char *end = range.end;
+	bool malformed = false;
+	while (rows < maxRows && p < end)
+	{
+		//blank lines are skipped
+		if (*p == '\n' || *p == '\r')
+		{
+			p++;
+			continue;
+		}
+
+		if (!typed)
+		{
+			types[rows] = defaultType;
+		}
+		bool otherShard = false;
+		for (int column = 0; column <= lastColumn; column++)
+		{
+			p = skipBlanks(p, end);
+			const char *next = p;
+			if (targets[column].decimals != nullptr)
+			{
+				next = parseDouble(p, end, targets[column].decimals[rows]);
+			}
+			else if (targets[column].integers != nullptr)
+			{
+				next = parseInteger(p, end, targets[column].integers[rows]);
+			}
+			else
+			{
+				while (next < end && *next != ',' && *next != '\n' && *next != '\r')
+				{
+					next++;
+				}
+			}
+			if (next != nullptr)
+			{
+				next = skipBlanks(next, end);
+			}
+			bool last = (column == lastColumn);
+			if (next == nullptr || (!last && (next >= end || *next != ',')) ||
+				(last && next < end && *next != ',' && *next != '\n' && *next != '\r'))
+			{
+				error = path + " line " + to_string(lineOf(p)) + ": bad or missing value in column " + to_string(column + 1);
+				malformed = true;
+				break;
+			}
+			p = last ? next : next + 1;
+			if (sharded && column == idColumn && trajectoryShardOf(block.vehicleIds[rows], shardCount) != shardIndex)
+			{
+				otherShard = true;
+				break;
+			}
+		}
+		if (malformed)
+		{
+			break;
+		}
+
+		//columns after the last one used
+		while (p < end && *p != '\n')
+		{
+			p++;
+		}
+		if (p < end)
+		{
+			p++;
+		}
+		if (otherShard)
+		{
+			skipped++;
+			continue;
+		}
+		if (sharded)
+		{
+			block.rangeIndices[rows] = rows + skipped;
+		}
+		rows++;
+	}
+	range.begin = p;
+	block.rangeRows = rows + skipped;
+
+	block.vehicleIds.resize(rows);
+	block.vehicleTypes.resize(rows);
+	block.times.resize(rows);
+	block.speeds.resize(rows);
+	block.accelerations.resize(hasAccelerations() ? rows : 0);
+	block.xs.resize(hasPositions() ? rows : 0);
+	block.ys.resize(hasPositions() ? rows : 0);
+	block.slopes.resize(hasSlopes() ? rows : 0);
+	block.rangeIndices.resize(sharded ? rows : 0);
+	if (malformed)
+	{
+		return false;
+	}
+	error.clear();
+	return rows > 0;
+}
@@ -0,0 +1,134 @@
+/*========================================================================= */
+/* TrajectoryCsv.h                                   Core module of MOVESTAR */
+/*																			*/
+/* Streaming reader of recorded trajectories in CSV format. The file is		*/
+/* memory-mapped and decoded in blocks of rows into column arrays. The		*/
+/* header names the columns: vehicle id, vehicle type, time [s], speed		*/
+/* [m/s] and, optionally, acceleration [m/s2], position x and y [m] and	*/
+/* slope (rise over run), in any order. Ranges of whole rows can be		*/
+/* decoded concurrently. Processes sharing a file by vehicle (shards)		*/
+/* each decode the rows of their own vehicles only.						*/
+/*========================================================================= */
+
+#ifndef __TRAJECTORYCSV_H
+#define __TRAJECTORYCSV_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+//column arrays of one block of trajectory rows
+struct TrajectoryBlock
+{
+	std::vector<long>   vehicleIds;
+	std::vector<long>   vehicleTypes;
+	std::vector<double> times;			//[s]
+	std::vector<double> speeds;			//[m/s]
+	std::vector<double> accelerations;	//[m/s2], empty if the file has no acceleration column
+	std::vector<double> xs;				//[m], empty if the file has no position columns
+	std::vector<double> ys;
+	std::vector<double> slopes;			//rise over run, empty if the file has no slope column
+
+	//rows of the range taken, decoded or left to another shard, and the index
+	//among them of every decoded row (only filled while rows are left)
+	std::size_t              rangeRows;
+	std::vector<std::size_t> rangeIndices;
+
+	std::size_t size() const { return times.size(); }
+};
+
+//shard of a vehicle among <shardCount> processes sharing a file; another hash
+//than the partitions of a process, so a shard spreads over all of them
+inline std::size_t trajectoryShardOf(long vehicleNumber, std::size_t shardCount)
+{
+	unsigned long long hash = ((unsigned long long)vehicleNumber ^ 0x5851F42D4C957F2DULL) * 0xD6E8FEB86659FD93ULL;
+	return (std::size_t)(hash >> 40) % shardCount;
+}
+
+//rows of the mapped file between two line starts
+struct TrajectoryCsvRange
+{
+	const char *begin;
+	const char *end;
+};
+
+class TrajectoryCsvReader
+{
+public:
+	TrajectoryCsvReader();
+
+	//maps <path> and parses its header; vehicles of a file without a type
+	//column get <defaultType>. Returns false with a message in <error>
+	bool open(const std::string &path, long defaultType, std::string &error);
+	void close();
+
+	bool hasAccelerations() const { return accelerationColumn >= 0; }
+	bool hasPositions() const { return xColumn >= 0; }
+	bool hasSlopes() const { return slopeColumn >= 0; }
+
+	//back to the first row
+	void rewind() { cursor = rows; }
+
+	//decodes the rows of the vehicles of shard <index> of <count> only (see
+	//trajectoryShardOf); the other rows are left once their id is read
+	void setShard(std::size_t index, std::size_t count) { shardIndex = index; shardCount = count; }
+
+	//gives the pages of the rows taken so far back to the system, so a file
+	//larger than the memory is read through a bounded window
+	void releaseTaken();
+
+	//has the system read the <bytes> after the rows taken so far ahead
+	void prefetch(std::size_t bytes) const;
+
+	//decodes up to <maxRows> rows into <block>. Returns false at the end of
+	//the file or on a malformed row, in which case <error> is set
+	bool read(TrajectoryBlock &block, std::size_t maxRows, std::string &error);
+
+	//takes the next <segmentBytes> (at least one row) off the file, cut at line
+	//starts into ranges of about <rangeBytes>. Returns false at the end of the file
+	bool nextSegment(std::size_t segmentBytes, std::size_t rangeBytes, std::vector<TrajectoryCsvRange> &ranges);
+
+	//decodes up to <maxRows> rows of <range> into <block>, advancing the range;
+	//safe to call concurrently for different ranges. Returns false as read() does
+	bool read(TrajectoryCsvRange &range, TrajectoryBlock &block, std::size_t maxRows, std::string &error) const;
+
+	//bytes of the file a row takes at least (one character and one separator
+	//per column up to the last one used), and bytes of a TrajectoryBlock per
+	//row; read() sizes a block for the most rows its range can hold
+	std::size_t minimumRowBytes() const;
+	std::size_t blockRowBytes() const;
+
+private:
+	TrajectoryCsvReader(const TrajectoryCsvReader &);
+	TrajectoryCsvReader &operator=(const TrajectoryCsvReader &);
+
+	//1-based line number of <position>, for messages
+	std::size_t lineOf(const char *position) const;
+
+	//index of the last column read
+	int lastColumn() const;
+
+	MappedFile  file;
+	std::string path;
+	const char *cursor;
+	const char *rows;		//first row after the header
+	const char *end;
+	const char *released;	//pages before it were given back
+	long        defaultType;
+	std::size_t shardIndex;
+	std::size_t shardCount;
+
+	//column index of each field, -1 if absent
+	int         idColumn;
+	int         typeColumn;
+	int         timeColumn;
+	int         speedColumn;
+	int         accelerationColumn;
+	int         xColumn;			//both coordinates or neither
+	int         yColumn;
+	int         slopeColumn;
+	int         columnCount;
+};
+
+#endif /* __TRAJECTORYCSV_H */
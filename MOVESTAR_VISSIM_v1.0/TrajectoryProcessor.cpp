@@ -0,0 +1,320 @@
+/*========================================================================= */
+/* TrajectoryProcessor.cpp                           Core module of MOVESTAR */
+/*																			*/
+/* Derived accelerations, block calculation and accumulation of totals.	*/
+/*========================================================================= */
+
+#include "TrajectoryProcessor.h"
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+
+TrajectoryProcessor::EngineQueue::EngineQueue()
+	: count(0), vehicleIds(TRAJECTORY_BLOCK_ROWS), vehicleTypes(TRAJECTORY_BLOCK_ROWS), times(TRAJECTORY_BLOCK_ROWS),
+	speeds(TRAJECTORY_BLOCK_ROWS), accelerations(TRAJECTORY_BLOCK_ROWS), tracks(TRAJECTORY_BLOCK_ROWS), braking(TRAJECTORY_BLOCK_ROWS),
+	xs(TRAJECTORY_BLOCK_ROWS), ys(TRAJECTORY_BLOCK_ROWS), slopes(TRAJECTORY_BLOCK_ROWS),
+	hc(TRAJECTORY_BLOCK_ROWS), co(TRAJECTORY_BLOCK_ROWS), nox(TRAJECTORY_BLOCK_ROWS), co2(TRAJECTORY_BLOCK_ROWS),
+	energy(TRAJECTORY_BLOCK_ROWS), pm25(TRAJECTORY_BLOCK_ROWS), opmodes(TRAJECTORY_BLOCK_ROWS)
+{
+}
+
+TrajectoryProcessor::TrajectoryProcessor(const SourceTypeRegistry &sourceTypes, double timeStep)
+	: engine(sourceTypes), timeStep(timeStep), aggregating(false), placed(false), rasterTile(nullptr), denseLimit(DENSE_VEHICLE_NUMBER_LIMIT), lastVehicleNumber(0),
+	lastTrack(-1), retiredNumbers(nullptr), reentered(0), secondOffset(0), rows(0), unknownRows(0), kernelBusy(0), aggregateBusy(0)
+{
+	engine.setTimeStep(timeStep);
+}
+
+void TrajectoryProcessor::addSpeedRow(long vehicleNumber, long vehicleType, double time, double speed, size_t row,
+	const TrajectoryPlace &place)
+{
+	int index = trackOf(vehicleNumber, vehicleType, row);
+	VehicleTrack &track = tracks[index];
+	track.lastRow = row;
+	if (track.rowsSeen >= 1)
+	{
+		//first row of a trajectory has no predecessor, its acceleration is 0 as in Spd2Acc
+		double acceleration = 0.0;
+		if (track.rowsSeen >= 2 && time != track.previousTime)
+		{
+			acceleration = (speed - track.previousSpeed) / (time - track.previousTime);
+		}
+		enqueue(index, track.pendingTime, track.pendingSpeed, acceleration, track.pendingPlace);
+	}
+	track.previousTime = track.pendingTime;
+	track.previousSpeed = track.pendingSpeed;
+	track.pendingTime = time;
+	track.pendingSpeed = speed;
+	track.pendingPlace = place;
+	track.rowsSeen++;
+}
+
+double TrajectoryProcessor::earliestPendingTime(double time) const
+{
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		if (tracks[i].rowsSeen >= 1 && tracks[i].pendingTime < time)
+		{
+			time = tracks[i].pendingTime;
+		}
+	}
+	return time;
+}
+
+void TrajectoryProcessor::finish()
+{
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		if (tracks[i].rowsSeen >= 1)
+		{
+			enqueue((int)i, tracks[i].pendingTime, tracks[i].pendingSpeed, 0.0, tracks[i].pendingPlace);
+			tracks[i].rowsSeen = 0;
+		}
+	}
+	calculateQueue();
+
+	//one histogram x rate matrix product per vehicle
+	if (aggregating)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (size_t i = 0; i < tracks.size(); i++)
+		{
+			const SourceTypeModel *sourceType = engine.registry().find(tracks[i].vehicleType);
+			const EmissionRateTable *table = sourceType != nullptr ? sourceType->rates : nullptr;
+			evaluateActivities(1, &tracks[i].activity, &table, timeStep, &tracks[i].totals);
+		}
+		aggregateBusy += chrono::steady_clock::now() - start;
+	}
+}
+
+void TrajectoryProcessor::retireBefore(size_t row)
+{
+	//the pending rows of the retiring vehicles are calculated while their tracks stay in place
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		if (tracks[i].lastRow < row && tracks[i].rowsSeen >= 1)
+		{
+			enqueue((int)i, tracks[i].pendingTime, tracks[i].pendingSpeed, 0.0, tracks[i].pendingPlace);
+			tracks[i].rowsSeen = 0;
+		}
+	}
+	calculateQueue();
+
+	size_t kept = 0;
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		if (tracks[i].lastRow < row)
+		{
+			engine.killVehicle(tracks[i].vehicleNumber);
+			setTrackIndex(tracks[i].vehicleNumber, -1);
+			retiredTracks.push_back(tracks[i]);
+			continue;
+		}
+		if (kept != i)
+		{
+			tracks[kept] = tracks[i];
+			setTrackIndex(tracks[kept].vehicleNumber, (int)kept);
+		}
+		kept++;
+	}
+	tracks.resize(kept);
+	lastTrack = -1;
+}
+
+void TrajectoryProcessor::appendLastRows(vector<size_t> &lastRows) const
+{
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		lastRows.push_back(tracks[i].lastRow);
+	}
+}
+
+int TrajectoryProcessor::createTrack(long vehicleNumber, long vehicleType, size_t row)
+{
+	int index = (int)tracks.size();
+	VehicleTrack track = {};
+	track.vehicleNumber = vehicleNumber;
+	track.vehicleType = vehicleType;
+	track.firstRow = row;
+	track.lastRow = row;
+	track.knownType = (engine.registry().find(vehicleType) != nullptr);
+	tracks.push_back(track);
+	setTrackIndex(vehicleNumber, index);
+	if (retiredNumbers != nullptr && vehicleNumber >= 0 && (size_t)vehicleNumber < retiredNumbers->size() &&
+		(*retiredNumbers)[vehicleNumber])
+	{
+		reentered++;
+	}
+	return index;
+}
+
+void TrajectoryProcessor::setTrackIndex(long vehicleNumber, int track)
+{
+	if (vehicleNumber >= 0 && vehicleNumber < denseLimit)
+	{
+		if ((unsigned long)vehicleNumber >= denseTracks.size())
+		{
+			denseTracks.resize(max((size_t)vehicleNumber + 1, denseTracks.size() * 2), -1);
+		}
+		denseTracks[vehicleNumber] = track;
+	}
+	else if (track >= 0)
+	{
+		sparseTracks[vehicleNumber] = track;
+	}
+	else
+	{
+		sparseTracks.erase(vehicleNumber);
+	}
+}
+
+void TrajectoryProcessor::calculateQueue()
+{
+	size_t count = queue.count;
+	if (count == 0)
+	{
+		return;
+	}
+	EmissionBatch batch = { count, queue.vehicleIds.data(), queue.vehicleTypes.data(), queue.speeds.data(),
+		queue.accelerations.data(), placed ? queue.slopes.data() : nullptr, queue.times.data(),
+		queue.hc.data(), queue.co.data(), queue.nox.data(), queue.co2.data(), queue.energy.data(), queue.pm25.data(),
+		nullptr, aggregating ? queue.opmodes.data() : nullptr };
+	chrono::steady_clock::time_point start = chrono::steady_clock::now(), calculated = start;
+	if (sweep)
+	{
+		//the sweep bins and adds up in one pass
+		engine.updateBraking(batch, queue.braking.data());
+		sweep->add(count, queue.tracks.data(), queue.vehicleIds.data(), queue.vehicleTypes.data(), queue.speeds.data(),
+			queue.accelerations.data(), batch.slopes, queue.braking.data());
+		calculated = chrono::steady_clock::now();
+	}
+	else if (aggregating)
+	{
+		engine.calculateOpmodes(batch);
+		calculated = chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++)
+		{
+			countOpmode(tracks[queue.tracks[i]], queue.speeds[i], i);
+		}
+	}
+	else
+	{
+		engine.calculate(batch);
+		calculated = chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++)
+		{
+			accumulate(tracks[queue.tracks[i]], queue.times[i], queue.speeds[i], i);
+		}
+	}
+	kernelBusy += calculated - start;
+	aggregateBusy += chrono::steady_clock::now() - calculated;
+	rows += count;
+	queue.count = 0;
+}
+
+void TrajectoryProcessor::addSpan(long vehicleNumber, long vehicleType, size_t row, size_t count,
+	const double *times, const double *speeds, const double *accelerations)
+{
+	//rows queued before come first
+	calculateQueue();
+	int index = trackOf(vehicleNumber, vehicleType, row);
+	VehicleTrack &track = tracks[index];
+
+	for (size_t first = 0; first < count; first += TRAJECTORY_BLOCK_ROWS)
+	{
+		size_t blockCount = min(count - first, (size_t)TRAJECTORY_BLOCK_ROWS);
+		fill(queue.vehicleIds.begin(), queue.vehicleIds.begin() + blockCount, vehicleNumber);
+		fill(queue.vehicleTypes.begin(), queue.vehicleTypes.begin() + blockCount, track.vehicleType);
+		EmissionBatch batch = { blockCount, queue.vehicleIds.data(), queue.vehicleTypes.data(), speeds + first,
+			accelerations + first, nullptr, times + first,
+			queue.hc.data(), queue.co.data(), queue.nox.data(), queue.co2.data(), queue.energy.data(), queue.pm25.data(),
+			nullptr, aggregating ? queue.opmodes.data() : nullptr };
+		chrono::steady_clock::time_point start = chrono::steady_clock::now(), calculated = start;
+		if (sweep)
+		{
+			fill(queue.tracks.begin(), queue.tracks.begin() + blockCount, index);
+			engine.updateBraking(batch, queue.braking.data());
+			sweep->add(blockCount, queue.tracks.data(), queue.vehicleIds.data(), queue.vehicleTypes.data(), speeds + first,
+				accelerations + first, nullptr, queue.braking.data());
+			calculated = chrono::steady_clock::now();
+		}
+		else if (aggregating)
+		{
+			engine.calculateOpmodes(batch);
+			calculated = chrono::steady_clock::now();
+			for (size_t i = 0; i < blockCount; i++)
+			{
+				countOpmode(track, speeds[first + i], i);
+			}
+		}
+		else
+		{
+			engine.calculate(batch);
+			calculated = chrono::steady_clock::now();
+			for (size_t i = 0; i < blockCount; i++)
+			{
+				accumulate(track, times[first + i], speeds[first + i], i);
+			}
+		}
+		kernelBusy += calculated - start;
+		aggregateBusy += chrono::steady_clock::now() - calculated;
+		rows += blockCount;
+	}
+}
+
+void TrajectoryProcessor::accumulate(VehicleTrack &track, double time, double speed, size_t i)
+{
+	if (!track.knownType)
+	{
+		unknownRows++;
+	}
+
+	//emission rates are per second, one row stands for one time step
+	double emissions[EMISSION_RATE_COUNT] = {
+		queue.hc[i] * timeStep, queue.co[i] * timeStep, queue.nox[i] * timeStep,
+		queue.co2[i] * timeStep, queue.energy[i] * timeStep, queue.pm25[i] * timeStep };
+	track.travelTime += timeStep;
+	track.travelDistance += speed * timeStep;
+
+	long long second = (long long)floor(time);
+	if (seconds.empty())
+	{
+		secondOffset = second;
+	}
+	if (second < secondOffset)
+	{
+		seconds.insert(seconds.begin(), (size_t)(secondOffset - second), EmissionTotals());
+		secondOffset = second;
+	}
+	if ((size_t)(second - secondOffset) >= seconds.size())
+	{
+		seconds.resize((size_t)(second - secondOffset) + 1, EmissionTotals());
+	}
+	EmissionTotals &bin = seconds[(size_t)(second - secondOffset)];
+	for (int k = 0; k < EMISSION_RATE_COUNT; k++)
+	{
+		track.totals.values[k] += emissions[k];
+		bin.values[k] += emissions[k];
+	}
+	if (rasterTile != nullptr)
+	{
+		rasterTile->add(time, queue.xs[i], queue.ys[i], emissions);
+	}
+}
+
+void TrajectoryProcessor::countOpmode(VehicleTrack &track, double speed, size_t i)
+{
+	if (!track.knownType)
+	{
+		unknownRows++;
+	}
+	track.travelTime += timeStep;
+	track.travelDistance += speed * timeStep;
+
+	int row = rateRowOfOpmode(queue.opmodes[i]);
+	if (row >= 0)
+	{
+		track.activity.samples[row]++;
+	}
+}
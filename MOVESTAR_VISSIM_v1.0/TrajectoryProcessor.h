@@ -0,0 +1,299 @@
+/*========================================================================= */
+/* TrajectoryProcessor.h                             Core module of MOVESTAR */
+/*																			*/
+/* Emission totals of recorded trajectories: rows are queued per vehicle,	*/
+/* their acceleration derived from the speed if the input has none, and	*/
+/* calculated by an EmissionEngine in blocks. Totals are kept per vehicle	*/
+/* and per second of simulation time, or, aggregating, the opmodes are		*/
+/* only counted per vehicle and the totals follow from the histograms.		*/
+/* Sweeping, the rows are binned under the source types of every scenario	*/
+/* (ScenarioSweep.h) and the totals are kept per scenario and type.		*/
+/* Out of core, the vehicles seen longest ago can be retired to bound the	*/
+/* memory, as if their trajectories ended there. Rows may carry their		*/
+/* place: the slope enters the VSP, the emissions go to a raster tile.	*/
+/*========================================================================= */
+
+#ifndef __TRAJECTORYPROCESSOR_H
+#define __TRAJECTORYPROCESSOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "EmissionAccumulator.h"
+#include "EmissionEngine.h"
+#include "EmissionRaster.h"
+#include "OpmodeActivity.h"
+#include "ScenarioSweep.h"
+
+//rows handed to the engine at a time
+#define TRAJECTORY_BLOCK_ROWS 1024
+
+//where a row was taken: position [m] and slope (rise over run)
+struct TrajectoryPlace
+{
+	double x;
+	double y;
+	double slope;
+};
+
+//per-vehicle state: the rows waiting for their derived acceleration and the
+//emission totals of the vehicle
+struct VehicleTrack
+{
+	long           vehicleNumber;
+	long           vehicleType;
+	std::size_t    firstRow;		//input row the vehicle first appeared in, for the output order
+	std::size_t    lastRow;			//input row it was last seen in, for retirement
+
+	//central difference: the acceleration of a row is known once the next row arrived
+	int            rowsSeen;
+	double         previousTime;
+	double         previousSpeed;
+	double         pendingTime;
+	double         pendingSpeed;
+	TrajectoryPlace pendingPlace;
+
+	bool           knownType;		//false if no source type is registered for the type
+	EmissionTotals totals;
+	double         travelTime;		//[s]
+	double         travelDistance;	//[m]
+	OpmodeActivity activity;		//samples per opmode, aggregating only
+};
+
+class TrajectoryProcessor
+{
+public:
+	//<timeStep> is the time one row stands for [s]
+	TrajectoryProcessor(const SourceTypeRegistry &sourceTypes, double timeStep);
+
+	//rate grids of the engine (see EmissionEngine::setRateGrids), before any row
+	void setRateGrids(const std::shared_ptr<const RateGrids> &grids) { engine.setRateGrids(grids); }
+
+	//aggregating, before any row: the opmodes of the rows are only counted in the
+	//activity of their vehicle, and finish() evaluates the vehicle totals from it.
+	//No per-second totals are kept
+	void setAggregate(bool aggregate) { aggregating = aggregate; }
+	bool aggregate() const { return aggregating; }
+
+	//scenario sweep, before any row: the engine only keeps the braking histories
+	//and the rows are binned under the source types of every scenario. No
+	//per-second or vehicle totals are kept
+	void setScenarios(const std::shared_ptr<const SweepScenarios> &scenarios)
+	{
+		sweep.reset(scenarios ? new ScenarioSweep(scenarios, timeStep) : nullptr);
+	}
+	const ScenarioSweep *scenarioSweep() const { return sweep.get(); }
+
+	//braking histories resampled to exact 1 Hz means, before any row
+	//(see EmissionEngine::setHistoryResampling)
+	void setHistoryResampling(bool resampling) { engine.setHistoryResampling(resampling); }
+
+	//compact mode of the engine (see EmissionEngine::setCompact), before any row
+	void setCompact(const std::shared_ptr<const CompactSourceTypes> &compactTypes) { engine.setCompact(compactTypes); }
+
+	//vehicle numbers indexed directly by the processor and its engine, before
+	//any row (see VehicleStateTable::setDenseLimit); 0 hashes every number, so
+	//the memory follows the live vehicles
+	void setDenseIndexLimit(long limit)
+	{
+		denseLimit = limit;
+		engine.setDenseVehicleLimit(limit);
+	}
+
+	//numbers of the vehicles retired by every processor of a run, indexed by
+	//number (numbers beyond it are not checked); a vehicle of this processor
+	//found in it on its first row is counted by reenteredVehicles()
+	void setRetiredNumbers(const std::vector<bool> *numbers) { retiredNumbers = numbers; }
+
+	//rows given with their place, before any row: the slope of a row enters its
+	//VSP and, with a <raster> tile, its emissions are added to the cell of its
+	//position (not aggregating or sweeping)
+	void setPlaces(EmissionRasterTile *raster)
+	{
+		placed = true;
+		rasterTile = raster;
+	}
+
+	//a row whose acceleration is given; <row> is its position in the input
+	void addRow(long vehicleNumber, long vehicleType, double time, double speed, double acceleration, std::size_t row,
+		const TrajectoryPlace &place = TrajectoryPlace())
+	{
+		int index = trackOf(vehicleNumber, vehicleType, row);
+		tracks[index].lastRow = row;
+		enqueue(index, time, speed, acceleration, place);
+	}
+
+	//a row whose acceleration is derived from the speeds around it
+	void addSpeedRow(long vehicleNumber, long vehicleType, double time, double speed, std::size_t row,
+		const TrajectoryPlace &place = TrajectoryPlace());
+
+	//earliest time of the rows still waiting for their acceleration [s], or
+	//<time> if none is earlier
+	double earliestPendingTime(double time) const;
+
+	//<count> consecutive rows of one vehicle with given accelerations, calculated
+	//straight from the arrays; <row> is the input position of the vehicle's first row
+	void addSpan(long vehicleNumber, long vehicleType, std::size_t row, std::size_t count,
+		const double *times, const double *speeds, const double *accelerations);
+
+	//calculates the queued rows now, to keep the queue in cache between batches of input
+	void flush() { calculateQueue(); }
+
+	//end of the input: the last row of every trajectory gets acceleration 0;
+	//aggregating, the totals of every vehicle are evaluated from its activity
+	void finish();
+
+	//retires the vehicles last seen before input row <row>: their pending row is
+	//calculated with acceleration 0, as at the end of the input, their engine
+	//state is dropped and their tracks move to retired(). A vehicle seen again
+	//later starts over as a new vehicle. Not aggregating or sweeping
+	void retireBefore(std::size_t row);
+	std::vector<VehicleTrack> &retired() { return retiredTracks; }
+
+	//appends the last input row of every vehicle to <rows>
+	void appendLastRows(std::vector<std::size_t> &rows) const;
+
+	//vehicles with state, the memory each takes (track, engine state and track
+	//index entry), the memory of the engine index and of the dense track index,
+	//and the memory of the per-second totals and of the queue
+	std::size_t liveVehicles() const { return tracks.size(); }
+	std::size_t vehicleBytes() const { return sizeof(VehicleTrack) + HASH_INDEX_ENTRY_BYTES + engine.vehicles().vehicleBytes(); }
+	std::size_t indexBytes() const { return engine.vehicles().indexBytes() + denseTracks.capacity() * sizeof(int); }
+	std::size_t secondBytes() const { return seconds.capacity() * sizeof(EmissionTotals); }
+	std::size_t queueBytes() const { return TRAJECTORY_BLOCK_ROWS * (2 * sizeof(long) + 12 * sizeof(double) + 2 * sizeof(int) + 1); }
+
+	//drops the per-second totals, once taken by the caller
+	void clearSecondTotals() { std::vector<EmissionTotals>().swap(seconds); }
+
+	//vehicles in the order they first appeared to this processor
+	const std::vector<VehicleTrack> &vehicles() const { return tracks; }
+
+	//per-second totals, element i holds second firstSecond() + i
+	const std::vector<EmissionTotals> &secondTotals() const { return seconds; }
+	long long firstSecond() const { return secondOffset; }
+
+	std::size_t rowCount() const { return rows; }
+	std::size_t unknownTypeRows() const { return unknownRows; }
+	std::size_t reenteredVehicles() const { return reentered; }
+
+	//time spent in the engine (VSP, opmodes, rates, or the sweep) and adding
+	//its outputs to the totals, histograms and raster tile; the clock is read
+	//once per block of rows
+	std::chrono::steady_clock::duration kernelTime() const { return kernelBusy; }
+	std::chrono::steady_clock::duration aggregateTime() const { return aggregateBusy; }
+
+private:
+	TrajectoryProcessor(const TrajectoryProcessor &);
+	TrajectoryProcessor &operator=(const TrajectoryProcessor &);
+
+	//rows ready for the engine, calculated once TRAJECTORY_BLOCK_ROWS are queued
+	struct EngineQueue
+	{
+		std::size_t         count;
+		std::vector<long>   vehicleIds;
+		std::vector<long>   vehicleTypes;
+		std::vector<double> times;
+		std::vector<double> speeds;
+		std::vector<double> accelerations;
+		std::vector<int>    tracks;
+		std::vector<unsigned char> braking;		//sweeping only
+		std::vector<double> xs, ys, slopes;		//rows given with their place only
+
+		//engine outputs [g/s], opmodes when aggregating
+		std::vector<double> hc, co, nox, co2, energy, pm25;
+		std::vector<int>    opmodes;
+
+		EngineQueue();
+	};
+
+	int trackOf(long vehicleNumber, long vehicleType, std::size_t row)
+	{
+		if (lastTrack >= 0 && lastVehicleNumber == vehicleNumber)
+		{
+			return lastTrack;
+		}
+
+		//small vehicle numbers are indexed directly, as in VehicleStateTable
+		int index = -1;
+		if (vehicleNumber >= 0 && vehicleNumber < denseLimit)
+		{
+			if ((unsigned long)vehicleNumber < denseTracks.size())
+			{
+				index = denseTracks[vehicleNumber];
+			}
+		}
+		else
+		{
+			std::unordered_map<long, int>::const_iterator it = sparseTracks.find(vehicleNumber);
+			index = (it == sparseTracks.end()) ? -1 : it->second;
+		}
+		if (index < 0)
+		{
+			index = createTrack(vehicleNumber, vehicleType, row);
+		}
+		lastVehicleNumber = vehicleNumber;
+		lastTrack = index;
+		return index;
+	}
+
+	void enqueue(int track, double time, double speed, double acceleration, const TrajectoryPlace &place)
+	{
+		std::size_t i = queue.count++;
+		queue.vehicleIds[i] = tracks[track].vehicleNumber;
+		queue.vehicleTypes[i] = tracks[track].vehicleType;
+		queue.times[i] = time;
+		queue.speeds[i] = speed;
+		queue.accelerations[i] = acceleration;
+		queue.tracks[i] = track;
+		if (placed)
+		{
+			queue.xs[i] = place.x;
+			queue.ys[i] = place.y;
+			queue.slopes[i] = place.slope;
+		}
+		if (queue.count == TRAJECTORY_BLOCK_ROWS)
+		{
+			calculateQueue();
+		}
+	}
+
+	int createTrack(long vehicleNumber, long vehicleType, std::size_t row);
+
+	//points the index entry of a vehicle at <track>, -1 removes it
+	void setTrackIndex(long vehicleNumber, int track);
+	void calculateQueue();
+
+	//adds the emissions of row <i> of the queue outputs to the totals
+	void accumulate(VehicleTrack &track, double time, double speed, std::size_t i);
+
+	//counts the opmode of row <i> of the queue outputs in the activity
+	void countOpmode(VehicleTrack &track, double speed, std::size_t i);
+
+	EmissionEngine                engine;
+	double                        timeStep;
+	bool                          aggregating;
+	bool                          placed;
+	EmissionRasterTile           *rasterTile;
+	std::unique_ptr<ScenarioSweep> sweep;
+	EngineQueue                   queue;
+	std::vector<VehicleTrack>     tracks;
+	std::vector<int>              denseTracks;
+	std::unordered_map<long, int> sparseTracks;
+	long                          denseLimit;
+	long                          lastVehicleNumber;
+	int                           lastTrack;
+	std::vector<VehicleTrack>     retiredTracks;
+	const std::vector<bool>      *retiredNumbers;
+	std::size_t                   reentered;
+
+	std::vector<EmissionTotals>   seconds;
+	long long                     secondOffset;
+	std::size_t                   rows;
+	std::size_t                   unknownRows;
+	std::chrono::steady_clock::duration kernelBusy;
+	std::chrono::steady_clock::duration aggregateBusy;
+};
+
+#endif /* __TRAJECTORYPROCESSOR_H */
@@ -0,0 +1,197 @@
+/*========================================================================= */
+/* VehicleStateTable.cpp                 VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Slot allocation and recycling for the per-vehicle state store.			*/
+/*========================================================================= */
+
+#include "VehicleStateTable.h"
+#include <algorithm>
+using namespace std;
+
+
+VehicleStateTable::VehicleStateTable()
+	: compactLayout(false), resamplingLayout(false), denseLimit(DENSE_VEHICLE_NUMBER_LIMIT), denseBase(0), freeHead(INVALID_VEHICLE_HANDLE), liveVehicles(0)
+{
+}
+
+void VehicleStateTable::setLayout(bool compact, bool resampling)
+{
+	clear();
+	compactLayout = compact;
+	resamplingLayout = resampling;
+}
+
+void VehicleStateTable::setDenseLimit(long limit)
+{
+	clear();
+	denseLimit = limit;
+}
+
+size_t VehicleStateTable::vehicleBytes() const
+{
+	return sizeof(VehicleState) + (compactLayout ? sizeof(CompactAccelerationHistory) : sizeof(AccelerationHistory)) +
+		(resamplingLayout ? sizeof(SecondAverage) : 0);
+}
+
+size_t VehicleStateTable::indexBytes() const
+{
+	return denseHandles.capacity() * sizeof(VehicleHandle) + handles.size() * HASH_INDEX_ENTRY_BYTES;
+}
+
+VehicleHandle VehicleStateTable::findSparse(long vehicleNumber) const
+{
+	unordered_map<long, VehicleHandle>::const_iterator it = handles.find(vehicleNumber);
+	return it == handles.end() ? INVALID_VEHICLE_HANDLE : it->second;
+}
+
+bool VehicleStateTable::placeDense(long vehicleNumber)
+{
+	if (vehicleNumber < denseBase || vehicleNumber >= denseLimit)
+	{
+		return false;
+	}
+	size_t offset = (size_t)(vehicleNumber - denseBase);
+	if (offset < denseHandles.size())
+	{
+		return true;
+	}
+
+	size_t span = max((size_t)DENSE_INDEX_MINIMUM, DENSE_INDEX_ENTRIES_PER_VEHICLE * (liveVehicles + 1));
+	if (offset >= span)
+	{
+		//slide the window so the number lands in its middle, hashing the
+		//vehicles still live below it; the upper half takes the next numbers
+		long base = vehicleNumber + 1 - (long)(span / 2);
+		vector<VehicleHandle> window(span, INVALID_VEHICLE_HANDLE);
+		for (size_t n = 0; n < denseHandles.size(); n++)
+		{
+			if (denseHandles[n] == INVALID_VEHICLE_HANDLE)
+			{
+				continue;
+			}
+			long number = denseBase + (long)n;
+			if (number < base)
+			{
+				handles[number] = denseHandles[n];
+			}
+			else
+			{
+				window[number - base] = denseHandles[n];
+			}
+		}
+		denseHandles.swap(window);
+		denseBase = base;
+		offset = (size_t)(vehicleNumber - denseBase);
+	}
+	if (offset >= denseHandles.size())
+	{
+		size_t size = denseHandles.size() < DENSE_INDEX_MINIMUM ? DENSE_INDEX_MINIMUM : denseHandles.size();
+		while (size <= offset)
+		{
+			size *= 2;
+		}
+		//numbers from the limit up are hashed, find() must not see them as dense
+		denseHandles.resize(min(min(size, span), (size_t)(denseLimit - denseBase)), INVALID_VEHICLE_HANDLE);
+	}
+	return true;
+}
+
+VehicleHandle VehicleStateTable::create(long vehicleNumber)
+{
+	VehicleHandle existing = find(vehicleNumber);
+	if (existing != INVALID_VEHICLE_HANDLE)
+	{
+		return existing;
+	}
+
+	//take a slot from the free list, or grow the slab if it is empty
+	VehicleHandle handle;
+	if (freeHead != INVALID_VEHICLE_HANDLE)
+	{
+		handle = freeHead;
+		freeHead = slots[handle].nextFree;
+	}
+	else
+	{
+		handle = (VehicleHandle)slots.size();
+		slots.push_back(VehicleState());
+		if (compactLayout)
+		{
+			compactHistories.push_back(CompactAccelerationHistory());
+		}
+		else
+		{
+			histories.push_back(AccelerationHistory());
+		}
+		if (resamplingLayout)
+		{
+			seconds.push_back(SecondAverage());
+		}
+	}
+
+	VehicleState &state = slots[handle];
+	state.vehicleNumber = vehicleNumber;
+	state.vehicleType = 0;
+	state.sourceType = nullptr;
+	state.rateGrid = nullptr;
+	state.compactType = nullptr;
+	if (compactLayout)
+	{
+		compactHistories[handle].clear();
+	}
+	else
+	{
+		histories[handle].clear();
+	}
+	if (resamplingLayout)
+	{
+		seconds[handle].clear();
+	}
+	state.nextFree = INVALID_VEHICLE_HANDLE;
+
+	if (placeDense(vehicleNumber))
+	{
+		denseHandles[vehicleNumber - denseBase] = handle;
+	}
+	else
+	{
+		handles[vehicleNumber] = handle;
+	}
+	liveVehicles++;
+	return handle;
+}
+
+void VehicleStateTable::kill(long vehicleNumber)
+{
+	VehicleHandle handle = find(vehicleNumber);
+	if (handle == INVALID_VEHICLE_HANDLE)
+	{
+		return;
+	}
+	unsigned long offset = (unsigned long)vehicleNumber - (unsigned long)denseBase;
+	if (offset < denseHandles.size())
+	{
+		denseHandles[offset] = INVALID_VEHICLE_HANDLE;
+	}
+	else
+	{
+		handles.erase(vehicleNumber);
+	}
+	liveVehicles--;
+
+	slots[handle].nextFree = freeHead;
+	freeHead = handle;
+}
+
+void VehicleStateTable::clear()
+{
+	slots.clear();
+	histories.clear();
+	compactHistories.clear();
+	seconds.clear();
+	vector<VehicleHandle>().swap(denseHandles);
+	denseBase = 0;
+	handles.clear();
+	freeHead = INVALID_VEHICLE_HANDLE;
+	liveVehicles = 0;
+}
@@ -0,0 +1,266 @@
+/*========================================================================= */
+/* VehicleStateTable.h                   VISSIM C++ API version of MOVESTAR */
+/*																			*/
+/* Per-vehicle state store used by the emission model. A slot is handed	*/
+/* out when a vehicle enters the network and recycled when it leaves, so	*/
+/* memory is bounded by the number of vehicles on the network at once.		*/
+/* The acceleration histories live in arrays beside the slots, in double	*/
+/* or quantized to int16 (compact mode), and the 1 Hz averages only exist	*/
+/* with resampled histories.												*/
+/*========================================================================= */
+
+#ifndef __VEHICLESTATETABLE_H
+#define __VEHICLESTATETABLE_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#include "MovestarRates.h"
+
+typedef int VehicleHandle;
+
+class RateGrid;
+struct CompactSourceType;
+
+#define INVALID_VEHICLE_HANDLE (-1)
+
+//vehicle numbers below this limit may be looked up in a direct-indexed array
+//(VISSIM numbers its vehicles from 1 up), larger ones in a hash map
+#define DENSE_VEHICLE_NUMBER_LIMIT (1L << 22)
+
+//the direct-indexed array is a window over the most recent numbers, at most
+//this many entries per live vehicle (and at least DENSE_INDEX_MINIMUM): as the
+//numbers rise it slides up, and the vehicles left below it are hashed
+#define DENSE_INDEX_ENTRIES_PER_VEHICLE 4
+#define DENSE_INDEX_MINIMUM 1024
+
+//memory of an entry of a hash-map index (node and bucket), about
+#define HASH_INDEX_ENTRY_BYTES 48
+
+//fixed 3-entry ring buffer holding the accelerations sampled once per second
+struct AccelerationHistory
+{
+	double values[3];
+	int    head;		//slot written by the next push
+	int    count;		//number of valid samples (0..3)
+
+	void clear()
+	{
+		values[0] = values[1] = values[2] = 0.0;
+		head = 0;
+		count = 0;
+	}
+
+	//push a sample, overwriting the oldest one once the buffer is full
+	void push(double acceleration)
+	{
+		values[head] = acceleration;
+		head = (head == 2) ? 0 : head + 1;
+		if (count < 3)
+		{
+			count++;
+		}
+	}
+
+	//sample by age, 0 being the oldest valid sample
+	double at(int index) const
+	{
+		int slot = head - count + index;
+		return values[slot < 0 ? slot + 3 : slot];
+	}
+
+	double newest() const
+	{
+		return values[head == 0 ? 2 : head - 1];
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	//true when the history alone puts the vehicle in the braking mode (opmode 0):
+	//the newest sample is at most -2, or all 3 samples are below -1
+	bool braking() const
+	{
+		if (count > 0 && newest() <= -2.0)
+		{
+			return true;
+		}
+		return count == 3 && values[0] < -1.0 && values[1] < -1.0 && values[2] < -1.0;
+	}
+};
+
+//steps per m/s2 of the samples of a compact history
+#define COMPACT_ACCELERATION_STEPS 1024
+
+//AccelerationHistory of the compact mode, 8 bytes instead of 32: the samples
+//are rounded to 1/COMPACT_ACCELERATION_STEPS m/s2 and saturate at +-32 m/s2
+struct CompactAccelerationHistory
+{
+	short         values[3];
+	unsigned char head;
+	unsigned char count;
+
+	void clear()
+	{
+		values[0] = values[1] = values[2] = 0;
+		head = 0;
+		count = 0;
+	}
+
+	void push(double acceleration)
+	{
+		double steps = acceleration * COMPACT_ACCELERATION_STEPS;
+		steps = steps < -32767.0 ? -32767.0 : (steps > 32767.0 ? 32767.0 : steps);
+		values[head] = (short)((int)(steps + 32768.5) - 32768);		//rounded, without a branch on the sign
+		head = (head == 2) ? 0 : head + 1;
+		if (count < 3)
+		{
+			count++;
+		}
+	}
+
+	double at(int index) const
+	{
+		int slot = head - count + index;
+		return (double)values[slot < 0 ? slot + 3 : slot] / COMPACT_ACCELERATION_STEPS;
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	//AccelerationHistory::braking() on the rounded samples
+	bool braking() const
+	{
+		if (count > 0 && values[head == 0 ? 2 : head - 1] <= -2 * COMPACT_ACCELERATION_STEPS)
+		{
+			return true;
+		}
+		return count == 3 && values[0] < -COMPACT_ACCELERATION_STEPS && values[1] < -COMPACT_ACCELERATION_STEPS &&
+			values[2] < -COMPACT_ACCELERATION_STEPS;
+	}
+};
+
+//1 Hz resampling: the second being accumulated and the accelerations seen in it
+struct SecondAverage
+{
+	long long second;
+	double    accelerationSum;
+	int       samples;
+
+	void clear()
+	{
+		second = 0;
+		accelerationSum = 0.0;
+		samples = 0;
+	}
+};
+
+//state kept for one vehicle between calls
+struct VehicleState
+{
+	long                vehicleNumber;
+	long                vehicleType;
+	const SourceTypeModel *sourceType;	//resolved at creation
+	const RateGrid      *rateGrid;		//grid of the source type, null without grids
+	const CompactSourceType *compactType;	//compact mode only
+	VehicleHandle       nextFree;
+};
+
+class VehicleStateTable
+{
+public:
+	VehicleStateTable();
+
+	//keeps the histories as CompactAccelerationHistory if <compact>, and a
+	//SecondAverage per vehicle if <resampling>. Drops every vehicle
+	void setLayout(bool compact, bool resampling);
+	bool compact() const { return compactLayout; }
+
+	//vehicle numbers below <limit> may be indexed directly (default
+	//DENSE_VEHICLE_NUMBER_LIMIT); at 0 every number is hashed. Drops every vehicle
+	void setDenseLimit(long limit);
+
+	//memory taken by a live vehicle, and by the index of the live vehicles
+	std::size_t vehicleBytes() const;
+	std::size_t indexBytes() const;
+
+	//hand out a slot for a vehicle entering the network (reuses the slot if it already has one)
+	VehicleHandle create(long vehicleNumber);
+
+	//return the slot of a vehicle leaving the network to the free list
+	void kill(long vehicleNumber);
+
+	//handle of a live vehicle, or INVALID_VEHICLE_HANDLE
+	VehicleHandle find(long vehicleNumber) const
+	{
+		//numbers below the window wrap around to large offsets
+		unsigned long offset = (unsigned long)vehicleNumber - (unsigned long)denseBase;
+		if (offset < denseHandles.size())
+		{
+			return denseHandles[offset];
+		}
+		return findSparse(vehicleNumber);
+	}
+
+	VehicleState &operator[](VehicleHandle handle) { return slots[handle]; }
+	const VehicleState &operator[](VehicleHandle handle) const { return slots[handle]; }
+
+	//history of a slot in the layout of the table
+	AccelerationHistory &history(VehicleHandle handle) { return histories[handle]; }
+	const AccelerationHistory &history(VehicleHandle handle) const { return histories[handle]; }
+	CompactAccelerationHistory &compactHistory(VehicleHandle handle) { return compactHistories[handle]; }
+	const CompactAccelerationHistory &compactHistory(VehicleHandle handle) const { return compactHistories[handle]; }
+	SecondAverage &currentSecond(VehicleHandle handle) { return seconds[handle]; }
+	const SecondAverage &currentSecond(VehicleHandle handle) const { return seconds[handle]; }
+	bool resampling() const { return resamplingLayout; }
+
+	//calls <function>(handle) for every live vehicle
+	template <class Function> void forEachLive(Function function) const
+	{
+		for (std::size_t n = 0; n < denseHandles.size(); n++)
+		{
+			if (denseHandles[n] != INVALID_VEHICLE_HANDLE)
+			{
+				function(denseHandles[n]);
+			}
+		}
+		for (std::unordered_map<long, VehicleHandle>::const_iterator it = handles.begin(); it != handles.end(); ++it)
+		{
+			function(it->second);
+		}
+	}
+
+	//number of vehicles currently on the network
+	std::size_t liveCount() const { return liveVehicles; }
+
+	//number of slots allocated so far (peak number of live vehicles)
+	std::size_t capacity() const { return slots.size(); }
+
+	void clear();
+
+private:
+	VehicleHandle findSparse(long vehicleNumber) const;
+
+	//true if <vehicleNumber> gets an entry of the dense window, which grows or
+	//slides up to take it when the live vehicles allow
+	bool placeDense(long vehicleNumber);
+
+	std::vector<VehicleState>                 slots;
+	std::vector<AccelerationHistory>          histories;		//by slot, unless compact
+	std::vector<CompactAccelerationHistory>   compactHistories;	//by slot, compact only
+	std::vector<SecondAverage>                seconds;			//by slot, resampling only
+	bool                                      compactLayout;
+	bool                                      resamplingLayout;
+	long                                      denseLimit;
+	long                                      denseBase;		//number of denseHandles[0]
+	std::vector<VehicleHandle>                denseHandles;
+	std::unordered_map<long, VehicleHandle>   handles;
+	VehicleHandle                             freeHead;
+	std::size_t                               liveVehicles;
+};
+
+#endif /* __VEHICLESTATETABLE_H */
@@ -0,0 +1,179 @@
+/*========================================================================= */
+/* WorkStealingPool.cpp                              Core module of MOVESTAR */
+/*																			*/
+/* Task distribution, stealing and completion of the worker threads.		*/
+/*========================================================================= */
+
+#include "WorkStealingPool.h"
+using namespace std;
+
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+	: threadCount(threads), currentTask(nullptr), generation(0), activeWorkers(0), stopping(false), remaining(0)
+{
+	if (threadCount == 0)
+	{
+		threadCount = thread::hardware_concurrency();
+	}
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+	for (unsigned i = 0; i < threadCount; i++)
+	{
+		queues.push_back(unique_ptr<WorkQueue>(new WorkQueue));
+	}
+
+	//worker 0 is the thread calling parallelFor
+	for (unsigned i = 1; i < threadCount; i++)
+	{
+		this->threads.push_back(thread(&WorkStealingPool::workerLoop, this, i));
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		lock_guard<std::mutex> guard(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+bool WorkStealingPool::takeTask(unsigned worker, size_t &index)
+{
+	//own queue first, newest index first
+	{
+		WorkQueue &own = *queues[worker];
+		lock_guard<std::mutex> guard(own.lock);
+		if (!own.indices.empty())
+		{
+			index = own.indices.back();
+			own.indices.pop_back();
+			return true;
+		}
+	}
+
+	//steal from the far end of the next non-empty queue
+	for (unsigned i = 1; i < threadCount; i++)
+	{
+		WorkQueue &victim = *queues[(worker + i) % threadCount];
+		lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.indices.empty())
+		{
+			index = victim.indices.front();
+			victim.indices.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingPool::runTasks(unsigned worker, const function<void(size_t, unsigned)> &task)
+{
+	size_t index;
+	while (takeTask(worker, index))
+	{
+		try
+		{
+			task(index, worker);
+		}
+		catch (...)
+		{
+			lock_guard<std::mutex> guard(mutex);
+			if (!failure)
+			{
+				failure = current_exception();
+			}
+		}
+		if (remaining.fetch_sub(1) == 1)
+		{
+			lock_guard<std::mutex> guard(mutex);
+			finished.notify_all();
+		}
+	}
+}
+
+void WorkStealingPool::workerLoop(unsigned worker)
+{
+	size_t seenGeneration = 0;
+	unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+		if (stopping)
+		{
+			return;
+		}
+		seenGeneration = generation;
+
+		//a worker waking after its parallelFor returned finds no task
+		const function<void(size_t, unsigned)> *task = currentTask;
+		if (task == nullptr)
+		{
+			continue;
+		}
+		activeWorkers++;
+		lock.unlock();
+		runTasks(worker, *task);
+		lock.lock();
+		activeWorkers--;
+		if (activeWorkers == 0)
+		{
+			finished.notify_all();
+		}
+	}
+}
+
+void WorkStealingPool::parallelFor(size_t count, const function<void(size_t, unsigned)> &task)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	if (threadCount == 1)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			task(i, 0);
+		}
+		return;
+	}
+
+	{
+		lock_guard<std::mutex> guard(mutex);
+		for (unsigned worker = 0; worker < threadCount; worker++)
+		{
+			WorkQueue &queue = *queues[worker];
+			lock_guard<std::mutex> queueGuard(queue.lock);
+			size_t first = count * worker / threadCount;
+			size_t last = count * (worker + 1) / threadCount;
+			for (size_t i = last; i > first; i--)
+			{
+				queue.indices.push_back(i - 1);		//the owner pops from the back, lowest index first
+			}
+		}
+		remaining = count;
+		failure = exception_ptr();
+		currentTask = &task;
+		generation++;
+	}
+	wake.notify_all();
+
+	runTasks(0, task);
+
+	unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&] { return remaining == 0 && activeWorkers == 0; });
+	currentTask = nullptr;
+	exception_ptr thrown = failure;
+	failure = exception_ptr();
+	lock.unlock();
+	if (thrown)
+	{
+		rethrow_exception(thrown);
+	}
+}
@@ -0,0 +1,70 @@
+/*========================================================================= */
+/* WorkStealingPool.h                                Core module of MOVESTAR */
+/*																			*/
+/* Fixed set of worker threads running indexed tasks. Every worker owns a	*/
+/* queue of task indices; a worker whose queue runs dry steals from the	*/
+/* other end of another worker's queue, so uneven tasks still keep all		*/
+/* threads busy.															*/
+/*========================================================================= */
+
+#ifndef __WORKSTEALINGPOOL_H
+#define __WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+	//pool of <threads> threads counting the calling one, 0 for one per hardware thread
+	explicit WorkStealingPool(unsigned threads = 0);
+	~WorkStealingPool();
+
+	unsigned size() const { return threadCount; }
+
+	//runs task(index, worker) for every index in [0, count) and returns once all
+	//ran. Worker 0 is the calling thread. Indices are dealt out in contiguous runs,
+	//so neighbouring tasks tend to share a worker. The first exception a task
+	//throws is rethrown here once the other tasks finished
+	void parallelFor(std::size_t count, const std::function<void(std::size_t, unsigned)> &task);
+
+private:
+	WorkStealingPool(const WorkStealingPool &);
+	WorkStealingPool &operator=(const WorkStealingPool &);
+
+	struct WorkQueue
+	{
+		std::mutex              lock;
+		std::deque<std::size_t> indices;
+	};
+
+	bool takeTask(unsigned worker, std::size_t &index);
+	void runTasks(unsigned worker, const std::function<void(std::size_t, unsigned)> &task);
+	void workerLoop(unsigned worker);
+
+	unsigned                                  threadCount;
+	std::vector<std::unique_ptr<WorkQueue> >  queues;
+	std::vector<std::thread>                  threads;
+
+	//state of the running parallelFor, guarded by <mutex>
+	std::mutex                                mutex;
+	std::condition_variable                   wake;
+	std::condition_variable                   finished;
+	const std::function<void(std::size_t, unsigned)> *currentTask;
+	std::size_t                               generation;
+	unsigned                                  activeWorkers;
+	bool                                      stopping;
+	std::exception_ptr                        failure;
+
+	std::atomic<std::size_t>                  remaining;
+};
+
+#endif /* __WORKSTEALINGPOOL_H */